@@ -0,0 +1,198 @@
+/**
+* @file AsyncFileWriter.cpp
+* @brief implementation of the write-behind file writer
+*/
+
+#include "AsyncFileWriter.h"
+
+#include <utility>
+
+namespace
+{
+const size_t NO_FILE = static_cast<size_t>(-1);
+}
+
+CAsyncFileWriter::CAsyncFileWriter(LogFnCallback oLogger, size_t uMaxQueuedBytes) :
+   m_uQueuedBytes(0),
+   m_uMaxQueuedBytes(uMaxQueuedBytes),
+   m_bStopping(false),
+   m_uCurrentFile(NO_FILE),
+   m_bPreallocated(false),
+   m_oLog(oLogger)
+{
+
+}
+
+CAsyncFileWriter::~CAsyncFileWriter()
+{
+   Finish();
+}
+
+void CAsyncFileWriter::Start()
+{
+   if (m_oThread.joinable())
+      return;
+
+   m_bStopping = false;
+   m_vecResults.clear();
+   m_oThread = std::thread(&CAsyncFileWriter::Run, this);
+}
+
+void CAsyncFileWriter::Finish()
+{
+   if (!m_oThread.joinable())
+      return;
+
+   {
+      std::lock_guard<std::mutex> lock(m_mtxQueue);
+      m_bStopping = true;
+   }
+   m_cvNotEmpty.notify_one();
+   m_oThread.join();
+}
+
+void CAsyncFileWriter::Open(size_t uFile, const std::string& strPath, const unsigned long long uExpectedSize)
+{
+   Command oCommand = { OPEN_FILE, uFile, strPath, uExpectedSize };
+   Push(std::move(oCommand));
+}
+
+void CAsyncFileWriter::Write(size_t uFile, std::string&& strData)
+{
+   if (strData.empty())
+      return;
+
+   Command oCommand = { WRITE_DATA, uFile, std::move(strData), 0 };
+   Push(std::move(oCommand));
+}
+
+void CAsyncFileWriter::Close(size_t uFile)
+{
+   Command oCommand = { CLOSE_FILE, uFile, std::string(), 0 };
+   Push(std::move(oCommand));
+}
+
+void CAsyncFileWriter::Push(Command&& oCommand)
+{
+   const size_t uSize = oCommand.strData.size();
+   {
+      std::unique_lock<std::mutex> lock(m_mtxQueue);
+      // a buffer larger than the queue is accepted once the queue is empty
+      m_cvNotFull.wait(lock, [this, uSize] { return m_uQueuedBytes == 0 || m_uQueuedBytes + uSize <= m_uMaxQueuedBytes; });
+      m_uQueuedBytes += uSize;
+      m_dqCommands.push_back(std::move(oCommand));
+   }
+   m_cvNotEmpty.notify_one();
+}
+
+/**
+* @brief body of the writer thread : executes the queued commands until Finish
+* is called and the queue is empty
+*/
+void CAsyncFileWriter::Run()
+{
+   for (;;)
+   {
+      Command oCommand;
+      {
+         std::unique_lock<std::mutex> lock(m_mtxQueue);
+         m_cvNotEmpty.wait(lock, [this] { return m_bStopping || !m_dqCommands.empty(); });
+         if (m_dqCommands.empty())
+            break;
+
+         oCommand = std::move(m_dqCommands.front());
+         m_dqCommands.pop_front();
+         m_uQueuedBytes -= oCommand.strData.size();
+      }
+      m_cvNotFull.notify_one();
+
+      Execute(oCommand);
+   }
+
+   CloseCurrent();
+}
+
+void CAsyncFileWriter::Execute(Command& oCommand)
+{
+   if (oCommand.uFile >= m_vecResults.size())
+      m_vecResults.resize(oCommand.uFile + 1);
+   FileResult& oResult = m_vecResults[oCommand.uFile];
+
+   switch (oCommand.eType)
+   {
+      case OPEN_FILE:
+         CloseCurrent();
+         oResult = FileResult();
+         oResult.strPath = oCommand.strData;
+         m_bPreallocated = oCommand.uExpectedSize > 0
+                        && CFilePreallocator::Preallocate(oResult.strPath, oCommand.uExpectedSize);
+         if (m_bPreallocated)
+            m_ofFile.open(oResult.strPath, std::ofstream::in | std::ofstream::out | std::ofstream::binary);
+         else
+            m_ofFile.open(oResult.strPath, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+         if (m_ofFile)
+         {
+            oResult.bSuccess = true;
+            m_uCurrentFile = oCommand.uFile;
+         }
+         else
+         {
+            oResult.strError = "Unable to open the file.";
+            m_ofFile.clear();
+
+            if (m_oLog)
+               m_oLog("[AsyncFileWriter][Error] Unable to open " + oResult.strPath + ".");
+         }
+         break;
+
+      case WRITE_DATA:
+         if (m_uCurrentFile != oCommand.uFile)
+            break;
+
+         m_ofFile.write(oCommand.strData.data(), oCommand.strData.size());
+         if (m_ofFile)
+            oResult.uOctets += oCommand.strData.size();
+         else
+         {
+            // the rest of the file is discarded
+            oResult.bSuccess = false;
+            oResult.strError = "Unable to write the file.";
+            m_ofFile.close();
+            m_ofFile.clear();
+            m_uCurrentFile = NO_FILE;
+            m_bPreallocated = false;
+
+            if (m_oLog)
+               m_oLog("[AsyncFileWriter][Error] Unable to write " + oResult.strPath + ".");
+         }
+         break;
+
+      case CLOSE_FILE:
+         if (m_uCurrentFile == oCommand.uFile)
+            CloseCurrent();
+         break;
+   }
+}
+
+void CAsyncFileWriter::CloseCurrent()
+{
+   if (m_uCurrentFile == NO_FILE)
+      return;
+
+   FileResult& oResult = m_vecResults[m_uCurrentFile];
+   m_ofFile.close();
+   if (!m_ofFile)
+   {
+      oResult.bSuccess = false;
+      oResult.strError = "Unable to close the file.";
+      m_ofFile.clear();
+   }
+   // the reserved size is only an estimate
+   else if (m_bPreallocated && !CFilePreallocator::Truncate(oResult.strPath, oResult.uOctets))
+   {
+      oResult.bSuccess = false;
+      oResult.strError = "Unable to truncate the file.";
+   }
+   m_uCurrentFile = NO_FILE;
+   m_bPreallocated = false;
+}
@@ -0,0 +1,105 @@
+/*
+* @file AsyncFileWriter.h
+* @brief writes files on a dedicated thread fed by a bounded queue
+*
+* The thread receiving the data only moves its buffers into the queue, the
+* opening, writing and closing of the files overlap with the network. The
+* queue is bounded in bytes : a slow disk blocks the producer instead of
+* letting the memory grow.
+*/
+
+#ifndef INCLUDE_ASYNCFILEWRITER_H_
+#define INCLUDE_ASYNCFILEWRITER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FilePreallocator.h"
+
+class CAsyncFileWriter
+{
+public:
+   typedef std::function<void(const std::string&)> LogFnCallback;
+
+   // outcome of a file, see GetResults
+   struct FileResult
+   {
+      FileResult() : bSuccess(false), uOctets(0) {}
+      std::string        strPath;
+      bool               bSuccess;
+      unsigned long long uOctets;
+      std::string        strError;
+   };
+
+   static const size_t DEFAULT_QUEUE_SIZE = 8 * 1024 * 1024;
+
+   explicit CAsyncFileWriter(LogFnCallback oLogger = nullptr, size_t uMaxQueuedBytes = DEFAULT_QUEUE_SIZE);
+   ~CAsyncFileWriter();
+
+   // copy constructor and assignment operator are disabled
+   CAsyncFileWriter(const CAsyncFileWriter& Copy) = delete;
+   CAsyncFileWriter& operator=(const CAsyncFileWriter& Copy) = delete;
+
+   /* starts the writer thread */
+   void Start();
+   /* waits until everything queued is written and stops the thread */
+   void Finish();
+
+   /* the files are processed in the order of the calls, uFile identifies a
+    * file in the results (usually its index in the batch). The space of the
+    * file is preallocated if its size is known. */
+   void Open(size_t uFile, const std::string& strPath, const unsigned long long uExpectedSize = 0);
+   /* strData is moved into the queue, blocks while the queue is full */
+   void Write(size_t uFile, std::string&& strData);
+   void Close(size_t uFile);
+
+   /* indexed by uFile, valid once Finish returned */
+   inline const std::vector<FileResult>& GetResults() const { return m_vecResults; }
+
+protected:
+   enum CommandType
+   {
+      OPEN_FILE,
+      WRITE_DATA,
+      CLOSE_FILE
+   };
+
+   struct Command
+   {
+      CommandType eType;
+      size_t      uFile;
+      std::string strData;  // path for OPEN_FILE
+      unsigned long long uExpectedSize;
+   };
+
+   void Push(Command&& oCommand);
+   void Run();
+   void Execute(Command& oCommand);
+   void CloseCurrent();
+
+   std::deque<Command>        m_dqCommands;
+   size_t                     m_uQueuedBytes;
+   size_t                     m_uMaxQueuedBytes;
+   bool                       m_bStopping;
+   std::mutex                 m_mtxQueue;
+   std::condition_variable    m_cvNotEmpty;
+   std::condition_variable    m_cvNotFull;
+   std::thread                m_oThread;
+
+   // used by the writer thread only
+   std::ofstream              m_ofFile;
+   size_t                     m_uCurrentFile;
+   bool                       m_bPreallocated;
+   std::vector<FileResult>    m_vecResults;
+
+   LogFnCallback              m_oLog;
+};
+
+#endif
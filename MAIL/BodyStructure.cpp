@@ -0,0 +1,206 @@
+/**
+* @file BodyStructure.cpp
+* @brief implementation of the BODYSTRUCTURE parser
+*/
+
+#include "BodyStructure.h"
+
+#include "IMAPSession.h"
+#include "MailCodec.h"
+
+namespace
+{
+const unsigned MAX_MIME_DEPTH = 32;
+
+struct Field
+{
+   CStringView             Value;
+   CImapSession::ValueType eType;
+
+   inline bool IsNil() const { return eType == CImapSession::VALUE_ATOM && Value.EqualsNoCase("NIL"); }
+};
+
+const bool SplitList(const CStringView& List, std::vector<Field>& vecFields)
+{
+   vecFields.clear();
+   return CImapSession::ParseList(List, [&vecFields](const CStringView& Value, const CImapSession::ValueType eType)
+                                  {
+                                     Field oField;
+                                     oField.Value = Value;
+                                     oField.eType = eType;
+                                     vecFields.push_back(oField);
+                                     return true;
+                                  });
+}
+
+/* content of a string field without its escapes, empty for NIL */
+std::string ToString(const Field& oField)
+{
+   if (oField.eType != CImapSession::VALUE_STRING)
+      return oField.IsNil() ? std::string() : oField.Value.ToString();
+
+   std::string strValue;
+   strValue.reserve(oField.Value.size());
+   for (size_t i = 0; i < oField.Value.size(); ++i)
+   {
+      if (oField.Value[i] == '\\' && i + 1 < oField.Value.size())
+         ++i;
+      strValue += oField.Value[i];
+   }
+   return strValue;
+}
+
+std::string ToLower(std::string strText)
+{
+   for (char& c : strText)
+      c = CStringView::ToLower(c);
+   return strText;
+}
+
+/* value of a parameter in a ("NAME" "value" ...) list */
+std::string GetParameter(const Field& oParameters, const CStringView& Name)
+{
+   std::vector<Field> vecParameters;
+   if (oParameters.eType != CImapSession::VALUE_LIST || !SplitList(oParameters.Value, vecParameters))
+      return std::string();
+
+   for (size_t i = 0; i + 1 < vecParameters.size(); i += 2)
+   {
+      if (vecParameters[i].Value.EqualsNoCase(Name))
+         return ToString(vecParameters[i + 1]);
+   }
+   return std::string();
+}
+
+unsigned long long ToNumber(const Field& oField)
+{
+   unsigned long long uNumber = 0;
+   for (size_t i = 0; i < oField.Value.size() && oField.Value[i] >= '0' && oField.Value[i] <= '9'; ++i)
+      uNumber = uNumber * 10 + (oField.Value[i] - '0');
+   return uNumber;
+}
+}
+
+const bool CBodyStructure::Parse(const CStringView& Structure)
+{
+   m_vecParts.clear();
+   if (!ParseBody(Structure, std::string(), 0))
+   {
+      m_vecParts.clear();
+      return false;
+   }
+   return true;
+}
+
+void CBodyStructure::Clear()
+{
+   m_vecParts.clear();
+}
+
+const CBodyStructure::Part* CBodyStructure::FindPart(const std::string& strPartId) const
+{
+   for (const Part& oPart : m_vecParts)
+      if (oPart.strPartId == strPartId)
+         return &oPart;
+
+   return nullptr;
+}
+
+const CBodyStructure::Part* CBodyStructure::FindText(const bool bHtml /* = false */) const
+{
+   const char* pszType = bHtml ? "text/html" : "text/plain";
+   for (const Part& oPart : m_vecParts)
+      if (!oPart.bAttachment && oPart.strContentType == pszType)
+         return &oPart;
+
+   return nullptr;
+}
+
+unsigned long long CBodyStructure::GetTotalSize() const
+{
+   unsigned long long uSize = 0;
+   for (const Part& oPart : m_vecParts)
+      uSize += oPart.uSize;
+   return uSize;
+}
+
+/**
+* @brief parses a body : a multipart lists its parts followed by its subtype,
+* a single part lists its type, subtype, parameters, id, description,
+* encoding and size, then the fields depending on its type
+*
+* @param [in] Body parenthesized body
+* @param [in] strPartId section number of the body, empty for the e-mail itself
+* @param [in] uDepth nesting level
+*/
+const bool CBodyStructure::ParseBody(const CStringView& Body, const std::string& strPartId, const unsigned uDepth)
+{
+   std::vector<Field> vecFields;
+   if (!SplitList(Body, vecFields) || vecFields.empty())
+      return false;
+
+   if (vecFields[0].eType == CImapSession::VALUE_LIST)
+   {
+      if (uDepth >= MAX_MIME_DEPTH)
+         return false;
+
+      unsigned uChildren = 0;
+      for (const Field& oField : vecFields)
+      {
+         if (oField.eType != CImapSession::VALUE_LIST)
+            break;
+
+         const std::string strChildId = (strPartId.empty() ? std::string() : strPartId + ".")
+                                      + std::to_string(++uChildren);
+         if (!ParseBody(oField.Value, strChildId, uDepth + 1))
+            return false;
+      }
+      return true;
+   }
+
+   // type subtype parameters id description encoding size
+   if (vecFields.size() < 7)
+      return false;
+
+   Part oPart;
+   oPart.strPartId = strPartId.empty() ? "1" : strPartId;
+   oPart.strContentType = ToLower(ToString(vecFields[0]) + "/" + ToString(vecFields[1]));
+   oPart.strCharset = GetParameter(vecFields[2], "charset");
+   oPart.strContentId = ToString(vecFields[3]);
+   oPart.strEncoding = ToLower(ToString(vecFields[5]));
+   oPart.uSize = ToNumber(vecFields[6]);
+
+   // text : lines, message/rfc822 : envelope, body and lines, then md5 and disposition
+   size_t uExtension = 7;
+   if (oPart.strContentType.compare(0, 5, "text/") == 0 && vecFields.size() > 7)
+   {
+      oPart.uLines = static_cast<unsigned long>(ToNumber(vecFields[7]));
+      uExtension = 8;
+   }
+   else if (oPart.strContentType == "message/rfc822" && vecFields.size() > 9)
+   {
+      oPart.uLines = static_cast<unsigned long>(ToNumber(vecFields[9]));
+      uExtension = 10;
+   }
+
+   std::string strDisposition;
+   if (vecFields.size() > uExtension + 1 && vecFields[uExtension + 1].eType == CImapSession::VALUE_LIST)
+   {
+      std::vector<Field> vecDisposition;
+      if (SplitList(vecFields[uExtension + 1].Value, vecDisposition) && !vecDisposition.empty())
+      {
+         strDisposition = ToLower(ToString(vecDisposition[0]));
+         if (vecDisposition.size() > 1)
+            oPart.strFileName = GetParameter(vecDisposition[1], "filename");
+      }
+   }
+
+   if (oPart.strFileName.empty())
+      oPart.strFileName = GetParameter(vecFields[2], "name");
+   if (oPart.strFileName.find("=?") != std::string::npos)
+      oPart.strFileName = CMailCodec::DecodeHeader(oPart.strFileName);
+   oPart.bAttachment = !oPart.strFileName.empty() || strDisposition == "attachment";
+
+   m_vecParts.push_back(std::move(oPart));
+   return true;
+}
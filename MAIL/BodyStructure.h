@@ -0,0 +1,57 @@
+/*
+* @file BodyStructure.h
+* @brief MIME structure of an e-mail as described by the IMAP server
+*
+* The BODYSTRUCTURE of a message (RFC 3501) gives the type, encoding, size and
+* section number of each part without downloading it, so the text of a
+* message can be shown, or a single attachment saved, by fetching only the
+* sections needed.
+*/
+
+#ifndef INCLUDE_BODYSTRUCTURE_H_
+#define INCLUDE_BODYSTRUCTURE_H_
+
+#include <string>
+#include <vector>
+
+#include "StringView.h"
+
+class CBodyStructure
+{
+public:
+   // leaf part of the structure (a message/rfc822 part is a leaf)
+   struct Part
+   {
+      Part() : uSize(0), uLines(0), bAttachment(false) {}
+      std::string          strPartId;       // IMAP section number ("1", "2.1" ...)
+      std::string          strContentType;  // lower case "type/subtype"
+      std::string          strCharset;
+      std::string          strEncoding;     // Content-Transfer-Encoding (lower case)
+      std::string          strFileName;
+      std::string          strContentId;
+      unsigned long long   uSize;           // encoded size in octets
+      unsigned long        uLines;          // text parts only
+      bool                 bAttachment;
+   };
+
+   CBodyStructure() {}
+
+   /* parses the value of a BODYSTRUCTURE (or BODY) data item, e.g.
+    * ("TEXT" "PLAIN" ("CHARSET" "us-ascii") NIL NIL "7BIT" 42 2) */
+   const bool Parse(const CStringView& Structure);
+   void Clear();
+
+   inline const std::vector<Part>& GetParts() const { return m_vecParts; }
+   const Part* FindPart(const std::string& strPartId) const;
+   /* first text/plain (or text/html) part that isn't an attachment, nullptr if none */
+   const Part* FindText(const bool bHtml = false) const;
+   /* sum of the part sizes */
+   unsigned long long GetTotalSize() const;
+
+protected:
+   const bool ParseBody(const CStringView& Body, const std::string& strPartId, const unsigned uDepth);
+
+   std::vector<Part> m_vecParts;
+};
+
+#endif
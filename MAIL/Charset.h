@@ -0,0 +1,39 @@
+/*
+* @file Charset.h
+* @brief conversion of the common e-mail charsets to UTF-8
+*
+* UTF-8, US-ASCII, ISO-8859-x, Windows-125x and KOI8-R/U are supported, the
+* single byte charsets through lookup tables. Pure ASCII runs are detected
+* 32 bytes at a time (SSE2/AVX2 when the compiler targets them) and copied
+* as is.
+*/
+
+#ifndef INCLUDE_CHARSET_H_
+#define INCLUDE_CHARSET_H_
+
+#include <cstddef>
+#include <string>
+
+#include "StringView.h"
+
+class CCharset
+{
+public:
+   /* appends the UTF-8 conversion of the text to strOutput, invalid or unmapped
+    * bytes become U+FFFD. Returns false (nothing appended) if the charset is unknown. */
+   static const bool ToUTF8(const CStringView& Charset, const char* pData, size_t uSize, std::string& strOutput);
+   static const bool IsSupported(const CStringView& Charset);
+
+   /* number of leading bytes below 0x80 */
+   static size_t ASCIIPrefix(const char* pData, size_t uSize);
+
+   static const bool IsValidUTF8(const char* pData, size_t uSize);
+   /* appends UTF-8 text, invalid sequences are replaced by U+FFFD */
+   static void AppendUTF8(const char* pData, size_t uSize, std::string& strOutput);
+   /* length of the well-formed UTF-8 sequence at pData, 0 if it's invalid */
+   static size_t SequenceLength(const unsigned char* pData, size_t uSize);
+
+   static void AppendCodePoint(unsigned int uCodePoint, std::string& strOutput);
+};
+
+#endif
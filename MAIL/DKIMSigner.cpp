@@ -0,0 +1,582 @@
+/**
+* @file DKIMSigner.cpp
+* @brief implementation of the streaming DKIM signer
+*/
+
+#include "DKIMSigner.h"
+#include "MailCodec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#ifdef DKIM_SUPPORT
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#endif
+
+struct CDKIMSigner::KeyContext
+{
+#ifdef DKIM_SUPPORT
+   KeyContext() : pKey(nullptr), pTemplate(nullptr) {}
+   ~KeyContext()
+   {
+      if (pTemplate != nullptr)
+         EVP_MD_CTX_free(pTemplate);
+      if (pKey != nullptr)
+         EVP_PKEY_free(pKey);
+   }
+
+   EVP_PKEY*   pKey;
+   /* digest-sign context already initialized with the key, copied for each message */
+   EVP_MD_CTX* pTemplate;
+#endif
+};
+
+namespace
+{
+std::mutex s_mtxKeyCache;
+std::map<std::string, std::weak_ptr<CDKIMSigner::KeyContext>> s_mapKeyCache;
+
+inline bool IsWSP(const char c) { return c == ' ' || c == '\t'; }
+
+#ifdef DKIM_SUPPORT
+/* cache key of a PEM string : its SHA-256, the key material isn't kept */
+std::string PEMCacheKey(const std::string& strPEM)
+{
+   unsigned char szDigest[EVP_MAX_MD_SIZE];
+   unsigned int uDigestSize = 0;
+   if (EVP_Digest(strPEM.data(), strPEM.size(), szDigest, &uDigestSize, EVP_sha256(), nullptr) != 1)
+      return std::string();
+
+   std::string strKey = "pem:";
+   CMailCodec::Base64Encode(szDigest, uDigestSize, strKey);
+   return strKey;
+}
+
+std::shared_ptr<CDKIMSigner::KeyContext> LoadKeyContext(const std::string& strCacheKey, const std::string& strPEM)
+{
+   std::lock_guard<std::mutex> lock(s_mtxKeyCache);
+
+   // the keys no longer used by any signer are dropped
+   for (auto it = s_mapKeyCache.begin(); it != s_mapKeyCache.end(); )
+   {
+      if (it->second.expired())
+         it = s_mapKeyCache.erase(it);
+      else
+         ++it;
+   }
+
+   auto itCached = s_mapKeyCache.find(strCacheKey);
+   if (itCached != s_mapKeyCache.end())
+      return itCached->second.lock();
+
+   if (strCacheKey.empty())
+      return nullptr;
+
+   BIO* pBio = BIO_new_mem_buf(strPEM.data(), static_cast<int>(strPEM.size()));
+   if (pBio == nullptr)
+      return nullptr;
+
+   std::shared_ptr<CDKIMSigner::KeyContext> pContext = std::make_shared<CDKIMSigner::KeyContext>();
+   pContext->pKey = PEM_read_bio_PrivateKey(pBio, nullptr, nullptr, nullptr);
+   BIO_free(pBio);
+
+   if (pContext->pKey == nullptr)
+      return nullptr;
+
+   pContext->pTemplate = EVP_MD_CTX_new();
+   if (pContext->pTemplate == nullptr
+       || EVP_DigestSignInit(pContext->pTemplate, nullptr, EVP_sha256(), nullptr, pContext->pKey) != 1)
+      return nullptr;
+
+   s_mapKeyCache[strCacheKey] = pContext;
+   return pContext;
+}
+#endif
+}
+
+/**
+* @brief constructor of the DKIM signer
+*
+* @param [in] strDomain signing domain (d= tag)
+* @param [in] strSelector selector of the public key in the DNS (s= tag)
+* @param [in] oLogger optional error logger
+*/
+CDKIMSigner::CDKIMSigner(const std::string& strDomain, const std::string& strSelector,
+                         LogFnCallback oLogger /* = nullptr */) :
+   m_strDomain(strDomain),
+   m_strSelector(strSelector),
+   m_eHeaderCanon(Canonicalization::RELAXED),
+   m_eBodyCanon(Canonicalization::RELAXED),
+   m_bTimestamp(true),
+   m_pBodyCtx(nullptr),
+   m_pSignCtx(nullptr),
+   m_uPendingCRLF(0),
+   m_bPendingWSP(false),
+   m_bPendingCR(false),
+   m_bBodyHasContent(false),
+   m_uBodyBuffered(0),
+   m_oLog(oLogger)
+{
+   SetSignedHeaders("from:to:cc:subject:date:message-id:reply-to:mime-version:content-type");
+
+#ifdef DKIM_SUPPORT
+   m_pBodyCtx = EVP_MD_CTX_new();
+   m_pSignCtx = EVP_MD_CTX_new();
+#endif
+}
+
+CDKIMSigner::~CDKIMSigner()
+{
+#ifdef DKIM_SUPPORT
+   EVP_MD_CTX_free(static_cast<EVP_MD_CTX*>(m_pBodyCtx));
+   EVP_MD_CTX_free(static_cast<EVP_MD_CTX*>(m_pSignCtx));
+#endif
+}
+
+const bool CDKIMSigner::LoadPrivateKey(const std::string& strPEM)
+{
+#ifdef DKIM_SUPPORT
+   m_pKey = LoadKeyContext(PEMCacheKey(strPEM), strPEM);
+   if (!m_pKey && m_oLog)
+      m_oLog("[DKIMSigner][Error] Unable to load the private key.");
+
+   return m_pKey != nullptr;
+#else
+   strPEM;
+   if (m_oLog)
+      m_oLog("[DKIMSigner][Error] DKIM signing is not supported by this build (OpenSSL is missing).");
+   return false;
+#endif
+}
+
+const bool CDKIMSigner::LoadPrivateKeyFile(const std::string& strPath)
+{
+#ifdef DKIM_SUPPORT
+   {
+      std::lock_guard<std::mutex> lock(s_mtxKeyCache);
+      auto itCached = s_mapKeyCache.find("file:" + strPath);
+      if (itCached != s_mapKeyCache.end() && (m_pKey = itCached->second.lock()))
+         return true;
+   }
+
+   std::ifstream ifKey(strPath, std::ifstream::binary);
+   if (!ifKey)
+   {
+      if (m_oLog)
+         m_oLog("[DKIMSigner][Error] Unable to open the private key file " + strPath + ".");
+      return false;
+   }
+   std::ostringstream ssPEM;
+   ssPEM << ifKey.rdbuf();
+
+   m_pKey = LoadKeyContext("file:" + strPath, ssPEM.str());
+   if (!m_pKey && m_oLog)
+      m_oLog("[DKIMSigner][Error] Unable to load the private key file " + strPath + ".");
+
+   return m_pKey != nullptr;
+#else
+   strPath;
+   if (m_oLog)
+      m_oLog("[DKIMSigner][Error] DKIM signing is not supported by this build (OpenSSL is missing).");
+   return false;
+#endif
+}
+
+void CDKIMSigner::SetSignedHeaders(const std::string& strHeaders)
+{
+   m_vecSignedHeaders.clear();
+
+   std::istringstream ssHeaders(strHeaders);
+   std::string strName;
+   while (std::getline(ssHeaders, strName, ':'))
+   {
+      strName.erase(std::remove_if(strName.begin(), strName.end(), ::isspace), strName.end());
+      std::transform(strName.begin(), strName.end(), strName.begin(), ::tolower);
+      if (!strName.empty())
+         m_vecSignedHeaders.push_back(strName);
+   }
+
+   if (std::find(m_vecSignedHeaders.begin(), m_vecSignedHeaders.end(), "from") == m_vecSignedHeaders.end())
+      m_vecSignedHeaders.insert(m_vecSignedHeaders.begin(), "from");
+
+   m_strSignedHeaders = strHeaders;
+}
+
+void CDKIMSigner::SetCanonicalization(Canonicalization eHeader, Canonicalization eBody)
+{
+   m_eHeaderCanon = eHeader;
+   m_eBodyCanon = eBody;
+}
+
+/**
+* @brief starts hashing a new body, the hash context is reused between bodies
+*/
+void CDKIMSigner::BeginBody()
+{
+   m_uPendingCRLF = 0;
+   m_bPendingWSP = false;
+   m_bPendingCR = false;
+   m_bBodyHasContent = false;
+   m_uBodyBuffered = 0;
+   m_strBodyHash.clear();
+
+#ifdef DKIM_SUPPORT
+   EVP_DigestInit_ex(static_cast<EVP_MD_CTX*>(m_pBodyCtx), EVP_sha256(), nullptr);
+#endif
+}
+
+/**
+* @brief canonicalizes (simple or relaxed) and hashes a chunk of the body
+*
+* Empty lines are only emitted once a non empty line follows them, so that
+* trailing empty lines are ignored without buffering the body.
+*
+* @param [in] pData chunk of the body
+* @param [in] uSize size of the chunk
+*/
+void CDKIMSigner::UpdateBody(const char* pData, size_t uSize)
+{
+   const char* pEnd = pData + uSize;
+
+   while (pData < pEnd)
+   {
+      if (m_bPendingCR)
+      {
+         m_bPendingCR = false;
+         if (*pData != '\n')
+            EmitBody("\r", 1);
+      }
+
+      const char c = *pData++;
+
+      if (c == '\n')
+      {
+         // end of line (LF or CRLF)
+         m_bPendingWSP = false;
+         ++m_uPendingCRLF;
+      }
+      else if (c == '\r')
+      {
+         m_bPendingCR = true;
+      }
+      else if (m_eBodyCanon == Canonicalization::RELAXED && IsWSP(c))
+      {
+         m_bPendingWSP = true;
+      }
+      else
+      {
+         // copy the run of plain characters up to the next special one at once
+         const char* pRun = pData;
+         while (pRun < pEnd && *pRun != '\n' && *pRun != '\r'
+                && !(m_eBodyCanon == Canonicalization::RELAXED && IsWSP(*pRun)))
+            ++pRun;
+
+         EmitBody(pData - 1, pRun - pData + 1);
+         pData = pRun;
+      }
+   }
+}
+
+const std::string& CDKIMSigner::EndBody()
+{
+   if (m_bPendingCR)
+   {
+      m_bPendingCR = false;
+      EmitBody("\r", 1);
+   }
+
+   // trailing empty lines and whitespace are dropped : a non empty body ends with
+   // exactly one CRLF, the simple canonicalization turns an empty body into a CRLF
+   if (m_bBodyHasContent || m_eBodyCanon == Canonicalization::SIMPLE)
+      WriteBody("\r\n", 2);
+
+   FlushBody();
+
+#ifdef DKIM_SUPPORT
+   unsigned char szDigest[EVP_MAX_MD_SIZE];
+   unsigned int uDigestSize = 0;
+   EVP_DigestFinal_ex(static_cast<EVP_MD_CTX*>(m_pBodyCtx), szDigest, &uDigestSize);
+
+   m_strBodyHash.clear();
+   CMailCodec::Base64Encode(szDigest, uDigestSize, m_strBodyHash);
+#endif
+
+   return m_strBodyHash;
+}
+
+/**
+* @brief appends canonical content to the hash buffer, the pending line breaks
+* and whitespace run are written first
+*/
+void CDKIMSigner::EmitBody(const char* pData, size_t uSize)
+{
+   for (; m_uPendingCRLF > 0; --m_uPendingCRLF)
+      WriteBody("\r\n", 2);
+
+   if (m_bPendingWSP)
+   {
+      m_bPendingWSP = false;
+      WriteBody(" ", 1);
+   }
+
+   WriteBody(pData, uSize);
+   m_bBodyHasContent = true;
+}
+
+void CDKIMSigner::WriteBody(const char* pData, size_t uSize)
+{
+   while (uSize > 0)
+   {
+      if (m_uBodyBuffered == sizeof(m_szBodyBuffer))
+         FlushBody();
+
+      const size_t uCopy = std::min(uSize, sizeof(m_szBodyBuffer) - m_uBodyBuffered);
+      std::memcpy(m_szBodyBuffer + m_uBodyBuffered, pData, uCopy);
+      m_uBodyBuffered += uCopy;
+      pData += uCopy;
+      uSize -= uCopy;
+   }
+}
+
+void CDKIMSigner::FlushBody()
+{
+#ifdef DKIM_SUPPORT
+   if (m_uBodyBuffered > 0)
+      EVP_DigestUpdate(static_cast<EVP_MD_CTX*>(m_pBodyCtx), m_szBodyBuffer, m_uBodyBuffered);
+#endif
+   m_uBodyBuffered = 0;
+}
+
+/**
+* @brief canonicalizes one header field (with its folded lines, without the
+* terminating line break) and appends it, CRLF terminated, to strOutput
+*/
+void CDKIMSigner::CanonicalizeHeader(const char* pField, size_t uSize, std::string& strOutput) const
+{
+   if (m_eHeaderCanon == Canonicalization::SIMPLE)
+   {
+      // keep the field as is, but line breaks are always sent as CRLF
+      for (size_t i = 0; i < uSize; ++i)
+      {
+         if (pField[i] == '\n' && (i == 0 || pField[i - 1] != '\r'))
+            strOutput += '\r';
+         strOutput += pField[i];
+      }
+      strOutput += "\r\n";
+      return;
+   }
+
+   const char* pColon = static_cast<const char*>(std::memchr(pField, ':', uSize));
+   if (pColon == nullptr)
+      return;
+
+   // lower case name without trailing whitespace
+   const char* pNameEnd = pColon;
+   while (pNameEnd > pField && IsWSP(pNameEnd[-1]))
+      --pNameEnd;
+   for (const char* p = pField; p < pNameEnd; ++p)
+      strOutput += static_cast<char>(::tolower(static_cast<unsigned char>(*p)));
+   strOutput += ':';
+
+   // unfolded value, whitespace runs reduced to one space, no leading/trailing whitespace
+   bool bPendingWSP = false;
+   bool bHasValue = false;
+   for (const char* p = pColon + 1; p < pField + uSize; ++p)
+   {
+      if (*p == '\r' || *p == '\n' || IsWSP(*p))
+      {
+         bPendingWSP = true;
+         continue;
+      }
+      if (bPendingWSP && bHasValue)
+         strOutput += ' ';
+      bPendingWSP = false;
+      bHasValue = true;
+      strOutput += *p;
+   }
+   strOutput += "\r\n";
+}
+
+/**
+* @brief computes the DKIM-Signature header
+*
+* @param [in] pHeaders header block of the message (without the empty line)
+* @param [in] uSize size of the header block
+* @param [out] strSignatureHeader "DKIM-Signature: ...\r\n"
+*
+* @retval true   The header was computed.
+* @retval false  No key is loaded, there's no From field or signing failed.
+*/
+const bool CDKIMSigner::SignHeaders(const char* pHeaders, size_t uSize, std::string& strSignatureHeader)
+{
+#ifdef DKIM_SUPPORT
+   if (!m_pKey)
+   {
+      if (m_oLog)
+         m_oLog("[DKIMSigner][Error] No private key loaded.");
+      return false;
+   }
+
+   // split the header block into fields (a field spans its folded lines)
+   struct HeaderField { const char* pStart; size_t uSize; std::string strName; bool bUsed; };
+   std::vector<HeaderField> vecFields;
+
+   const char* p = pHeaders;
+   const char* pEnd = pHeaders + uSize;
+   while (p < pEnd)
+   {
+      const char* pFieldStart = p;
+      const char* pFieldEnd = p;
+      do
+      {
+         const char* pLF = static_cast<const char*>(std::memchr(p, '\n', pEnd - p));
+         pFieldEnd = (pLF == nullptr) ? pEnd : pLF;
+         p = (pLF == nullptr) ? pEnd : pLF + 1;
+      } while (p < pEnd && IsWSP(*p));
+
+      const char* pLineEnd = pFieldEnd;
+      if (pLineEnd > pFieldStart && pLineEnd[-1] == '\r')
+         --pLineEnd;
+
+      const char* pColon = static_cast<const char*>(std::memchr(pFieldStart, ':', pLineEnd - pFieldStart));
+      if (pColon == nullptr)
+         continue;
+
+      std::string strName(pFieldStart, pColon);
+      strName.erase(std::remove_if(strName.begin(), strName.end(), ::isspace), strName.end());
+      std::transform(strName.begin(), strName.end(), strName.begin(), ::tolower);
+      vecFields.push_back({ pFieldStart, static_cast<size_t>(pLineEnd - pFieldStart), strName, false });
+   }
+
+   // select the instances to sign, from the bottom of the header block (RFC 6376 5.4.2)
+   std::string strCanonHeaders;
+   std::string strSigned;
+   bool bFromSigned = false;
+   for (const std::string& strName : m_vecSignedHeaders)
+   {
+      for (auto it = vecFields.rbegin(); it != vecFields.rend(); ++it)
+      {
+         if (!it->bUsed && it->strName == strName)
+         {
+            it->bUsed = true;
+            bFromSigned = bFromSigned || strName == "from";
+            CanonicalizeHeader(it->pStart, it->uSize, strCanonHeaders);
+            if (!strSigned.empty())
+               strSigned += ':';
+            strSigned += strName;
+            break;
+         }
+      }
+   }
+
+   if (!bFromSigned)
+   {
+      if (m_oLog)
+         m_oLog("[DKIMSigner][Error] The message has no From header field.");
+      return false;
+   }
+
+   std::ostringstream ssSignature;
+   ssSignature << "DKIM-Signature: v=1; a=rsa-sha256; c="
+               << ((m_eHeaderCanon == Canonicalization::RELAXED) ? "relaxed" : "simple") << '/'
+               << ((m_eBodyCanon == Canonicalization::RELAXED) ? "relaxed" : "simple")
+               << "; d=" << m_strDomain << "; s=" << m_strSelector << ";";
+   if (m_bTimestamp)
+      ssSignature << " t=" << static_cast<long long>(time(nullptr)) << ";";
+   ssSignature << "\r\n\th=" << strSigned << "; bh=" << m_strBodyHash << ";\r\n\tb=";
+   strSignatureHeader = ssSignature.str();
+
+   // the signature header itself is hashed with an empty b= and without its final CRLF
+   CanonicalizeHeader(strSignatureHeader.data(), strSignatureHeader.size(), strCanonHeaders);
+   strCanonHeaders.resize(strCanonHeaders.size() - 2);
+
+   EVP_MD_CTX* pSignCtx = static_cast<EVP_MD_CTX*>(m_pSignCtx);
+   size_t uSignatureSize = 0;
+   if (EVP_MD_CTX_copy_ex(pSignCtx, m_pKey->pTemplate) != 1
+       || EVP_DigestSignUpdate(pSignCtx, strCanonHeaders.data(), strCanonHeaders.size()) != 1
+       || EVP_DigestSignFinal(pSignCtx, nullptr, &uSignatureSize) != 1)
+   {
+      if (m_oLog)
+         m_oLog("[DKIMSigner][Error] Unable to compute the signature.");
+      return false;
+   }
+
+   std::vector<unsigned char> vecSignature(uSignatureSize);
+   if (EVP_DigestSignFinal(pSignCtx, vecSignature.data(), &uSignatureSize) != 1)
+   {
+      if (m_oLog)
+         m_oLog("[DKIMSigner][Error] Unable to compute the signature.");
+      return false;
+   }
+
+   CMailCodec::Base64Encode(vecSignature.data(), uSignatureSize, strSignatureHeader);
+   strSignatureHeader += "\r\n";
+   return true;
+#else
+   pHeaders; uSize; strSignatureHeader;
+   if (m_oLog)
+      m_oLog("[DKIMSigner][Error] DKIM signing is not supported by this build (OpenSSL is missing).");
+   return false;
+#endif
+}
+
+/**
+* @brief signs a whole message in two passes over the same memory : the body is
+* hashed first, then the headers are signed. No copy of the message is made.
+*
+* @param [in] pMessage message (headers, empty line, body), LF or CRLF line breaks
+* @param [in] uSize size of the message
+* @param [out] strSignatureHeader header to send before the message
+*/
+const bool CDKIMSigner::SignMessage(const char* pMessage, size_t uSize, std::string& strSignatureHeader)
+{
+   size_t uHeadersEnd = 0;
+   const size_t uBodyStart = FindBody(pMessage, uSize, uHeadersEnd);
+
+   BeginBody();
+   UpdateBody(pMessage + uBodyStart, uSize - uBodyStart);
+   EndBody();
+
+   return SignHeaders(pMessage, uHeadersEnd, strSignatureHeader);
+}
+
+size_t CDKIMSigner::FindBody(const char* pMessage, size_t uSize, size_t& uHeadersEnd)
+{
+   const char* p = pMessage;
+   const char* pEnd = pMessage + uSize;
+
+   // an empty line (LF or CRLF) separates the headers from the body
+   while (p < pEnd)
+   {
+      if (*p == '\n')
+      {
+         uHeadersEnd = 0;
+         return 1;
+      }
+      if (*p == '\r' && p + 1 < pEnd && p[1] == '\n')
+      {
+         uHeadersEnd = 0;
+         return 2;
+      }
+
+      const char* pLF = static_cast<const char*>(std::memchr(p, '\n', pEnd - p));
+      if (pLF == nullptr)
+         break;
+      p = pLF + 1;
+
+      if (p < pEnd && (*p == '\n' || (*p == '\r' && p + 1 < pEnd && p[1] == '\n')))
+      {
+         uHeadersEnd = p - pMessage;
+         return uHeadersEnd + ((*p == '\n') ? 1 : 2);
+      }
+   }
+
+   uHeadersEnd = uSize;
+   return uSize;
+}
@@ -0,0 +1,109 @@
+/*
+* @file DKIMSigner.h
+* @brief streaming DKIM (RFC 6376) signer for outgoing e-mails
+*
+* The body is canonicalized and hashed in a single pass without being
+* copied, then the DKIM-Signature header is computed over the selected
+* header fields. Since the signature header must be sent before the body,
+* the SMTP client signs a memory (or memory mapped) source first and then
+* streams the very same bytes to the server.
+*
+* Requires OpenSSL (the build defines DKIM_SUPPORT when it is found).
+*/
+
+#ifndef INCLUDE_DKIMSIGNER_H_
+#define INCLUDE_DKIMSIGNER_H_
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class CDKIMSigner
+{
+public:
+   typedef std::function<void(const std::string&)> LogFnCallback;
+
+   enum class Canonicalization
+   {
+      SIMPLE,
+      RELAXED
+   };
+
+   CDKIMSigner(const std::string& strDomain, const std::string& strSelector,
+               LogFnCallback oLogger = nullptr);
+   ~CDKIMSigner();
+
+   // copy constructor and assignment operator are disabled
+   CDKIMSigner(const CDKIMSigner& Copy) = delete;
+   CDKIMSigner& operator=(const CDKIMSigner& Copy) = delete;
+
+   /* load the RSA private key from a PEM string or a PEM file. Parsed keys are
+    * cached process-wide (by path or by a SHA-256 of the PEM) while a signer
+    * uses them, so signers sharing a key don't parse it again. */
+   const bool LoadPrivateKey(const std::string& strPEM);
+   const bool LoadPrivateKeyFile(const std::string& strPath);
+
+   /* colon separated list of header fields to sign, "from" is always required */
+   void SetSignedHeaders(const std::string& strHeaders);
+   void SetCanonicalization(Canonicalization eHeader, Canonicalization eBody);
+   inline void SetTimestamp(const bool& bTimestamp) { m_bTimestamp = bTimestamp; }
+
+   inline const std::string& GetDomain() const { return m_strDomain; }
+   inline const std::string& GetSelector() const { return m_strSelector; }
+   inline const std::string& GetSignedHeaders() const { return m_strSignedHeaders; }
+   inline const bool HasKey() const { return m_pKey != nullptr; }
+
+   /* streaming body hash : BeginBody, UpdateBody as many times as needed, EndBody.
+    * Lines may end with LF or CRLF, both are hashed as CRLF. */
+   void BeginBody();
+   void UpdateBody(const char* pData, size_t uSize);
+   /* returns the base64 body hash (bh= tag) */
+   const std::string& EndBody();
+
+   /* compute the DKIM-Signature header (CRLF terminated) over the header block
+    * pHeaders (without the empty separator line) using the last body hash */
+   const bool SignHeaders(const char* pHeaders, size_t uSize, std::string& strSignatureHeader);
+
+   /* sign a complete message (headers, empty line, body) held in memory */
+   const bool SignMessage(const char* pMessage, size_t uSize, std::string& strSignatureHeader);
+
+   /* offset of the body in a message (past the empty line), uSize if there's none.
+    * uHeadersEnd receives the size of the header block. */
+   static size_t FindBody(const char* pMessage, size_t uSize, size_t& uHeadersEnd);
+
+   /* parsed private key and its digest-sign template, shared between signers */
+   struct KeyContext;
+
+protected:
+   void EmitBody(const char* pData, size_t uSize);
+   void WriteBody(const char* pData, size_t uSize);
+   void FlushBody();
+   void CanonicalizeHeader(const char* pField, size_t uSize, std::string& strOutput) const;
+
+   std::string                   m_strDomain;
+   std::string                   m_strSelector;
+   std::string                   m_strSignedHeaders;
+   std::vector<std::string>      m_vecSignedHeaders;
+   Canonicalization              m_eHeaderCanon;
+   Canonicalization              m_eBodyCanon;
+   bool                          m_bTimestamp;
+
+   std::shared_ptr<KeyContext>   m_pKey;
+   void*                         m_pBodyCtx;    // EVP_MD_CTX reused for every body
+   void*                         m_pSignCtx;    // EVP_MD_CTX copied from the key template
+
+   // body canonicalization state
+   std::string                   m_strBodyHash;
+   size_t                        m_uPendingCRLF;
+   bool                          m_bPendingWSP;
+   bool                          m_bPendingCR;
+   bool                          m_bBodyHasContent;
+   char                          m_szBodyBuffer[4096];
+   size_t                        m_uBodyBuffered;
+
+   LogFnCallback                 m_oLog;
+};
+
+#endif
@@ -0,0 +1,52 @@
+/**
+* @file FilePreallocator.cpp
+* @brief implementation of the file space reservation
+*/
+
+#include "FilePreallocator.h"
+
+#ifndef WINDOWS
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+/**
+* @brief reserves the disk space of a file (posix_fallocate)
+*
+* @param [in] strPath path of the file, created or emptied
+* @param [in] uSize number of bytes to reserve
+*
+* @retval true   The space is reserved, the file size is uSize.
+* @retval false  Not supported by the platform or the file couldn't be created.
+*/
+const bool CFilePreallocator::Preallocate(const std::string& strPath, const unsigned long long uSize)
+{
+#if defined(__linux__)
+   if (uSize == 0)
+      return false;
+
+   const int iFd = open(strPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+   if (iFd < 0)
+      return false;
+
+   const int iResult = posix_fallocate(iFd, 0, static_cast<off_t>(uSize));
+   close(iFd);
+   return iResult == 0;
+#else
+   strPath;
+   uSize;
+   return false;
+#endif
+}
+
+const bool CFilePreallocator::Truncate(const std::string& strPath, const unsigned long long uSize)
+{
+#ifndef WINDOWS
+   return truncate(strPath.c_str(), static_cast<off_t>(uSize)) == 0;
+#else
+   strPath;
+   uSize;
+   return false;
+#endif
+}
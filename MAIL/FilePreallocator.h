@@ -0,0 +1,25 @@
+/*
+* @file FilePreallocator.h
+* @brief reservation of the disk space of a file whose size is known in advance
+*
+* A file written by small appends is extended block after block (and often
+* fragmented), a preallocated file gets its extents at once.
+*/
+
+#ifndef INCLUDE_FILEPREALLOCATOR_H_
+#define INCLUDE_FILEPREALLOCATOR_H_
+
+#include <string>
+
+class CFilePreallocator
+{
+public:
+   /* creates (or empties) the file and reserves uSize bytes for it. The file
+    * size becomes uSize : it must be truncated to the size actually written.
+    * Returns false if the space couldn't be reserved (e.g. unsupported platform). */
+   static const bool Preallocate(const std::string& strPath, const unsigned long long uSize);
+
+   static const bool Truncate(const std::string& strPath, const unsigned long long uSize);
+};
+
+#endif
@@ -0,0 +1,134 @@
+/**
+* @file HeaderParser.cpp
+* @brief implementation of the RFC 5322 header parser
+*/
+
+#include "HeaderParser.h"
+
+namespace
+{
+inline bool IsWSP(const char c) { return c == ' ' || c == '\t'; }
+}
+
+/**
+* @brief indexes a header block, the previous index is discarded
+*
+* Lines may end with CRLF or LF. Lines starting with a space or a tab continue
+* the previous field, lines that aren't a field (e.g. an mbox "From " line) are
+* skipped. The line breaks are located with memchr which is vectorized by the
+* C libraries we build against.
+*
+* @param [in] Headers buffer starting with the header fields
+*/
+void CHeaderParser::Parse(const CStringView& Headers)
+{
+   m_vecFields.clear();
+
+   const char* p = Headers.data();
+   const char* const pEnd = Headers.end();
+   Field* pLast = nullptr;
+
+   while (p < pEnd)
+   {
+      const char* pNewLine = static_cast<const char*>(memchr(p, '\n', pEnd - p));
+      const char* pNext = pNewLine ? pNewLine + 1 : pEnd;
+      const char* pLineEnd = pNewLine ? pNewLine : pEnd;
+      if (pLineEnd > p && pLineEnd[-1] == '\r')
+         --pLineEnd;
+
+      // empty line : end of the header block
+      if (pLineEnd == p)
+      {
+         p = pNext;
+         break;
+      }
+
+      if (IsWSP(*p))
+      {
+         // continuation line, extends the value of the previous field
+         if (pLast != nullptr)
+         {
+            const char* pValueEnd = pLineEnd;
+            while (pValueEnd > p && IsWSP(pValueEnd[-1]))
+               --pValueEnd;
+            if (pValueEnd > p)
+               pLast->Value = CStringView(pLast->Value.data(), pValueEnd - pLast->Value.data());
+         }
+      }
+      else
+      {
+         const char* pColon = static_cast<const char*>(memchr(p, ':', pLineEnd - p));
+         const char* pNameEnd = pColon;
+
+         // obsolete syntax allows spaces before the colon, but not inside the name
+         if (pNameEnd != nullptr)
+         {
+            while (pNameEnd > p && IsWSP(pNameEnd[-1]))
+               --pNameEnd;
+            if (pNameEnd == p || memchr(p, ' ', pNameEnd - p) || memchr(p, '\t', pNameEnd - p))
+               pNameEnd = nullptr;
+         }
+
+         if (pNameEnd != nullptr)
+         {
+            const char* pValue = pColon + 1;
+            while (pValue < pLineEnd && IsWSP(*pValue))
+               ++pValue;
+            const char* pValueEnd = pLineEnd;
+            while (pValueEnd > pValue && IsWSP(pValueEnd[-1]))
+               --pValueEnd;
+
+            m_vecFields.push_back({ CStringView(p, pNameEnd - p), CStringView(pValue, pValueEnd - pValue) });
+            pLast = &m_vecFields.back();
+         }
+         else
+            pLast = nullptr;
+      }
+
+      p = pNext;
+   }
+
+   m_uHeaderSize = p - Headers.data();
+}
+
+void CHeaderParser::Clear()
+{
+   m_vecFields.clear();
+   m_uHeaderSize = 0;
+}
+
+const CHeaderParser::Field* CHeaderParser::Find(const CStringView& Name) const
+{
+   for (const Field& oField : m_vecFields)
+      if (oField.Name.EqualsNoCase(Name))
+         return &oField;
+
+   return nullptr;
+}
+
+CStringView CHeaderParser::GetValue(const CStringView& Name) const
+{
+   const Field* pField = Find(Name);
+   return pField ? pField->Value : CStringView();
+}
+
+/**
+* @brief unfolds a field value : the line breaks followed by a space or a tab
+* are removed, the white space itself is kept
+*
+* @param [in] Value raw field value returned by the parser
+*/
+std::string CHeaderParser::Unfold(const CStringView& Value)
+{
+   std::string strValue;
+   strValue.reserve(Value.size());
+
+   for (size_t i = 0; i < Value.size(); ++i)
+   {
+      const char c = Value[i];
+      if (c == '\r' || c == '\n')
+         continue;
+      strValue += c;
+   }
+   return strValue;
+}
@@ -0,0 +1,53 @@
+/*
+* @file HeaderParser.h
+* @brief single pass RFC 5322 header parser
+*
+* The header block is scanned once and indexed as (name, value) views into
+* the caller's buffer : nothing is copied and, when the parser is reused, no
+* memory is allocated either. The buffer must outlive the index.
+*/
+
+#ifndef INCLUDE_HEADERPARSER_H_
+#define INCLUDE_HEADERPARSER_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "StringView.h"
+
+class CHeaderParser
+{
+public:
+   struct Field
+   {
+      CStringView Name;
+      CStringView Value;  // raw value : may contain folding line breaks, see Unfold()
+   };
+
+   CHeaderParser() : m_uHeaderSize(0) {}
+
+   /* index the header fields of an e-mail (or of a header block), parsing stops
+    * at the empty line separating the headers from the body */
+   void Parse(const CStringView& Headers);
+   void Clear();
+
+   inline const std::vector<Field>& GetFields() const { return m_vecFields; }
+   inline size_t GetCount() const { return m_vecFields.size(); }
+   /* size of the header block including the empty line, i.e. the offset of the body */
+   inline size_t GetHeaderSize() const { return m_uHeaderSize; }
+
+   /* first field with that name (case insensitive), nullptr if there's none */
+   const Field* Find(const CStringView& Name) const;
+   /* raw value of the first field with that name, empty if there's none */
+   CStringView GetValue(const CStringView& Name) const;
+
+   /* value with the folding line breaks removed (RFC 5322 2.2.3) */
+   static std::string Unfold(const CStringView& Value);
+
+protected:
+   std::vector<Field> m_vecFields;
+   size_t             m_uHeaderSize;
+};
+
+#endif
@@ -6,19 +6,41 @@
 
 #include "IMAPClient.h"
 
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+
+#include "Charset.h"
+
 CIMAPClient::CIMAPClient(LogFnCallback oLogger) :
    CMailClient(oLogger),
-   m_pstrText(nullptr),
    m_eOperationType(IMAP_NOOP),
    m_eMailProperty(MailProperty::Flagged),
-   m_eSearchOption(SearchOption::FLAGGED)
+   m_eSearchOption(SearchOption::FLAGGED),
+   m_pstrText(nullptr),
+   m_pMIMESplitter(nullptr),
+   m_pSink(nullptr),
+   m_uExpectedSize(0),
+   m_strMailbox("INBOX"),
+   m_oSession([this](const std::string& strMessage)
+              {
+                 if (m_eSettingsFlags & ENABLE_LOG)
+                    m_oLog(strMessage);
+              }),
+   m_bStopIdle(false),
+   m_uIdleRefresh(28 * 60)
 {
 
 }
 
 const bool CIMAPClient::CleanupSession()
 {
+   if (m_oSession.IsOpen())
+      m_oSession.Logout();
+
    m_pstrText = nullptr;
+   m_pMIMESplitter = nullptr;
+   m_pSink = nullptr;
    return CMailClient::CleanupSession();
 }
 
@@ -55,24 +77,49 @@ const bool CIMAPClient::SendFile(const std::string& strPath)
    return Perform();
 }
 
-const bool CIMAPClient::GetString(const std::string& strMsgNumber, std::string& strOutput)
+const bool CIMAPClient::GetString(const std::string& strMsgNumber, std::string& strOutput,
+                                 const unsigned long long uExpectedSize /* = 0 */)
 {
    m_strMsgNumber = strMsgNumber;
    m_pstrText = &strOutput;
+   m_uExpectedSize = uExpectedSize;
    m_eOperationType = IMAP_RETR_STRING;
 
    return Perform();
 }
 
-const bool CIMAPClient::GetFile(const std::string& strMsgNumber, const std::string& strFilePath)
+const bool CIMAPClient::GetString(const std::string& strMsgNumber, CMailSink& oSink)
+{
+   m_strMsgNumber = strMsgNumber;
+   m_pSink = &oSink;
+   m_eOperationType = IMAP_RETR_SINK;
+
+   const bool bResult = Perform();
+   m_pSink = nullptr;
+   oSink.OnComplete(bResult);
+   return bResult;
+}
+
+const bool CIMAPClient::GetFile(const std::string& strMsgNumber, const std::string& strFilePath,
+                               const unsigned long long uExpectedSize /* = 0 */)
 {
    m_strMsgNumber = strMsgNumber;
    m_strLocalFile = strFilePath;
+   m_uExpectedSize = uExpectedSize;
    m_eOperationType = IMAP_RETR_FILE;
 
    return Perform();
 }
 
+const bool CIMAPClient::GetMIMEParts(const std::string& strMsgNumber, CMIMESplitter& oSplitter)
+{
+   m_strMsgNumber = strMsgNumber;
+   m_pMIMESplitter = &oSplitter;
+   m_eOperationType = IMAP_RETR_MIME;
+
+   return Perform();
+}
+
 const bool CIMAPClient::DeleteFolder(const std::string& strFolderName)
 {
    m_strFolderName = strFolderName;
@@ -123,6 +170,141 @@ const bool CIMAPClient::Search(std::string& strRes, SearchOption eSearchOption)
    return Perform();
 }
 
+const bool CIMAPClient::Search(CUIDBitmap& oUIDs, SearchOption eSearchOption /* = SearchOption::NEW */)
+{
+   const char* pszKey = GetSearchKey(eSearchOption);
+   if (pszKey == nullptr)
+      return false;
+
+   return Search(oUIDs, pszKey);
+}
+
+/**
+* @brief sends a UID SEARCH and adds the UIDs found to a bitmap
+*
+* libcurl rejects response lines longer than its buffer, and the SEARCH
+* response of a large folder is a single line of several MB : the native
+* session is used, and the numbers are scanned straight into the bitmap.
+*
+* @param [out] oUIDs UIDs of the e-mails matching the criteria
+* @param [in] strCriteria search criteria, e.g. "UNSEEN SINCE 1-Feb-2024"
+*
+* @retval true   Successfully searched.
+* @retval false  The search failed.
+*/
+const bool CIMAPClient::Search(CUIDBitmap& oUIDs, const std::string& strCriteria)
+{
+   oUIDs.Clear();
+
+   if (GetSession() == nullptr)
+      return false;
+
+   if (!m_oSession.EnsureSelected(m_strMailbox))
+      return false;
+
+   CSearchResultParser oParser(oUIDs);
+   std::string strStatus;
+   if (!m_oSession.Execute("UID SEARCH " + strCriteria, [&oParser](const CStringView& Response)
+                           {
+                              oParser.Write("* ", 2);
+                              oParser.Write(Response.data(), Response.size());
+                              oParser.Write("\r\n", 2);
+                           }, strStatus))
+      return false;
+   oParser.Finish();
+
+   if (strStatus.compare(0, 2, "OK") != 0)
+   {
+      if (m_eSettingsFlags & ENABLE_LOG)
+         m_oLog("[IMAPClient][Error] UID SEARCH failed : " + strStatus);
+
+      return false;
+   }
+   return true;
+}
+
+/**
+* @brief searches with criteria built by CSearchCriteria
+*
+* With ESEARCH (RFC 4731) the search is sent with RETURN : the server only
+* sends what was asked, and the UIDs as a sequence set, e.g. "1:90000"
+* rather than 90000 numbers. Without it the UIDs are searched and the count,
+* the smallest and the largest UID are computed from them.
+*
+* @param [out] Result what was asked by uReturn, the rest is left to 0
+* @param [in] Criteria search criteria
+* @param [in] uReturn ImapSearchResult::RETURN_MIN, RETURN_MAX, RETURN_COUNT and/or RETURN_ALL
+*
+* @retval true   Successfully searched.
+* @retval false  The criteria are invalid or the search failed.
+*/
+const bool CIMAPClient::Search(ImapSearchResult& Result, const CSearchCriteria& Criteria,
+                               const unsigned uReturn /* = ImapSearchResult::RETURN_ALL */)
+{
+   Result.Clear();
+
+   if (!Criteria.IsValid())
+   {
+      if (m_eSettingsFlags & ENABLE_LOG)
+         m_oLog("[IMAPClient][Error] Invalid search criteria.");
+
+      return false;
+   }
+
+   if (GetSession() == nullptr)
+      return false;
+
+   const std::string strCriteria = (Criteria.IsUtf8() ? "CHARSET UTF-8 " : "") + Criteria.ToString();
+
+   if (!m_oSession.HasCapability("ESEARCH"))
+   {
+      if (!Search(Result.oUIDs, strCriteria))
+         return false;
+
+      Result.uCount = (uReturn & ImapSearchResult::RETURN_COUNT) ? Result.oUIDs.GetCount() : 0;
+      Result.uMin = (uReturn & ImapSearchResult::RETURN_MIN) ? Result.oUIDs.GetMin() : 0;
+      Result.uMax = (uReturn & ImapSearchResult::RETURN_MAX) ? Result.oUIDs.GetMax() : 0;
+      if (!(uReturn & ImapSearchResult::RETURN_ALL))
+         Result.oUIDs.Clear();
+      return true;
+   }
+
+   std::string strReturn;
+   if (uReturn & ImapSearchResult::RETURN_MIN)
+      strReturn += " MIN";
+   if (uReturn & ImapSearchResult::RETURN_MAX)
+      strReturn += " MAX";
+   if (uReturn & ImapSearchResult::RETURN_COUNT)
+      strReturn += " COUNT";
+   if (uReturn & ImapSearchResult::RETURN_ALL)
+      strReturn += " ALL";
+   if (!strReturn.empty())
+      strReturn.erase(0, 1);
+
+   if (!m_oSession.EnsureSelected(m_strMailbox))
+      return false;
+
+   bool bValid = true;
+   std::string strStatus;
+   if (!m_oSession.Execute("UID SEARCH RETURN (" + strReturn + ") " + strCriteria,
+                           [&Result, &bValid](const CStringView& Response)
+                           {
+                              if (Response.substr(0, 7).EqualsNoCase("ESEARCH")
+                                  && !CSearchResultParser::ParseExtended(Response, Result))
+                                 bValid = false;
+                           }, strStatus))
+      return false;
+
+   if (strStatus.compare(0, 2, "OK") != 0 || !bValid)
+   {
+      if (m_eSettingsFlags & ENABLE_LOG)
+         m_oLog("[IMAPClient][Error] UID SEARCH failed : " + strStatus);
+
+      return false;
+   }
+   return true;
+}
+
 const bool CIMAPClient::InfoFolder(std::string& strFolderName, std::string& strInfo)
 {
    m_strFolderName = strFolderName;
@@ -132,6 +314,577 @@ const bool CIMAPClient::InfoFolder(std::string& strFolderName, std::string& strI
    return Perform();
 }
 
+const bool CIMAPClient::GetBodyStructure(const std::string& strFolder, const uint32_t uUID,
+                                         CBodyStructure& oStructure)
+{
+   oStructure.Clear();
+
+   CUIDBitmap oUIDs;
+   oUIDs.Add(uUID);
+
+   bool bFound = false;
+   bool bParsed = false;
+   if (!FetchMany(strFolder, oUIDs, [&](const ImapFetchMessage& Message)
+                  {
+                     CImapSession::ParseFetchItems(Message.Items, [&](const CStringView& Name, const CStringView& Value)
+                                                   {
+                                                      if (!Name.EqualsNoCase("BODYSTRUCTURE"))
+                                                         return true;
+
+                                                      bFound = true;
+                                                      bParsed = oStructure.Parse(Value);
+                                                      return false;
+                                                   });
+                     return true;
+                  }, "(BODYSTRUCTURE)"))
+      return false;
+
+   if (!bParsed)
+   {
+      if (m_eSettingsFlags & ENABLE_LOG)
+         m_oLog(bFound ? "[IMAPClient][Error] Invalid BODYSTRUCTURE of message " + std::to_string(uUID) + "."
+                       : "[IMAPClient][Error] Message " + std::to_string(uUID) + " not found.");
+
+      return false;
+   }
+   return true;
+}
+
+/**
+* @brief retrieves a single section of an e-mail, or a range of it, instead
+* of the whole e-mail
+*
+* BODY.PEEK is used so the e-mail isn't marked as seen.
+*
+* @param [in] strFolder folder of the e-mail
+* @param [in] uUID UID of the e-mail
+* @param [in] strSection section, e.g. a part number given by GetBodyStructure
+* @param [out] strOutput encoded content of the section
+* @param [in] uOffset first byte to retrieve when uLength isn't 0
+* @param [in] uLength number of bytes to retrieve, 0 for the whole section
+*
+* @retval true   The section was retrieved.
+* @retval false  The e-mail or the section doesn't exist, or the fetch failed.
+*/
+const bool CIMAPClient::GetSection(const std::string& strFolder, const uint32_t uUID, const std::string& strSection,
+                                   std::string& strOutput, const unsigned long long uOffset /* = 0 */,
+                                   const unsigned long long uLength /* = 0 */)
+{
+   strOutput.clear();
+
+   CUIDBitmap oUIDs;
+   oUIDs.Add(uUID);
+
+   std::string strItems = "(BODY.PEEK[" + strSection + "]";
+   if (uLength > 0)
+      strItems += "<" + std::to_string(uOffset) + "." + std::to_string(uLength) + ">";
+   strItems += ")";
+
+   bool bFound = false;
+   if (!FetchMany(strFolder, oUIDs, [&](const ImapFetchMessage& Message)
+                  {
+                     if (Message.Data.data() == nullptr)
+                        return true;
+
+                     strOutput.assign(Message.Data.data(), Message.Data.size());
+                     bFound = true;
+                     return true;
+                  }, strItems))
+      return false;
+
+   if (!bFound)
+   {
+      if (m_eSettingsFlags & ENABLE_LOG)
+         m_oLog("[IMAPClient][Error] Section " + strSection + " of message " + std::to_string(uUID) + " not found.");
+
+      return false;
+   }
+   return true;
+}
+
+/**
+* @brief retrieves a text part and converts it to UTF-8
+*
+* Only the part is downloaded, a preview pane can show an e-mail with large
+* attachments after a few KB. The decoders accept a truncated input, so
+* uMaxSize may cut a base64 or quoted-printable part anywhere.
+*
+* @param [in] strFolder folder of the e-mail
+* @param [in] uUID UID of the e-mail
+* @param [in] oPart part given by GetBodyStructure (e.g. FindText)
+* @param [out] strOutput UTF-8 text
+* @param [in] uMaxSize maximum number of encoded bytes to retrieve, 0 for the whole part
+*/
+const bool CIMAPClient::GetPartText(const std::string& strFolder, const uint32_t uUID,
+                                    const CBodyStructure::Part& oPart, std::string& strOutput,
+                                    const unsigned long long uMaxSize /* = 0 */)
+{
+   strOutput.clear();
+
+   std::string strEncoded;
+   if (!GetSection(strFolder, uUID, oPart.strPartId, strEncoded, 0,
+                   (uMaxSize > 0 && uMaxSize < oPart.uSize) ? uMaxSize : 0))
+      return false;
+
+   std::string strDecoded;
+   if (oPart.strEncoding == "base64")
+   {
+      CMailCodec::Base64Decoder oDecoder;
+      strDecoded.resize(strEncoded.size() + 2);
+      strDecoded.resize(oDecoder.Decode(strEncoded.data(), strEncoded.size(), &strDecoded[0]));
+   }
+   else if (oPart.strEncoding == "quoted-printable")
+   {
+      CMailCodec::QuotedPrintableDecoder oDecoder;
+      strDecoded.resize(strEncoded.size() + 3);
+      size_t uSize = oDecoder.Decode(strEncoded.data(), strEncoded.size(), &strDecoded[0]);
+      uSize += oDecoder.Finish(&strDecoded[uSize]);
+      strDecoded.resize(uSize);
+   }
+   else
+      strDecoded.swap(strEncoded);
+
+   if (oPart.strCharset.empty())
+   {
+      // undeclared charset : UTF-8 if it's valid, Windows-1252 (superset of US-ASCII) otherwise
+      return CCharset::ToUTF8(CCharset::IsValidUTF8(strDecoded.data(), strDecoded.size()) ? "utf-8" : "windows-1252",
+                              strDecoded.data(), strDecoded.size(), strOutput);
+   }
+
+   if (!CCharset::ToUTF8(oPart.strCharset, strDecoded.data(), strDecoded.size(), strOutput))
+   {
+      strOutput.swap(strDecoded);
+      return false;
+   }
+   return true;
+}
+
+CImapSession* CIMAPClient::GetSession()
+{
+   if (m_oSession.IsOpen())
+      return &m_oSession;
+
+   if (!OpenConnection(m_oSession.GetConnection()) || !m_oSession.Start())
+   {
+      if (m_eSettingsFlags & ENABLE_LOG)
+         m_oLog("[IMAPClient][Error] Unable to open the IMAP session.");
+
+      m_oSession.Close();
+      return nullptr;
+   }
+   return &m_oSession;
+}
+
+/**
+* @brief retrieves many e-mails without a round trip per message
+*
+* GetString performs a transfer (and a round trip) per message. Here the UIDs
+* are sent as a compressed sequence set in a single UID FETCH (split in
+* several commands if the set is very long) and each message is handed to
+* fnMessage once its response, literal included, is complete : only one
+* message at a time is held in memory.
+*
+* @param [in] strFolder folder of the messages, selected if it isn't already
+* @param [in] oUIDs UIDs of the messages
+* @param [in] fnMessage receives the messages as they arrive
+* @param [in] strItems data items to fetch, e.g. "(BODY.PEEK[] FLAGS)"
+*
+* @retval true   Every FETCH completed and fnMessage accepted every message.
+* @retval false  A command failed or fnMessage returned false.
+*/
+const bool CIMAPClient::FetchMany(const std::string& strFolder, const CUIDBitmap& oUIDs,
+                                  const FetchFnCallback& fnMessage, const std::string& strItems /* = "(BODY.PEEK[])" */)
+{
+   bool bContinue = true;
+   const CImapSession::UntaggedFnCallback fnUntagged = [&](const CStringView& Response)
+   {
+      // "<sequence number> FETCH (...)"
+      size_t uPos = 0;
+      unsigned long uSeqNumber = 0;
+      while (uPos < Response.size() && Response[uPos] >= '0' && Response[uPos] <= '9')
+         uSeqNumber = uSeqNumber * 10 + (Response[uPos++] - '0');
+
+      if (!bContinue || uPos == 0 || !Response.substr(uPos, 7).EqualsNoCase(" FETCH "))
+         return;
+
+      ImapFetchMessage Message;
+      Message.uUID = 0;
+      Message.uSeqNumber = uSeqNumber;
+      Message.Items = Response.substr(uPos + 7);
+      bool bData = false;
+      CImapSession::ParseFetchItems(Message.Items, [&](const CStringView& Name, const CStringView& Value)
+                                    {
+                                       if (Name.EqualsNoCase("UID"))
+                                          Message.uUID = static_cast<uint32_t>(strtoul(Value.ToString().c_str(), nullptr, 10));
+                                       else if (!bData && (Name.substr(0, 5).EqualsNoCase("BODY[")
+                                                           || Name.substr(0, 7).EqualsNoCase("BINARY[")
+                                                           || Name.substr(0, 6).EqualsNoCase("RFC822")))
+                                       {
+                                          // first content item, RFC822.SIZE is a number
+                                          if (!Name.EqualsNoCase("RFC822.SIZE"))
+                                          {
+                                             Message.Data = Value;
+                                             bData = true;
+                                          }
+                                       }
+                                       return true;
+                                    });
+
+      // unsolicited FETCH (e.g. a flag change made by another client) have no UID
+      if (Message.uUID == 0 || !oUIDs.Contains(Message.uUID))
+         return;
+
+      if (!fnMessage(Message))
+         bContinue = false;
+   };
+
+   if (!ExecuteOnSet(strFolder, "FETCH", oUIDs, strItems, fnUntagged, [&bContinue]() { return !bContinue; }))
+      return false;
+
+   return bContinue;
+}
+
+const bool CIMAPClient::StoreFlags(const std::string& strFolder, const CUIDBitmap& oUIDs, const std::string& strFlags,
+                                   const bool bAdd /* = true */)
+{
+   return ExecuteOnSet(strFolder, "STORE", oUIDs, std::string(bAdd ? "+" : "-") + "FLAGS.SILENT (" + strFlags + ")",
+                       nullptr);
+}
+
+const bool CIMAPClient::SetMailProperty(const std::string& strFolder, const CUIDBitmap& oUIDs, MailProperty eProperty,
+                                        const bool bAdd /* = true */)
+{
+   const char* pszFlag = GetFlagName(eProperty);
+   if (pszFlag == nullptr)
+      return false;
+
+   return StoreFlags(strFolder, oUIDs, pszFlag, bAdd);
+}
+
+const bool CIMAPClient::CopyMany(const std::string& strFolder, const CUIDBitmap& oUIDs,
+                                 const std::string& strDestination)
+{
+   return ExecuteOnSet(strFolder, "COPY", oUIDs, CImapSession::Quote(strDestination), nullptr);
+}
+
+/**
+* @brief moves a set of e-mails to another folder
+*
+* With MOVE (RFC 6851) each chunk of the set is moved atomically. Otherwise
+* the e-mails are copied, flagged as deleted and expunged : with UIDPLUS only
+* the UIDs of the set are expunged, without it a plain EXPUNGE also removes
+* the other e-mails of the folder already flagged as deleted.
+*
+* @param [in] strFolder folder of the e-mails, selected if it isn't already
+* @param [in] oUIDs UIDs of the e-mails
+* @param [in] strDestination folder receiving the e-mails
+*
+* @retval true   Successfully moved.
+* @retval false  A command failed, the e-mails copied before are kept in both folders.
+*/
+const bool CIMAPClient::MoveMany(const std::string& strFolder, const CUIDBitmap& oUIDs,
+                                 const std::string& strDestination)
+{
+   if (oUIDs.IsEmpty())
+      return true;
+
+   if (GetSession() == nullptr)
+      return false;
+
+   if (m_oSession.HasCapability("MOVE"))
+      return ExecuteOnSet(strFolder, "MOVE", oUIDs, CImapSession::Quote(strDestination), nullptr);
+
+   if (!CopyMany(strFolder, oUIDs, strDestination) || !StoreFlags(strFolder, oUIDs, "\\Deleted"))
+      return false;
+
+   if (m_oSession.HasCapability("UIDPLUS"))
+      return ExpungeMany(strFolder, oUIDs);
+
+   std::string strStatus;
+   if (!m_oSession.Execute("EXPUNGE", nullptr, strStatus))
+      return false;
+
+   if (strStatus.compare(0, 2, "OK") != 0)
+   {
+      if (m_eSettingsFlags & ENABLE_LOG)
+         m_oLog("[IMAPClient][Error] EXPUNGE failed : " + strStatus);
+
+      return false;
+   }
+   return true;
+}
+
+const bool CIMAPClient::ExpungeMany(const std::string& strFolder, const CUIDBitmap& oUIDs)
+{
+   if (oUIDs.IsEmpty())
+      return true;
+
+   if (GetSession() == nullptr)
+      return false;
+
+   if (!m_oSession.HasCapability("UIDPLUS"))
+   {
+      if (m_eSettingsFlags & ENABLE_LOG)
+         m_oLog("[IMAPClient][Error] The server doesn't support UID EXPUNGE (UIDPLUS).");
+
+      return false;
+   }
+
+   return ExecuteOnSet(strFolder, "EXPUNGE", oUIDs, std::string(), nullptr);
+}
+
+/**
+* @brief uploads many e-mails to a folder
+*
+* Appending one e-mail per request costs a round trip per e-mail, two
+* without LITERAL+. Here the e-mails are grouped in MULTIAPPEND commands of
+* up to 8 MB (a command is atomic : a refused e-mail cancels its command), or
+* sent in an APPEND each without waiting for the completion of the previous
+* ones. At most 16 commands are in flight.
+*
+* @param [in] strFolder folder receiving the e-mails, it doesn't need to be selected
+* @param [in] vecMessages the e-mails with their flags and internal date
+*
+* @retval true   Every e-mail was appended.
+* @retval false  A command failed, the e-mails of the other commands may have been appended.
+*/
+const bool CIMAPClient::AppendMany(const std::string& strFolder, const std::vector<ImapAppendMessage>& vecMessages)
+{
+   static const size_t MAX_BATCH_SIZE = 8 * 1024 * 1024;
+   static const size_t MAX_PENDING = 16;
+
+   if (vecMessages.empty())
+      return true;
+
+   if (GetSession() == nullptr)
+      return false;
+
+   const bool bMultiAppend = m_oSession.HasCapability("MULTIAPPEND");
+   const bool bNonSync = m_oSession.HasCapability("LITERAL+");
+
+   std::deque<std::string> dqPending;
+   const auto WaitOldest = [&]()
+   {
+      std::string strStatus;
+      const std::string strTag = dqPending.front();
+      dqPending.pop_front();
+      if (!m_oSession.WaitCompletion(strTag, nullptr, strStatus))
+         return false;
+
+      if (strStatus.compare(0, 2, "OK") != 0)
+      {
+         if (m_eSettingsFlags & ENABLE_LOG)
+            m_oLog("[IMAPClient][Error] APPEND failed : " + strStatus);
+
+         return false;
+      }
+      return true;
+   };
+
+   bool bResult = true;
+   std::vector<std::string> vecTexts;
+   std::vector<CStringView> vecLiterals;
+   for (size_t uNext = 0; uNext < vecMessages.size() && bResult; )
+   {
+      // APPEND "folder" (flags) "date" {n}<e-mail> (flags) "date" {n}<e-mail> ...
+      vecTexts.assign(1, "APPEND " + CImapSession::Quote(strFolder));
+      vecLiterals.clear();
+      size_t uBatchSize = 0;
+      do
+      {
+         const ImapAppendMessage& Message = vecMessages[uNext++];
+         if (!Message.strFlags.empty())
+            vecTexts.back() += " (" + Message.strFlags + ")";
+         if (Message.tInternalDate != 0)
+            vecTexts.back() += " \"" + FormatInternalDate(Message.tInternalDate) + "\"";
+         vecTexts.back() += " ";
+
+         vecLiterals.push_back(Message.Data);
+         vecTexts.emplace_back();
+         uBatchSize += Message.Data.size();
+      }
+      while (bMultiAppend && uNext < vecMessages.size()
+             && uBatchSize + vecMessages[uNext].Data.size() <= MAX_BATCH_SIZE);
+
+      std::string strStatus;
+      const std::string strTag = m_oSession.SendLiterals(vecTexts, vecLiterals, bNonSync, strStatus);
+      if (strTag.empty())
+      {
+         if ((m_eSettingsFlags & ENABLE_LOG) && !strStatus.empty())
+            m_oLog("[IMAPClient][Error] APPEND refused : " + strStatus);
+
+         bResult = false;
+         break;
+      }
+
+      dqPending.push_back(strTag);
+      if (dqPending.size() >= MAX_PENDING)
+         bResult = WaitOldest();
+   }
+
+   // the completions of the commands in flight are read even after a failure
+   while (!dqPending.empty() && m_oSession.IsOpen())
+   {
+      if (!WaitOldest())
+         bResult = false;
+   }
+   return bResult && dqPending.empty();
+}
+
+/**
+* @brief runs a UID command over a set of e-mails
+*
+* The set is compressed (e.g. "1:500,720,900:1200") and sent in a single
+* command. Servers limit the length of a command line, a longer set is split
+* at a comma and sent in several commands.
+*
+* @param [in] strFolder folder of the e-mails, selected if it isn't already
+* @param [in] strCommand command following "UID", e.g. "STORE"
+* @param [in] oUIDs UIDs of the e-mails
+* @param [in] strArguments appended after the set, may be empty
+* @param [in] fnUntagged receives the untagged responses, may be nullptr
+* @param [in] fnStop checked before each command, returns true to skip the remaining ones
+*
+* @retval true   Every command completed (or the set is empty).
+* @retval false  The connection failed or a command was refused.
+*/
+const bool CIMAPClient::ExecuteOnSet(const std::string& strFolder, const std::string& strCommand,
+                                     const CUIDBitmap& oUIDs, const std::string& strArguments,
+                                     const CImapSession::UntaggedFnCallback& fnUntagged,
+                                     const CImapSession::StopFnCallback& fnStop /* = nullptr */)
+{
+   // servers limit the length of a command line (8 KB is a safe bet)
+   static const size_t MAX_SET_LENGTH = 7 * 1024;
+
+   if (oUIDs.IsEmpty())
+      return true;
+
+   if (GetSession() == nullptr)
+      return false;
+
+   if (!m_oSession.EnsureSelected(strFolder))
+      return false;
+
+   std::string strSet;
+   oUIDs.ToSequenceSet(strSet);
+
+   for (size_t uStart = 0; uStart < strSet.size() && !(fnStop && fnStop()); )
+   {
+      size_t uEnd = strSet.size();
+      if (uEnd - uStart > MAX_SET_LENGTH)
+         uEnd = strSet.rfind(',', uStart + MAX_SET_LENGTH);
+
+      std::string strLine = "UID " + strCommand + " " + strSet.substr(uStart, uEnd - uStart);
+      if (!strArguments.empty())
+         strLine += " " + strArguments;
+
+      std::string strStatus;
+      if (!m_oSession.Execute(strLine, fnUntagged, strStatus))
+         return false;
+
+      if (strStatus.compare(0, 2, "OK") != 0)
+      {
+         if (m_eSettingsFlags & ENABLE_LOG)
+            m_oLog("[IMAPClient][Error] UID " + strCommand + " failed : " + strStatus);
+
+         return false;
+      }
+      uStart = uEnd + 1;
+   }
+
+   return true;
+}
+
+/**
+* @brief waits for changes in a folder with IDLE (RFC 2177)
+*
+* Instead of polling with Search or Noop, the folder is examined on a
+* dedicated connection and the server pushes EXISTS, EXPUNGE and FETCH
+* responses as soon as the folder changes. Once QRESYNC is enabled on the
+* session (CImapSync does), expunges are pushed as VANISHED UIDs instead. The counts reported by EXAMINE are
+* delivered first, so the caller starts from a known state.
+*
+* @param [in] strFolder folder to watch, e.g. "INBOX"
+* @param [in] fnEvent receives the changes, returns false to leave IDLE
+*
+* @retval true   IDLE was left because of fnEvent or StopIdle.
+* @retval false  The server doesn't support or refused IDLE, or the connection failed.
+*/
+const bool CIMAPClient::Idle(const std::string& strFolder, const IdleFnCallback& fnEvent)
+{
+   m_bStopIdle = false;
+
+   if (GetSession() == nullptr)
+      return false;
+
+   if (!m_oSession.HasCapability("IDLE"))
+   {
+      if (m_eSettingsFlags & ENABLE_LOG)
+         m_oLog("[IMAPClient][Error] The server doesn't support IDLE.");
+
+      return false;
+   }
+
+   bool bContinue = true;
+   const CImapSession::UntaggedFnCallback fnUntagged = [&](const CStringView& Response)
+   {
+      ImapIdleEvent Event;
+      if (bContinue && ParseIdleEvent(Response, Event) && !fnEvent(Event))
+         bContinue = false;
+   };
+
+   if (!m_oSession.Select(strFolder, true, fnUntagged))
+      return false;
+
+   return m_oSession.Idle(fnUntagged, m_uIdleRefresh, [&]() { return !bContinue || m_bStopIdle; });
+}
+
+const bool CIMAPClient::ParseIdleEvent(const CStringView& Response, ImapIdleEvent& Event)
+{
+   // with QRESYNC the expunges are reported as "VANISHED <UIDs>" (or "VANISHED (EARLIER) <UIDs>")
+   if (Response.substr(0, 9).EqualsNoCase("VANISHED "))
+   {
+      CStringView Set = Response.substr(9);
+      if (Set.substr(0, 10).EqualsNoCase("(EARLIER) "))
+         Set = Set.substr(10);
+
+      Event.eType = ImapIdleEvent::VANISHED;
+      Event.oUIDs.Clear();
+      if (!Event.oUIDs.AddSequenceSet(Set))
+         return false;
+
+      Event.uNumber = static_cast<unsigned long>(Event.oUIDs.GetCount());
+      return true;
+   }
+
+   // "<number> EXISTS", "<number> EXPUNGE", "<number> RECENT" or "<number> FETCH (...)"
+   size_t uPos = 0;
+   unsigned long uNumber = 0;
+   while (uPos < Response.size() && Response[uPos] >= '0' && Response[uPos] <= '9')
+      uNumber = uNumber * 10 + (Response[uPos++] - '0');
+
+   if (uPos == 0 || uPos >= Response.size() || Response[uPos] != ' ')
+      return false;
+
+   const CStringView Keyword = Response.substr(uPos + 1, Response.find(' ', uPos + 1) - uPos - 1);
+   if (Keyword.EqualsNoCase("EXISTS"))
+      Event.eType = ImapIdleEvent::EXISTS;
+   else if (Keyword.EqualsNoCase("EXPUNGE"))
+      Event.eType = ImapIdleEvent::EXPUNGE;
+   else if (Keyword.EqualsNoCase("RECENT"))
+      Event.eType = ImapIdleEvent::RECENT;
+   else if (Keyword.EqualsNoCase("FETCH"))
+   {
+      Event.eType = ImapIdleEvent::FETCH;
+      Event.strData = Response.substr(uPos + 1).ToString();
+   }
+   else
+      return false;
+
+   Event.uNumber = uNumber;
+   return true;
+}
+
 void CIMAPClient::ParseURL(std::string& strURL)
 {
    std::string strTmp = strURL;
@@ -156,6 +909,70 @@ void CIMAPClient::ParseURL(std::string& strURL)
 
 }
 
+const char* CIMAPClient::GetSearchKey(const SearchOption eSearchOption)
+{
+   switch (eSearchOption)
+   {
+      case SearchOption::ANSWERED: return "ANSWERED";
+      case SearchOption::DELETED:  return "DELETED";
+      case SearchOption::DRAFT:    return "DRAFT";
+      case SearchOption::FLAGGED:  return "FLAGGED";
+      case SearchOption::NEW:      return "NEW";
+      case SearchOption::RECENT:   return "RECENT";
+      case SearchOption::SEEN:     return "SEEN";
+   }
+   return nullptr;
+}
+
+const char* CIMAPClient::GetFlagName(const MailProperty eProperty)
+{
+   switch (eProperty)
+   {
+      case MailProperty::Deleted:  return "\\Deleted";
+      case MailProperty::Seen:     return "\\Seen";
+      case MailProperty::Answered: return "\\Answered";
+      case MailProperty::Flagged:  return "\\Flagged";
+      case MailProperty::Draft:    return "\\Draft";
+      case MailProperty::Recent:   return "\\Recent";
+   }
+   return nullptr;
+}
+
+std::string CIMAPClient::FormatInternalDate(const time_t tDate)
+{
+   static const char* const MONTHS[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                         "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+   struct tm Time;
+#ifdef _MSC_VER
+   gmtime_s(&Time, &tDate);
+#else
+   gmtime_r(&tDate, &Time);
+#endif
+
+   // the day is padded with a space (RFC 3501 date-day-fixed)
+   char szDate[32];
+   snprintf(szDate, sizeof(szDate), "%2d-%s-%04d %02d:%02d:%02d +0000", Time.tm_mday, MONTHS[Time.tm_mon],
+            Time.tm_year + 1900, Time.tm_hour, Time.tm_min, Time.tm_sec);
+   return szDate;
+}
+
+/**
+* @brief current mailbox as a path of the request URL : the characters that
+* would end the path (e.g. ';', '?', '#') or aren't allowed in a URL are
+* percent-encoded, libcurl decodes them before sending the mailbox name
+*/
+std::string CIMAPClient::GetMailboxPath() const
+{
+   char* pszEscaped = curl_easy_escape(m_pCurlSession, m_strMailbox.c_str(), static_cast<int>(m_strMailbox.size()));
+   if (pszEscaped == nullptr)
+      return m_strMailbox;
+
+   const std::string strPath(pszEscaped);
+   curl_free(pszEscaped);
+   return strPath;
+}
+
 /**
 * @brief configures the curl session according to requested
 * IMAp operation.
@@ -177,10 +994,8 @@ const bool CIMAPClient::PrePerform()
    switch (m_eOperationType)
    {
       case IMAP_SEND_STRING:
-         /* This will create a new message 100. Note that you should perform an
-         * EXAMINE command to obtain the UID of the next message to create and a
-         * SELECT to ensure you are creating the message in the OUTBOX. */
-         strRequestURL += m_strMsgNumber;
+         /* the message is appended to the mailbox named in the URL */
+         strRequestURL += GetMailboxPath();
          m_ssString.str(m_strMail);
          
          /* LF will be replaced by CRLF when sending the mail.
@@ -197,6 +1012,8 @@ const bool CIMAPClient::PrePerform()
       case IMAP_SEND_FILE:
          if (!m_strLocalFile.empty())
          {
+            strRequestURL += GetMailboxPath();
+
             // Request file size
             /*struct stat file_info;
             if (stat(m_strLocalFile.c_str(), &file_info))
@@ -277,13 +1094,17 @@ const bool CIMAPClient::PrePerform()
 
       case IMAP_RETR_STRING:
          if (!m_strMsgNumber.empty())
-            strRequestURL += "INBOX/;UID=" + m_strMsgNumber;
+            strRequestURL += GetMailboxPath() + "/;UID=" + m_strMsgNumber;
          else
             return false;
 
          /* This will retrieve message 'm_strMsgNumber' from the user's mailbox */
          if (m_pstrText != nullptr)
          {
+            /* a single allocation instead of growing by doubling */
+            if (m_uExpectedSize > 0)
+               m_pstrText->reserve(m_pstrText->size() + static_cast<size_t>(m_uExpectedSize));
+
             curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEFUNCTION, &CMailClient::WriteInStringCallback);
             curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEDATA, m_pstrText);
          }
@@ -291,17 +1112,27 @@ const bool CIMAPClient::PrePerform()
             return false;
          break;
 
+      case IMAP_RETR_SINK:
+         if (!m_strMsgNumber.empty() && m_pSink != nullptr)
+            strRequestURL += GetMailboxPath() + "/;UID=" + m_strMsgNumber;
+         else
+            return false;
+
+         /* the chunks are handed over as they are received, nothing is buffered */
+         curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEFUNCTION, &CMailSink::WriteCallback);
+         curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEDATA, m_pSink);
+         break;
+
       case IMAP_RETR_FILE:
          if (!m_strMsgNumber.empty())
-            strRequestURL += "INBOX/;UID=" + m_strMsgNumber;
+            strRequestURL += GetMailboxPath() + "/;UID=" + m_strMsgNumber;
          else
             return false;
 
-         m_fLocalFile.open(m_strLocalFile, std::fstream::out | std::fstream::binary | std::fstream::trunc);
-         if (m_fLocalFile)
+         if (OpenLocalFile(m_uExpectedSize))
          {
-            curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEFUNCTION, &CMailClient::WriteToFileCallback);
-            curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEDATA, &m_fLocalFile);
+            curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEFUNCTION, &CMailClient::WriteToLocalFileCallback);
+            curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEDATA, this);
          }
          else
          {
@@ -313,6 +1144,18 @@ const bool CIMAPClient::PrePerform()
          }
          break;
 
+      case IMAP_RETR_MIME:
+         if (!m_strMsgNumber.empty() && m_pMIMESplitter != nullptr)
+            strRequestURL += GetMailboxPath() + "/;UID=" + m_strMsgNumber;
+         else
+            return false;
+
+         /* parts are decoded and written to disk as the e-mail is received */
+         m_pMIMESplitter->Reset();
+         curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEFUNCTION, &CMIMESplitter::WriteCallback);
+         curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEDATA, m_pMIMESplitter);
+         break;
+
       case IMAP_INFO_FOLDER:
          if (m_pstrText != nullptr)
          {
@@ -345,7 +1188,7 @@ const bool CIMAPClient::PrePerform()
       case IMAP_COPY:
          if (!m_strMsgNumber.empty() && !m_strFolderName.empty())
          {
-            strRequestURL += "INBOX";
+            strRequestURL += GetMailboxPath();
             /* Set the COPY command specifing the message ID and destination folder */
             curl_easy_setopt(m_pCurlSession, CURLOPT_CUSTOMREQUEST,
                ("COPY "+ m_strMsgNumber + " " + m_strFolderName).c_str());
@@ -379,22 +1222,10 @@ const bool CIMAPClient::PrePerform()
          else
             return false;
 
-         strRequestURL += "INBOX";
-
-         if (m_eSearchOption == SearchOption::ANSWERED)
-            strCmd = "ANSWERED";
-         else if (m_eSearchOption == SearchOption::DELETED)
-            strCmd = "DELETED";
-         else if (m_eSearchOption == SearchOption::DRAFT)
-            strCmd = "DRAFT";
-         else if (m_eSearchOption == SearchOption::FLAGGED)
-            strCmd = "FLAGGED";
-         else if (m_eSearchOption == SearchOption::NEW)
-            strCmd = "NEW";
-         else if (m_eSearchOption == SearchOption::RECENT)
-            strCmd = "RECENT";
-         else if (m_eSearchOption == SearchOption::SEEN)
-            strCmd = "SEEN";
+         strRequestURL += GetMailboxPath();
+
+         if (GetSearchKey(m_eSearchOption) != nullptr)
+            strCmd = GetSearchKey(m_eSearchOption);
          else
          {
             return false;
@@ -412,28 +1243,18 @@ const bool CIMAPClient::PrePerform()
       case IMAP_STORE:
          if (!m_strMsgNumber.empty())
          {
-            if (m_eMailProperty == MailProperty::Deleted)
-               strCmd = "Deleted";
-            else if (m_eMailProperty == MailProperty::Seen)
-               strCmd = "Seen";
-            else if (m_eMailProperty == MailProperty::Answered)
-               strCmd = "Answered";
-            else if (m_eMailProperty == MailProperty::Flagged)
-               strCmd = "Flagged";
-            else if (m_eMailProperty == MailProperty::Draft)
-               strCmd = "Draft";
-            else if (m_eMailProperty == MailProperty::Recent)
-               strCmd = "Recent";
+            if (GetFlagName(m_eMailProperty) != nullptr)
+               strCmd = GetFlagName(m_eMailProperty);
             else
             {
                return false;
             }
 
-            strRequestURL += "INBOX";
+            strRequestURL += GetMailboxPath();
 
             /* Set the STORE command with the Deleted flag for message m_strMsgNumber */
             curl_easy_setopt(m_pCurlSession, CURLOPT_CUSTOMREQUEST,
-               ("STORE " + m_strMsgNumber + " +Flags \\" + strCmd).c_str());
+               ("STORE " + m_strMsgNumber + " +Flags " + strCmd).c_str());
          }
          else
             return false;
@@ -464,12 +1285,23 @@ const bool CIMAPClient::PrePerform()
 const bool CIMAPClient::PostPerform(CURLcode ePerformCode)
 {
    if (m_eOperationType == IMAP_SEND_FILE || m_eOperationType == IMAP_RETR_FILE)
-      if (m_fLocalFile.is_open())
-         m_fLocalFile.close();
+      CloseLocalFile();
+
+   if (m_eOperationType == IMAP_RETR_MIME && m_pMIMESplitter != nullptr)
+   {
+      /* flush the last part, even if the transfer failed */
+      if (!m_pMIMESplitter->Finish())
+      {
+         if (m_eSettingsFlags & ENABLE_LOG)
+            m_oLog("[IMAPClient][Error] Unable to save the MIME parts of the e-mail.");
+
+         return false;
+      }
+   }
 
-   if (m_eOperationType == IMAP_STORE)
+   if (m_eOperationType == IMAP_STORE && m_eMailProperty == MailProperty::Deleted)
    {
-      if (ePerformCode != CURLE_OK)
+      if (ePerformCode == CURLE_OK)
       {
          /* Set the EXPUNGE command, although you can use the CLOSE command if you
          * don't want to know the result of the STORE */
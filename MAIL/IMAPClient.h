@@ -9,7 +9,55 @@
 #ifndef INCLUDE_IMAPCLIENT_H_
 #define INCLUDE_IMAPCLIENT_H_
 
+#include <atomic>
+#include <ctime>
+#include <vector>
+
+#include "BodyStructure.h"
+#include "IMAPSession.h"
+#include "ImapSearch.h"
 #include "MAILClient.h"
+#include "MailSink.h"
+#include "MIMESplitter.h"
+#include "UIDBitmap.h"
+
+/* change reported by the server while a folder is held in IDLE */
+struct ImapIdleEvent
+{
+   enum EventType
+   {
+      EXISTS,     // uNumber is the new message count
+      EXPUNGE,    // uNumber is the sequence number of the removed message
+      RECENT,     // uNumber is the count of recent messages
+      FETCH,      // flags of message uNumber changed, strData holds the response
+      VANISHED    // messages expunged once QRESYNC is enabled (e.g. by CImapSync) :
+                  // oUIDs holds their UIDs, uNumber their count
+   };
+
+   EventType      eType;
+   unsigned long  uNumber;
+   std::string    strData;
+   CUIDBitmap     oUIDs;
+};
+
+/* message returned by a bulk fetch, the views are only valid during the callback */
+struct ImapFetchMessage
+{
+   uint32_t       uUID;
+   unsigned long  uSeqNumber;
+   CStringView    Data;    // first BODY[...], BINARY[...] or RFC822 item, e.g. the message
+   CStringView    Items;   // every data item, e.g. "(UID 4 FLAGS (\Seen) BODY[] {12}...)"
+};
+
+/* e-mail added to a folder by AppendMany, Data must stay valid during the call */
+struct ImapAppendMessage
+{
+   ImapAppendMessage() : tInternalDate(0) {}
+
+   CStringView    Data;            // the e-mail, lines ended by CRLF
+   std::string    strFlags;        // e.g. "\Seen \Flagged", may be empty
+   time_t         tInternalDate;   // e.g. when it was received, 0 for the time of the upload
+};
 
 class CIMAPClient : public CMailClient
 {
@@ -35,6 +83,11 @@ public:
    };
 
 
+   /* returns false to leave IDLE */
+   typedef std::function<bool(const ImapIdleEvent& Event)> IdleFnCallback;
+   /* returns false to ignore the remaining messages */
+   typedef std::function<bool(const ImapFetchMessage& Message)> FetchFnCallback;
+
    explicit CIMAPClient(LogFnCallback oLogger);
 
    // copy constructor and assignment operator are disabled
@@ -55,11 +108,21 @@ public:
    /* send a text file as an e-mail */
    const bool SendFile(const std::string& strPath);
 
-   /* retrieve e-mail and save its content in strOutput */
-   const bool GetString(const std::string& strMsgNumber, std::string& strOutput);
+   /* retrieve e-mail and save its content in strOutput, uExpectedSize (its
+    * RFC822.SIZE) is reserved at once */
+   const bool GetString(const std::string& strMsgNumber, std::string& strOutput,
+                        const unsigned long long uExpectedSize = 0);
 
-   /* retrieve e-mail and save its content in a file */
-   const bool GetFile(const std::string& strMsgNumber, const std::string& strFilePath);
+   /* retrieve e-mail and pass its content to oSink as it arrives */
+   const bool GetString(const std::string& strMsgNumber, CMailSink& oSink);
+
+   /* retrieve e-mail and save its content in a file, its space is preallocated
+    * if uExpectedSize (its RFC822.SIZE) is given */
+   const bool GetFile(const std::string& strMsgNumber, const std::string& strFilePath,
+                      const unsigned long long uExpectedSize = 0);
+
+   /* retrieve e-mail and save each of its MIME parts in a file while downloading it */
+   const bool GetMIMEParts(const std::string& strMsgNumber, CMIMESplitter& oSplitter);
 
    /* delete an existing folder */
    const bool DeleteFolder(const std::string& strMsgNumber);
@@ -78,10 +141,92 @@ public:
    
    /* search for e-mails according to SearchOption */
    const bool Search(std::string& strRes, SearchOption eSearchOption = SearchOption::NEW);
+
+   /* search for e-mails and save their UIDs in oUIDs, the response is parsed
+    * without splitting it in strings. Results can be combined with the set
+    * operations of CUIDBitmap. */
+   const bool Search(CUIDBitmap& oUIDs, SearchOption eSearchOption = SearchOption::NEW);
+   /* same with any search criteria (RFC 3501 section 6.4.4), e.g. "UNSEEN SINCE 1-Feb-2024" */
+   const bool Search(CUIDBitmap& oUIDs, const std::string& strCriteria);
+   /* search with criteria built by CSearchCriteria. uReturn (ImapSearchResult::RETURN_...
+    * flags) tells what to return : with ESEARCH only that is sent by the server,
+    * e.g. a count instead of the UIDs. */
+   const bool Search(ImapSearchResult& Result, const CSearchCriteria& Criteria,
+                     const unsigned uReturn = ImapSearchResult::RETURN_ALL);
       
    /* obtain information about a folder */
    const bool InfoFolder(std::string& strFolderName, std::string& strInfo);
 
+   /* retrieve a set of e-mails with a single UID FETCH (ranges are compressed,
+    * e.g. "1:500,720,900:1200") and pass each one to fnMessage as soon as
+    * it's received. strItems is the list of data items to fetch. */
+   const bool FetchMany(const std::string& strFolder, const CUIDBitmap& oUIDs, const FetchFnCallback& fnMessage,
+                        const std::string& strItems = "(BODY.PEEK[])");
+
+   /* add (or remove if !bAdd) flags to a set of e-mails with a single UID
+    * STORE, e.g. strFlags = "\Seen \Flagged". The server doesn't send the
+    * new flags back (FLAGS.SILENT). */
+   const bool StoreFlags(const std::string& strFolder, const CUIDBitmap& oUIDs, const std::string& strFlags,
+                         const bool bAdd = true);
+   /* same with a MailProperty */
+   const bool SetMailProperty(const std::string& strFolder, const CUIDBitmap& oUIDs, MailProperty eProperty,
+                              const bool bAdd = true);
+
+   /* copy a set of e-mails to strDestination with a single UID COPY */
+   const bool CopyMany(const std::string& strFolder, const CUIDBitmap& oUIDs, const std::string& strDestination);
+
+   /* move a set of e-mails with UID MOVE (RFC 6851), or copy them, flag them
+    * as deleted and expunge them if the server lacks MOVE */
+   const bool MoveMany(const std::string& strFolder, const CUIDBitmap& oUIDs, const std::string& strDestination);
+
+   /* permanently remove the e-mails of the set flagged as deleted, the others
+    * are kept. Needs UIDPLUS (RFC 4315). */
+   const bool ExpungeMany(const std::string& strFolder, const CUIDBitmap& oUIDs);
+
+   /* upload many e-mails to a folder without a round trip per e-mail : with
+    * MULTIAPPEND (RFC 3502) a command carries many of them, otherwise the
+    * APPEND commands are pipelined. With LITERAL+ the e-mails are sent
+    * without waiting for the server to accept each one. */
+   const bool AppendMany(const std::string& strFolder, const std::vector<ImapAppendMessage>& vecMessages);
+
+   /* retrieve the MIME structure of an e-mail without its content */
+   const bool GetBodyStructure(const std::string& strFolder, const uint32_t uUID, CBodyStructure& oStructure);
+
+   /* retrieve a section of an e-mail (e.g. "1.2", "HEADER", "2.MIME") as it's
+    * encoded. If uLength isn't 0, only uLength bytes from uOffset are sent. */
+   const bool GetSection(const std::string& strFolder, const uint32_t uUID, const std::string& strSection,
+                         std::string& strOutput, const unsigned long long uOffset = 0,
+                         const unsigned long long uLength = 0);
+
+   /* retrieve a text part found with GetBodyStructure, decoded and converted
+    * to UTF-8. uMaxSize limits the download (e.g. for a preview), 0 retrieves
+    * the whole part. */
+   const bool GetPartText(const std::string& strFolder, const uint32_t uUID, const CBodyStructure::Part& oPart,
+                          std::string& strOutput, const unsigned long long uMaxSize = 0);
+
+   /* mailbox of the operations not taking one (GetString, GetFile, GetMIMEParts,
+    * SendString, SendFile, CopyMail, SetMailProperty and Search), "INBOX" by
+    * default. Consecutive operations on a mailbox select it only once. */
+   inline void SetMailbox(const std::string& strMailbox) { m_strMailbox = strMailbox; }
+   inline const std::string& GetMailbox() const { return m_strMailbox; }
+
+   /* native session used by Idle and CImapSync, opened (logged in) on first
+    * use and kept until CleanupSession, nullptr if it can't be opened */
+   CImapSession* GetSession();
+
+   /* examine a folder and wait for changes with IDLE instead of polling it,
+    * fnEvent is called as soon as the server reports one. Blocks until
+    * fnEvent returns false or StopIdle is called (returns true), or until
+    * the connection fails or the server lacks or refuses IDLE (returns false) */
+   const bool Idle(const std::string& strFolder, const IdleFnCallback& fnEvent);
+
+   /* may be called from another thread, Idle returns within a second */
+   inline void StopIdle() { m_bStopIdle = true; }
+
+   /* IDLE is re-issued every uSeconds (default 28 minutes, servers may drop
+    * a client idling for more than 30 minutes), 0 is 29 minutes */
+   inline void SetIdleRefresh(const unsigned& uSeconds) { m_uIdleRefresh = uSeconds; }
+
 protected:
    enum MailOperation
    {
@@ -90,7 +235,9 @@ protected:
       IMAP_SEND_STRING,
       IMAP_SEND_FILE,
       IMAP_RETR_FILE,
+      IMAP_RETR_MIME,
       IMAP_RETR_STRING,
+      IMAP_RETR_SINK,
       IMAP_DELETE_FOLDER,
       IMAP_INFO_FOLDER,
       IMAP_LSUB,
@@ -104,6 +251,27 @@ protected:
    const bool PostPerform(CURLcode ePerformCode) override;
    inline void ParseURL(std::string& strURL) override final;
 
+   /* runs "UID <strCommand> <set> <strArguments>" in strFolder, the set is
+    * split in several commands if it's too long for a command line */
+   const bool ExecuteOnSet(const std::string& strFolder, const std::string& strCommand, const CUIDBitmap& oUIDs,
+                           const std::string& strArguments, const CImapSession::UntaggedFnCallback& fnUntagged,
+                           const CImapSession::StopFnCallback& fnStop = nullptr);
+
+   /* internal date of an APPEND, e.g. "17-Jul-2024 09:44:25 +0000" */
+   static std::string FormatInternalDate(const time_t tDate);
+
+   /* flag of a MailProperty (e.g. "\Seen"), nullptr if it's unknown */
+   static const char* GetFlagName(const MailProperty eProperty);
+
+   /* current mailbox, percent-encoded for the request URL */
+   std::string GetMailboxPath() const;
+
+   /* search key of a SearchOption, nullptr if it's unknown */
+   static const char* GetSearchKey(const SearchOption eSearchOption);
+
+   /* turns an untagged response into an event, false if it isn't one */
+   static const bool ParseIdleEvent(const CStringView& Response, ImapIdleEvent& Event);
+
    MailOperation        m_eOperationType;
    MailProperty         m_eMailProperty;
    SearchOption         m_eSearchOption;
@@ -115,6 +283,14 @@ protected:
    std::string          m_strMsgNumber;
    std::string          m_strFolderName;
    std::string*         m_pstrText;
+   CMIMESplitter*       m_pMIMESplitter;
+   CMailSink*           m_pSink;
+   unsigned long long   m_uExpectedSize;
+   std::string          m_strMailbox;
+
+   CImapSession         m_oSession;
+   std::atomic<bool>    m_bStopIdle;
+   unsigned             m_uIdleRefresh;
 
 };
 
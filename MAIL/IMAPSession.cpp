@@ -0,0 +1,706 @@
+/**
+* @file IMAPSession.cpp
+* @brief implementation of the native IMAP session
+*/
+
+#include "IMAPSession.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+CImapSession::CImapSession(LogFnCallback oLogger) :
+   m_oConnection(oLogger),
+   m_uTag(0),
+   m_bReadOnly(false),
+   m_uUidValidity(0),
+   m_oLog(oLogger)
+{
+
+}
+
+/**
+* @brief reads the capabilities of the server, they aren't part of the
+* greeting libcurl consumed
+*
+* @retval true   The session is ready.
+* @retval false  The connection failed.
+*/
+const bool CImapSession::Start()
+{
+   m_strCapabilities.clear();
+
+   std::string strStatus;
+   return Execute("CAPABILITY",
+                  [this](const CStringView& Response)
+                  {
+                     if (Response.size() > 11 && Response.substr(0, 11).EqualsNoCase("CAPABILITY "))
+                        m_strCapabilities = Response.substr(11).ToString();
+                  }, strStatus);
+}
+
+const bool CImapSession::Logout()
+{
+   if (!IsOpen())
+      return false;
+
+   std::string strStatus;
+   const bool bResult = Execute("LOGOUT", nullptr, strStatus);
+   Close();
+   return bResult && strStatus.compare(0, 2, "OK") == 0;
+}
+
+void CImapSession::Close()
+{
+   m_oConnection.Close();
+   m_strBuffer.clear();
+   m_strCapabilities.clear();
+   m_strSelected.clear();
+   m_uUidValidity = 0;
+   m_strEnabled.clear();
+   m_mapPending.clear();
+}
+
+const bool CImapSession::HasCapability(const CStringView& Capability) const
+{
+   const CStringView Capabilities(m_strCapabilities);
+   size_t uPos = 0;
+   while (uPos < Capabilities.size())
+   {
+      size_t uEnd = Capabilities.find(' ', uPos);
+      if (uEnd == CStringView::npos)
+         uEnd = Capabilities.size();
+
+      if (Capabilities.substr(uPos, uEnd - uPos).EqualsNoCase(Capability))
+         return true;
+      uPos = uEnd + 1;
+   }
+   return false;
+}
+
+const bool CImapSession::Enable(const std::string& strExtension)
+{
+   const std::string strToken = " " + strExtension + " ";
+   if ((" " + m_strEnabled + " ").find(strToken) != std::string::npos)
+      return true;
+
+   std::string strStatus;
+   if (!Execute("ENABLE " + strExtension, nullptr, strStatus))
+      return false;
+
+   if (strStatus.compare(0, 2, "OK") != 0)
+   {
+      if (m_oLog)
+         m_oLog("[ImapSession][Error] Unable to enable " + strExtension + " : " + strStatus);
+
+      return false;
+   }
+
+   m_strEnabled += m_strEnabled.empty() ? strExtension : " " + strExtension;
+   return true;
+}
+
+const bool CImapSession::Execute(const std::string& strCommand, const UntaggedFnCallback& fnUntagged,
+                                 std::string& strStatus)
+{
+   if (strCommand.find("\r\n") == std::string::npos)
+   {
+      const std::string strTag = NextTag();
+      return SendCommand(strTag, strCommand) && ReadResponses(strTag, fnUntagged, false, strStatus);
+   }
+
+   std::vector<std::string> vecTexts;
+   std::vector<CStringView> vecLiterals;
+   if (!SplitLiterals(strCommand, vecTexts, vecLiterals))
+   {
+      if (m_oLog)
+         m_oLog("[ImapSession][Error] Malformed literal in the command.");
+
+      return false;
+   }
+
+   const std::string strTag = SendLiterals(vecTexts, vecLiterals, HasCapability("LITERAL+"), strStatus);
+   if (strTag.empty())
+      return !strStatus.empty(); // a refused literal completes the command
+
+   return WaitCompletion(strTag, fnUntagged, strStatus);
+}
+
+const bool CImapSession::SplitLiterals(const std::string& strCommand, std::vector<std::string>& vecTexts,
+                                       std::vector<CStringView>& vecLiterals)
+{
+   vecTexts.assign(1, std::string());
+   vecLiterals.clear();
+
+   size_t uPos = 0;
+   size_t uCRLF = 0;
+   while ((uCRLF = strCommand.find("\r\n", uPos)) != std::string::npos)
+   {
+      // "{123}" ends the text preceding the literal
+      const size_t uOpen = strCommand.rfind('{', uCRLF);
+      if (uOpen == std::string::npos || uOpen < uPos || uOpen + 2 >= uCRLF || strCommand[uCRLF - 1] != '}')
+         return false;
+
+      unsigned long long uSize = 0;
+      for (size_t i = uOpen + 1; i < uCRLF - 1; ++i)
+      {
+         if (strCommand[i] < '0' || strCommand[i] > '9' || uSize > strCommand.size())
+            return false;
+         uSize = uSize * 10 + (strCommand[i] - '0');
+      }
+      if (uSize > strCommand.size() - uCRLF - 2)
+         return false;
+
+      vecTexts.back().append(strCommand, uPos, uOpen - uPos);
+      vecLiterals.emplace_back(strCommand.data() + uCRLF + 2, static_cast<size_t>(uSize));
+      vecTexts.emplace_back();
+      uPos = uCRLF + 2 + static_cast<size_t>(uSize);
+   }
+   vecTexts.back().append(strCommand, uPos, std::string::npos);
+   return true;
+}
+
+/**
+* @brief sends a command made of texts and literals (e.g. an APPEND), its
+* completion is read later by WaitCompletion
+*
+* Without LITERAL+ the server must accept each literal with a continuation
+* request ("+ ...") before it's sent. The completion of commands sent before
+* may arrive meanwhile : it's kept for their WaitCompletion. The data of the
+* literals is sent as is, without copying it in the command.
+*
+* @param [in] vecTexts text preceding each literal, and the one following the last
+* @param [in] vecLiterals data of the literals
+* @param [in] bNonSync the server supports LITERAL+
+* @param [out] strStatus completion of the command if the server refused a literal
+*
+* @retval tag of the command, empty if the connection failed or a literal was refused
+*/
+std::string CImapSession::SendLiterals(const std::vector<std::string>& vecTexts,
+                                       const std::vector<CStringView>& vecLiterals, const bool bNonSync,
+                                       std::string& strStatus)
+{
+   strStatus.clear();
+   if (vecTexts.size() != vecLiterals.size() + 1)
+      return std::string();
+
+   if (!IsOpen())
+   {
+      if (m_oLog)
+         m_oLog("[ImapSession][Error] The session isn't open.");
+
+      return std::string();
+   }
+
+   // small literals are sent with the text around them, a command is then
+   // written at once instead of in several short packets
+   const std::string strTag = NextTag();
+   std::string strOutput = strTag + " ";
+   auto Flush = [this, &strOutput]()
+   {
+      if (!strOutput.empty() && !m_oConnection.Send(strOutput))
+      {
+         Close();
+         return false;
+      }
+      strOutput.clear();
+      return true;
+   };
+
+   for (size_t i = 0; i < vecLiterals.size(); ++i)
+   {
+      strOutput += vecTexts[i] + "{" + std::to_string(vecLiterals[i].size()) + (bNonSync ? "+}\r\n" : "}\r\n");
+
+      if (!bNonSync)
+      {
+         if (!Flush())
+            return std::string();
+
+         // "+ Ready for literal data", or the completion if the literal is refused
+         std::string strContinuation;
+         if (!ReadResponses(strTag, nullptr, true, strContinuation))
+            return std::string();
+
+         if (strContinuation.compare(0, 1, "+") != 0)
+         {
+            strStatus = strContinuation;
+            return std::string();
+         }
+      }
+
+      if (vecLiterals[i].size() <= LITERAL_COPY_MAX)
+      {
+         strOutput.append(vecLiterals[i].data(), vecLiterals[i].size());
+      }
+      else if (!Flush() || !m_oConnection.Send(vecLiterals[i].data(), vecLiterals[i].size()))
+      {
+         Close();
+         return std::string();
+      }
+   }
+
+   strOutput += vecTexts.back() + "\r\n";
+   if (!Flush())
+      return std::string();
+
+   m_mapPending[strTag];
+   return strTag;
+}
+
+const bool CImapSession::WaitCompletion(const std::string& strTag, const UntaggedFnCallback& fnUntagged,
+                                        std::string& strStatus)
+{
+   const auto itPending = m_mapPending.find(strTag);
+   if (itPending != m_mapPending.end() && !itPending->second.empty())
+   {
+      strStatus = itPending->second;
+      m_mapPending.erase(itPending);
+      return true;
+   }
+
+   const bool bResult = ReadResponses(strTag, fnUntagged, false, strStatus);
+   m_mapPending.erase(strTag);
+   return bResult;
+}
+
+const bool CImapSession::Select(const std::string& strMailbox, const bool bReadOnly,
+                                const UntaggedFnCallback& fnUntagged, const std::string& strParameters /* = "" */)
+{
+   m_strSelected.clear();
+   m_uUidValidity = 0;
+
+   std::string strCommand = (bReadOnly ? "EXAMINE " : "SELECT ") + Quote(strMailbox);
+   if (!strParameters.empty())
+      strCommand += " " + strParameters;
+
+   unsigned long uUidValidity = 0;
+   std::string strStatus;
+   if (!Execute(strCommand, [&fnUntagged, &uUidValidity](const CStringView& Response)
+                {
+                   // "OK [UIDVALIDITY 3857529045] UIDs valid"
+                   if (Response.substr(0, 16).EqualsNoCase("OK [UIDVALIDITY "))
+                      uUidValidity = strtoul(Response.substr(16, 10).ToString().c_str(), nullptr, 10);
+
+                   if (fnUntagged)
+                      fnUntagged(Response);
+                }, strStatus))
+      return false;
+
+   if (strStatus.compare(0, 2, "OK") != 0)
+   {
+      if (m_oLog)
+         m_oLog("[ImapSession][Error] Unable to select " + strMailbox + " : " + strStatus);
+
+      return false;
+   }
+
+   m_strSelected = strMailbox;
+   m_bReadOnly = bReadOnly;
+   m_uUidValidity = uUidValidity;
+   return true;
+}
+
+const bool CImapSession::IsSelected(const std::string& strMailbox, const bool bReadOnly /* = false */) const
+{
+   if (m_strSelected.empty() || (m_bReadOnly && !bReadOnly))
+      return false;
+
+   // INBOX is case-insensitive, the other names aren't
+   return m_strSelected == strMailbox
+       || (CStringView(m_strSelected).EqualsNoCase("INBOX") && CStringView(strMailbox).EqualsNoCase("INBOX"));
+}
+
+const bool CImapSession::EnsureSelected(const std::string& strMailbox, const bool bReadOnly /* = false */)
+{
+   return IsSelected(strMailbox, bReadOnly) || Select(strMailbox, bReadOnly, nullptr);
+}
+
+/**
+* @brief holds the selected mailbox in IDLE
+*
+* The server may drop a client idling for more than 30 minutes (RFC 2177), so
+* IDLE is ended with DONE and issued again every uRefreshSeconds. Between two
+* checks of fnStop the thread sleeps on the socket : the responses are
+* delivered as soon as they arrive and nothing is sent.
+*
+* @param [in] fnUntagged receives the untagged responses (EXISTS, EXPUNGE...)
+* @param [in] uRefreshSeconds delay before IDLE is re-issued, 0 for the
+* maximum of 29 minutes
+* @param [in] fnStop returns true to end the IDLE
+* @param [in] uCheckMs delay between two calls to fnStop
+*
+* @retval true   fnStop ended the IDLE.
+* @retval false  IDLE or DONE was refused or the connection failed.
+*/
+const bool CImapSession::Idle(const UntaggedFnCallback& fnUntagged, const unsigned uRefreshSeconds,
+                              const StopFnCallback& fnStop, const unsigned uCheckMs /* = 500 */)
+{
+   // 0 would re-issue IDLE in a busy loop
+   const unsigned uRefresh = (uRefreshSeconds > 0) ? uRefreshSeconds : 29 * 60;
+
+   for (;;)
+   {
+      const std::string strTag = NextTag();
+      std::string strStatus;
+      if (!SendCommand(strTag, "IDLE") || !ReadResponses(strTag, fnUntagged, true, strStatus))
+         return false;
+
+      if (strStatus.compare(0, 1, "+") != 0)
+      {
+         if (m_oLog)
+            m_oLog("[ImapSession][Error] IDLE refused : " + strStatus);
+
+         return false;
+      }
+
+      const auto tRefresh = std::chrono::steady_clock::now() + std::chrono::seconds(uRefresh);
+      bool bStop = false;
+      std::string strResponse;
+      while (!(bStop = fnStop()) && std::chrono::steady_clock::now() < tRefresh)
+      {
+         // only untagged responses are expected while idling
+         while (NextResponse(fnUntagged, strResponse))
+            ;
+
+         if (m_oConnection.WaitReadable(uCheckMs) && !m_oConnection.Receive(m_strBuffer))
+         {
+            Close();
+            return false;
+         }
+      }
+
+      if (!m_oConnection.Send("DONE\r\n"))
+      {
+         Close();
+         return false;
+      }
+      if (!ReadResponses(strTag, fnUntagged, false, strStatus))
+         return false;
+
+      if (strStatus.compare(0, 2, "OK") != 0)
+      {
+         if (m_oLog)
+            m_oLog("[ImapSession][Error] IDLE ended with : " + strStatus);
+
+         return false;
+      }
+
+      if (bStop)
+         return true;
+   }
+}
+
+/**
+* @brief finds the end of a response, a line ending with {n} (or {n+}) is
+* followed by a literal of n bytes and the response goes on after it
+*
+* @param [in] strBuffer received data
+* @param [in] uStart beginning of the response
+*
+* @return offset following the CRLF ending the response, npos if more data is needed
+*/
+size_t CImapSession::FindResponseEnd(const std::string& strBuffer, const size_t uStart /* = 0 */)
+{
+   size_t uPos = uStart;
+   while (uPos < strBuffer.size())
+   {
+      const char* pNewLine = static_cast<const char*>(memchr(strBuffer.data() + uPos, '\n', strBuffer.size() - uPos));
+      if (pNewLine == nullptr)
+         return std::string::npos;
+
+      const size_t uNewLine = pNewLine - strBuffer.data();
+      size_t uLineEnd = uNewLine;
+      if (uLineEnd > uPos && strBuffer[uLineEnd - 1] == '\r')
+         --uLineEnd;
+
+      // "{123}" or "{123+}" at the end of the line
+      size_t uDigitsEnd = uLineEnd;
+      if (uDigitsEnd > uPos && strBuffer[uDigitsEnd - 1] == '}')
+      {
+         --uDigitsEnd;
+         if (uDigitsEnd > uPos && strBuffer[uDigitsEnd - 1] == '+')
+            --uDigitsEnd;
+
+         size_t uDigits = uDigitsEnd;
+         while (uDigits > uPos && strBuffer[uDigits - 1] >= '0' && strBuffer[uDigits - 1] <= '9')
+            --uDigits;
+
+         if (uDigits < uDigitsEnd && uDigits > uPos && strBuffer[uDigits - 1] == '{')
+         {
+            const unsigned long long uLiteral = strtoull(strBuffer.c_str() + uDigits, nullptr, 10);
+            if (uLiteral >= strBuffer.size() - uNewLine)
+               return std::string::npos;
+
+            uPos = uNewLine + 1 + static_cast<size_t>(uLiteral);
+            continue;
+         }
+      }
+      return uNewLine + 1;
+   }
+   return std::string::npos;
+}
+
+std::string CImapSession::Quote(const std::string& strText)
+{
+   std::string strQuoted;
+   strQuoted.reserve(strText.size() + 2);
+   strQuoted += '"';
+   for (const char c : strText)
+   {
+      if (c == '"' || c == '\\')
+         strQuoted += '\\';
+      strQuoted += c;
+   }
+   strQuoted += '"';
+   return strQuoted;
+}
+
+/**
+* @brief walks the data items of a FETCH response, the literals are skipped
+* by their size so the message content is never scanned
+*
+* @param [in] Items parenthesized list of the data items
+* @param [in] fnItem receives each item name and its value
+*
+* @retval true   Every item was passed to fnItem (or it stopped the parsing).
+* @retval false  The list is malformed.
+*/
+const bool CImapSession::ParseFetchItems(const CStringView& Items, const ItemFnCallback& fnItem)
+{
+   if (Items.empty() || Items[0] != '(')
+      return false;
+
+   size_t uPos = 1;
+   for (;;)
+   {
+      while (uPos < Items.size() && Items[uPos] == ' ')
+         ++uPos;
+      if (uPos >= Items.size())
+         return false;
+      if (Items[uPos] == ')')
+         return true;
+
+      // name, a section may hold spaces : BODY[HEADER.FIELDS (FROM TO)]<0>
+      const size_t uNameStart = uPos;
+      while (uPos < Items.size() && Items[uPos] != ' ' && Items[uPos] != ')')
+      {
+         if (Items[uPos] == '[')
+         {
+            uPos = Items.find(']', uPos);
+            if (uPos == CStringView::npos)
+               return false;
+         }
+         ++uPos;
+      }
+      const CStringView Name = Items.substr(uNameStart, uPos - uNameStart);
+
+      if (uPos >= Items.size() || Items[uPos] != ' ')
+         return false;
+
+      CStringView Value;
+      ValueType eType;
+      uPos = ReadValue(Items, uPos + 1, Value, eType);
+      if (uPos == CStringView::npos)
+         return false;
+
+      if (eType == VALUE_ATOM && Value.EqualsNoCase("NIL"))
+         Value = CStringView();
+
+      if (!fnItem(Name, Value))
+         return true;
+   }
+}
+
+const bool CImapSession::ParseList(const CStringView& List, const ValueFnCallback& fnValue)
+{
+   if (List.empty() || List[0] != '(')
+      return false;
+
+   size_t uPos = 1;
+   for (;;)
+   {
+      while (uPos < List.size() && List[uPos] == ' ')
+         ++uPos;
+      if (uPos >= List.size())
+         return false;
+      if (List[uPos] == ')')
+         return true;
+
+      CStringView Value;
+      ValueType eType;
+      uPos = ReadValue(List, uPos, Value, eType);
+      if (uPos == CStringView::npos)
+         return false;
+
+      if (!fnValue(Value, eType))
+         return true;
+   }
+}
+
+size_t CImapSession::ReadValue(const CStringView& Text, size_t uPos, CStringView& Value, ValueType& eType)
+{
+   if (uPos >= Text.size())
+      return CStringView::npos;
+
+   eType = (Text[uPos] == '(') ? VALUE_LIST : (Text[uPos] == '"' || Text[uPos] == '{') ? VALUE_STRING : VALUE_ATOM;
+
+   const size_t uStart = uPos;
+   switch (Text[uPos])
+   {
+      case '"':
+         for (++uPos; uPos < Text.size() && Text[uPos] != '"'; ++uPos)
+         {
+            if (Text[uPos] == '\\')
+               ++uPos;
+         }
+         if (uPos >= Text.size())
+            return CStringView::npos;
+
+         Value = Text.substr(uStart + 1, uPos - uStart - 1);
+         return uPos + 1;
+
+      case '{':
+      {
+         unsigned long long uSize = 0;
+         for (++uPos; uPos < Text.size() && Text[uPos] >= '0' && Text[uPos] <= '9'; ++uPos)
+            uSize = uSize * 10 + (Text[uPos] - '0');
+         if (uPos < Text.size() && Text[uPos] == '+')
+            ++uPos;
+         if (Text.substr(uPos, 3) != CStringView("}\r\n") || uSize > Text.size() - uPos - 3)
+            return CStringView::npos;
+
+         Value = Text.substr(uPos + 3, static_cast<size_t>(uSize));
+         return uPos + 3 + static_cast<size_t>(uSize);
+      }
+
+      case '(':
+      {
+         // nested lists may hold strings and literals
+         unsigned uDepth = 1;
+         ++uPos;
+         while (uDepth > 0)
+         {
+            if (uPos >= Text.size())
+               return CStringView::npos;
+
+            const char c = Text[uPos];
+            if (c == '"' || c == '{')
+            {
+               CStringView Nested;
+               ValueType eNested;
+               uPos = ReadValue(Text, uPos, Nested, eNested);
+               if (uPos == CStringView::npos)
+                  return CStringView::npos;
+               continue;
+            }
+            if (c == '(')
+               ++uDepth;
+            else if (c == ')')
+               --uDepth;
+            ++uPos;
+         }
+         Value = Text.substr(uStart, uPos - uStart);
+         return uPos;
+      }
+
+      default:
+         // atom, number or NIL
+         while (uPos < Text.size() && Text[uPos] != ' ' && Text[uPos] != ')')
+            ++uPos;
+         Value = Text.substr(uStart, uPos - uStart);
+         return uPos;
+   }
+}
+
+std::string CImapSession::NextTag()
+{
+   return "T" + std::to_string(++m_uTag);
+}
+
+const bool CImapSession::SendCommand(const std::string& strTag, const std::string& strCommand)
+{
+   if (!IsOpen())
+   {
+      if (m_oLog)
+         m_oLog("[ImapSession][Error] The session isn't open.");
+
+      return false;
+   }
+
+   if (!m_oConnection.Send(strTag + " " + strCommand + "\r\n"))
+   {
+      Close();
+      return false;
+   }
+   return true;
+}
+
+const bool CImapSession::ReadResponses(const std::string& strTag, const UntaggedFnCallback& fnUntagged,
+                                       const bool bContinuation, std::string& strStatus)
+{
+   std::string strResponse;
+   for (;;)
+   {
+      while (NextResponse(fnUntagged, strResponse))
+      {
+         if (bContinuation && strResponse.compare(0, 1, "+") == 0)
+         {
+            strStatus = strResponse;
+            return true;
+         }
+
+         if (strResponse.size() > strTag.size() && strResponse.compare(0, strTag.size(), strTag) == 0
+             && strResponse[strTag.size()] == ' ')
+         {
+            strStatus = strResponse.substr(strTag.size() + 1);
+            return true;
+         }
+         // the completion of a pipelined command is kept, anything else is skipped
+         if (!m_mapPending.empty())
+         {
+            const size_t uSpace = strResponse.find(' ');
+            const auto itPending = m_mapPending.find(strResponse.substr(0, uSpace));
+            if (uSpace != std::string::npos && itPending != m_mapPending.end())
+               itPending->second = strResponse.substr(uSpace + 1);
+         }
+      }
+
+      if (!m_oConnection.Receive(m_strBuffer))
+      {
+         if (m_oLog)
+            m_oLog("[ImapSession][Error] Connection lost while waiting for " + strTag + ".");
+
+         Close();
+         return false;
+      }
+   }
+}
+
+const bool CImapSession::NextResponse(const UntaggedFnCallback& fnUntagged, std::string& strResponse)
+{
+   size_t uStart = 0;
+   size_t uEnd;
+   bool bFound = false;
+
+   while (!bFound && (uEnd = FindResponseEnd(m_strBuffer, uStart)) != std::string::npos)
+   {
+      size_t uLineEnd = uEnd - 1;
+      if (uLineEnd > uStart && m_strBuffer[uLineEnd - 1] == '\r')
+         --uLineEnd;
+
+      if (m_strBuffer.compare(uStart, 2, "* ") == 0)
+      {
+         if (fnUntagged)
+            fnUntagged(CStringView(m_strBuffer.data() + uStart + 2, uLineEnd - uStart - 2));
+      }
+      else
+      {
+         strResponse.assign(m_strBuffer, uStart, uLineEnd - uStart);
+         bFound = true;
+      }
+      uStart = uEnd;
+   }
+
+   m_strBuffer.erase(0, uStart);
+   return bFound;
+}
@@ -0,0 +1,155 @@
+/*
+* @file IMAPSession.h
+* @brief native IMAP session for the operations libcurl doesn't offer
+*
+* The commands are tagged and sent on a connection logged in by libcurl. The
+* responses are framed as they arrive, literals ({n} followed by n bytes)
+* included, and the untagged ones are handed to a callback. Used to hold a
+* mailbox in IDLE (RFC 2177).
+*/
+
+#ifndef INCLUDE_IMAPSESSION_H_
+#define INCLUDE_IMAPSESSION_H_
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "MailConnection.h"
+#include "StringView.h"
+
+class CImapSession
+{
+public:
+   enum ValueType
+   {
+      VALUE_ATOM,    // atom or number, NIL included
+      VALUE_STRING,  // quoted string or literal
+      VALUE_LIST     // parenthesized list
+   };
+
+   typedef std::function<void(const std::string&)> LogFnCallback;
+   /* untagged response without "* " and the final CRLF, literals included */
+   typedef std::function<void(const CStringView& Response)> UntaggedFnCallback;
+   /* polled while idling, returns true to leave IDLE */
+   typedef std::function<bool()> StopFnCallback;
+   /* data item of a FETCH response, returns false to stop the parsing */
+   typedef std::function<bool(const CStringView& Name, const CStringView& Value)> ItemFnCallback;
+   /* element of a parenthesized list, returns false to stop the parsing */
+   typedef std::function<bool(const CStringView& Value, const ValueType eType)> ValueFnCallback;
+
+   explicit CImapSession(LogFnCallback oLogger = nullptr);
+
+   // copy constructor and assignment operator are disabled
+   CImapSession(const CImapSession& Copy) = delete;
+   CImapSession& operator=(const CImapSession& Copy) = delete;
+
+   /* the connection must be opened (logged in) before Start is called */
+   inline CMailConnection& GetConnection() { return m_oConnection; }
+   inline const bool IsOpen() const { return m_oConnection.IsOpen(); }
+
+   /* reads the capabilities of the server */
+   const bool Start();
+   /* sends LOGOUT and closes the connection */
+   const bool Logout();
+   /* drops the connection */
+   void Close();
+
+   /* case insensitive, e.g. "IDLE" */
+   const bool HasCapability(const CStringView& Capability) const;
+
+   /* ENABLE an extension (RFC 5161) once per connection, e.g. "QRESYNC" */
+   const bool Enable(const std::string& strExtension);
+
+   /* sends a command and waits for its completion. Returns false if the
+    * connection failed, strStatus receives the completion without the tag
+    * (e.g. "OK done" or "NO failure"). The literals of the command ("{n}\r\n"
+    * followed by n bytes, e.g. built by CSearchCriteria) go through SendLiterals. */
+   const bool Execute(const std::string& strCommand, const UntaggedFnCallback& fnUntagged, std::string& strStatus);
+
+   /* sends a command whose arguments include literals without waiting for
+    * its completion, so that several commands can be pipelined. Texts and
+    * literals alternate : vecTexts[i] is followed by vecLiterals[i] (sent as
+    * {n} and the data) and vecTexts has one more element. With bNonSync
+    * (LITERAL+) the literals are sent at once, otherwise each one waits for
+    * the continuation request of the server. Returns the tag of the command,
+    * empty if it failed (strStatus receives the refusal). */
+   std::string SendLiterals(const std::vector<std::string>& vecTexts, const std::vector<CStringView>& vecLiterals,
+                            const bool bNonSync, std::string& strStatus);
+   /* waits for the completion of a command sent by SendLiterals */
+   const bool WaitCompletion(const std::string& strTag, const UntaggedFnCallback& fnUntagged,
+                             std::string& strStatus);
+
+   /* selects (or examines if bReadOnly) a mailbox, strParameters is appended
+    * to the command, e.g. "(CONDSTORE)" */
+   const bool Select(const std::string& strMailbox, const bool bReadOnly, const UntaggedFnCallback& fnUntagged,
+                     const std::string& strParameters = "");
+   inline const std::string& GetSelected() const { return m_strSelected; }
+   /* UIDVALIDITY of the selected mailbox, 0 if none is selected */
+   inline unsigned long GetUidValidity() const { return m_uUidValidity; }
+   /* the mailbox is selected, with write access unless bReadOnly */
+   const bool IsSelected(const std::string& strMailbox, const bool bReadOnly = false) const;
+   /* selects a mailbox unless IsSelected : back-to-back commands on a
+    * mailbox cost a single SELECT */
+   const bool EnsureSelected(const std::string& strMailbox, const bool bReadOnly = false);
+
+   /* enters IDLE and passes the untagged responses to fnUntagged as they
+    * arrive. IDLE is re-issued every uRefreshSeconds (0 is 29 minutes),
+    * fnStop is checked every uCheckMs. Returns true once fnStop asked to
+    * stop and IDLE was left, false if the connection failed or IDLE or
+    * DONE was refused. */
+   const bool Idle(const UntaggedFnCallback& fnUntagged, const unsigned uRefreshSeconds,
+                   const StopFnCallback& fnStop, const unsigned uCheckMs = 500);
+
+   /* end of the response starting at uStart (after its CRLF), npos if it isn't complete */
+   static size_t FindResponseEnd(const std::string& strBuffer, const size_t uStart = 0);
+   /* mailbox name as a quoted string */
+   static std::string Quote(const std::string& strText);
+
+   /* walks the data items of a FETCH response, e.g. "(UID 4 BODY[] {12}...)" :
+    * the name (e.g. "BODY[HEADER]<0>") and the value of each one, a literal or
+    * a quoted string without its delimiters, a list with its parentheses,
+    * NIL as an empty value. False if the response is malformed. */
+   static const bool ParseFetchItems(const CStringView& Items, const ItemFnCallback& fnItem);
+   /* walks the elements of a parenthesized list, e.g. a BODYSTRUCTURE */
+   static const bool ParseList(const CStringView& List, const ValueFnCallback& fnValue);
+
+protected:
+   /* literals up to this size are copied to be sent with their command */
+   static const size_t LITERAL_COPY_MAX = 64 * 1024;
+
+   /* splits a command at its literals ("{n}\r\n" followed by n bytes) for
+    * SendLiterals, false if one is malformed */
+   static const bool SplitLiterals(const std::string& strCommand, std::vector<std::string>& vecTexts,
+                                   std::vector<CStringView>& vecLiterals);
+
+   /* reads the value starting at uPos, returns the position following it or npos */
+   static size_t ReadValue(const CStringView& Text, size_t uPos, CStringView& Value, ValueType& eType);
+
+   std::string NextTag();
+   const bool SendCommand(const std::string& strTag, const std::string& strCommand);
+   /* reads the responses until the completion of strTag (or a continuation
+    * request if bContinuation) */
+   const bool ReadResponses(const std::string& strTag, const UntaggedFnCallback& fnUntagged,
+                            const bool bContinuation, std::string& strStatus);
+   /* passes the complete untagged responses of the buffer to fnUntagged, stops
+    * at the first other one and returns it in strResponse */
+   const bool NextResponse(const UntaggedFnCallback& fnUntagged, std::string& strResponse);
+
+   CMailConnection   m_oConnection;
+   std::string       m_strBuffer;
+   unsigned long     m_uTag;
+   std::string       m_strCapabilities;
+   std::string       m_strSelected;
+   bool              m_bReadOnly;
+   unsigned long     m_uUidValidity;
+   std::string       m_strEnabled;
+   /* commands sent by SendLiterals and their completion once received */
+   std::map<std::string, std::string> m_mapPending;
+
+   LogFnCallback     m_oLog;
+};
+
+#endif
@@ -0,0 +1,503 @@
+/**
+* @file ImapSearch.cpp
+* @brief implementation of the IMAP search results
+*/
+
+#include "ImapSearch.h"
+
+#include "StringView.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+const char SEARCH_PREFIX[] = "* SEARCH";
+const size_t SEARCH_PREFIX_SIZE = sizeof(SEARCH_PREFIX) - 1;
+
+/* quoted string, CR and LF can't be quoted and are replaced by spaces. A
+ * quoted string is 7 bits (RFC 3501) : non-ASCII text is sent as a literal,
+ * "{n}\r\n" followed by the text. */
+std::string QuoteString(const std::string& strText, bool& bUtf8)
+{
+   for (const char c : strText)
+   {
+      if (static_cast<unsigned char>(c) >= 0x80)
+      {
+         bUtf8 = true;
+         return "{" + std::to_string(strText.size()) + "}\r\n" + strText;
+      }
+   }
+
+   std::string strQuoted;
+   strQuoted.reserve(strText.size() + 2);
+   strQuoted += '"';
+   for (const char c : strText)
+   {
+      if (c == '"' || c == '\\')
+         strQuoted += '\\';
+      strQuoted += (c == '\r' || c == '\n') ? ' ' : c;
+   }
+   strQuoted += '"';
+   return strQuoted;
+}
+
+/* flag keywords are atoms : no space, control, 8 bits or atom-specials */
+bool IsAtom(const std::string& strText)
+{
+   for (const char c : strText)
+   {
+      const unsigned char uc = static_cast<unsigned char>(c);
+      if (uc <= 0x20 || uc >= 0x7F || std::strchr("(){%*\"\\]", c) != nullptr)
+         return false;
+   }
+   return !strText.empty();
+}
+
+uint64_t ToNumber(const CStringView& Value)
+{
+   uint64_t uNumber = 0;
+   for (size_t i = 0; i < Value.size() && Value[i] >= '0' && Value[i] <= '9'; ++i)
+      uNumber = uNumber * 10 + (Value[i] - '0');
+   return uNumber;
+}
+
+/* position following the parenthesized list starting at uPos */
+size_t SkipList(const CStringView& Text, size_t uPos)
+{
+   unsigned uDepth = 0;
+   for (; uPos < Text.size(); ++uPos)
+   {
+      if (Text[uPos] == '(')
+         ++uDepth;
+      else if (Text[uPos] == ')' && --uDepth == 0)
+         return uPos + 1;
+   }
+   return uPos;
+}
+}
+
+CSearchCriteria& CSearchCriteria::Answered(const bool bSet /* = true */)
+{
+   return AddKey(bSet ? "ANSWERED" : "UNANSWERED");
+}
+
+CSearchCriteria& CSearchCriteria::Deleted(const bool bSet /* = true */)
+{
+   return AddKey(bSet ? "DELETED" : "UNDELETED");
+}
+
+CSearchCriteria& CSearchCriteria::Draft(const bool bSet /* = true */)
+{
+   return AddKey(bSet ? "DRAFT" : "UNDRAFT");
+}
+
+CSearchCriteria& CSearchCriteria::Flagged(const bool bSet /* = true */)
+{
+   return AddKey(bSet ? "FLAGGED" : "UNFLAGGED");
+}
+
+CSearchCriteria& CSearchCriteria::Seen(const bool bSet /* = true */)
+{
+   return AddKey(bSet ? "SEEN" : "UNSEEN");
+}
+
+CSearchCriteria& CSearchCriteria::Keyword(const std::string& strKeyword, const bool bSet /* = true */)
+{
+   // anything else would add search keys
+   if (!IsAtom(strKeyword))
+   {
+      m_bValid = false;
+      return *this;
+   }
+
+   return AddKey((bSet ? "KEYWORD " : "UNKEYWORD ") + strKeyword);
+}
+
+CSearchCriteria& CSearchCriteria::New()
+{
+   return AddKey("NEW");
+}
+
+CSearchCriteria& CSearchCriteria::Recent()
+{
+   return AddKey("RECENT");
+}
+
+CSearchCriteria& CSearchCriteria::Since(const unsigned uDay, const unsigned uMonth, const unsigned uYear)
+{
+   return AddDate("SINCE", uDay, uMonth, uYear);
+}
+
+CSearchCriteria& CSearchCriteria::Before(const unsigned uDay, const unsigned uMonth, const unsigned uYear)
+{
+   return AddDate("BEFORE", uDay, uMonth, uYear);
+}
+
+CSearchCriteria& CSearchCriteria::On(const unsigned uDay, const unsigned uMonth, const unsigned uYear)
+{
+   return AddDate("ON", uDay, uMonth, uYear);
+}
+
+CSearchCriteria& CSearchCriteria::SentSince(const unsigned uDay, const unsigned uMonth, const unsigned uYear)
+{
+   return AddDate("SENTSINCE", uDay, uMonth, uYear);
+}
+
+CSearchCriteria& CSearchCriteria::SentBefore(const unsigned uDay, const unsigned uMonth, const unsigned uYear)
+{
+   return AddDate("SENTBEFORE", uDay, uMonth, uYear);
+}
+
+CSearchCriteria& CSearchCriteria::From(const std::string& strText)
+{
+   return AddString("FROM", strText);
+}
+
+CSearchCriteria& CSearchCriteria::To(const std::string& strText)
+{
+   return AddString("TO", strText);
+}
+
+CSearchCriteria& CSearchCriteria::Cc(const std::string& strText)
+{
+   return AddString("CC", strText);
+}
+
+CSearchCriteria& CSearchCriteria::Subject(const std::string& strText)
+{
+   return AddString("SUBJECT", strText);
+}
+
+CSearchCriteria& CSearchCriteria::Header(const std::string& strField, const std::string& strText)
+{
+   return AddKey("HEADER " + QuoteString(strField, m_bUtf8) + " " + QuoteString(strText, m_bUtf8));
+}
+
+CSearchCriteria& CSearchCriteria::Body(const std::string& strText)
+{
+   return AddString("BODY", strText);
+}
+
+CSearchCriteria& CSearchCriteria::Text(const std::string& strText)
+{
+   return AddString("TEXT", strText);
+}
+
+CSearchCriteria& CSearchCriteria::Larger(const unsigned long long uSize)
+{
+   return AddKey("LARGER " + std::to_string(uSize));
+}
+
+CSearchCriteria& CSearchCriteria::Smaller(const unsigned long long uSize)
+{
+   return AddKey("SMALLER " + std::to_string(uSize));
+}
+
+CSearchCriteria& CSearchCriteria::Uid(const CUIDBitmap& oUIDs)
+{
+   // a sequence set can't be empty
+   if (oUIDs.IsEmpty())
+   {
+      m_bValid = false;
+      return *this;
+   }
+
+   std::string strSet;
+   oUIDs.ToSequenceSet(strSet);
+   return AddKey("UID " + strSet);
+}
+
+CSearchCriteria& CSearchCriteria::Uid(const uint32_t uFirst, const uint32_t uLast)
+{
+   if (uFirst == 0 || uLast < uFirst)
+   {
+      m_bValid = false;
+      return *this;
+   }
+
+   return AddKey("UID " + std::to_string(uFirst) + (uLast != uFirst ? ":" + std::to_string(uLast) : std::string()));
+}
+
+CSearchCriteria& CSearchCriteria::ModSeq(const unsigned long long uModSeq)
+{
+   return AddKey("MODSEQ " + std::to_string(uModSeq));
+}
+
+CSearchCriteria& CSearchCriteria::Not(const CSearchCriteria& Criteria)
+{
+   Merge(Criteria);
+   return AddKey("NOT " + Criteria.ToKey());
+}
+
+CSearchCriteria& CSearchCriteria::Or(const CSearchCriteria& A, const CSearchCriteria& B)
+{
+   Merge(A);
+   Merge(B);
+   return AddKey("OR " + A.ToKey() + " " + B.ToKey());
+}
+
+CSearchCriteria& CSearchCriteria::And(const CSearchCriteria& Criteria)
+{
+   Merge(Criteria);
+   if (Criteria.IsEmpty())
+      return *this;
+
+   if (!m_strKeys.empty())
+      m_strKeys += ' ';
+   m_strKeys += Criteria.m_strKeys;
+   m_uKeys += Criteria.m_uKeys;
+   return *this;
+}
+
+CSearchCriteria& CSearchCriteria::Raw(const std::string& strKey)
+{
+   return AddKey(strKey);
+}
+
+std::string CSearchCriteria::ToString() const
+{
+   return IsEmpty() ? std::string("ALL") : m_strKeys;
+}
+
+CSearchCriteria& CSearchCriteria::AddKey(const std::string& strKey)
+{
+   if (!m_strKeys.empty())
+      m_strKeys += ' ';
+   m_strKeys += strKey;
+   ++m_uKeys;
+   return *this;
+}
+
+/* dates are sent as "1-Feb-2024" */
+CSearchCriteria& CSearchCriteria::AddDate(const char* pszKey, const unsigned uDay, const unsigned uMonth,
+                                          const unsigned uYear)
+{
+   static const char* const MONTHS[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                         "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+   if (uDay < 1 || uDay > 31 || uMonth < 1 || uMonth > 12 || uYear < 1 || uYear > 9999)
+   {
+      m_bValid = false;
+      return *this;
+   }
+
+   char szDate[16];
+   snprintf(szDate, sizeof(szDate), "%u-%s-%04u", uDay, MONTHS[uMonth - 1], uYear);
+   return AddKey(std::string(pszKey) + " " + szDate);
+}
+
+CSearchCriteria& CSearchCriteria::AddString(const char* pszKey, const std::string& strText)
+{
+   return AddKey(std::string(pszKey) + " " + QuoteString(strText, m_bUtf8));
+}
+
+CSearchCriteria& CSearchCriteria::Merge(const CSearchCriteria& Criteria)
+{
+   m_bUtf8 = m_bUtf8 || Criteria.m_bUtf8;
+   m_bValid = m_bValid && Criteria.m_bValid;
+   return *this;
+}
+
+std::string CSearchCriteria::ToKey() const
+{
+   return (m_uKeys > 1) ? "(" + m_strKeys + ")" : ToString();
+}
+
+void ImapSearchResult::Clear()
+{
+   uCount = 0;
+   uMin = 0;
+   uMax = 0;
+   oUIDs.Clear();
+}
+
+CSearchResultParser::CSearchResultParser(CUIDBitmap& oResult) :
+   m_oResult(oResult)
+{
+   Reset();
+}
+
+void CSearchResultParser::Reset()
+{
+   m_eState = LINE_START;
+   m_uMatched = 0;
+   m_uNumber = 0;
+   m_bDigits = false;
+   m_uRunFirst = 0;
+   m_uRunLast = 0;
+   m_uCount = 0;
+}
+
+/**
+* @brief parses a chunk of the responses, a number or the prefix may be split
+* between two chunks
+*
+* @retval true   Always, unknown responses are skipped.
+*/
+const bool CSearchResultParser::Write(const char* pData, size_t uSize)
+{
+   const char* const pEnd = pData + uSize;
+   for (const char* p = pData; p < pEnd; ++p)
+   {
+      const char c = *p;
+      switch (m_eState)
+      {
+         case LINE_START:
+            if (CStringView::ToLower(c) == CStringView::ToLower(SEARCH_PREFIX[m_uMatched]))
+            {
+               if (++m_uMatched == SEARCH_PREFIX_SIZE)
+                  m_eState = NUMBERS;
+            }
+            else if (c != '\n')
+               m_eState = SKIP_LINE;
+            else
+               m_uMatched = 0;
+            break;
+
+         case NUMBERS:
+            if (c >= '0' && c <= '9')
+            {
+               // most of the response : the digits are scanned in a tight loop
+               uint64_t uNumber = m_uNumber;
+               for (; p < pEnd && *p >= '0' && *p <= '9'; ++p)
+               {
+                  if (uNumber <= 0xFFFFFFFFull)
+                     uNumber = uNumber * 10 + (*p - '0');
+               }
+               m_uNumber = uNumber;
+               m_bDigits = true;
+               --p; // the outer loop moves to the character following the number
+               break;
+            }
+
+            AddNumber();
+            if (c == '(')
+               m_eState = SKIP_LIST;
+            else if (c == '\n')
+            {
+               m_eState = LINE_START;
+               m_uMatched = 0;
+            }
+            break;
+
+         case SKIP_LIST:
+            if (c == ')')
+               m_eState = NUMBERS;
+            else if (c == '\n')
+            {
+               m_eState = LINE_START;
+               m_uMatched = 0;
+            }
+            break;
+
+         case SKIP_LINE:
+            if (c == '\n')
+            {
+               m_eState = LINE_START;
+               m_uMatched = 0;
+            }
+            break;
+      }
+   }
+   return true;
+}
+
+void CSearchResultParser::Finish()
+{
+   AddNumber();
+   if (m_uRunFirst != 0)
+   {
+      m_oResult.AddRange(m_uRunFirst, m_uRunLast);
+      m_uRunFirst = 0;
+   }
+}
+
+void CSearchResultParser::AddNumber()
+{
+   if (!m_bDigits)
+      return;
+
+   const uint64_t uNumber = m_uNumber;
+   m_uNumber = 0;
+   m_bDigits = false;
+
+   // sequence numbers and UIDs are non-zero 32 bits numbers
+   if (uNumber == 0 || uNumber > 0xFFFFFFFFull)
+      return;
+
+   const uint32_t uUID = static_cast<uint32_t>(uNumber);
+   ++m_uCount;
+   if (m_uRunFirst != 0 && uUID == m_uRunLast + 1)
+   {
+      m_uRunLast = uUID;
+      return;
+   }
+
+   if (m_uRunFirst != 0)
+      m_oResult.AddRange(m_uRunFirst, m_uRunLast);
+   m_uRunFirst = m_uRunLast = uUID;
+}
+
+/**
+* @brief parses the result of a search sent with RETURN (RFC 4731) : the
+* correlator and UID indicator are skipped, then each data item is a name
+* followed by its value. The items not asked for are left untouched.
+*
+* @param [in] Response untagged response without "* "
+* @param [in,out] Result receives COUNT, MIN, MAX and ALL
+*
+* @retval true   Response is an ESEARCH response.
+* @retval false  It isn't one (or its ALL set is malformed).
+*/
+const bool CSearchResultParser::ParseExtended(const CStringView& Response, ImapSearchResult& Result)
+{
+   if (!Response.substr(0, 8).EqualsNoCase("ESEARCH ") && !Response.EqualsNoCase("ESEARCH"))
+      return false;
+
+   size_t uPos = 7;
+   while (uPos < Response.size())
+   {
+      if (Response[uPos] == ' ')
+      {
+         ++uPos;
+         continue;
+      }
+      // (TAG "T4")
+      if (Response[uPos] == '(')
+      {
+         uPos = SkipList(Response, uPos);
+         continue;
+      }
+
+      size_t uEnd = Response.find(' ', uPos);
+      if (uEnd == CStringView::npos)
+         uEnd = Response.size();
+      const CStringView Name = Response.substr(uPos, uEnd - uPos);
+      uPos = uEnd + 1;
+      if (Name.EqualsNoCase("UID") || uPos >= Response.size())
+         continue;
+
+      // value : a number, a sequence set or a list (e.g. PARTIAL results)
+      if (Response[uPos] == '(')
+      {
+         uPos = SkipList(Response, uPos);
+         continue;
+      }
+      uEnd = Response.find(' ', uPos);
+      if (uEnd == CStringView::npos)
+         uEnd = Response.size();
+      const CStringView Value = Response.substr(uPos, uEnd - uPos);
+      uPos = uEnd;
+
+      if (Name.EqualsNoCase("COUNT"))
+         Result.uCount = static_cast<size_t>(ToNumber(Value));
+      else if (Name.EqualsNoCase("MIN"))
+         Result.uMin = static_cast<uint32_t>(ToNumber(Value));
+      else if (Name.EqualsNoCase("MAX"))
+         Result.uMax = static_cast<uint32_t>(ToNumber(Value));
+      else if (Name.EqualsNoCase("ALL") && !Result.oUIDs.AddSequenceSet(Value))
+         return false;
+   }
+   return true;
+}
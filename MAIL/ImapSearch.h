@@ -0,0 +1,165 @@
+/*
+* @file ImapSearch.h
+* @brief typed results of IMAP searches
+*
+* The "* SEARCH 1 2 3 ..." responses are parsed chunk by chunk : the numbers
+* are scanned digit by digit and consecutive ones are added to a compressed
+* bitmap as ranges, so a result of millions of UIDs is never split in strings.
+*
+* CSearchCriteria builds the criteria of a search so the filtering (by date,
+* sender, size...) is done by the server. With ESEARCH (RFC 4731) the server
+* can return only the count, the smallest or the largest UID, and sends the
+* UIDs as a sequence set.
+*/
+
+#ifndef INCLUDE_IMAPSEARCH_H_
+#define INCLUDE_IMAPSEARCH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "StringView.h"
+#include "UIDBitmap.h"
+
+/* search criteria (RFC 3501 section 6.4.4), the keys added are ANDed, e.g.
+ * CSearchCriteria().Seen(false).Since(1, 2, 2024).From("alice@example.com") */
+class CSearchCriteria
+{
+public:
+   CSearchCriteria() : m_uKeys(0), m_bUtf8(false), m_bValid(true) {}
+
+   /* flags, bSet = false searches the e-mails without it (e.g. UNSEEN). A
+    * keyword that isn't an atom makes the criteria invalid. */
+   CSearchCriteria& Answered(const bool bSet = true);
+   CSearchCriteria& Deleted(const bool bSet = true);
+   CSearchCriteria& Draft(const bool bSet = true);
+   CSearchCriteria& Flagged(const bool bSet = true);
+   CSearchCriteria& Seen(const bool bSet = true);
+   CSearchCriteria& Keyword(const std::string& strKeyword, const bool bSet = true);
+   CSearchCriteria& New();
+   CSearchCriteria& Recent();
+
+   /* internal date of the e-mail (Sent* : its Date header), e.g. Since(1, 2, 2024) */
+   CSearchCriteria& Since(const unsigned uDay, const unsigned uMonth, const unsigned uYear);
+   CSearchCriteria& Before(const unsigned uDay, const unsigned uMonth, const unsigned uYear);
+   CSearchCriteria& On(const unsigned uDay, const unsigned uMonth, const unsigned uYear);
+   CSearchCriteria& SentSince(const unsigned uDay, const unsigned uMonth, const unsigned uYear);
+   CSearchCriteria& SentBefore(const unsigned uDay, const unsigned uMonth, const unsigned uYear);
+
+   /* case insensitive substring of a header, of the body or of the whole e-mail */
+   CSearchCriteria& From(const std::string& strText);
+   CSearchCriteria& To(const std::string& strText);
+   CSearchCriteria& Cc(const std::string& strText);
+   CSearchCriteria& Subject(const std::string& strText);
+   CSearchCriteria& Header(const std::string& strField, const std::string& strText);
+   CSearchCriteria& Body(const std::string& strText);
+   CSearchCriteria& Text(const std::string& strText);
+
+   /* RFC822.SIZE in octets */
+   CSearchCriteria& Larger(const unsigned long long uSize);
+   CSearchCriteria& Smaller(const unsigned long long uSize);
+
+   /* UIDs, an empty set makes the criteria invalid */
+   CSearchCriteria& Uid(const CUIDBitmap& oUIDs);
+   CSearchCriteria& Uid(const uint32_t uFirst, const uint32_t uLast);
+
+   /* e-mails changed after a mod-sequence (CONDSTORE) */
+   CSearchCriteria& ModSeq(const unsigned long long uModSeq);
+
+   /* e-mails not matching Criteria, matching A or B, or matching Criteria too */
+   CSearchCriteria& Not(const CSearchCriteria& Criteria);
+   CSearchCriteria& Or(const CSearchCriteria& A, const CSearchCriteria& B);
+   CSearchCriteria& And(const CSearchCriteria& Criteria);
+
+   /* key sent as is, e.g. "X-GM-RAW \"has:attachment\"" */
+   CSearchCriteria& Raw(const std::string& strKey);
+
+   inline bool IsEmpty() const { return m_uKeys == 0; }
+   /* false if a date, a keyword or a UID set was invalid */
+   inline bool IsValid() const { return m_bValid; }
+   /* a string isn't ASCII : it's a literal and the search must be sent with
+    * CHARSET UTF-8 (CIMAPClient::Search does both) */
+   inline bool IsUtf8() const { return m_bUtf8; }
+
+   /* the keys, "ALL" if there are none */
+   std::string ToString() const;
+
+protected:
+   CSearchCriteria& AddKey(const std::string& strKey);
+   CSearchCriteria& AddDate(const char* pszKey, const unsigned uDay, const unsigned uMonth, const unsigned uYear);
+   CSearchCriteria& AddString(const char* pszKey, const std::string& strText);
+   CSearchCriteria& Merge(const CSearchCriteria& Criteria);
+   /* the criteria as a single key, parenthesized if it has several */
+   std::string ToKey() const;
+
+   std::string    m_strKeys;
+   unsigned       m_uKeys;
+   bool           m_bUtf8;
+   bool           m_bValid;
+};
+
+/* result of a search, the data not asked for is left to 0 (or empty) */
+struct ImapSearchResult
+{
+   enum ReturnOption
+   {
+      RETURN_MIN     = 1,
+      RETURN_MAX     = 2,
+      RETURN_COUNT   = 4,
+      RETURN_ALL     = 8   // the UIDs
+   };
+
+   ImapSearchResult() : uCount(0), uMin(0), uMax(0) {}
+   void Clear();
+
+   size_t         uCount;
+   uint32_t       uMin;
+   uint32_t       uMax;
+   CUIDBitmap     oUIDs;
+};
+
+class CSearchResultParser
+{
+public:
+   /* the numbers found are added to oResult */
+   explicit CSearchResultParser(CUIDBitmap& oResult);
+
+   void Reset();
+
+   /* untagged responses, they can be split anywhere. The responses other
+    * than SEARCH are skipped. */
+   const bool Write(const char* pData, size_t uSize);
+   /* adds the pending number and range */
+   void Finish();
+
+   /* numbers parsed since the last Reset */
+   inline size_t GetCount() const { return m_uCount; }
+
+   /* parses an ESEARCH response without "* ", e.g.
+    * "ESEARCH (TAG "A1") UID COUNT 5 MIN 2 MAX 9 ALL 2:4,8:9",
+    * false if it isn't one */
+   static const bool ParseExtended(const CStringView& Response, ImapSearchResult& Result);
+
+protected:
+   enum State
+   {
+      LINE_START,    // matching "* SEARCH"
+      NUMBERS,
+      SKIP_LIST,     // "(MODSEQ 123)" after the numbers
+      SKIP_LINE
+   };
+
+   void AddNumber();
+
+   CUIDBitmap&    m_oResult;
+   State          m_eState;
+   size_t         m_uMatched;    // characters of "* SEARCH" matched
+   uint64_t       m_uNumber;
+   bool           m_bDigits;
+   uint32_t       m_uRunFirst;   // consecutive numbers not added yet, none if m_uRunFirst is 0
+   uint32_t       m_uRunLast;
+   size_t         m_uCount;
+};
+
+#endif
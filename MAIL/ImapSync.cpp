@@ -0,0 +1,425 @@
+/**
+* @file ImapSync.cpp
+* @brief implementation of the incremental IMAP synchronization
+*/
+
+#include "ImapSync.h"
+
+#include <cstdio>
+#include <fstream>
+
+#include "Varint.h"
+
+namespace
+{
+const char STATE_FILE_MAGIC[] = "IMAPSYNC1";
+const size_t STATE_FILE_MAGIC_SIZE = sizeof(STATE_FILE_MAGIC) - 1;
+
+/* reads a decimal number at uPos and moves uPos after it */
+bool ReadNumber(const CStringView& Text, size_t& uPos, unsigned long long& uNumber)
+{
+   const size_t uStart = uPos;
+   uNumber = 0;
+   while (uPos < Text.size() && Text[uPos] >= '0' && Text[uPos] <= '9')
+      uNumber = uNumber * 10 + (Text[uPos++] - '0');
+   return uPos > uStart;
+}
+
+/* value of a response code, e.g. "OK [UIDNEXT 12] ..." */
+bool ReadResponseCode(const CStringView& Response, const CStringView& Code, unsigned long long& uValue)
+{
+   const size_t uStart = 4; // "OK ["
+   if (Response.size() <= uStart + Code.size() || !Response.substr(0, uStart).EqualsNoCase("OK [")
+       || !Response.substr(uStart, Code.size()).EqualsNoCase(Code) || Response[uStart + Code.size()] != ' ')
+      return false;
+
+   size_t uPos = uStart + Code.size() + 1;
+   return ReadNumber(Response, uPos, uValue);
+}
+}
+
+/**
+* @brief constructor of the IMAP synchronizer
+*
+* @param [in] oClient IMAP client, its session must be initialized before Sync is called
+* @param [in] strStateFile path of the state file of the account (all its folders)
+* @param [in] oLogger optional log function
+*/
+CImapSync::CImapSync(CIMAPClient& oClient, const std::string& strStateFile, LogFnCallback oLogger) :
+   m_oClient(oClient),
+   m_strStateFile(strStateFile),
+   m_bLoaded(false),
+   m_uChanges(0),
+   m_oLog(oLogger)
+{
+}
+
+/**
+* @brief loads the state file : for each folder its name, UIDVALIDITY,
+* UIDNEXT and HIGHESTMODSEQ as varints followed by its UIDs
+*
+* @retval true   Successfully loaded.
+* @retval false  The state file is corrupted.
+*/
+const bool CImapSync::Load()
+{
+   m_mapFolders.clear();
+
+   std::ifstream ifState(m_strStateFile, std::ifstream::in | std::ifstream::binary);
+   if (ifState)
+   {
+      const std::string strState((std::istreambuf_iterator<char>(ifState)), std::istreambuf_iterator<char>());
+      ifState.close();
+
+      if (strState.compare(0, STATE_FILE_MAGIC_SIZE, STATE_FILE_MAGIC) != 0)
+      {
+         if (m_oLog)
+            m_oLog("[ImapSync][Error] Invalid state file " + m_strStateFile + ".");
+
+         return false;
+      }
+
+      size_t uPos = STATE_FILE_MAGIC_SIZE;
+      size_t uFolders = 0;
+      bool bValid = ReadVarint(strState, uPos, uFolders);
+      for (size_t i = 0; bValid && i < uFolders; ++i)
+      {
+         size_t uNameSize = 0;
+         bValid = ReadVarint(strState, uPos, uNameSize) && uNameSize <= strState.size() - uPos;
+         if (!bValid)
+            break;
+
+         ImapFolderState& oState = m_mapFolders[strState.substr(uPos, uNameSize)];
+         uPos += uNameSize;
+         bValid = ReadVarint(strState, uPos, oState.uUidValidity) && ReadVarint(strState, uPos, oState.uUidNext)
+               && ReadVarint(strState, uPos, oState.uHighestModSeq) && oState.oUIDs.Deserialize(strState, uPos);
+      }
+
+      if (!bValid)
+      {
+         if (m_oLog)
+            m_oLog("[ImapSync][Error] Truncated state file " + m_strStateFile + ".");
+
+         m_mapFolders.clear();
+         return false;
+      }
+   }
+
+   m_bLoaded = true;
+   return true;
+}
+
+/**
+* @brief writes the state file (through a temporary file, so a crash leaves
+* the previous state intact)
+*/
+const bool CImapSync::Save()
+{
+   std::string strState(STATE_FILE_MAGIC, STATE_FILE_MAGIC_SIZE);
+   WriteVarint(strState, m_mapFolders.size());
+   for (const auto& Folder : m_mapFolders)
+   {
+      WriteVarint(strState, Folder.first.size());
+      strState += Folder.first;
+      WriteVarint(strState, Folder.second.uUidValidity);
+      WriteVarint(strState, Folder.second.uUidNext);
+      WriteVarint(strState, Folder.second.uHighestModSeq);
+      Folder.second.oUIDs.Serialize(strState);
+   }
+
+   const std::string strTempFile = m_strStateFile + ".tmp";
+   std::ofstream ofState(strTempFile, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+   ofState.write(strState.data(), strState.size());
+   ofState.close();
+
+   if (!ofState)
+   {
+      if (m_oLog)
+         m_oLog("[ImapSync][Error] Unable to write state file " + strTempFile + ".");
+
+      return false;
+   }
+
+#ifdef WINDOWS
+   remove(m_strStateFile.c_str());
+#endif
+   if (rename(strTempFile.c_str(), m_strStateFile.c_str()) != 0)
+   {
+      if (m_oLog)
+         m_oLog("[ImapSync][Error] Unable to replace state file " + m_strStateFile + ".");
+
+      return false;
+   }
+
+   return true;
+}
+
+/**
+* @brief reports the changes of a folder since the last sync
+*
+* The folder is examined (read-only). Depending on the server :
+* - QRESYNC : the EXAMINE carries the known UIDVALIDITY and HIGHESTMODSEQ, the
+*   server answers with the changed messages and the VANISHED UIDs.
+* - CONDSTORE : a single UID FETCH CHANGEDSINCE returns the new and changed
+*   messages, nothing is sent if HIGHESTMODSEQ didn't move.
+* - neither : the messages from the known UIDNEXT on are fetched, flag
+*   changes can't be detected.
+* Expunged messages are looked for with UID SEARCH only when the message count
+* doesn't match the known UIDs. A new UIDVALIDITY invalidates the state : a
+* RESET is reported followed by every message.
+*
+* @param [in] strFolder folder to synchronize, e.g. "INBOX"
+* @param [in] fnChange receives the changes, returns false to abort the sync
+*
+* @retval true   The changes were reported and the state saved.
+* @retval false  A command failed or fnChange aborted the sync.
+*/
+const bool CImapSync::Sync(const std::string& strFolder, const ChangeFnCallback& fnChange)
+{
+   m_uChanges = 0;
+
+   if (!m_bLoaded && !Load())
+      return false;
+
+   CImapSession* pSession = m_oClient.GetSession();
+   if (pSession == nullptr)
+      return false;
+
+   const bool bQResync = pSession->HasCapability("QRESYNC") && pSession->Enable("QRESYNC");
+   const bool bCondStore = bQResync || pSession->HasCapability("CONDSTORE");
+
+   const auto itFolder = m_mapFolders.find(strFolder);
+   const bool bKnown = itFolder != m_mapFolders.end();
+   // the state is updated once every change is accepted
+   ImapFolderState oState = bKnown ? itFolder->second : ImapFolderState();
+
+   unsigned long long uExists = 0;
+   unsigned long long uUidValidity = 0;
+   unsigned long long uUidNext = 0;
+   unsigned long long uHighestModSeq = 0;
+   std::vector<ImapSyncChange> vecFetched;
+   CUIDBitmap oVanished;
+   CUIDBitmap oPresent;
+
+   const CImapSession::UntaggedFnCallback fnUntagged = [&](const CStringView& Response)
+   {
+      unsigned long long uNumber = 0;
+      size_t uPos = 0;
+      if (ReadNumber(Response, uPos, uNumber))
+      {
+         const CStringView Keyword = Response.substr(uPos + 1, Response.find(' ', uPos + 1) - uPos - 1);
+         if (Keyword.EqualsNoCase("EXISTS"))
+            uExists = uNumber;
+         else if (Keyword.EqualsNoCase("EXPUNGE") && uExists > 0)
+            --uExists;
+         else if (Keyword.EqualsNoCase("FETCH"))
+         {
+            ImapSyncChange Change;
+            if (ParseFetch(Response.substr(uPos + 7), Change))
+               vecFetched.push_back(Change);
+         }
+      }
+      else if (Response.substr(0, 9).EqualsNoCase("VANISHED "))
+      {
+         CStringView Set = Response.substr(9);
+         if (Set.substr(0, 10).EqualsNoCase("(EARLIER) "))
+            Set = Set.substr(10);
+         oVanished.AddSequenceSet(Set);
+      }
+      else if (Response.substr(0, 7).EqualsNoCase("SEARCH "))
+      {
+         // "SEARCH 1 4 9"
+         for (uPos = 7; uPos < Response.size(); ++uPos)
+         {
+            if (ReadNumber(Response, uPos, uNumber) && uNumber > 0 && uNumber <= 0xFFFFFFFFull)
+               oPresent.Add(static_cast<uint32_t>(uNumber));
+         }
+      }
+      else if (!ReadResponseCode(Response, "UIDVALIDITY", uUidValidity) && !ReadResponseCode(Response, "UIDNEXT", uUidNext))
+         ReadResponseCode(Response, "HIGHESTMODSEQ", uHighestModSeq); // absent with NOMODSEQ
+   };
+
+   const auto Execute = [&](const std::string& strCommand)
+   {
+      std::string strStatus;
+      if (!pSession->Execute(strCommand, fnUntagged, strStatus))
+         return false;
+
+      if (strStatus.compare(0, 2, "OK") != 0)
+      {
+         if (m_oLog)
+            m_oLog("[ImapSync][Error] " + strCommand + " failed : " + strStatus);
+
+         return false;
+      }
+      return true;
+   };
+
+   const bool bSelectResync = bQResync && bKnown && oState.uHighestModSeq > 0;
+   std::string strParameters;
+   if (bSelectResync)
+      strParameters = "(QRESYNC (" + std::to_string(oState.uUidValidity) + " "
+                    + std::to_string(oState.uHighestModSeq) + "))";
+   else if (bCondStore)
+      strParameters = "(CONDSTORE)";
+
+   if (!pSession->Select(strFolder, true, fnUntagged, strParameters))
+      return false;
+
+   const bool bModSeq = bCondStore && uHighestModSeq > 0;
+   std::vector<ImapSyncChange> vecChanges;
+
+   if (!bKnown || uUidValidity != oState.uUidValidity)
+   {
+      if (bKnown)
+      {
+         ImapSyncChange Reset;
+         Reset.eType = ImapSyncChange::RESET;
+         Reset.uUID = 0;
+         Reset.uModSeq = 0;
+         vecChanges.push_back(Reset);
+      }
+
+      oState = ImapFolderState();
+      vecFetched.clear();
+      oVanished.Clear();
+      if (uExists > 0 && !Execute(bModSeq ? "UID FETCH 1:* (FLAGS MODSEQ)" : "UID FETCH 1:* (FLAGS)"))
+         return false;
+   }
+   else if (bSelectResync && bModSeq)
+   {
+      // the EXAMINE returned the changes
+   }
+   else if (bModSeq && oState.uHighestModSeq > 0)
+   {
+      if (uHighestModSeq != oState.uHighestModSeq
+          && !Execute("UID FETCH 1:* (FLAGS) (CHANGEDSINCE " + std::to_string(oState.uHighestModSeq) + ")"))
+         return false;
+   }
+   else if (uExists > 0 && (uUidNext == 0 || uUidNext > oState.uUidNext))
+   {
+      // "n:*" also returns the last message when n is beyond it
+      if (!Execute("UID FETCH " + std::to_string(oState.uUidNext > 0 ? oState.uUidNext : 1) + ":* (FLAGS)"))
+         return false;
+   }
+
+   // without mod-sequences the flags of known messages can't be compared
+   const bool bFlagsTracked = bModSeq && oState.uHighestModSeq > 0;
+   std::vector<ImapSyncChange> vecNew;
+   CUIDBitmap oAdded;
+   for (ImapSyncChange& Change : vecFetched)
+   {
+      if (oState.oUIDs.Contains(Change.uUID))
+      {
+         if (!bFlagsTracked)
+            continue;
+         Change.eType = ImapSyncChange::FLAGS;
+      }
+      else if (oAdded.Contains(Change.uUID))
+         continue;
+      else
+      {
+         Change.eType = ImapSyncChange::NEW;
+         oAdded.Add(Change.uUID);
+      }
+      vecNew.push_back(std::move(Change));
+   }
+
+   oVanished.Intersect(oState.oUIDs);
+   oState.oUIDs.Union(oAdded);
+   oState.oUIDs.Subtract(oVanished);
+
+   // the count tells if messages were expunged without being reported
+   if (oState.oUIDs.GetCount() != uExists)
+   {
+      oPresent.Clear();
+      if (uExists > 0 && !Execute("UID SEARCH ALL"))
+         return false;
+
+      CUIDBitmap oGone = oState.oUIDs;
+      oGone.Subtract(oPresent);
+      oVanished.Union(oGone);
+      oState.oUIDs.Subtract(oGone);
+   }
+
+   oVanished.ForEach([&vecChanges](uint32_t uUID)
+                     {
+                        ImapSyncChange Change;
+                        Change.eType = ImapSyncChange::VANISHED;
+                        Change.uUID = uUID;
+                        Change.uModSeq = 0;
+                        vecChanges.push_back(Change);
+                        return true;
+                     });
+   vecChanges.insert(vecChanges.end(), vecNew.begin(), vecNew.end());
+
+   for (const ImapSyncChange& Change : vecChanges)
+   {
+      if (!fnChange(Change))
+         return false;
+      ++m_uChanges;
+   }
+
+   oState.uUidValidity = static_cast<unsigned long>(uUidValidity);
+   oState.uUidNext = (uUidNext > 0) ? static_cast<unsigned long>(uUidNext) : oState.oUIDs.GetMax() + 1;
+   oState.uHighestModSeq = bModSeq ? uHighestModSeq : 0;
+
+   // a sync without changes doesn't rewrite the state
+   if (bKnown && m_uChanges == 0 && itFolder->second.uUidNext == oState.uUidNext
+       && itFolder->second.uHighestModSeq == oState.uHighestModSeq)
+      return true;
+
+   m_mapFolders[strFolder] = std::move(oState);
+   return Save();
+}
+
+const ImapFolderState* CImapSync::GetFolderState(const std::string& strFolder) const
+{
+   const auto itFolder = m_mapFolders.find(strFolder);
+   return (itFolder != m_mapFolders.end()) ? &itFolder->second : nullptr;
+}
+
+void CImapSync::ResetFolder(const std::string& strFolder)
+{
+   m_mapFolders.erase(strFolder);
+}
+
+/**
+* @brief extracts the UID, the flags and the mod-sequence of a FETCH response
+*
+* @param [in] Response data items of the response, e.g.
+* "(UID 12 FLAGS (\Seen) MODSEQ (42))"
+* @param [out] Change receives uUID, strFlags and uModSeq
+*
+* @retval true   The response has a UID.
+* @retval false  No UID, the response can't be matched with a message.
+*/
+const bool CImapSync::ParseFetch(const CStringView& Response, ImapSyncChange& Change)
+{
+   Change.eType = ImapSyncChange::FLAGS;
+   Change.uUID = 0;
+   Change.uModSeq = 0;
+   Change.strFlags.clear();
+
+   unsigned long long uUID = 0;
+   CImapSession::ParseFetchItems(Response, [&](const CStringView& Name, const CStringView& Value)
+                                 {
+                                    size_t uPos = 0;
+                                    if (Name.EqualsNoCase("UID"))
+                                       ReadNumber(Value, uPos, uUID);
+                                    else if (Name.EqualsNoCase("FLAGS") && Value.size() >= 2)
+                                       Change.strFlags = Value.substr(1, Value.size() - 2).ToString();
+                                    else if (Name.EqualsNoCase("MODSEQ") && Value.size() >= 2)
+                                    {
+                                       uPos = 1;
+                                       ReadNumber(Value, uPos, Change.uModSeq);
+                                    }
+                                    return true;
+                                 });
+
+   if (uUID == 0 || uUID > 0xFFFFFFFFull)
+      return false;
+
+   Change.uUID = static_cast<uint32_t>(uUID);
+   return true;
+}
@@ -0,0 +1,98 @@
+/*
+* @file ImapSync.h
+* @brief incremental synchronization of IMAP folders (RFC 7162)
+*
+* For each folder the UIDVALIDITY, UIDNEXT, HIGHESTMODSEQ and the UIDs already
+* reported are kept in a state file. With QRESYNC the SELECT itself returns
+* the messages changed and expunged since the last sync, with CONDSTORE a
+* FETCH CHANGEDSINCE does, and without either the new messages are found from
+* UIDNEXT : a sync costs what changed, not the size of the folder.
+*/
+
+#ifndef INCLUDE_IMAPSYNC_H_
+#define INCLUDE_IMAPSYNC_H_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "IMAPClient.h"
+#include "UIDBitmap.h"
+
+/* change found by a sync */
+struct ImapSyncChange
+{
+   enum ChangeType
+   {
+      RESET,      // UIDVALIDITY changed, the UIDs reported before are no longer valid
+      NEW,        // new message, strFlags holds its flags
+      FLAGS,      // the flags of a known message changed
+      VANISHED    // the message was expunged
+   };
+
+   ChangeType           eType;
+   uint32_t             uUID;
+   unsigned long long   uModSeq;   // 0 without CONDSTORE
+   std::string          strFlags;  // e.g. "\Seen \Flagged"
+};
+
+struct ImapFolderState
+{
+   ImapFolderState() : uUidValidity(0), uUidNext(0), uHighestModSeq(0) {}
+
+   unsigned long        uUidValidity;
+   unsigned long        uUidNext;
+   unsigned long long   uHighestModSeq;   // 0 if the server doesn't keep mod-sequences
+   CUIDBitmap           oUIDs;            // UIDs reported so far
+};
+
+class CImapSync
+{
+public:
+   typedef std::function<void(const std::string&)> LogFnCallback;
+   /* receives a change, returns false to abort the sync */
+   typedef std::function<bool(const ImapSyncChange& Change)> ChangeFnCallback;
+
+   CImapSync(CIMAPClient& oClient, const std::string& strStateFile, LogFnCallback oLogger = nullptr);
+
+   // copy constructor and assignment operator are disabled
+   CImapSync(const CImapSync& Copy) = delete;
+   CImapSync& operator=(const CImapSync& Copy) = delete;
+
+   /* read the state file, a missing file is an empty state. Called by the
+    * first Sync if it wasn't called before. */
+   const bool Load();
+   /* rewrite the state file */
+   const bool Save();
+
+   /* pass the changes of a folder since the last sync to fnChange. The state
+    * is saved only if every change was accepted, otherwise the next sync
+    * reports them again. QRESYNC stays enabled on the client's session : its
+    * Idle then reports expunges as VANISHED events. */
+   const bool Sync(const std::string& strFolder, const ChangeFnCallback& fnChange);
+
+   /* nullptr if the folder was never synchronized */
+   const ImapFolderState* GetFolderState(const std::string& strFolder) const;
+   /* forget a folder, its next sync reports every message as new */
+   void ResetFolder(const std::string& strFolder);
+
+   /* number of changes reported by the last Sync */
+   inline size_t GetChangeCount() const { return m_uChanges; }
+
+   /* parses "UID 12 FLAGS (\Seen) MODSEQ (42)" out of a FETCH response,
+    * false if it has no UID */
+   static const bool ParseFetch(const CStringView& Response, ImapSyncChange& Change);
+
+protected:
+   CIMAPClient&                           m_oClient;
+   std::string                            m_strStateFile;
+   bool                                   m_bLoaded;
+   size_t                                 m_uChanges;
+   std::map<std::string, ImapFolderState> m_mapFolders;
+
+   LogFnCallback                          m_oLog;
+};
+
+#endif
@@ -0,0 +1,328 @@
+/**
+* @file ImapTokenizer.cpp
+* @brief implementation of the IMAP response tokenizer
+*/
+
+#include "ImapTokenizer.h"
+
+namespace
+{
+// a larger literal is a malformed response
+const unsigned long long MAX_LITERAL_SIZE = 1ull << 48;
+
+/* characters ending an atom or changing its state, the others are skipped at once */
+struct AtomSpecials
+{
+   AtomSpecials() : bSpecial()
+   {
+      for (const char c : { ' ', '(', ')', '"', '[', ']', '\r', '\n' })
+         bSpecial[static_cast<unsigned char>(c)] = true;
+   }
+   bool bSpecial[256];
+};
+const AtomSpecials ATOM_SPECIALS;
+}
+
+CImapTokenizer::CImapTokenizer(const TokenFnCallback& fnToken) :
+   m_fnToken(fnToken)
+{
+   Reset();
+}
+
+void CImapTokenizer::Reset()
+{
+   m_eState = BETWEEN;
+   m_strToken.clear();
+   m_uDepth = 0;
+   m_uBrackets = 0;
+   m_bEscape = false;
+   m_bEscaped = false;
+   m_uLiteralSize = 0;
+   m_uLiteralLeft = 0;
+   m_bLiteralDigits = false;
+   m_pLiteralSink = nullptr;
+}
+
+/**
+* @brief tokenizes a chunk of the responses
+*
+* Atoms and quoted strings are scanned in tight loops and reported as views of
+* pData, only the part of a token received in a previous chunk is kept in
+* m_strToken. The payload of a literal is handed over as is, in as many pieces
+* as it was received.
+*
+* @param [in] pData next bytes of the responses
+* @param [in] uSize number of bytes
+*
+* @retval true   Successfully tokenized, the last token may be incomplete.
+* @retval false  The callback (or the literal sink) stopped the tokenizer, or
+*                a literal is too large. A "{" that isn't followed by a size,
+*                "}" and the end of the line starts an atom.
+*/
+const bool CImapTokenizer::Write(const char* pData, size_t uSize)
+{
+   const char* const pEnd = pData + uSize;
+   const char* p = pData;
+   const char* pStart = pData; // beginning of the current token in this chunk
+
+   while (p < pEnd)
+   {
+      switch (m_eState)
+      {
+         case BETWEEN:
+         {
+            const char c = *p;
+            if (c == ' ' || c == '\r')
+               ++p;
+            else if (c == '\n')
+            {
+               m_uDepth = 0;
+               if (!Emit(ImapToken::LINE_END, p++, 0))
+                  return false;
+            }
+            else if (c == '(')
+            {
+               ++m_uDepth;
+               if (!Emit(ImapToken::LIST_START, p++, 1))
+                  return false;
+            }
+            else if (c == ')')
+            {
+               if (m_uDepth > 0)
+                  --m_uDepth;
+               if (!Emit(ImapToken::LIST_END, p++, 1))
+                  return false;
+            }
+            else if (c == '"')
+            {
+               m_eState = QUOTED;
+               m_bEscape = false;
+               m_bEscaped = false;
+               pStart = ++p;
+            }
+            else if (c == '{')
+            {
+               // kept until it's known to be a literal
+               m_eState = LITERAL_SIZE;
+               m_strToken.assign(1, c);
+               m_uLiteralSize = 0;
+               m_bLiteralDigits = false;
+               ++p;
+            }
+            else
+            {
+               m_eState = ATOM;
+               m_uBrackets = 0;
+               pStart = p;
+            }
+            break;
+         }
+
+         case ATOM:
+            // a section, e.g. [HEADER.FIELDS (FROM TO)], belongs to the atom
+            for (; p < pEnd; ++p)
+            {
+               while (p < pEnd && !ATOM_SPECIALS.bSpecial[static_cast<unsigned char>(*p)])
+                  ++p;
+               if (p == pEnd)
+                  break;
+
+               const char c = *p;
+               if (c == '[')
+                  ++m_uBrackets;
+               else if (c == ']')
+               {
+                  if (m_uBrackets > 0)
+                     --m_uBrackets;
+               }
+               else if (c == '\r' || c == '\n')
+                  break;
+               else if (m_uBrackets == 0 && (c == ' ' || c == '(' || c == ')' || c == '"'))
+                  break;
+            }
+            if (p == pEnd)
+               break; // continued in the next chunk
+
+            m_eState = BETWEEN;
+            if (!EmitPending(ImapToken::ATOM, pStart, p))
+               return false;
+            break;
+
+         case QUOTED:
+            if (!m_bEscaped)
+            {
+               while (p < pEnd && *p != '"' && *p != '\\' && *p != '\n')
+                  ++p;
+               if (p == pEnd)
+                  break; // continued in the next chunk
+
+               if (*p == '\\')
+               {
+                  // from now on the string is unescaped in m_strToken
+                  m_strToken.append(pStart, p);
+                  m_bEscaped = true;
+                  m_bEscape = true;
+                  ++p;
+                  break;
+               }
+            }
+            else if (m_bEscape)
+            {
+               m_strToken += *p++;
+               m_bEscape = false;
+               break;
+            }
+            else if (*p == '\\')
+            {
+               m_bEscape = true;
+               ++p;
+               break;
+            }
+            else if (*p != '"' && *p != '\n')
+            {
+               m_strToken += *p++;
+               break;
+            }
+
+            // closing quote, or the end of the line in a malformed string
+            m_eState = BETWEEN;
+            if (!EmitPending(ImapToken::STRING, m_bEscaped ? p : pStart, p))
+               return false;
+            if (*p == '"')
+               ++p;
+            break;
+
+         case LITERAL_SIZE:
+         {
+            // {12} or {12+} (LITERAL+)
+            const char c = *p;
+            const bool bPlus = m_strToken.back() == '+';
+            if (c >= '0' && c <= '9' && !bPlus)
+            {
+               // a larger size is reported once the literal is complete
+               if (m_uLiteralSize <= MAX_LITERAL_SIZE)
+                  m_uLiteralSize = m_uLiteralSize * 10 + (c - '0');
+               m_bLiteralDigits = true;
+            }
+            else if (c == '}' && m_bLiteralDigits)
+               m_eState = LITERAL_CRLF;
+            else if (c != '+' || !m_bLiteralDigits || bPlus)
+            {
+               // not a literal but text, e.g. "* OK {maintenance}"
+               m_eState = ATOM;
+               m_uBrackets = 0;
+               pStart = p;
+               break;
+            }
+            m_strToken += *p++;
+            break;
+         }
+
+         case LITERAL_CRLF:
+         {
+            const char c = *p;
+            if (c == '\r')
+            {
+               ++p;
+               break;
+            }
+            if (c != '\n')
+            {
+               // "{12}" followed by text on the same line
+               m_eState = ATOM;
+               m_uBrackets = 0;
+               pStart = p;
+               break;
+            }
+            ++p;
+
+            m_strToken.clear();
+            if (m_uLiteralSize > MAX_LITERAL_SIZE)
+               return false;
+
+            m_eState = LITERAL_DATA;
+            m_uLiteralLeft = m_uLiteralSize;
+            m_pLiteralSink = nullptr;
+
+            ImapToken Token;
+            Token.eType = ImapToken::LITERAL;
+            Token.uSize = m_uLiteralSize;
+            if (!m_fnToken(Token))
+               return false;
+
+            if (m_uLiteralLeft == 0 && !EndLiteral())
+               return false;
+            break;
+         }
+
+         case LITERAL_DATA:
+         {
+            const size_t uChunk = (m_uLiteralLeft < static_cast<unsigned long long>(pEnd - p))
+                                  ? static_cast<size_t>(m_uLiteralLeft) : static_cast<size_t>(pEnd - p);
+            if (m_pLiteralSink != nullptr)
+            {
+               if (!m_pLiteralSink->OnChunk(p, uChunk))
+               {
+                  m_pLiteralSink->OnComplete(false);
+                  m_pLiteralSink = nullptr;
+                  return false;
+               }
+            }
+            else if (!Emit(ImapToken::LITERAL_DATA, p, uChunk))
+               return false;
+
+            p += uChunk;
+            m_uLiteralLeft -= uChunk;
+            if (m_uLiteralLeft == 0 && !EndLiteral())
+               return false;
+            break;
+         }
+      }
+   }
+
+   // keep the beginning of a token split between two chunks
+   if (m_eState == ATOM || (m_eState == QUOTED && !m_bEscaped))
+      m_strToken.append(pStart, pEnd);
+
+   return true;
+}
+
+size_t CImapTokenizer::WriteCallback(void* ptr, size_t size, size_t nmemb, void* data)
+{
+   CImapTokenizer* pTokenizer = reinterpret_cast<CImapTokenizer*>(data);
+   if (pTokenizer == nullptr || !pTokenizer->Write(static_cast<const char*>(ptr), size * nmemb))
+      return 0;
+
+   return size * nmemb;
+}
+
+const bool CImapTokenizer::Emit(const ImapToken::TokenType eType, const char* pData, const size_t uSize)
+{
+   ImapToken Token;
+   Token.eType = eType;
+   Token.Value = CStringView(pData, uSize);
+   Token.uSize = 0;
+   return m_fnToken(Token);
+}
+
+const bool CImapTokenizer::EmitPending(const ImapToken::TokenType eType, const char* pStart, const char* pEnd)
+{
+   if (m_strToken.empty())
+      return Emit(eType, pStart, static_cast<size_t>(pEnd - pStart));
+
+   m_strToken.append(pStart, pEnd);
+   const bool bResult = Emit(eType, m_strToken.data(), m_strToken.size());
+   m_strToken.clear();
+   return bResult;
+}
+
+const bool CImapTokenizer::EndLiteral()
+{
+   m_eState = BETWEEN;
+   if (m_pLiteralSink != nullptr)
+   {
+      m_pLiteralSink->OnComplete(true);
+      m_pLiteralSink = nullptr;
+   }
+   return Emit(ImapToken::LITERAL_END, nullptr, 0);
+}
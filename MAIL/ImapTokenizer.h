@@ -0,0 +1,98 @@
+/*
+* @file ImapTokenizer.h
+* @brief incremental tokenizer of IMAP responses
+*
+* The bytes are tokenized as they are received, in chunks split anywhere :
+* atoms, quoted strings, parenthesized lists and {n} literals are reported to
+* a callback as views of the chunk written, a token is only copied when it's
+* split between two chunks. The payload of a literal (e.g. the body of a
+* FETCH) is never buffered, it's passed on by chunks or to a CMailSink.
+*/
+
+#ifndef INCLUDE_IMAPTOKENIZER_H_
+#define INCLUDE_IMAPTOKENIZER_H_
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+#include "MailSink.h"
+#include "StringView.h"
+
+struct ImapToken
+{
+   enum TokenType
+   {
+      ATOM,          // atom, number or NIL, a [...] section is included : "BODY[HEADER.FIELDS (FROM)]<0>"
+      STRING,        // quoted string without its quotes and escapes
+      LIST_START,
+      LIST_END,
+      LITERAL,       // {n} : uSize is n, the payload follows
+      LITERAL_DATA,  // chunk of the payload (unless it's passed to a sink)
+      LITERAL_END,
+      LINE_END       // end of a response
+   };
+
+   TokenType            eType;
+   CStringView          Value;   // valid during the callback only
+   unsigned long long   uSize;   // LITERAL only
+};
+
+class CImapTokenizer
+{
+public:
+   /* returns false to stop the tokenizer (Write returns false) */
+   typedef std::function<bool(const ImapToken& Token)> TokenFnCallback;
+
+   explicit CImapTokenizer(const TokenFnCallback& fnToken);
+
+   // copy constructor and assignment operator are disabled
+   CImapTokenizer(const CImapTokenizer& Copy) = delete;
+   CImapTokenizer& operator=(const CImapTokenizer& Copy) = delete;
+
+   void Reset();
+
+   /* next bytes of the responses, false if the callback stopped the
+    * tokenizer or a literal is too large (Reset must be called then) */
+   const bool Write(const char* pData, size_t uSize);
+
+   /* called while handling a LITERAL token : its payload is passed to
+    * pSink (OnComplete is called at its end) instead of LITERAL_DATA tokens */
+   inline void SetLiteralSink(CMailSink* pSink) { m_pLiteralSink = pSink; }
+
+   /* nesting level of the lists in the current response */
+   inline unsigned GetDepth() const { return m_uDepth; }
+
+   /* libcurl write callback, data must point to a CImapTokenizer */
+   static size_t WriteCallback(void* ptr, size_t size, size_t nmemb, void* data);
+
+protected:
+   enum State
+   {
+      BETWEEN,       // between two tokens
+      ATOM,
+      QUOTED,
+      LITERAL_SIZE,  // "{123", an atom if it isn't followed by "}" and the end of the line
+      LITERAL_CRLF,  // "}" read, waiting for the end of the line
+      LITERAL_DATA
+   };
+
+   const bool Emit(const ImapToken::TokenType eType, const char* pData, const size_t uSize);
+   /* emits the token started in the chunk (or a previous one) and ending at pEnd */
+   const bool EmitPending(const ImapToken::TokenType eType, const char* pStart, const char* pEnd);
+   const bool EndLiteral();
+
+   TokenFnCallback      m_fnToken;
+   State                m_eState;
+   std::string          m_strToken;         // beginning of a token split between chunks, or "{123}" read so far
+   unsigned             m_uDepth;
+   unsigned             m_uBrackets;        // open [ of the current atom
+   bool                 m_bEscape;          // previous character of the string was a backslash
+   bool                 m_bEscaped;         // the string has escapes, it's unescaped in m_strToken
+   unsigned long long   m_uLiteralSize;
+   unsigned long long   m_uLiteralLeft;
+   bool                 m_bLiteralDigits;
+   CMailSink*           m_pLiteralSink;
+};
+
+#endif
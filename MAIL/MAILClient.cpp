@@ -28,6 +28,8 @@ CMailClient::CMailClient(LogFnCallback Logger) :
    m_pRecipientslist(nullptr),
    m_bProgressCallbackSet(false),
    m_bNoSignal(false),
+   m_bLocalFilePreallocated(false),
+   m_uLocalFileWritten(0),
    m_curlHandle(CurlHandle::instance())
 {
 }
@@ -216,9 +218,56 @@ const bool CMailClient::Perform()
       return false;
    }
 
+   SetSessionOptions(m_pCurlSession);
+
+   if (m_bProgressCallbackSet)
+   {
+      curl_easy_setopt(m_pCurlSession, CURLOPT_PROGRESSFUNCTION, *GetProgressFnCallback());
+      curl_easy_setopt(m_pCurlSession, CURLOPT_PROGRESSDATA, &m_ProgressStruct);
+      curl_easy_setopt(m_pCurlSession, CURLOPT_NOPROGRESS, 0L);
+   }
+
+#ifdef DEBUG_CURL
+   StartCurlDebug();
+#endif
+
+   // Perform the requested operation
+   res = curl_easy_perform(m_pCurlSession);
+
+#ifdef DEBUG_CURL
+   EndCurlDebug();
+#endif
+
+   if (!PostPerform(res))
+   {
+      if (m_eSettingsFlags & ENABLE_LOG)
+         m_oLog(LOG_ERROR_POSTPERFORM_FAILED_MSG);
+
+      return false;
+   }
+
+   if (res != CURLE_OK)
+   {
+      if (m_eSettingsFlags & ENABLE_LOG)
+         m_oLog(StringFormat(LOG_ERROR_CURL_PEFORM_FAILURE_FORMAT, res, curl_easy_strerror(res)));
+
+      return false;
+   }
+   return true;
+}
+
+/**
+* @brief sets the options common to every request of the session : credentials,
+* encryption, certificates, timeout and proxy
+*
+* @param [in] pCurl curl handle to configure
+*
+*/
+void CMailClient::SetSessionOptions(CURL* pCurl)
+{
    /* Set username and password */
-   curl_easy_setopt(m_pCurlSession, CURLOPT_USERNAME, m_strUserName.c_str());
-   curl_easy_setopt(m_pCurlSession, CURLOPT_PASSWORD, m_strPassword.c_str());
+   curl_easy_setopt(pCurl, CURLOPT_USERNAME, m_strUserName.c_str());
+   curl_easy_setopt(pCurl, CURLOPT_PASSWORD, m_strPassword.c_str());
 
 
    if (m_eSslTlsFlags & ENABLE_TLS)
@@ -241,19 +290,19 @@ const bool CMailClient::Perform()
       * self-signed) and add it to the set of certificates that are known to
       * libcurl using CURLOPT_CAINFO and/or CURLOPT_CAPATH. See docs/SSLCERTS
       * for more information. */
-      curl_easy_setopt(m_pCurlSession, CURLOPT_USE_SSL, static_cast<long>(CURLUSESSL_ALL));
+      curl_easy_setopt(pCurl, CURLOPT_USE_SSL, static_cast<long>(CURLUSESSL_ALL));
    }
    if (!s_strCertificationAuthorityFile.empty())
-      curl_easy_setopt(m_pCurlSession, CURLOPT_CAINFO, s_strCertificationAuthorityFile.c_str());
+      curl_easy_setopt(pCurl, CURLOPT_CAINFO, s_strCertificationAuthorityFile.c_str());
 
    if (!m_strSSLCertFile.empty())
-      curl_easy_setopt(m_pCurlSession, CURLOPT_SSLCERT, m_strSSLCertFile.c_str());
+      curl_easy_setopt(pCurl, CURLOPT_SSLCERT, m_strSSLCertFile.c_str());
 
    if (!m_strSSLKeyFile.empty())
-      curl_easy_setopt(m_pCurlSession, CURLOPT_SSLKEY, m_strSSLKeyFile.c_str());
+      curl_easy_setopt(pCurl, CURLOPT_SSLKEY, m_strSSLKeyFile.c_str());
 
    if (!m_strSSLKeyPwd.empty())
-      curl_easy_setopt(m_pCurlSession, CURLOPT_KEYPASSWD, m_strSSLKeyPwd.c_str());
+      curl_easy_setopt(pCurl, CURLOPT_KEYPASSWD, m_strSSLKeyPwd.c_str());
 
    if (!(m_eSettingsFlags & VERIFY_PEER))
    {
@@ -265,7 +314,7 @@ const bool CMailClient::Perform()
       * If you have a CA cert for the server stored someplace else than in the
       * default bundle, then the CURLOPT_CAPATH option might come handy for
       * you. */
-      curl_easy_setopt(m_pCurlSession, CURLOPT_SSL_VERIFYPEER, 0L);
+      curl_easy_setopt(pCurl, CURLOPT_SSL_VERIFYPEER, 0L);
    }
 
    /* If the site you're connecting to uses a different host name that what
@@ -273,63 +322,115 @@ const bool CMailClient::Perform()
    * subjectAltName) fields, libcurl will refuse to connect. You can skip
    * this check, but this will make the connection less secure. */
    if (!(m_eSettingsFlags & VERIFY_HOST))
-      curl_easy_setopt(m_pCurlSession, CURLOPT_SSL_VERIFYHOST, 0L); // use 2L for strict name check
-
-   if (m_bProgressCallbackSet)
-   {
-      curl_easy_setopt(m_pCurlSession, CURLOPT_PROGRESSFUNCTION, *GetProgressFnCallback());
-      curl_easy_setopt(m_pCurlSession, CURLOPT_PROGRESSDATA, &m_ProgressStruct);
-      curl_easy_setopt(m_pCurlSession, CURLOPT_NOPROGRESS, 0L);
-   }
+      curl_easy_setopt(pCurl, CURLOPT_SSL_VERIFYHOST, 0L); // use 2L for strict name check
 
    /* some servers need this */
-   curl_easy_setopt(m_pCurlSession, CURLOPT_USERAGENT, CLIENT_USERAGENT);
+   curl_easy_setopt(pCurl, CURLOPT_USERAGENT, CLIENT_USERAGENT);
 
    if (m_iCurlTimeout > 0)
    {
-      curl_easy_setopt(m_pCurlSession, CURLOPT_TIMEOUT, m_iCurlTimeout);
+      curl_easy_setopt(pCurl, CURLOPT_TIMEOUT, m_iCurlTimeout);
       // don't want to get a sig alarm on timeout
-      curl_easy_setopt(m_pCurlSession, CURLOPT_NOSIGNAL, 1);
+      curl_easy_setopt(pCurl, CURLOPT_NOSIGNAL, 1);
    }
 
    if (!m_strProxy.empty())
    {
-      curl_easy_setopt(m_pCurlSession, CURLOPT_PROXY, m_strProxy.c_str());
-      curl_easy_setopt(m_pCurlSession, CURLOPT_HTTPPROXYTUNNEL, 1L);
+      curl_easy_setopt(pCurl, CURLOPT_PROXY, m_strProxy.c_str());
+      curl_easy_setopt(pCurl, CURLOPT_HTTPPROXYTUNNEL, 1L);
    }
 
    if (m_bNoSignal)
    {
-      curl_easy_setopt(m_pCurlSession, CURLOPT_NOSIGNAL, 1L);
+      curl_easy_setopt(pCurl, CURLOPT_NOSIGNAL, 1L);
    }
+}
 
-#ifdef DEBUG_CURL
-   StartCurlDebug();
-#endif
-
-   // Perform the requested operation
-   res = curl_easy_perform(m_pCurlSession);
-
-#ifdef DEBUG_CURL
-   EndCurlDebug();
-#endif
-
-   if (!PostPerform(res))
+/**
+* @brief opens a raw connection to the server of the session : libcurl connects,
+* negotiates TLS and logs in, then the protocol can be spoken directly
+*
+* @param [in] oConnection connection to open
+*
+* @retval true   Successfully connected and logged in.
+* @retval false  The session isn't initialized or the connection failed.
+*/
+const bool CMailClient::OpenConnection(CMailConnection& oConnection)
+{
+   if (!m_pCurlSession)
    {
       if (m_eSettingsFlags & ENABLE_LOG)
-         m_oLog(LOG_ERROR_POSTPERFORM_FAILED_MSG);
+         m_oLog(LOG_ERROR_CURL_NOT_INIT_MSG);
 
       return false;
    }
 
-   if (res != CURLE_OK)
-   {
-      if (m_eSettingsFlags & ENABLE_LOG)
-         m_oLog(StringFormat(LOG_ERROR_CURL_PEFORM_FAILURE_FORMAT, res, curl_easy_strerror(res)));
-
+   CURL* pCurl = curl_easy_init();
+   if (pCurl == nullptr)
       return false;
+
+   SetSessionOptions(pCurl);
+   curl_easy_setopt(pCurl, CURLOPT_URL, m_strURL.c_str());
+   curl_easy_setopt(pCurl, CURLOPT_CONNECT_ONLY, 1L);
+
+   oConnection.SetTimeout(m_iCurlTimeout);
+   return oConnection.Open(pCurl);
+}
+
+/**
+* @brief closes the connection kept open by the curl session (the server
+* receives QUIT or LOGOUT), the next request opens a new one
+*
+*/
+void CMailClient::CloseCachedConnection()
+{
+   if (!m_pCurlSession)
+      return;
+
+   curl_easy_cleanup(m_pCurlSession);
+   m_pCurlSession = curl_easy_init();
+   m_ProgressStruct.pCurl = m_pCurlSession;
+}
+
+/**
+* @brief opens the local file receiving a message
+*
+* When the size of the message is known, the space of the file is reserved at
+* once instead of growing with each write.
+*
+* @param [in] uExpectedSize size of the message, 0 if unknown
+*
+* @retval true   The file is opened.
+* @retval false  The file couldn't be opened.
+*/
+const bool CMailClient::OpenLocalFile(const unsigned long long uExpectedSize /* = 0 */)
+{
+   m_uLocalFileWritten = 0;
+   m_bLocalFilePreallocated = uExpectedSize > 0 && CFilePreallocator::Preallocate(m_strLocalFile, uExpectedSize);
+
+   if (m_bLocalFilePreallocated)
+      m_fLocalFile.open(m_strLocalFile, std::fstream::in | std::fstream::out | std::fstream::binary);
+   else
+      m_fLocalFile.open(m_strLocalFile, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+
+   return m_fLocalFile.is_open();
+}
+
+void CMailClient::CloseLocalFile()
+{
+   if (!m_fLocalFile.is_open())
+      return;
+
+   if (m_bLocalFilePreallocated)
+   {
+      // the reserved size is only an estimate, tellp can't be trusted after a failed write
+      m_fLocalFile.close();
+      CFilePreallocator::Truncate(m_strLocalFile, m_uLocalFileWritten);
    }
-   return true;
+   else
+      m_fLocalFile.close();
+
+   m_bLocalFilePreallocated = false;
 }
 
 /**
@@ -418,6 +519,29 @@ size_t CMailClient::WriteToFileCallback(void* buff, size_t size, size_t nmemb, v
    return size * nmemb;
 }
 
+/**
+* @brief stores the server response in m_fLocalFile and counts the bytes written
+*
+* @param buff pointer of max size (size*nmemb) to read data from it
+* @param size size parameter
+* @param nmemb memblock parameter
+* @param data pointer to the mail client
+*
+* @return (size * nmemb), 0 if the write failed (the transfer is aborted)
+*/
+size_t CMailClient::WriteToLocalFileCallback(void* buff, size_t size, size_t nmemb, void* data)
+{
+   if ((size == 0) || (nmemb == 0) || ((size*nmemb) < 1) || (data == nullptr))
+      return 0;
+
+   CMailClient* pClient = reinterpret_cast<CMailClient*>(data);
+   if (!pClient->m_fLocalFile.write(reinterpret_cast<char*>(buff), size * nmemb))
+      return 0;
+
+   pClient->m_uLocalFileWritten += size * nmemb;
+   return size * nmemb;
+}
+
 /**
 * @brief sends a line from an already opened file stream (text)
 *
@@ -497,6 +621,73 @@ size_t CMailClient::ReadFromFileCallback(void* ptr, size_t size, size_t nmemb, v
    return 0;
 }
 
+/**
+* @brief sends a memory block in chunks as large as libcurl's buffer,
+* bare LF line breaks are sent as CRLF
+*
+* @param ptr pointer of max size (size*nmemb) to write data to it
+* @param size size parameter
+* @param nmemb memblock parameter
+* @param userp pointer to user data (UploadBufferStruct)
+*
+* @return number of bytes written in ptr, 0 at the end of the data
+*/
+size_t CMailClient::ReadFromMemoryCallback(void* ptr, size_t size, size_t nmemb, void* userp)
+{
+   if ((size == 0) || (nmemb == 0) || (userp == nullptr))
+      return 0;
+
+   UploadBufferStruct* pUpload = reinterpret_cast<UploadBufferStruct*>(userp);
+   char* pOut = reinterpret_cast<char*>(ptr);
+   const size_t uCapacity = size * nmemb;
+   size_t uWritten = 0;
+
+   if (pUpload->uPrefixOffset < pUpload->strPrefix.size())
+   {
+      const size_t uCopy = std::min(uCapacity, pUpload->strPrefix.size() - pUpload->uPrefixOffset);
+      std::memcpy(pOut, pUpload->strPrefix.data() + pUpload->uPrefixOffset, uCopy);
+      pUpload->uPrefixOffset += uCopy;
+      uWritten += uCopy;
+   }
+
+   while (uWritten < uCapacity && pUpload->uOffset < pUpload->uSize)
+   {
+      const char* pStart = pUpload->pData + pUpload->uOffset;
+      const size_t uAvailable = std::min(uCapacity - uWritten, pUpload->uSize - pUpload->uOffset);
+
+      // copy up to the next line break at once
+      const char* pLF = static_cast<const char*>(std::memchr(pStart, '\n', uAvailable));
+      const size_t uRun = (pLF == nullptr) ? uAvailable : static_cast<size_t>(pLF - pStart);
+
+      if (uRun > 0)
+      {
+         std::memcpy(pOut + uWritten, pStart, uRun);
+         uWritten += uRun;
+         pUpload->uOffset += uRun;
+         pUpload->bLastWasCR = (pStart[uRun - 1] == '\r');
+      }
+
+      if (pLF == nullptr)
+         continue;
+
+      if (pUpload->bLastWasCR)
+      {
+         pOut[uWritten++] = '\n';
+      }
+      else
+      {
+         if (uCapacity - uWritten < 2)
+            break;
+         pOut[uWritten++] = '\r';
+         pOut[uWritten++] = '\n';
+      }
+      ++pUpload->uOffset;
+      pUpload->bLastWasCR = false;
+   }
+
+   return uWritten;
+}
+
 #ifdef DEBUG_CURL
 void CMailClient::SetCurlTraceLogDirectory(const std::string& strPath)
 {
@@ -35,6 +35,8 @@
 #include <memory>          // std::unique_ptr
 
 #include "CurlHandle.h"
+#include "FilePreallocator.h"
+#include "MailConnection.h"
 
 class CMailClient
 {
@@ -55,6 +57,24 @@ public:
       void*  pOwner;
    };
 
+   // Memory upload source - data pointer of ReadFromMemoryCallback references it
+   struct UploadBufferStruct
+   {
+      UploadBufferStruct() : pData(nullptr), uSize(0), uOffset(0), uPrefixOffset(0), bLastWasCR(false) {}
+      void Reset(const char* pNewData, size_t uNewSize)
+      {
+         pData = pNewData; uSize = uNewSize; uOffset = 0;
+         strPrefix.clear(); uPrefixOffset = 0; bLastWasCR = false;
+      }
+      /* sent as is before the data (e.g. a DKIM-Signature header) */
+      std::string strPrefix;
+      const char* pData;
+      size_t      uSize;
+      size_t      uOffset;
+      size_t      uPrefixOffset;
+      bool        bLastWasCR;
+   };
+
    enum SettingsFlag
    {
       NO_FLAGS    = 0x00,
@@ -131,15 +151,27 @@ protected:
    virtual const bool PrePerform() { return true; }
    /* common operations to SMTP, POP & IMAP are performed here */
    const bool Perform();
+   /* credentials, encryption, certificates, timeout and proxy of the session */
+   void SetSessionOptions(CURL* pCurl);
+   /* raw connection logged in with the settings of the session */
+   const bool OpenConnection(CMailConnection& oConnection);
+   /* releases the connection libcurl keeps open between requests */
+   void CloseCachedConnection();
+   /* opens m_strLocalFile for writing, its space is preallocated if the size is known */
+   const bool OpenLocalFile(const unsigned long long uExpectedSize = 0);
+   /* closes m_fLocalFile, a preallocated file is cut to the written size */
+   void CloseLocalFile();
    virtual const bool PostPerform(CURLcode ePerformCode) { ePerformCode;  return true; }
    virtual inline void ParseURL(std::string& strURL) { strURL; }
 
    // Curl callbacks
    static size_t WriteInStringCallback(void* ptr, size_t size, size_t nmemb, void* data);
    static size_t WriteToFileCallback(void* ptr, size_t size, size_t nmemb, void* data);
+   static size_t WriteToLocalFileCallback(void* ptr, size_t size, size_t nmemb, void* data);
    static size_t ReadLineFromFileStreamCallback(void* ptr, size_t size, size_t nmemb, void* stream);
    static size_t ReadLineFromStringStreamCallback(void* ptr, size_t size, size_t nmemb, void* userp);
    static size_t ReadFromFileCallback(void* ptr, size_t size, size_t nmemb, void* stream);
+   static size_t ReadFromMemoryCallback(void* ptr, size_t size, size_t nmemb, void* userp);
 
    // Helper for error log printing
    static std::string StringFormat(const std::string strFormat, ...);
@@ -161,6 +193,8 @@ protected:
     * or input string stream operations */ 
    std::string          m_strLocalFile;
    std::fstream         m_fLocalFile;
+   bool                 m_bLocalFilePreallocated;
+   unsigned long long   m_uLocalFileWritten;   // bytes written by WriteToLocalFileCallback
    std::istringstream   m_ssString;
 
    // SSL
@@ -0,0 +1,552 @@
+/**
+* @file MIMESplitter.cpp
+* @brief implementation of the incremental MIME splitter
+*/
+
+#include "MIMESplitter.h"
+#include "HeaderParser.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+// headers bigger than that are cut (protects the buffer against malformed e-mails)
+const size_t MAX_HEADERS_SIZE = 64 * 1024;
+
+inline bool IsWSP(const char c) { return c == ' ' || c == '\t'; }
+
+std::string ToLower(std::string strText)
+{
+   std::transform(strText.begin(), strText.end(), strText.begin(), ::tolower);
+   return strText;
+}
+
+std::string Trim(const std::string& strText)
+{
+   const size_t uStart = strText.find_first_not_of(" \t\r\n");
+   if (uStart == std::string::npos)
+      return std::string();
+   const size_t uEnd = strText.find_last_not_of(" \t\r\n");
+   return strText.substr(uStart, uEnd - uStart + 1);
+}
+
+std::string PercentDecode(const std::string& strText)
+{
+   std::string strDecoded;
+   for (size_t i = 0; i < strText.size(); ++i)
+   {
+      if (strText[i] == '%' && i + 2 < strText.size() && isxdigit(strText[i + 1]) && isxdigit(strText[i + 2]))
+      {
+         strDecoded += static_cast<char>(std::stoi(strText.substr(i + 1, 2), nullptr, 16));
+         i += 2;
+      }
+      else
+         strDecoded += strText[i];
+   }
+   return strDecoded;
+}
+}
+
+/**
+* @brief constructor of the MIME splitter
+*
+* @param [in] strDirectory existing directory where the parts are written
+* @param [in] oLogger optional error logger
+*/
+CMIMESplitter::CMIMESplitter(const std::string& strDirectory, LogFnCallback oLogger /* = nullptr */) :
+   m_strDirectory(strDirectory),
+   m_eState(MIME_HEADERS),
+   m_bAttachmentsOnly(false),
+   m_bError(false),
+   m_bInLeaf(false),
+   m_eEncoding(ENC_NONE),
+   m_oLog(oLogger)
+{
+   if (!m_strDirectory.empty()
+#ifdef WINDOWS
+       && m_strDirectory.at(m_strDirectory.length() - 1) != '\\')
+   {
+      m_strDirectory += '\\';
+   }
+#else
+       && m_strDirectory.at(m_strDirectory.length() - 1) != '/')
+   {
+      m_strDirectory += '/';
+   }
+#endif
+}
+
+CMIMESplitter::~CMIMESplitter()
+{
+   EndPart();
+}
+
+void CMIMESplitter::Reset()
+{
+   EndPart();
+   m_strBuffer.clear();
+   m_vecMultiparts.clear();
+   m_vecParts.clear();
+   m_setFileNames.clear();
+   m_eState = MIME_HEADERS;
+   m_bError = false;
+}
+
+/**
+* @brief parses the next chunk of the e-mail
+*
+* @param [in] pData chunk of the raw e-mail
+* @param [in] uSize size of the chunk
+*
+* @retval true   The chunk was processed.
+* @retval false  A part couldn't be written (see HasError()).
+*/
+const bool CMIMESplitter::Write(const char* pData, size_t uSize)
+{
+   if (m_bError)
+      return false;
+
+   m_strBuffer.append(pData, uSize);
+   return Process(false);
+}
+
+const bool CMIMESplitter::Finish()
+{
+   if (m_bError)
+      return false;
+
+   const bool bRes = Process(true);
+   EndPart();
+   m_strBuffer.clear();
+   return bRes;
+}
+
+/**
+* @brief stores the server response in the splitter
+*
+* @param ptr pointer of max size (size*nmemb) to read data from it
+* @param size size parameter
+* @param nmemb memblock parameter
+* @param data pointer to user data (CMIMESplitter)
+*
+* @return (size * nmemb), 0 to abort the transfer when a part can't be written
+*/
+size_t CMIMESplitter::WriteCallback(void* ptr, size_t size, size_t nmemb, void* data)
+{
+   CMIMESplitter* pSplitter = reinterpret_cast<CMIMESplitter*>(data);
+   if (pSplitter == nullptr)
+      return 0;
+
+   return pSplitter->Write(reinterpret_cast<char*>(ptr), size * nmemb) ? size * nmemb : 0;
+}
+
+/**
+* @brief consumes as much of the buffer as possible. Only the bytes that may
+* belong to a delimiter split between two chunks (or incomplete headers) are kept.
+*/
+const bool CMIMESplitter::Process(const bool bFinal)
+{
+   while (true)
+   {
+      switch (m_eState)
+      {
+         case MIME_HEADERS:
+         {
+            // headers end with an empty line
+            size_t uHeadersEnd = std::string::npos;
+            size_t uBodyStart = 0;
+            if (m_strBuffer.compare(0, 2, "\r\n") == 0)
+            {
+               uHeadersEnd = 0;
+               uBodyStart = 2;
+            }
+            else if (m_strBuffer.compare(0, 1, "\n") == 0)
+            {
+               uHeadersEnd = 0;
+               uBodyStart = 1;
+            }
+            else
+            {
+               for (size_t uLF = m_strBuffer.find('\n'); uLF != std::string::npos; uLF = m_strBuffer.find('\n', uLF + 1))
+               {
+                  if (m_strBuffer.compare(uLF + 1, 1, "\n") == 0)
+                  {
+                     uHeadersEnd = uLF + 1;
+                     uBodyStart = uLF + 2;
+                     break;
+                  }
+                  if (m_strBuffer.compare(uLF + 1, 2, "\r\n") == 0)
+                  {
+                     uHeadersEnd = uLF + 1;
+                     uBodyStart = uLF + 3;
+                     break;
+                  }
+               }
+            }
+
+            if (uHeadersEnd == std::string::npos)
+            {
+               if (!bFinal && m_strBuffer.size() < MAX_HEADERS_SIZE)
+                  return true;
+               uHeadersEnd = uBodyStart = m_strBuffer.size();
+            }
+
+            const std::string strHeaders = m_strBuffer.substr(0, uHeadersEnd);
+            m_strBuffer.erase(0, uBodyStart);
+            if (!StartPart(strHeaders))
+               return false;
+            break;
+         }
+
+         case MIME_BODY:
+         {
+            if (m_vecMultiparts.empty())
+            {
+               // single part e-mail
+               const bool bRes = EmitContent(m_strBuffer.data(), m_strBuffer.size());
+               m_strBuffer.clear();
+               return bRes;
+            }
+
+            const Multipart& oMultipart = m_vecMultiparts.back();
+            const size_t uDelimiter = FindDelimiter(oMultipart, m_strBuffer.data(), m_strBuffer.size());
+
+            if (uDelimiter == std::string::npos)
+            {
+               if (bFinal)
+               {
+                  // unterminated multipart
+                  const bool bRes = EmitContent(m_strBuffer.data(), m_strBuffer.size());
+                  m_strBuffer.clear();
+                  EndPart();
+                  m_eState = MIME_DONE;
+                  return bRes;
+               }
+
+               // the end of the buffer may be the beginning of a delimiter (and its CR)
+               const size_t uKeep = std::min(m_strBuffer.size(), oMultipart.strDelimiter.size());
+               const bool bRes = EmitContent(m_strBuffer.data(), m_strBuffer.size() - uKeep);
+               m_strBuffer.erase(0, m_strBuffer.size() - uKeep);
+               return bRes;
+            }
+
+            // the line break before the delimiter belongs to the delimiter
+            size_t uContentEnd = uDelimiter;
+            if (uContentEnd > 0 && m_strBuffer[uContentEnd - 1] == '\r')
+               --uContentEnd;
+            if (!EmitContent(m_strBuffer.data(), uContentEnd))
+               return false;
+
+            const size_t uAfter = uDelimiter + oMultipart.strDelimiter.size();
+            if (uAfter + 2 > m_strBuffer.size() && !bFinal)
+            {
+               // wait for the characters telling if it's the close delimiter
+               m_strBuffer.erase(0, uDelimiter);
+               return true;
+            }
+
+            EndPart();
+            if (m_strBuffer.compare(uAfter, 2, "--") == 0)
+            {
+               // close delimiter : back in the parent multipart (epilogue is ignored)
+               m_vecMultiparts.pop_back();
+               m_strBuffer.erase(0, uAfter + 2);
+               m_eState = m_vecMultiparts.empty() ? MIME_DONE : MIME_BODY;
+            }
+            else
+            {
+               m_strBuffer.erase(0, uAfter);
+               m_eState = MIME_SKIP_LINE;
+            }
+            break;
+         }
+
+         case MIME_SKIP_LINE:
+         {
+            // transport padding after a delimiter
+            const size_t uLF = m_strBuffer.find('\n');
+            if (uLF == std::string::npos)
+            {
+               m_strBuffer.clear();
+               if (bFinal)
+                  m_eState = MIME_DONE;
+               return true;
+            }
+            m_strBuffer.erase(0, uLF + 1);
+            m_eState = MIME_HEADERS;
+            break;
+         }
+
+         case MIME_DONE:
+         default:
+            m_strBuffer.clear();
+            return true;
+      }
+   }
+}
+
+/**
+* @brief starts a new part from its headers : opens a multipart or the output
+* file of a leaf part
+*/
+const bool CMIMESplitter::StartPart(const std::string& strHeaders)
+{
+   std::string strPartId;
+   if (!m_vecMultiparts.empty())
+   {
+      Multipart& oParent = m_vecMultiparts.back();
+      strPartId = std::to_string(++oParent.uChildren);
+      if (!oParent.strPartId.empty())
+         strPartId = oParent.strPartId + "." + strPartId;
+   }
+
+   CHeaderParser oHeaders;
+   oHeaders.Parse(strHeaders);
+
+   const std::string strContentType = Trim(CHeaderParser::Unfold(oHeaders.GetValue("Content-Type")));
+   std::string strType = ToLower(Trim(strContentType.substr(0, strContentType.find(';'))));
+   if (strType.empty())
+      strType = "text/plain";
+
+   const std::string strBoundary = GetParameter(strContentType, "boundary");
+   if (strType.compare(0, 10, "multipart/") == 0 && !strBoundary.empty())
+   {
+      Multipart oMultipart;
+      oMultipart.strDelimiter = "\n--" + strBoundary;
+      oMultipart.strPartId = strPartId;
+      oMultipart.uChildren = 0;
+
+      // Horspool bad character table
+      const size_t uLength = oMultipart.strDelimiter.size();
+      std::fill(oMultipart.aSkip, oMultipart.aSkip + 256, uLength);
+      for (size_t i = 0; i + 1 < uLength; ++i)
+         oMultipart.aSkip[static_cast<unsigned char>(oMultipart.strDelimiter[i])] = uLength - 1 - i;
+
+      m_vecMultiparts.push_back(oMultipart);
+
+      // the first delimiter may directly follow the headers
+      m_strBuffer.insert(0, "\n");
+      m_eState = MIME_BODY;
+      return true;
+   }
+
+   PartInfo oPart;
+   oPart.strPartId = strPartId.empty() ? "1" : strPartId;
+   oPart.strContentType = strType;
+   oPart.strCharset = GetParameter(strContentType, "charset");
+   oPart.strEncoding = ToLower(Trim(CHeaderParser::Unfold(oHeaders.GetValue("Content-Transfer-Encoding"))));
+
+   const std::string strDisposition = CHeaderParser::Unfold(oHeaders.GetValue("Content-Disposition"));
+   oPart.strFileName = GetParameter(strDisposition, "filename");
+   if (oPart.strFileName.empty())
+      oPart.strFileName = GetParameter(strContentType, "name");
+   // many mailers encode the file name as an RFC 2047 encoded word instead of using RFC 2231
+   if (oPart.strFileName.find("=?") != std::string::npos)
+      oPart.strFileName = CMailCodec::DecodeHeader(oPart.strFileName);
+   oPart.bAttachment = !oPart.strFileName.empty() || ToLower(Trim(strDisposition)).compare(0, 10, "attachment") == 0;
+
+   if (oPart.strEncoding == "base64")
+      m_eEncoding = ENC_BASE64;
+   else if (oPart.strEncoding == "quoted-printable")
+      m_eEncoding = ENC_QP;
+   else
+      m_eEncoding = ENC_NONE;
+   m_oBase64.Reset();
+   m_oQuotedPrintable.Reset();
+
+   if (!m_bAttachmentsOnly || oPart.bAttachment)
+   {
+      oPart.strPath = MakeFilePath(oPart);
+      m_ofPart.open(oPart.strPath, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+      if (!m_ofPart)
+      {
+         if (m_oLog)
+            m_oLog("[MIMESplitter][Error] Unable to open local file " + oPart.strPath + ".");
+
+         m_bError = true;
+         return false;
+      }
+   }
+
+   m_vecParts.push_back(oPart);
+   m_bInLeaf = true;
+   m_eState = MIME_BODY;
+   return true;
+}
+
+const bool CMIMESplitter::EmitContent(const char* pData, size_t uSize)
+{
+   if (!m_bInLeaf || uSize == 0)
+      return true;
+
+   const char* pOutput = pData;
+   size_t uOutput = uSize;
+
+   if (m_eEncoding != ENC_NONE)
+   {
+      m_vecDecoded.resize(uSize + 3);
+      uOutput = (m_eEncoding == ENC_BASE64) ? m_oBase64.Decode(pData, uSize, m_vecDecoded.data())
+                                            : m_oQuotedPrintable.Decode(pData, uSize, m_vecDecoded.data());
+      pOutput = m_vecDecoded.data();
+   }
+
+   m_vecParts.back().uSize += uOutput;
+
+   if (m_ofPart.is_open() && !m_ofPart.write(pOutput, uOutput))
+   {
+      if (m_oLog)
+         m_oLog("[MIMESplitter][Error] Unable to write local file " + m_vecParts.back().strPath + ".");
+
+      m_bError = true;
+      return false;
+   }
+   return true;
+}
+
+void CMIMESplitter::EndPart()
+{
+   if (!m_bInLeaf)
+      return;
+
+   if (m_eEncoding == ENC_QP)
+   {
+      char szRemaining[3];
+      const size_t uRemaining = m_oQuotedPrintable.Finish(szRemaining);
+      m_vecParts.back().uSize += uRemaining;
+      if (m_ofPart.is_open())
+         m_ofPart.write(szRemaining, uRemaining);
+   }
+
+   if (m_ofPart.is_open())
+      m_ofPart.close();
+   m_bInLeaf = false;
+}
+
+/**
+* @brief builds a unique path for a part from its file name or its type
+*/
+std::string CMIMESplitter::MakeFilePath(const PartInfo& oPart)
+{
+   std::string strName = oPart.strFileName;
+   for (char& c : strName)
+   {
+      if (c == '/' || c == '\\' || c == ':' || static_cast<unsigned char>(c) < 0x20)
+         c = '_';
+   }
+   if (strName.empty() || strName == "." || strName == "..")
+   {
+      strName = "part_" + oPart.strPartId;
+      if (oPart.strContentType == "text/plain")
+         strName += ".txt";
+      else if (oPart.strContentType == "text/html")
+         strName += ".html";
+      else if (oPart.strContentType == "message/rfc822")
+         strName += ".eml";
+      else
+         strName += ".bin";
+   }
+
+   // two attachments may have the same name, and the prefixed name may be
+   // taken too : the file is truncated when it's opened
+   if (!m_setFileNames.insert(strName).second)
+   {
+      const std::string strBase = strName;
+      strName = oPart.strPartId + "_" + strBase;
+      for (unsigned uSuffix = 2; !m_setFileNames.insert(strName).second; ++uSuffix)
+         strName = oPart.strPartId + "_" + std::to_string(uSuffix) + "_" + strBase;
+   }
+
+   return m_strDirectory + strName;
+}
+
+/**
+* @brief Boyer-Moore-Horspool search of a multipart delimiter
+*
+* @return offset of the delimiter or std::string::npos
+*/
+size_t CMIMESplitter::FindDelimiter(const Multipart& oMultipart, const char* pData, size_t uSize)
+{
+   const std::string& strDelimiter = oMultipart.strDelimiter;
+   const size_t uLength = strDelimiter.size();
+   const char cLast = strDelimiter[uLength - 1];
+
+   size_t uPos = 0;
+   while (uPos + uLength <= uSize)
+   {
+      const char c = pData[uPos + uLength - 1];
+      if (c == cLast && std::memcmp(pData + uPos, strDelimiter.data(), uLength - 1) == 0)
+         return uPos;
+      uPos += oMultipart.aSkip[static_cast<unsigned char>(c)];
+   }
+   return std::string::npos;
+}
+
+/**
+* @brief returns the unfolded value of a header field
+*
+* @param [in] strHeaders header block
+* @param [in] strName field name (case insensitive)
+*/
+std::string CMIMESplitter::GetHeaderValue(const std::string& strHeaders, const std::string& strName)
+{
+   CHeaderParser oParser;
+   oParser.Parse(strHeaders);
+   return Trim(CHeaderParser::Unfold(oParser.GetValue(strName)));
+}
+
+/**
+* @brief returns a parameter of a structured field value, RFC 2231 extended
+* values (name*=charset'lang'value) are percent decoded
+*
+* @param [in] strValue e.g. multipart/mixed; boundary="abc"
+* @param [in] strName parameter name (case insensitive)
+*/
+std::string CMIMESplitter::GetParameter(const std::string& strValue, const std::string& strName)
+{
+   size_t uPos = strValue.find(';');
+   while (uPos != std::string::npos)
+   {
+      ++uPos;
+      const size_t uEqual = strValue.find('=', uPos);
+      if (uEqual == std::string::npos)
+         break;
+
+      const std::string strKey = ToLower(Trim(strValue.substr(uPos, uEqual - uPos)));
+
+      // parse the value (quoted string or token)
+      std::string strParam;
+      size_t uNext = uEqual + 1;
+      while (uNext < strValue.size() && IsWSP(strValue[uNext]))
+         ++uNext;
+      if (uNext < strValue.size() && strValue[uNext] == '"')
+      {
+         for (++uNext; uNext < strValue.size() && strValue[uNext] != '"'; ++uNext)
+         {
+            if (strValue[uNext] == '\\' && uNext + 1 < strValue.size())
+               ++uNext;
+            strParam += strValue[uNext];
+         }
+         uNext = strValue.find(';', uNext);
+      }
+      else
+      {
+         const size_t uEnd = strValue.find(';', uNext);
+         strParam = Trim(strValue.substr(uNext, (uEnd == std::string::npos) ? std::string::npos : uEnd - uNext));
+         uNext = uEnd;
+      }
+
+      if (strKey == ToLower(strName))
+         return strParam;
+
+      if (strKey == ToLower(strName) + "*")
+      {
+         const size_t uQuote = strParam.find('\'');
+         const size_t uLangEnd = (uQuote == std::string::npos) ? uQuote : strParam.find('\'', uQuote + 1);
+         return PercentDecode((uLangEnd == std::string::npos) ? strParam : strParam.substr(uLangEnd + 1));
+      }
+
+      uPos = uNext;
+   }
+   return std::string();
+}
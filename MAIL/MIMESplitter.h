@@ -0,0 +1,125 @@
+/*
+* @file MIMESplitter.h
+* @brief incremental MIME (RFC 2045/2046) parser writing every part of an
+* e-mail in its own file while the e-mail is being downloaded
+*
+* It can be used as a libcurl write callback : the boundaries are searched
+* (Boyer-Moore-Horspool) in the received chunks, base64 and quoted-printable
+* parts are decoded on the fly and written to disk, so the whole e-mail is
+* never held in memory nor stored in a temporary file.
+*/
+
+#ifndef INCLUDE_MIMESPLITTER_H_
+#define INCLUDE_MIMESPLITTER_H_
+
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "MailCodec.h"
+#include "MailSink.h"
+
+class CMIMESplitter : public CMailSink
+{
+public:
+   typedef std::function<void(const std::string&)> LogFnCallback;
+
+   // manifest entry, one for each leaf part
+   struct PartInfo
+   {
+      PartInfo() : uSize(0), bAttachment(false) {}
+      std::string strPartId;       // IMAP section number ("1", "2.1" ...)
+      std::string strContentType;  // lower case "type/subtype"
+      std::string strCharset;
+      std::string strEncoding;     // Content-Transfer-Encoding (lower case)
+      std::string strFileName;     // file name announced by the e-mail, if any
+      std::string strPath;         // file holding the decoded part, empty if not saved
+      size_t      uSize;           // decoded size
+      bool        bAttachment;
+   };
+
+   explicit CMIMESplitter(const std::string& strDirectory, LogFnCallback oLogger = nullptr);
+   ~CMIMESplitter();
+
+   // copy constructor and assignment operator are disabled
+   CMIMESplitter(const CMIMESplitter& Copy) = delete;
+   CMIMESplitter& operator=(const CMIMESplitter& Copy) = delete;
+
+   /* get ready for a new e-mail, the manifest is cleared */
+   void Reset();
+
+   /* feed the next chunk of the raw e-mail */
+   const bool Write(const char* pData, size_t uSize);
+
+   /* end of the e-mail : flushes and closes the last part */
+   const bool Finish();
+
+   /* CMailSink : a splitter can consume any retrieval (Reset it before) */
+   bool OnChunk(const char* pData, size_t uSize) override { return Write(pData, uSize); }
+   void OnComplete(const bool) override { Finish(); }
+
+   /* only save the attachments (parts with a file name or an attachment disposition),
+    * the other parts are still listed in the manifest */
+   inline void SetAttachmentsOnly(const bool& bAttachmentsOnly) { m_bAttachmentsOnly = bAttachmentsOnly; }
+
+   inline const std::vector<PartInfo>& GetParts() const { return m_vecParts; }
+   inline const std::string& GetDirectory() const { return m_strDirectory; }
+   inline const bool HasError() const { return m_bError; }
+
+   /* libcurl write callback, data must point to a CMIMESplitter */
+   static size_t WriteCallback(void* ptr, size_t size, size_t nmemb, void* data);
+
+   /* value of a header field (unfolded) in a header block, empty if not found */
+   static std::string GetHeaderValue(const std::string& strHeaders, const std::string& strName);
+   /* parameter of a structured header value, e.g. boundary in a Content-Type */
+   static std::string GetParameter(const std::string& strValue, const std::string& strName);
+
+protected:
+   enum State
+   {
+      MIME_HEADERS,
+      MIME_BODY,
+      MIME_SKIP_LINE,
+      MIME_DONE
+   };
+
+   // an open multipart : its delimiter and the skip table used to search it
+   struct Multipart
+   {
+      std::string strDelimiter;    // "\n--" + boundary
+      std::string strPartId;
+      unsigned    uChildren;
+      size_t      aSkip[256];
+   };
+
+   const bool Process(const bool bFinal);
+   const bool StartPart(const std::string& strHeaders);
+   const bool EmitContent(const char* pData, size_t uSize);
+   void EndPart();
+   std::string MakeFilePath(const PartInfo& oPart);
+   static size_t FindDelimiter(const Multipart& oMultipart, const char* pData, size_t uSize);
+
+   std::string             m_strDirectory;
+   std::string             m_strBuffer;
+   std::vector<Multipart>  m_vecMultiparts;
+   std::vector<PartInfo>   m_vecParts;
+   std::set<std::string>   m_setFileNames;
+   State                   m_eState;
+   bool                    m_bAttachmentsOnly;
+   bool                    m_bError;
+
+   // current leaf part
+   bool                    m_bInLeaf;
+   std::ofstream           m_ofPart;
+   enum { ENC_NONE, ENC_BASE64, ENC_QP } m_eEncoding;
+   CMailCodec::Base64Decoder           m_oBase64;
+   CMailCodec::QuotedPrintableDecoder  m_oQuotedPrintable;
+   std::vector<char>       m_vecDecoded;
+
+   LogFnCallback           m_oLog;
+};
+
+#endif
@@ -0,0 +1,500 @@
+/**
+* @file MailCodec.cpp
+* @brief implementation of the content transfer encodings
+*/
+
+#include "MailCodec.h"
+#include "Charset.h"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MAILCODEC_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+const char s_szBase64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// value of a base64 digit, 64 for '=' and 0xFF for characters to skip (line breaks etc...)
+struct Base64Table
+{
+   Base64Table()
+   {
+      for (int i = 0; i < 256; ++i)
+         aValues[i] = 0xFF;
+      for (int i = 0; i < 64; ++i)
+         aValues[static_cast<unsigned char>(s_szBase64Alphabet[i])] = static_cast<unsigned char>(i);
+      aValues[static_cast<unsigned char>('=')] = 64;
+   }
+   unsigned char aValues[256];
+};
+const Base64Table s_oBase64Table;
+
+inline int HexValue(const char c)
+{
+   if (c >= '0' && c <= '9') return c - '0';
+   if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+   if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+   return -1;
+}
+
+inline bool IsLWSP(const char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+inline unsigned CountTrailingZeros(unsigned int uMask)
+{
+#ifdef _MSC_VER
+   unsigned long uIndex;
+   _BitScanForward(&uIndex, uMask);
+   return static_cast<unsigned>(uIndex);
+#else
+   return static_cast<unsigned>(__builtin_ctz(uMask));
+#endif
+}
+
+// number of leading bytes that can be copied as is from a header value : stops
+// at '=' (possible encoded word), line breaks and 8-bit bytes. 32 bytes are
+// checked at once with AVX2 or SSE2.
+size_t PlainTextPrefix(const char* pData, size_t uSize)
+{
+   size_t i = 0;
+
+#if defined(__AVX2__)
+   const __m256i oEqual = _mm256_set1_epi8('=');
+   const __m256i oCR = _mm256_set1_epi8('\r');
+   const __m256i oLF = _mm256_set1_epi8('\n');
+   for (; i + 32 <= uSize; i += 32)
+   {
+      const __m256i oChunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pData + i));
+      const __m256i oSpecial = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(oChunk, oEqual),
+                                                               _mm256_cmpeq_epi8(oChunk, oCR)),
+                                               _mm256_or_si256(_mm256_cmpeq_epi8(oChunk, oLF), oChunk));
+      const unsigned int uMask = static_cast<unsigned int>(_mm256_movemask_epi8(oSpecial));
+      if (uMask != 0)
+         return i + CountTrailingZeros(uMask);
+   }
+#elif defined(MAILCODEC_SSE2)
+   const __m128i oEqual = _mm_set1_epi8('=');
+   const __m128i oCR = _mm_set1_epi8('\r');
+   const __m128i oLF = _mm_set1_epi8('\n');
+   for (; i + 32 <= uSize; i += 32)
+   {
+      unsigned int uMask = 0;
+      for (int iHalf = 0; iHalf < 2; ++iHalf)
+      {
+         const __m128i oChunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + i + 16 * iHalf));
+         const __m128i oSpecial = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(oChunk, oEqual),
+                                                            _mm_cmpeq_epi8(oChunk, oCR)),
+                                               _mm_or_si128(_mm_cmpeq_epi8(oChunk, oLF), oChunk));
+         uMask |= static_cast<unsigned int>(_mm_movemask_epi8(oSpecial)) << (16 * iHalf);
+      }
+      if (uMask != 0)
+         return i + CountTrailingZeros(uMask);
+   }
+#endif
+
+   for (; i < uSize; ++i)
+   {
+      const char c = pData[i];
+      if (c == '=' || c == '\r' || c == '\n' || (static_cast<unsigned char>(c) & 0x80))
+         break;
+   }
+   return i;
+}
+
+// appends unencoded header text : line breaks are dropped (unfolding), 8-bit
+// bytes are kept when they form valid UTF-8 and read as Windows-1252 otherwise
+void AppendHeaderText(const char* pData, size_t uSize, std::string& strOutput)
+{
+   size_t i = 0;
+   while (i < uSize)
+   {
+      const size_t uPlain = PlainTextPrefix(pData + i, uSize - i);
+      strOutput.append(pData + i, uPlain);
+      i += uPlain;
+      if (i == uSize)
+         break;
+
+      const char c = pData[i];
+      if (c == '\r' || c == '\n')
+         ++i;
+      else if (c == '=')
+      {
+         strOutput += c;
+         ++i;
+      }
+      else
+      {
+         const size_t uLength = CCharset::SequenceLength(reinterpret_cast<const unsigned char*>(pData) + i, uSize - i);
+         if (uLength != 0)
+         {
+            strOutput.append(pData + i, uLength);
+            i += uLength;
+         }
+         else
+            CCharset::ToUTF8("windows-1252", pData + i++, 1, strOutput);
+      }
+   }
+}
+
+bool IsLinearWhiteSpace(const char* pData, size_t uSize)
+{
+   for (size_t i = 0; i < uSize; ++i)
+      if (!IsLWSP(pData[i]))
+         return false;
+   return true;
+}
+
+// an RFC 2047 encoded word : =?charset?encoding?text?=
+struct EncodedWord
+{
+   CStringView Charset;
+   char        cEncoding;
+   CStringView Text;
+   const char* pEnd;
+};
+
+bool ParseEncodedWord(const char* p, const char* pEnd, EncodedWord& oWord)
+{
+   // p points to "=?"
+   const char* pCharset = p + 2;
+   const char* pQuestion = static_cast<const char*>(memchr(pCharset, '?', pEnd - pCharset));
+   if (pQuestion == nullptr || pQuestion == pCharset || pEnd - pQuestion < 5 || pQuestion[2] != '?')
+      return false;
+   for (const char* q = pCharset; q < pQuestion; ++q)
+      if (IsLWSP(*q) || *q == '=')
+         return false;
+
+   oWord.cEncoding = CStringView::ToLower(pQuestion[1]);
+   if (oWord.cEncoding != 'b' && oWord.cEncoding != 'q')
+      return false;
+
+   // a '?' can't appear in the encoded text, the first one must end the word
+   const char* pText = pQuestion + 3;
+   const char* pTextEnd = static_cast<const char*>(memchr(pText, '?', pEnd - pText));
+   if (pTextEnd == nullptr || pTextEnd + 1 == pEnd || pTextEnd[1] != '=')
+      return false;
+   for (const char* q = pText; q < pTextEnd; ++q)
+      if (IsLWSP(*q))
+         return false;
+
+   oWord.Charset = CStringView(pCharset, pQuestion - pCharset);
+   oWord.Text = CStringView(pText, pTextEnd - pText);
+   oWord.pEnd = pTextEnd + 2;
+   return true;
+}
+}
+
+/**
+* @brief base64 encodes a memory block
+*
+* @param [in] pInput data to encode
+* @param [in] uSize size of the data
+* @param [out] strOutput string to which the encoded data is appended
+*/
+void CMailCodec::Base64Encode(const unsigned char* pInput, size_t uSize, std::string& strOutput)
+{
+   strOutput.reserve(strOutput.size() + ((uSize + 2) / 3) * 4);
+
+   size_t i = 0;
+   for (; i + 2 < uSize; i += 3)
+   {
+      const unsigned int uTriple = (pInput[i] << 16) | (pInput[i + 1] << 8) | pInput[i + 2];
+      strOutput += s_szBase64Alphabet[(uTriple >> 18) & 0x3F];
+      strOutput += s_szBase64Alphabet[(uTriple >> 12) & 0x3F];
+      strOutput += s_szBase64Alphabet[(uTriple >> 6) & 0x3F];
+      strOutput += s_szBase64Alphabet[uTriple & 0x3F];
+   }
+
+   if (i < uSize)
+   {
+      const unsigned int uTriple = (pInput[i] << 16) | ((i + 1 < uSize) ? (pInput[i + 1] << 8) : 0);
+      strOutput += s_szBase64Alphabet[(uTriple >> 18) & 0x3F];
+      strOutput += s_szBase64Alphabet[(uTriple >> 12) & 0x3F];
+      strOutput += (i + 1 < uSize) ? s_szBase64Alphabet[(uTriple >> 6) & 0x3F] : '=';
+      strOutput += '=';
+   }
+}
+
+std::string CMailCodec::Base64Encode(const std::string& strInput)
+{
+   std::string strOutput;
+   Base64Encode(reinterpret_cast<const unsigned char*>(strInput.data()), strInput.size(), strOutput);
+   return strOutput;
+}
+
+std::string CMailCodec::Base64Decode(const std::string& strInput)
+{
+   std::string strOutput(strInput.size() + 2, '\0');
+   Base64Decoder oDecoder;
+   strOutput.resize(oDecoder.Decode(strInput.data(), strInput.size(), &strOutput[0]));
+   return strOutput;
+}
+
+std::string CMailCodec::QuotedPrintableDecode(const std::string& strInput)
+{
+   std::string strOutput(strInput.size() + 3, '\0');
+   QuotedPrintableDecoder oDecoder;
+   size_t uSize = oDecoder.Decode(strInput.data(), strInput.size(), &strOutput[0]);
+   uSize += oDecoder.Finish(&strOutput[uSize]);
+   strOutput.resize(uSize);
+   return strOutput;
+}
+
+/**
+* @brief decodes the encoded words of a header field value (RFC 2047)
+*
+* The white space separating two encoded words is ignored, and the decoded bytes
+* of adjacent words sharing a charset are converted together, so a multibyte
+* character split between two words is decoded correctly.
+*
+* @param [in] Value raw header field value (may be folded)
+* @param [out] strOutput string to which the UTF-8 text is appended
+*
+* @retval true   Successfully decoded.
+* @retval false  At least one encoded word uses an unsupported charset.
+*/
+const bool CMailCodec::DecodeHeader(const CStringView& Value, std::string& strOutput)
+{
+   bool bResult = true;
+   const char* p = Value.data();
+   const char* const pEnd = Value.end();
+   const char* pText = p;               // start of the text that isn't decoded yet
+
+   // adjacent encoded words waiting to be converted
+   std::string strPending;
+   CStringView PendingCharset;
+   const char* pPendingStart = nullptr;
+   const char* pPendingEnd = nullptr;
+
+   strOutput.reserve(strOutput.size() + Value.size());
+
+   auto FlushPending = [&]()
+   {
+      if (pPendingStart == nullptr)
+         return;
+      if (!CCharset::ToUTF8(PendingCharset, strPending.data(), strPending.size(), strOutput))
+      {
+         AppendHeaderText(pPendingStart, pPendingEnd - pPendingStart, strOutput);
+         bResult = false;
+      }
+      strPending.clear();
+      pPendingStart = nullptr;
+   };
+
+   while (p < pEnd)
+   {
+      p += PlainTextPrefix(p, pEnd - p);
+      if (p == pEnd)
+         break;
+
+      EncodedWord oWord;
+      if (*p != '=' || p + 1 == pEnd || p[1] != '?' || !ParseEncodedWord(p, pEnd, oWord))
+      {
+         ++p;
+         continue;
+      }
+
+      // white space between two encoded words is dropped
+      if (pPendingStart == nullptr || !IsLinearWhiteSpace(pText, p - pText))
+      {
+         FlushPending();
+         AppendHeaderText(pText, p - pText, strOutput);
+      }
+      if (pPendingStart != nullptr && !PendingCharset.EqualsNoCase(oWord.Charset))
+         FlushPending();
+
+      const size_t uOffset = strPending.size();
+      strPending.resize(uOffset + oWord.Text.size() + 3);
+      size_t uDecoded;
+      if (oWord.cEncoding == 'b')
+      {
+         Base64Decoder oDecoder;
+         uDecoded = oDecoder.Decode(oWord.Text.data(), oWord.Text.size(), &strPending[uOffset]);
+      }
+      else
+      {
+         QuotedPrintableDecoder oDecoder;
+         oDecoder.SetUnderscoreIsSpace(true);
+         uDecoded = oDecoder.Decode(oWord.Text.data(), oWord.Text.size(), &strPending[uOffset]);
+         uDecoded += oDecoder.Finish(&strPending[uOffset + uDecoded]);
+      }
+      strPending.resize(uOffset + uDecoded);
+
+      if (pPendingStart == nullptr)
+      {
+         pPendingStart = p;
+         PendingCharset = oWord.Charset;
+      }
+      pPendingEnd = oWord.pEnd;
+      p = pText = oWord.pEnd;
+   }
+
+   FlushPending();
+   AppendHeaderText(pText, pEnd - pText, strOutput);
+
+   return bResult;
+}
+
+std::string CMailCodec::DecodeHeader(const CStringView& Value)
+{
+   std::string strOutput;
+   DecodeHeader(Value, strOutput);
+   return strOutput;
+}
+
+/**
+* @brief decodes a chunk of base64 data, characters outside of the alphabet
+* (line breaks, spaces) are skipped and everything after the padding is ignored
+*
+* @param [in] pInput chunk of base64 data
+* @param [in] uSize size of the chunk
+* @param [out] pOutput receives the decoded bytes (3/4 of uSize plus 2 at most)
+*
+* @return number of decoded bytes
+*/
+size_t CMailCodec::Base64Decoder::Decode(const char* pInput, size_t uSize, char* pOutput)
+{
+   char* pOut = pOutput;
+   const unsigned char* p = reinterpret_cast<const unsigned char*>(pInput);
+   const unsigned char* pEnd = p + uSize;
+
+   if (m_bEnded)
+      return 0;
+
+   // fast path : four digits at once when no bits are pending
+   while (p < pEnd)
+   {
+      if (m_iBitCount == 0)
+      {
+         while (pEnd - p >= 4)
+         {
+            const unsigned char a = s_oBase64Table.aValues[p[0]];
+            const unsigned char b = s_oBase64Table.aValues[p[1]];
+            const unsigned char c = s_oBase64Table.aValues[p[2]];
+            const unsigned char d = s_oBase64Table.aValues[p[3]];
+            if ((a | b | c | d) >= 64)
+               break;
+
+            const unsigned int uQuad = (a << 18) | (b << 12) | (c << 6) | d;
+            *pOut++ = static_cast<char>(uQuad >> 16);
+            *pOut++ = static_cast<char>(uQuad >> 8);
+            *pOut++ = static_cast<char>(uQuad);
+            p += 4;
+         }
+         if (p == pEnd)
+            break;
+      }
+
+      const unsigned char uValue = s_oBase64Table.aValues[*p++];
+      if (uValue == 0xFF)
+         continue;
+      if (uValue == 64)
+      {
+         m_bEnded = true;
+         break;
+      }
+
+      m_uBits = (m_uBits << 6) | uValue;
+      m_iBitCount += 6;
+      if (m_iBitCount >= 8)
+      {
+         m_iBitCount -= 8;
+         *pOut++ = static_cast<char>(m_uBits >> m_iBitCount);
+         m_uBits &= (1u << m_iBitCount) - 1;
+      }
+   }
+
+   return pOut - pOutput;
+}
+
+/**
+* @brief decodes a chunk of quoted-printable data (RFC 2045 6.7), soft line
+* breaks are removed and malformed escape sequences are kept as is
+*
+* @param [in] pInput chunk of quoted-printable data
+* @param [in] uSize size of the chunk
+* @param [out] pOutput receives the decoded bytes (uSize + 2 at most)
+*
+* @return number of decoded bytes
+*/
+size_t CMailCodec::QuotedPrintableDecoder::Decode(const char* pInput, size_t uSize, char* pOutput)
+{
+   char* pOut = pOutput;
+   size_t i = 0;
+
+   while (i < uSize)
+   {
+      const char c = pInput[i++];
+      switch (m_eState)
+      {
+         case QP_TEXT:
+            if (c == '=')
+               m_eState = QP_EQUAL;
+            else
+               *pOut++ = (c == '_' && m_bUnderscoreIsSpace) ? ' ' : c;
+            break;
+
+         case QP_EQUAL:
+            if (c == '\r')
+               m_eState = QP_SOFT_CR;
+            else if (c == '\n')
+               m_eState = QP_TEXT;
+            else if (HexValue(c) >= 0)
+            {
+               m_cHigh = c;
+               m_eState = QP_HEX;
+            }
+            else
+            {
+               *pOut++ = '=';
+               *pOut++ = c;
+               m_eState = QP_TEXT;
+            }
+            break;
+
+         case QP_HEX:
+            if (HexValue(c) >= 0)
+            {
+               *pOut++ = static_cast<char>((HexValue(m_cHigh) << 4) | HexValue(c));
+            }
+            else
+            {
+               *pOut++ = '=';
+               *pOut++ = m_cHigh;
+               --i; // reprocess c as text
+            }
+            m_eState = QP_TEXT;
+            break;
+
+         case QP_SOFT_CR:
+            m_eState = QP_TEXT;
+            if (c != '\n')
+               --i;
+            break;
+      }
+   }
+
+   return pOut - pOutput;
+}
+
+size_t CMailCodec::QuotedPrintableDecoder::Finish(char* pOutput)
+{
+   size_t uSize = 0;
+   if (m_eState == QP_EQUAL)
+      pOutput[uSize++] = '=';
+   else if (m_eState == QP_HEX)
+   {
+      pOutput[uSize++] = '=';
+      pOutput[uSize++] = m_cHigh;
+   }
+   m_eState = QP_TEXT;
+   return uSize;
+}
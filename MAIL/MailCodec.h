@@ -0,0 +1,68 @@
+/*
+* @file MailCodec.h
+* @brief content transfer encodings used by the mail clients
+*/
+
+#ifndef INCLUDE_MAILCODEC_H_
+#define INCLUDE_MAILCODEC_H_
+
+#include <cstddef>
+#include <string>
+
+#include "StringView.h"
+
+class CMailCodec
+{
+public:
+   /* appends the base64 encoding (RFC 4648, no line breaks) of the input to strOutput */
+   static void Base64Encode(const unsigned char* pInput, size_t uSize, std::string& strOutput);
+   static std::string Base64Encode(const std::string& strInput);
+
+   /* decode a whole base64 or quoted-printable string */
+   static std::string Base64Decode(const std::string& strInput);
+   static std::string QuotedPrintableDecode(const std::string& strInput);
+
+   /* decode the RFC 2047 encoded words of a header field value (B and Q encodings)
+    * and append the UTF-8 text to strOutput. Folding line breaks are removed, raw
+    * 8-bit text is kept if it's UTF-8 and read as Windows-1252 otherwise. Returns
+    * false if a charset isn't supported, the encoded word is then kept as is. */
+   static const bool DecodeHeader(const CStringView& Value, std::string& strOutput);
+   static std::string DecodeHeader(const CStringView& Value);
+
+   /* Incremental decoders : the input can be split anywhere, the state is kept
+    * between calls. Decode() writes at most uSize bytes (plus 2 for base64) in pOutput
+    * and returns the number of bytes written. */
+   class Base64Decoder
+   {
+   public:
+      Base64Decoder() : m_uBits(0), m_iBitCount(0), m_bEnded(false) {}
+      void Reset() { m_uBits = 0; m_iBitCount = 0; m_bEnded = false; }
+      size_t Decode(const char* pInput, size_t uSize, char* pOutput);
+
+   protected:
+      unsigned int m_uBits;
+      int          m_iBitCount;
+      bool         m_bEnded;    // padding reached
+   };
+
+   class QuotedPrintableDecoder
+   {
+   public:
+      QuotedPrintableDecoder() : m_eState(QP_TEXT), m_cHigh(0), m_bUnderscoreIsSpace(false) {}
+      void Reset() { m_eState = QP_TEXT; m_cHigh = 0; }
+      size_t Decode(const char* pInput, size_t uSize, char* pOutput);
+      /* flush an incomplete escape sequence left at the end of the input */
+      size_t Finish(char* pOutput);
+
+      /* RFC 2047 "Q" encoding : '_' stands for a space */
+      inline void SetUnderscoreIsSpace(const bool& bEnable) { m_bUnderscoreIsSpace = bEnable; }
+
+   protected:
+      enum State { QP_TEXT, QP_EQUAL, QP_HEX, QP_SOFT_CR };
+      State m_eState;
+      char  m_cHigh;
+      bool  m_bUnderscoreIsSpace;
+   };
+};
+
+#endif
@@ -0,0 +1,211 @@
+/**
+* @file MailConnection.cpp
+* @brief implementation of the raw mail server connection
+*/
+
+#include "MailConnection.h"
+
+#ifdef WINDOWS
+#include <winsock2.h>
+#else
+#include <poll.h>
+#endif
+
+namespace
+{
+const size_t RECEIVE_CHUNK_SIZE = 16384;
+// a receive returns once that much data is appended, even if more is available
+const size_t RECEIVE_MAX_SIZE = 262144;
+}
+
+CMailConnection::CMailConnection(LogFnCallback oLogger) :
+   m_pCurl(nullptr),
+   m_Socket(CURL_SOCKET_BAD),
+   m_iTimeout(0),
+   m_oLog(oLogger)
+{
+
+}
+
+CMailConnection::~CMailConnection()
+{
+   Close();
+}
+
+/**
+* @brief performs the connection (TLS and login included) and retrieves its socket
+*
+* @param [in] pCurl curl handle configured with the server URL, the credentials
+* and CURLOPT_CONNECT_ONLY
+*
+* @retval true   Successfully connected.
+* @retval false  The connection or the login failed.
+*/
+const bool CMailConnection::Open(CURL* pCurl)
+{
+   Close();
+   if (pCurl == nullptr)
+      return false;
+
+   m_pCurl = pCurl;
+
+   const CURLcode res = curl_easy_perform(m_pCurl);
+   if (res != CURLE_OK)
+   {
+      if (m_oLog)
+         m_oLog(std::string("[MailConnection][Error] Unable to connect : ") + curl_easy_strerror(res));
+
+      Close();
+      return false;
+   }
+
+   if (curl_easy_getinfo(m_pCurl, CURLINFO_ACTIVESOCKET, &m_Socket) != CURLE_OK || m_Socket == CURL_SOCKET_BAD)
+   {
+      if (m_oLog)
+         m_oLog("[MailConnection][Error] Unable to retrieve the socket of the connection.");
+
+      Close();
+      return false;
+   }
+
+   return true;
+}
+
+void CMailConnection::Close()
+{
+   if (m_pCurl != nullptr)
+   {
+      curl_easy_cleanup(m_pCurl);
+      m_pCurl = nullptr;
+   }
+   m_Socket = CURL_SOCKET_BAD;
+}
+
+/**
+* @brief sends the whole buffer, waits when the socket buffer is full
+*
+* @retval true   Successfully sent.
+* @retval false  The connection is closed or timed out.
+*/
+const bool CMailConnection::Send(const char* pData, size_t uSize)
+{
+   if (m_pCurl == nullptr)
+      return false;
+
+   while (uSize > 0)
+   {
+      size_t uSent = 0;
+      const CURLcode res = curl_easy_send(m_pCurl, pData, uSize, &uSent);
+
+      if (res == CURLE_AGAIN)
+      {
+         if (!Wait(false, m_iTimeout > 0 ? m_iTimeout * 1000L : -1L))
+         {
+            if (m_oLog)
+               m_oLog("[MailConnection][Error] Timeout while sending data.");
+
+            return false;
+         }
+         continue;
+      }
+
+      if (res != CURLE_OK)
+      {
+         if (m_oLog)
+            m_oLog(std::string("[MailConnection][Error] Unable to send data : ") + curl_easy_strerror(res));
+
+         return false;
+      }
+
+      pData += uSent;
+      uSize -= uSent;
+   }
+   return true;
+}
+
+/**
+* @brief reads everything that is available (up to RECEIVE_MAX_SIZE bytes)
+*
+* The socket is only waited on once curl_easy_recv reports that no data is
+* left : with TLS, decrypted data can be pending while the socket is empty.
+*
+* @param [out] strBuffer the received data is appended to it
+*
+* @retval true   Data was received.
+* @retval false  The connection was closed by the server, failed or timed out.
+*/
+const bool CMailConnection::Receive(std::string& strBuffer)
+{
+   if (m_pCurl == nullptr)
+      return false;
+
+   char szChunk[RECEIVE_CHUNK_SIZE];
+   size_t uAppended = 0;
+
+   while (uAppended < RECEIVE_MAX_SIZE)
+   {
+      size_t uReceived = 0;
+      const CURLcode res = curl_easy_recv(m_pCurl, szChunk, sizeof(szChunk), &uReceived);
+
+      if (res == CURLE_AGAIN)
+      {
+         if (uAppended > 0)
+            break;
+
+         if (!Wait(true, m_iTimeout > 0 ? m_iTimeout * 1000L : -1L))
+         {
+            if (m_oLog)
+               m_oLog("[MailConnection][Error] Timeout while waiting for the server.");
+
+            return false;
+         }
+         continue;
+      }
+
+      if (res != CURLE_OK || uReceived == 0)
+      {
+         if (uAppended > 0)
+            break;
+
+         if (m_oLog)
+            m_oLog(res != CURLE_OK ? std::string("[MailConnection][Error] Unable to receive data : ") + curl_easy_strerror(res)
+                                   : std::string("[MailConnection][Error] Connection closed by the server."));
+
+         return false;
+      }
+
+      strBuffer.append(szChunk, uReceived);
+      uAppended += uReceived;
+   }
+   return true;
+}
+
+/**
+* @brief waits for incoming data, to be called once Receive has emptied the
+* connection (data buffered by the TLS layer isn't seen on the socket)
+*/
+const bool CMailConnection::WaitReadable(const long lTimeoutMs)
+{
+   return m_pCurl != nullptr && Wait(true, lTimeoutMs);
+}
+
+/**
+* @brief waits for the socket with poll, select can't watch a descriptor
+* beyond FD_SETSIZE (a process polling many accounts has that many)
+*/
+const bool CMailConnection::Wait(const bool bRead, const long lTimeoutMs)
+{
+#ifdef WINDOWS
+   WSAPOLLFD Poll = {};
+   Poll.fd = m_Socket;
+   Poll.events = bRead ? POLLRDNORM : POLLWRNORM;
+   const int iResult = WSAPoll(&Poll, 1, static_cast<INT>(lTimeoutMs));
+#else
+   struct pollfd Poll = {};
+   Poll.fd = m_Socket;
+   Poll.events = bRead ? POLLIN : POLLOUT;
+   const int iResult = poll(&Poll, 1, static_cast<int>(lTimeoutMs));
+#endif
+   // an error or a hang up is reported as ready, the next send or receive fails
+   return iResult > 0;
+}
@@ -0,0 +1,62 @@
+/*
+* @file MailConnection.h
+* @brief raw connection to a mail server, established and logged in by libcurl
+*
+* libcurl performs the connection, the TLS handshake and the authentication
+* (CURLOPT_CONNECT_ONLY), the protocol is then spoken directly on the
+* connection. Used by the native POP3 session to pipeline commands.
+*/
+
+#ifndef INCLUDE_MAILCONNECTION_H_
+#define INCLUDE_MAILCONNECTION_H_
+
+#include <cstddef>
+#include <curl/curl.h>
+#include <functional>
+#include <string>
+
+class CMailConnection
+{
+public:
+   typedef std::function<void(const std::string&)> LogFnCallback;
+
+   explicit CMailConnection(LogFnCallback oLogger = nullptr);
+   ~CMailConnection();
+
+   // copy constructor and assignment operator are disabled
+   CMailConnection(const CMailConnection& Copy) = delete;
+   CMailConnection& operator=(const CMailConnection& Copy) = delete;
+
+   /* connects with a curl handle configured with CURLOPT_CONNECT_ONLY, the
+    * connection owns the handle afterwards (even if the connection fails) */
+   const bool Open(CURL* pCurl);
+   /* drops the connection, nothing is sent to the server */
+   void Close();
+
+   inline const bool IsOpen() const { return m_pCurl != nullptr; }
+
+   /* timeout in seconds of a send or a receive, 0 waits forever */
+   inline void SetTimeout(const int& iTimeout) { m_iTimeout = iTimeout; }
+   inline const int GetTimeout() const { return m_iTimeout; }
+
+   const bool Send(const char* pData, size_t uSize);
+   inline const bool Send(const std::string& strData) { return Send(strData.data(), strData.size()); }
+
+   /* appends the received data to strBuffer, waits for it if none is available */
+   const bool Receive(std::string& strBuffer);
+
+   /* waits until data can be read or the timeout (in milliseconds, -1 waits
+    * forever) expires, returns false on timeout */
+   const bool WaitReadable(const long lTimeoutMs);
+
+protected:
+   const bool Wait(const bool bRead, const long lTimeoutMs);
+
+   CURL*          m_pCurl;
+   curl_socket_t  m_Socket;
+   int            m_iTimeout;
+
+   LogFnCallback  m_oLog;
+};
+
+#endif
@@ -0,0 +1,322 @@
+/**
+* @file MailMessage.cpp
+* @brief implementation of the lazily parsed e-mail
+*/
+
+#include "MailMessage.h"
+#include "Charset.h"
+#include "MailCodec.h"
+#include "MIMESplitter.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+// deeper multiparts are seen as opaque leaves (protects against malicious e-mails)
+const unsigned MAX_MIME_DEPTH = 32;
+
+// parts are decoded to files by chunks of that size
+const size_t DECODE_CHUNK_SIZE = 64 * 1024;
+
+inline bool IsLWSP(const char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+std::string ToLower(const CStringView& Text)
+{
+   std::string strText(Text.ToString());
+   std::transform(strText.begin(), strText.end(), strText.begin(), CStringView::ToLower);
+   return strText;
+}
+}
+
+CMailMessage::CMailMessage() :
+   m_bOpen(false),
+   m_bHeadersIndexed(false),
+   m_bPartsIndexed(false)
+{
+}
+
+CMailMessage::~CMailMessage()
+{
+   Close();
+}
+
+/**
+* @brief maps an e-mail file, nothing is read until a header or a part is accessed
+*
+* @param [in] strPath path of the e-mail file
+*
+* @retval true   Successfully mapped.
+* @retval false  The file can't be opened or mapped.
+*/
+const bool CMailMessage::Open(const std::string& strPath)
+{
+   Close();
+
+   if (!m_oFile.Open(strPath))
+      return false;
+
+   // reading a few headers mustn't trigger the read-ahead of the whole file
+   m_oFile.AdviseRandom();
+   m_Data = CStringView(m_oFile.GetData(), m_oFile.GetSize());
+   m_bOpen = true;
+   return true;
+}
+
+void CMailMessage::Attach(const CStringView& Data)
+{
+   Close();
+
+   m_Data = Data;
+   m_bOpen = true;
+}
+
+void CMailMessage::Close()
+{
+   m_oFile.Close();
+   m_Data = CStringView();
+   m_bOpen = false;
+
+   m_oHeaders.Clear();
+   m_bHeadersIndexed = false;
+   m_vecParts.clear();
+   m_bPartsIndexed = false;
+}
+
+const CHeaderParser& CMailMessage::GetHeaders()
+{
+   if (!m_bHeadersIndexed)
+   {
+      m_oHeaders.Parse(m_Data);
+      m_bHeadersIndexed = true;
+   }
+   return m_oHeaders;
+}
+
+CStringView CMailMessage::GetHeader(const CStringView& Name)
+{
+   return GetHeaders().GetValue(Name);
+}
+
+std::string CMailMessage::GetDecodedHeader(const CStringView& Name)
+{
+   return CMailCodec::DecodeHeader(GetHeader(Name));
+}
+
+const std::vector<CMailMessage::Part>& CMailMessage::GetParts()
+{
+   if (!m_bPartsIndexed)
+   {
+      IndexParts(m_Data, std::string(), 0);
+      m_bPartsIndexed = true;
+   }
+   return m_vecParts;
+}
+
+const CMailMessage::Part* CMailMessage::FindPart(const std::string& strPartId)
+{
+   for (const Part& oPart : GetParts())
+      if (oPart.strPartId == strPartId)
+         return &oPart;
+
+   return nullptr;
+}
+
+/**
+* @brief indexes the leaf parts of a MIME entity, multiparts are walked recursively
+*
+* A part ends at the line break preceding the next delimiter line. A missing
+* close delimiter ends the last part at the end of its parent.
+*
+* @param [in] Entity header block and body of the entity
+* @param [in] strPartId section number of the entity, empty for the e-mail itself
+* @param [in] uDepth nesting level
+*/
+void CMailMessage::IndexParts(const CStringView& Entity, const std::string& strPartId, unsigned uDepth)
+{
+   CHeaderParser oHeaders;
+   oHeaders.Parse(Entity);
+
+   const std::string strContentType = CHeaderParser::Unfold(oHeaders.GetValue("Content-Type"));
+   std::string strType = ToLower(CStringView(strContentType).substr(0, strContentType.find(';')).Trim());
+   if (strType.empty())
+      strType = "text/plain";
+
+   const CStringView Body = Entity.substr(oHeaders.GetHeaderSize());
+   const std::string strBoundary = CMIMESplitter::GetParameter(strContentType, "boundary");
+
+   if (strType.compare(0, 10, "multipart/") == 0 && !strBoundary.empty() && uDepth < MAX_MIME_DEPTH)
+   {
+      const std::string strDelimiter = "--" + strBoundary;
+      const char* p = Body.data();
+      const char* const pEnd = Body.end();
+      const char* pPartStart = nullptr;
+      unsigned uChildren = 0;
+
+      auto AddChild = [&](const char* pPartEnd)
+      {
+         const std::string strChildId = (strPartId.empty() ? std::string() : strPartId + ".")
+                                      + std::to_string(++uChildren);
+         IndexParts(CStringView(pPartStart, pPartEnd - pPartStart), strChildId, uDepth + 1);
+      };
+
+      while (p < pEnd)
+      {
+         const char* pNewLine = static_cast<const char*>(memchr(p, '\n', pEnd - p));
+         const char* pLineEnd = pNewLine ? pNewLine : pEnd;
+         const char* pNext = pNewLine ? pNewLine + 1 : pEnd;
+
+         if (static_cast<size_t>(pLineEnd - p) >= strDelimiter.size()
+             && memcmp(p, strDelimiter.data(), strDelimiter.size()) == 0)
+         {
+            const char* q = p + strDelimiter.size();
+            const bool bClose = (pLineEnd - q >= 2 && q[0] == '-' && q[1] == '-');
+            if (bClose)
+               q += 2;
+            while (q < pLineEnd && IsLWSP(*q))
+               ++q;
+
+            if (q == pLineEnd)
+            {
+               if (pPartStart != nullptr)
+               {
+                  // the line break before the delimiter belongs to it
+                  const char* pPartEnd = p;
+                  if (pPartEnd > pPartStart && pPartEnd[-1] == '\n')
+                     --pPartEnd;
+                  if (pPartEnd > pPartStart && pPartEnd[-1] == '\r')
+                     --pPartEnd;
+                  AddChild(pPartEnd);
+               }
+
+               pPartStart = bClose ? nullptr : pNext;
+               if (bClose)
+                  break;
+            }
+         }
+         p = pNext;
+      }
+
+      if (pPartStart != nullptr)
+         AddChild(pEnd);
+
+      if (uChildren > 0)
+         return;
+   }
+
+   Part oPart;
+   oPart.strPartId = strPartId.empty() ? "1" : strPartId;
+   oPart.strContentType = strType;
+   oPart.strCharset = CMIMESplitter::GetParameter(strContentType, "charset");
+   oPart.strEncoding = ToLower(CStringView(CHeaderParser::Unfold(oHeaders.GetValue("Content-Transfer-Encoding"))).Trim());
+
+   const std::string strDisposition = CHeaderParser::Unfold(oHeaders.GetValue("Content-Disposition"));
+   oPart.strFileName = CMIMESplitter::GetParameter(strDisposition, "filename");
+   if (oPart.strFileName.empty())
+      oPart.strFileName = CMIMESplitter::GetParameter(strContentType, "name");
+   if (oPart.strFileName.find("=?") != std::string::npos)
+      oPart.strFileName = CMailCodec::DecodeHeader(oPart.strFileName);
+   oPart.bAttachment = !oPart.strFileName.empty()
+                     || ToLower(CStringView(strDisposition).Trim()).compare(0, 10, "attachment") == 0;
+
+   oPart.Headers = Entity.substr(0, oHeaders.GetHeaderSize());
+   oPart.Body = Body;
+   m_vecParts.push_back(oPart);
+}
+
+/**
+* @brief decodes the content transfer encoding (base64, quoted-printable) of a part
+*
+* @param [in] oPart part returned by GetParts
+* @param [out] strOutput decoded content
+*/
+const bool CMailMessage::DecodePart(const Part& oPart, std::string& strOutput) const
+{
+   const CStringView& Body = oPart.Body;
+
+   if (oPart.strEncoding == "base64")
+   {
+      CMailCodec::Base64Decoder oDecoder;
+      strOutput.resize(Body.size() + 2);
+      strOutput.resize(oDecoder.Decode(Body.data(), Body.size(), &strOutput[0]));
+   }
+   else if (oPart.strEncoding == "quoted-printable")
+   {
+      CMailCodec::QuotedPrintableDecoder oDecoder;
+      strOutput.resize(Body.size() + 3);
+      size_t uSize = oDecoder.Decode(Body.data(), Body.size(), &strOutput[0]);
+      uSize += oDecoder.Finish(&strOutput[uSize]);
+      strOutput.resize(uSize);
+   }
+   else
+      strOutput.assign(Body.data(), Body.size());
+
+   return true;
+}
+
+/**
+* @brief decodes a text part and converts it to UTF-8
+*
+* @param [in] oPart part returned by GetParts
+* @param [out] strOutput UTF-8 text
+*
+* @retval true   Successfully converted.
+* @retval false  Unsupported charset, strOutput holds the decoded bytes as is.
+*/
+const bool CMailMessage::GetPartText(const Part& oPart, std::string& strOutput) const
+{
+   std::string strDecoded;
+   DecodePart(oPart, strDecoded);
+
+   strOutput.clear();
+   if (oPart.strCharset.empty())
+   {
+      // undeclared charset : UTF-8 if it's valid, Windows-1252 (superset of US-ASCII) otherwise
+      return CCharset::ToUTF8(CCharset::IsValidUTF8(strDecoded.data(), strDecoded.size()) ? "utf-8" : "windows-1252",
+                              strDecoded.data(), strDecoded.size(), strOutput);
+   }
+
+   if (!CCharset::ToUTF8(oPart.strCharset, strDecoded.data(), strDecoded.size(), strOutput))
+   {
+      strOutput.swap(strDecoded);
+      return false;
+   }
+   return true;
+}
+
+/**
+* @brief decodes a part to a local file by chunks
+*
+* @param [in] oPart part returned by GetParts
+* @param [in] strPath path of the file to create
+*/
+const bool CMailMessage::SavePart(const Part& oPart, const std::string& strPath) const
+{
+   std::ofstream ofPart(strPath, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+   if (!ofPart)
+      return false;
+
+   CMailCodec::Base64Decoder oBase64;
+   CMailCodec::QuotedPrintableDecoder oQuotedPrintable;
+   std::vector<char> vecBuffer(DECODE_CHUNK_SIZE + 3);
+
+   const bool bBase64 = (oPart.strEncoding == "base64");
+   const bool bQuotedPrintable = (oPart.strEncoding == "quoted-printable");
+
+   for (size_t uOffset = 0; uOffset < oPart.Body.size(); uOffset += DECODE_CHUNK_SIZE)
+   {
+      const CStringView Chunk = oPart.Body.substr(uOffset, DECODE_CHUNK_SIZE);
+      if (bBase64)
+         ofPart.write(vecBuffer.data(), oBase64.Decode(Chunk.data(), Chunk.size(), vecBuffer.data()));
+      else if (bQuotedPrintable)
+         ofPart.write(vecBuffer.data(), oQuotedPrintable.Decode(Chunk.data(), Chunk.size(), vecBuffer.data()));
+      else
+         ofPart.write(Chunk.data(), Chunk.size());
+   }
+   if (bQuotedPrintable)
+      ofPart.write(vecBuffer.data(), oQuotedPrintable.Finish(vecBuffer.data()));
+
+   ofPart.close();
+   return !ofPart.fail();
+}
@@ -0,0 +1,86 @@
+/*
+* @file MailMessage.h
+* @brief read-only view on an e-mail saved on disk (e.g. by GetFile)
+*
+* The file is memory mapped and nothing is parsed when it's opened : the
+* header index is built on the first header access (only the header pages
+* are read), the MIME structure on the first part access, and a part is
+* decoded only when its content is requested.
+*/
+
+#ifndef INCLUDE_MAILMESSAGE_H_
+#define INCLUDE_MAILMESSAGE_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "HeaderParser.h"
+#include "MappedFile.h"
+#include "StringView.h"
+
+class CMailMessage
+{
+public:
+   // leaf part of the MIME structure, the views point into the mapping
+   struct Part
+   {
+      Part() : bAttachment(false) {}
+      std::string strPartId;       // IMAP section number ("1", "2.1" ...)
+      std::string strContentType;  // lower case "type/subtype"
+      std::string strCharset;
+      std::string strEncoding;     // Content-Transfer-Encoding (lower case)
+      std::string strFileName;
+      bool        bAttachment;
+      CStringView Headers;
+      CStringView Body;            // encoded content
+   };
+
+   CMailMessage();
+   ~CMailMessage();
+
+   // copy constructor and assignment operator are disabled
+   CMailMessage(const CMailMessage& Copy) = delete;
+   CMailMessage& operator=(const CMailMessage& Copy) = delete;
+
+   /* maps an e-mail file, the previous one is closed */
+   const bool Open(const std::string& strPath);
+   /* uses an e-mail held in memory (e.g. by GetString), the buffer must outlive the object */
+   void Attach(const CStringView& Data);
+   void Close();
+
+   inline const bool IsOpen() const { return m_bOpen; }
+   inline const CStringView& GetRaw() const { return m_Data; }
+
+   /* header fields of the e-mail, indexed on first access */
+   const CHeaderParser& GetHeaders();
+   /* raw value of a header field, empty if it isn't present */
+   CStringView GetHeader(const CStringView& Name);
+   /* unfolded value with the RFC 2047 encoded words decoded to UTF-8 */
+   std::string GetDecodedHeader(const CStringView& Name);
+
+   /* leaf parts of the MIME structure, indexed on first access */
+   const std::vector<Part>& GetParts();
+   const Part* FindPart(const std::string& strPartId);
+
+   /* decode the content transfer encoding of a part */
+   const bool DecodePart(const Part& oPart, std::string& strOutput) const;
+   /* decoded text part converted to UTF-8 */
+   const bool GetPartText(const Part& oPart, std::string& strOutput) const;
+   /* decode a part to a file without holding it in memory */
+   const bool SavePart(const Part& oPart, const std::string& strPath) const;
+
+protected:
+   void IndexParts(const CStringView& Entity, const std::string& strPartId, unsigned uDepth);
+
+   CMappedFile       m_oFile;
+   CStringView       m_Data;
+   bool              m_bOpen;
+
+   CHeaderParser     m_oHeaders;
+   bool              m_bHeadersIndexed;
+   std::vector<Part> m_vecParts;
+   bool              m_bPartsIndexed;
+};
+
+#endif
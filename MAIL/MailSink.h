@@ -0,0 +1,41 @@
+/*
+* @file MailSink.h
+* @brief consumer of a message received by chunks
+*
+* A sink processes the message as it arrives (parsing, hashing, forwarding...)
+* instead of waiting for the whole message to be appended to a string.
+*/
+
+#ifndef INCLUDE_MAILSINK_H_
+#define INCLUDE_MAILSINK_H_
+
+#include <cstddef>
+
+class CMailSink
+{
+public:
+   virtual ~CMailSink() {}
+
+   /* next chunk of the message, returning false aborts the transfer */
+   virtual bool OnChunk(const char* pData, size_t uSize) = 0;
+
+   /* end of the transfer, bSuccess is false if it failed or was aborted */
+   virtual void OnComplete(const bool bSuccess) = 0;
+
+   /* operations removing the messages from the server (e.g. POP3 Drain) ask
+    * for a confirmation first : return true once the messages completed so far
+    * are durably stored, false keeps them on the server */
+   virtual bool OnCommit() { return true; }
+
+   /* libcurl write callback, data must point to a CMailSink */
+   static size_t WriteCallback(void* ptr, size_t size, size_t nmemb, void* data)
+   {
+      CMailSink* pSink = reinterpret_cast<CMailSink*>(data);
+      if (pSink == nullptr || !pSink->OnChunk(static_cast<const char*>(ptr), size * nmemb))
+         return 0;
+
+      return size * nmemb;
+   }
+};
+
+#endif
@@ -0,0 +1,147 @@
+/**
+* @file MappedFile.cpp
+* @brief implementation of the read-only file mapping
+*/
+
+#include "MappedFile.h"
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::CMappedFile() :
+   m_pData(nullptr),
+   m_uSize(0),
+   m_bOpen(false),
+#ifdef WINDOWS
+   m_hFile(INVALID_HANDLE_VALUE),
+   m_hMapping(nullptr)
+#else
+   m_iFd(-1)
+#endif
+{
+
+}
+
+CMappedFile::~CMappedFile()
+{
+   Close();
+}
+
+/**
+* @brief maps a file in memory
+*
+* @param [in] strPath path of the file to map
+*
+* @retval true   The file is mapped (GetData() may be nullptr for an empty file).
+* @retval false  The file couldn't be opened or mapped.
+*/
+const bool CMappedFile::Open(const std::string& strPath)
+{
+   Close();
+
+#ifdef WINDOWS
+   m_hFile = CreateFileA(strPath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                         OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+   if (m_hFile == INVALID_HANDLE_VALUE)
+      return false;
+
+   LARGE_INTEGER liSize;
+   if (!GetFileSizeEx(m_hFile, &liSize))
+   {
+      Close();
+      return false;
+   }
+   m_uSize = static_cast<size_t>(liSize.QuadPart);
+
+   if (m_uSize > 0)
+   {
+      m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (m_hMapping == nullptr)
+      {
+         Close();
+         return false;
+      }
+      m_pData = static_cast<const char*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+      if (m_pData == nullptr)
+      {
+         Close();
+         return false;
+      }
+   }
+#else
+   m_iFd = open(strPath.c_str(), O_RDONLY);
+   if (m_iFd < 0)
+      return false;
+
+   struct stat stInfo;
+   if (fstat(m_iFd, &stInfo) != 0)
+   {
+      Close();
+      return false;
+   }
+   m_uSize = static_cast<size_t>(stInfo.st_size);
+
+   if (m_uSize > 0)
+   {
+      void* pMap = mmap(nullptr, m_uSize, PROT_READ, MAP_PRIVATE, m_iFd, 0);
+      if (pMap == MAP_FAILED)
+      {
+         Close();
+         return false;
+      }
+      m_pData = static_cast<const char*>(pMap);
+   }
+#endif
+
+   m_bOpen = true;
+   return true;
+}
+
+/**
+* @brief unmaps the file, has no effect if nothing is mapped
+*/
+void CMappedFile::Close()
+{
+#ifdef WINDOWS
+   if (m_pData != nullptr)
+      UnmapViewOfFile(m_pData);
+   if (m_hMapping != nullptr)
+      CloseHandle(m_hMapping);
+   if (m_hFile != INVALID_HANDLE_VALUE)
+      CloseHandle(m_hFile);
+   m_hMapping = nullptr;
+   m_hFile = INVALID_HANDLE_VALUE;
+#else
+   if (m_pData != nullptr)
+      munmap(const_cast<char*>(m_pData), m_uSize);
+   if (m_iFd >= 0)
+      close(m_iFd);
+   m_iFd = -1;
+#endif
+
+   m_pData = nullptr;
+   m_uSize = 0;
+   m_bOpen = false;
+}
+
+void CMappedFile::AdviseSequential() const
+{
+#ifndef WINDOWS
+   if (m_pData != nullptr)
+      madvise(const_cast<char*>(m_pData), m_uSize, MADV_SEQUENTIAL);
+#endif
+}
+
+void CMappedFile::AdviseRandom() const
+{
+#ifndef WINDOWS
+   if (m_pData != nullptr)
+      madvise(const_cast<char*>(m_pData), m_uSize, MADV_RANDOM);
+#endif
+}
@@ -0,0 +1,51 @@
+/*
+* @file MappedFile.h
+* @brief read-only memory mapping of a local file
+*
+* Used to stream large e-mails (signing, uploading, parsing) straight
+* from the page cache instead of copying them into a std::string.
+*/
+
+#ifndef INCLUDE_MAPPEDFILE_H_
+#define INCLUDE_MAPPEDFILE_H_
+
+#include <cstddef>
+#include <string>
+
+class CMappedFile
+{
+public:
+   CMappedFile();
+   ~CMappedFile();
+
+   // copy constructor and assignment operator are disabled
+   CMappedFile(const CMappedFile& Copy) = delete;
+   CMappedFile& operator=(const CMappedFile& Copy) = delete;
+
+   /* maps the whole file in memory (read-only), an empty file is a valid mapping */
+   const bool Open(const std::string& strPath);
+   void Close();
+
+   inline const bool IsOpen() const { return m_bOpen; }
+   inline const char* GetData() const { return m_pData; }
+   inline const size_t GetSize() const { return m_uSize; }
+
+   /* hints the kernel that the mapping will be read sequentially */
+   void AdviseSequential() const;
+   /* hints the kernel that only parts of the mapping will be read (no read-ahead) */
+   void AdviseRandom() const;
+
+protected:
+   const char*    m_pData;
+   size_t         m_uSize;
+   bool           m_bOpen;
+
+#ifdef WINDOWS
+   void*          m_hFile;
+   void*          m_hMapping;
+#else
+   int            m_iFd;
+#endif
+};
+
+#endif
@@ -6,23 +6,53 @@
 
 #include "POPClient.h"
 
+#include <chrono>
+#include <cstdio>
+
+namespace
+{
+// received data is handed to the writer thread by buffers of that size
+const size_t WRITE_BUFFER_SIZE = 262144;
+// a size announced by the server isn't trusted beyond that for presizing
+const unsigned long long MAX_PRESIZE = 268435456;
+}
+
 CPOPClient::CPOPClient(LogFnCallback oLogger) :
    CMailClient(oLogger),
+   m_eOperationType(POP3_NOOP),
    m_pstrText(nullptr),
-   m_eOperationType(POP3_NOOP)
+   m_pMIMESplitter(nullptr),
+   m_pSink(nullptr),
+   m_uExpectedSize(0),
+   m_uTopLines(0),
+   m_oSession([this](const std::string& strMessage)
+              {
+                 if (m_eSettingsFlags & ENABLE_LOG)
+                    m_oLog(strMessage);
+              }),
+   m_bPipelining(false),
+   m_uDrained(0)
 {
 
 }
 
 const bool CPOPClient::CleanupSession()
 {
+   if (m_oSession.IsOpen())
+      m_oSession.Quit();
+
    m_pstrText = nullptr;
+   m_pMIMESplitter = nullptr;
+   m_pSink = nullptr;
+   m_oResponseParser.Reset();
+   m_vecListedSizes.clear();
    return CMailClient::CleanupSession();
 }
 
 const bool CPOPClient::List(std::string& strList)
 {
    m_pstrText = &strList;
+   m_oResponseParser.Reset();
    m_eOperationType = POP3_LIST;
    return Perform();
 }
@@ -30,30 +60,89 @@ const bool CPOPClient::List(std::string& strList)
 const bool CPOPClient::ListUIDL(std::string& strList)
 {
    m_pstrText = &strList;
+   m_oResponseParser.Reset();
    m_eOperationType = POP3_UIDL;
    return Perform();
 }
 
-const bool CPOPClient::GetString(const std::string& strMsgNumber, std::string& strOutput)
+const bool CPOPClient::List(std::vector<PopListEntry>& vecList)
+{
+   m_pstrText = nullptr;
+   m_oResponseParser.SetTarget(&vecList);
+   m_eOperationType = POP3_LIST;
+
+   const bool bResult = Perform();
+
+   // message numbers are 1 to n, sparse only after deletions
+   m_vecListedSizes.clear();
+   if (bResult)
+   {
+      for (const PopListEntry& oEntry : vecList)
+      {
+         if (oEntry.uMsgNumber > 2 * vecList.size() + 1024)
+            continue;
+         if (oEntry.uMsgNumber >= m_vecListedSizes.size())
+            m_vecListedSizes.resize(oEntry.uMsgNumber + 1, 0);
+         m_vecListedSizes[oEntry.uMsgNumber] = oEntry.uOctets;
+      }
+   }
+   return bResult;
+}
+
+const bool CPOPClient::ListUIDL(std::vector<PopUidlEntry>& vecList)
+{
+   m_pstrText = nullptr;
+   m_oResponseParser.SetTarget(&vecList);
+   m_eOperationType = POP3_UIDL;
+   return Perform();
+}
+
+const bool CPOPClient::GetString(const std::string& strMsgNumber, std::string& strOutput,
+                                const unsigned long long uExpectedSize /* = 0 */)
 {
    m_pstrText = &strOutput;
    m_strMsgNumber = strMsgNumber;
+   m_uExpectedSize = std::min((uExpectedSize > 0) ? uExpectedSize : GetListedSize(strMsgNumber), MAX_PRESIZE);
    m_eOperationType = POP3_RETR_STRING;
    return Perform();
 }
 
-const bool CPOPClient::GetFile(const std::string& strMsgNumber, const std::string& strFilePath)
+const bool CPOPClient::GetString(const std::string& strMsgNumber, CMailSink& oSink)
+{
+   m_pSink = &oSink;
+   m_strMsgNumber = strMsgNumber;
+   m_eOperationType = POP3_RETR_SINK;
+
+   const bool bResult = Perform();
+   m_pSink = nullptr;
+   oSink.OnComplete(bResult);
+   return bResult;
+}
+
+const bool CPOPClient::GetFile(const std::string& strMsgNumber, const std::string& strFilePath,
+                              const unsigned long long uExpectedSize /* = 0 */)
 {
    m_strLocalFile = strFilePath;
    m_strMsgNumber = strMsgNumber;
+   m_uExpectedSize = std::min((uExpectedSize > 0) ? uExpectedSize : GetListedSize(strMsgNumber), MAX_PRESIZE);
    m_eOperationType = POP3_RETR_FILE;
    return Perform();
 }
 
-const bool CPOPClient::GetHeaders(const std::string& strMsgNumber, std::string& strOutput)
+const bool CPOPClient::GetMIMEParts(const std::string& strMsgNumber, CMIMESplitter& oSplitter)
+{
+   m_pMIMESplitter = &oSplitter;
+   m_strMsgNumber = strMsgNumber;
+   m_eOperationType = POP3_RETR_MIME;
+   return Perform();
+}
+
+const bool CPOPClient::GetHeaders(const std::string& strMsgNumber, std::string& strOutput,
+                                  const unsigned int uBodyLines /* = 0 */)
 {
    m_pstrText = &strOutput;
    m_strMsgNumber = strMsgNumber;
+   m_uTopLines = uBodyLines;
    m_eOperationType = POP3_TOP;
    return Perform();
 }
@@ -74,10 +163,546 @@ const bool CPOPClient::Noop()
 const bool CPOPClient::Stat(std::string& strStat)
 {
    m_pstrText = &strStat;
+   m_oResponseParser.Reset();
    m_eOperationType = POP3_STAT;
    return Perform();
 }
 
+const bool CPOPClient::Stat(PopStat& oStat)
+{
+   m_pstrText = nullptr;
+   m_oResponseParser.SetTarget(&oStat);
+   m_eOperationType = POP3_STAT;
+   return Perform();
+}
+
+const bool CPOPClient::GetStrings(const std::vector<std::string>& vecMsgNumbers, std::vector<std::string>& vecOutput)
+{
+   return RetrieveBatch(false, 0, vecMsgNumbers, vecOutput);
+}
+
+const bool CPOPClient::GetHeaders(const std::vector<std::string>& vecMsgNumbers, std::vector<std::string>& vecOutput,
+                                  const unsigned int uBodyLines /* = 0 */)
+{
+   return RetrieveBatch(true, uBodyLines, vecMsgNumbers, vecOutput);
+}
+
+const bool CPOPClient::HarvestHeaders(const unsigned long uFirst, const unsigned long uLast,
+                                      const unsigned int uBodyLines, const HeadersFnCallback& fnHeaders)
+{
+   std::vector<std::string> vecMsgNumbers;
+   for (unsigned long uMsgNumber = uFirst; uMsgNumber >= uFirst && uMsgNumber <= uLast; ++uMsgNumber)
+      vecMsgNumbers.push_back(std::to_string(uMsgNumber));
+
+   return HarvestHeaders(vecMsgNumbers, uBodyLines, fnHeaders);
+}
+
+/**
+* @brief retrieves the headers of e-mails with TOP and passes them, indexed, to
+* a callback
+*
+* With pipelining enabled the whole range is sent through the native session
+* (a window of TOP commands in flight), otherwise each message is a request on
+* the connection libcurl keeps open. A single buffer and header index are
+* reused : the memory doesn't depend on the number of messages.
+*
+* @param [in] vecMsgNumbers messages to index
+* @param [in] uBodyLines number of body lines to retrieve with the headers
+* @param [in] fnHeaders receives the index of each message
+*
+* @retval true   Every message was indexed.
+* @retval false  A message couldn't be retrieved, the connection failed or
+* fnHeaders stopped the harvest.
+*/
+const bool CPOPClient::HarvestHeaders(const std::vector<std::string>& vecMsgNumbers, const unsigned int uBodyLines,
+                                      const HeadersFnCallback& fnHeaders)
+{
+   if (!fnHeaders)
+      return false;
+
+   bool bResult = true;
+   std::string strResponse;
+
+   if (!m_bPipelining)
+   {
+      for (const std::string& strMsgNumber : vecMsgNumbers)
+      {
+         strResponse.clear();
+         if (!GetHeaders(strMsgNumber, strResponse, uBodyLines))
+            bResult = false;
+         else if (!ParseHeaders(strMsgNumber, strResponse, fnHeaders))
+            return false;
+      }
+      return bResult;
+   }
+
+   const std::string strArguments = " " + std::to_string(uBodyLines);
+   std::vector<CPopSession::Request> vecRequests;
+   vecRequests.reserve(vecMsgNumbers.size());
+   for (const std::string& strMsgNumber : vecMsgNumbers)
+      vecRequests.emplace_back("TOP " + strMsgNumber + strArguments, true);
+
+   return ExecuteBatch(vecRequests,
+                       [&strResponse](size_t, const char* pData, size_t uSize)
+                       {
+                          strResponse.append(pData, uSize);
+                          return true;
+                       },
+                       [&](size_t uIndex, bool bOK, const std::string& strStatus)
+                       {
+                          if (!bOK)
+                          {
+                             if (m_eSettingsFlags & ENABLE_LOG)
+                                m_oLog("[POPClient][Error] Unable to retrieve the headers of message "
+                                       + vecMsgNumbers[uIndex] + " : " + strStatus);
+
+                             bResult = false;
+                             return true;
+                          }
+
+                          const bool bContinue = ParseHeaders(vecMsgNumbers[uIndex], strResponse, fnHeaders);
+                          strResponse.clear();
+                          return bContinue;
+                       }) && bResult;
+}
+
+const bool CPOPClient::Delete(const std::vector<std::string>& vecMsgNumbers)
+{
+   bool bResult = true;
+
+   if (!m_bPipelining)
+   {
+      for (const std::string& strMsgNumber : vecMsgNumbers)
+         if (!Delete(strMsgNumber))
+            bResult = false;
+
+      return bResult;
+   }
+
+   std::vector<CPopSession::Request> vecRequests;
+   vecRequests.reserve(vecMsgNumbers.size());
+   for (const std::string& strMsgNumber : vecMsgNumbers)
+      vecRequests.emplace_back("DELE " + strMsgNumber, false);
+
+   return ExecuteBatch(vecRequests, nullptr,
+                       [&](size_t uIndex, bool bOK, const std::string& strStatus)
+                       {
+                          if (!bOK)
+                          {
+                             if (m_eSettingsFlags & ENABLE_LOG)
+                                m_oLog("[POPClient][Error] Unable to delete message " + vecMsgNumbers[uIndex]
+                                       + " : " + strStatus);
+
+                             bResult = false;
+                          }
+                          return true;
+                       }) && bResult;
+}
+
+const bool CPOPClient::GetFiles(const unsigned long uFirst, const unsigned long uLast, const std::string& strDirectory,
+                                PopFilesReport& oReport, const FileNameFnCallback& fnFileName /* = nullptr */)
+{
+   std::vector<std::string> vecMsgNumbers;
+   for (unsigned long uMsgNumber = uFirst; uMsgNumber >= uFirst && uMsgNumber <= uLast; ++uMsgNumber)
+      vecMsgNumbers.push_back(std::to_string(uMsgNumber));
+
+   return GetFiles(vecMsgNumbers, strDirectory, oReport, fnFileName);
+}
+
+/**
+* @brief retrieves e-mails in files, the RETR commands are pipelined when the
+* server supports it
+*
+* The received data is moved by large buffers to a writer thread through a
+* bounded queue : opening, writing and closing the files doesn't delay the
+* network, and a slow disk throttles the download instead of filling the
+* memory. The file of a message that wasn't completely received is removed.
+*
+* @param [in] vecMsgNumbers messages to retrieve
+* @param [in] strDirectory existing directory of the files
+* @param [out] oReport status of each message, total size and duration
+* @param [in] fnFileName naming policy, "<number>.eml" if empty
+*
+* @retval true   Every message was retrieved and written.
+* @retval false  At least one message failed, see oReport.
+*/
+const bool CPOPClient::GetFiles(const std::vector<std::string>& vecMsgNumbers, const std::string& strDirectory,
+                                PopFilesReport& oReport, const FileNameFnCallback& fnFileName /* = nullptr */)
+{
+   const std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+
+   oReport = PopFilesReport();
+   oReport.vecFiles.resize(vecMsgNumbers.size());
+
+   std::string strPrefix = strDirectory;
+   if (!strPrefix.empty() && strPrefix.back() != '/' && strPrefix.back() != '\\')
+      strPrefix += '/';
+
+   std::vector<CPopSession::Request> vecRequests;
+   vecRequests.reserve(vecMsgNumbers.size());
+   for (size_t i = 0; i < vecMsgNumbers.size(); ++i)
+   {
+      PopFileResult& oFile = oReport.vecFiles[i];
+      oFile.strMsgNumber = vecMsgNumbers[i];
+      oFile.strFilePath = strPrefix + (fnFileName ? fnFileName(vecMsgNumbers[i]) : vecMsgNumbers[i] + ".eml");
+      vecRequests.emplace_back("RETR " + vecMsgNumbers[i], true);
+   }
+
+   CAsyncFileWriter oWriter([this](const std::string& strMessage)
+                            {
+                               if (m_eSettingsFlags & ENABLE_LOG)
+                                  m_oLog(strMessage);
+                            });
+   oWriter.Start();
+
+   const size_t NO_MESSAGE = static_cast<size_t>(-1);
+   size_t uOpened = NO_MESSAGE;
+   std::string strBuffer;
+   std::vector<bool> vecReceived(vecMsgNumbers.size(), false);
+
+   auto OpenFile = [&](size_t uIndex)
+   {
+      if (uOpened != uIndex)
+      {
+         oWriter.Open(uIndex, oReport.vecFiles[uIndex].strFilePath,
+                      std::min(GetListedSize(vecMsgNumbers[uIndex]), MAX_PRESIZE));
+         uOpened = uIndex;
+         strBuffer.reserve(WRITE_BUFFER_SIZE);
+      }
+   };
+
+   ExecuteBatch(vecRequests,
+                [&](size_t uIndex, const char* pData, size_t uSize)
+                {
+                   OpenFile(uIndex);
+                   strBuffer.append(pData, uSize);
+                   oReport.uOctets += uSize;
+
+                   if (strBuffer.size() >= WRITE_BUFFER_SIZE)
+                   {
+                      oWriter.Write(uIndex, std::move(strBuffer));
+                      strBuffer.clear();
+                      strBuffer.reserve(WRITE_BUFFER_SIZE);
+                   }
+                   return true;
+                },
+                [&](size_t uIndex, bool bOK, const std::string& strStatus)
+                {
+                   if (!bOK)
+                   {
+                      oReport.vecFiles[uIndex].strError = strStatus;
+                      return true;
+                   }
+
+                   OpenFile(uIndex);
+                   oWriter.Write(uIndex, std::move(strBuffer));
+                   strBuffer.clear();
+                   oWriter.Close(uIndex);
+                   vecReceived[uIndex] = true;
+                   return true;
+                });
+
+   oWriter.Finish();
+
+   const std::vector<CAsyncFileWriter::FileResult>& vecWritten = oWriter.GetResults();
+   for (size_t i = 0; i < oReport.vecFiles.size(); ++i)
+   {
+      PopFileResult& oFile = oReport.vecFiles[i];
+      const bool bOpened = i < vecWritten.size() && !vecWritten[i].strPath.empty();
+
+      if (bOpened)
+      {
+         oFile.uOctets = vecWritten[i].uOctets;
+         oFile.strError = vecWritten[i].strError;
+      }
+
+      oFile.bSuccess = vecReceived[i] && bOpened && vecWritten[i].bSuccess;
+      if (oFile.bSuccess)
+         continue;
+
+      // no partial file is left behind
+      if (bOpened)
+         remove(oFile.strFilePath.c_str());
+
+      if (oFile.strError.empty())
+         oFile.strError = "Not received from the server.";
+
+      if (m_eSettingsFlags & ENABLE_LOG)
+         m_oLog("[POPClient][Error] Unable to retrieve message " + oFile.strMsgNumber + " in "
+                + oFile.strFilePath + " : " + oFile.strError);
+
+      ++oReport.uFailed;
+   }
+
+   oReport.dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+   return oReport.uFailed == 0;
+}
+
+/**
+* @brief retrieves the e-mails of the mailbox in a sink and deletes them, in a
+* single native session
+*
+* The RETR commands are pipelined, then DELE is sent for the e-mails the sink
+* received completely. Deletions are only committed by QUIT, which is sent
+* once the sink confirms the storage (OnCommit) : a crash or a failure at any
+* point leaves the e-mails on the server (at-least-once delivery).
+*
+* @param [in] uMaxMessages maximum number of e-mails to drain, 0 for all
+* @param [in] oSink receives the e-mails one after another
+*
+* @retval true   Every listed e-mail was stored and deleted.
+* @retval false  An e-mail couldn't be retrieved or deleted (the other ones are
+* committed), or nothing was committed (see GetDrainedCount).
+*/
+const bool CPOPClient::Drain(const size_t uMaxMessages, CMailSink& oSink)
+{
+   m_uDrained = 0;
+
+   std::vector<PopListEntry> vecList;
+   CPopResponseParser oParser;
+   oParser.SetTarget(&vecList);
+   bool bListed = false;
+
+   if (!ExecuteBatch(std::vector<CPopSession::Request>(1, CPopSession::Request("LIST", true)),
+                     [&oParser](size_t, const char* pData, size_t uSize)
+                     {
+                        oParser.Feed(pData, uSize);
+                        return true;
+                     },
+                     [&bListed](size_t, bool bOK, const std::string&)
+                     {
+                        bListed = bOK;
+                        return true;
+                     }))
+      return false;
+
+   if (!oParser.Finish() || !bListed)
+   {
+      if (m_eSettingsFlags & ENABLE_LOG)
+         m_oLog("[POPClient][Error] Unable to list the mailbox to drain.");
+
+      return false;
+   }
+
+   if (uMaxMessages > 0 && vecList.size() > uMaxMessages)
+      vecList.resize(uMaxMessages);
+
+   if (vecList.empty())
+      return true;
+
+   // retrieval : the sink gets each e-mail followed by its completion
+   std::vector<CPopSession::Request> vecRequests;
+   vecRequests.reserve(vecList.size());
+   for (const PopListEntry& oEntry : vecList)
+      vecRequests.emplace_back("RETR " + std::to_string(oEntry.uMsgNumber), true);
+
+   const size_t NO_MESSAGE = static_cast<size_t>(-1);
+   size_t uReceiving = NO_MESSAGE;
+   std::vector<size_t> vecStored;
+   vecStored.reserve(vecList.size());
+
+   const bool bRetrieved = ExecuteBatch(vecRequests,
+      [&oSink, &uReceiving](size_t uIndex, const char* pData, size_t uSize)
+      {
+         uReceiving = uIndex;
+         return oSink.OnChunk(pData, uSize);
+      },
+      [&](size_t uIndex, bool bOK, const std::string& strStatus)
+      {
+         uReceiving = NO_MESSAGE;
+         oSink.OnComplete(bOK);
+
+         if (bOK)
+            vecStored.push_back(uIndex);
+         else if (m_eSettingsFlags & ENABLE_LOG)
+            m_oLog("[POPClient][Error] Unable to retrieve message " + std::to_string(vecList[uIndex].uMsgNumber)
+                   + " : " + strStatus);
+         return true;
+      });
+
+   if (!bRetrieved)
+   {
+      // the session is dropped, nothing is deleted
+      if (uReceiving != NO_MESSAGE)
+         oSink.OnComplete(false);
+
+      return false;
+   }
+
+   // deletion of the stored e-mails
+   vecRequests.clear();
+   for (const size_t uIndex : vecStored)
+      vecRequests.emplace_back("DELE " + std::to_string(vecList[uIndex].uMsgNumber), false);
+
+   size_t uDeleted = 0;
+   if (!vecRequests.empty()
+       && !ExecuteBatch(vecRequests, nullptr,
+                        [&](size_t uIndex, bool bOK, const std::string& strStatus)
+                        {
+                           if (bOK)
+                              ++uDeleted;
+                           else if (m_eSettingsFlags & ENABLE_LOG)
+                              m_oLog("[POPClient][Error] Unable to delete message "
+                                     + std::to_string(vecList[vecStored[uIndex]].uMsgNumber) + " : " + strStatus);
+                           return true;
+                        }))
+      return false;
+
+   if (!oSink.OnCommit())
+   {
+      if (m_eSettingsFlags & ENABLE_LOG)
+         m_oLog("[POPClient][Error] Storage not confirmed, the drained e-mails stay on the server.");
+
+      m_oSession.Close();
+      return false;
+   }
+
+   if (!m_oSession.Quit())
+   {
+      if (m_eSettingsFlags & ENABLE_LOG)
+         m_oLog("[POPClient][Error] The server didn't confirm the deletions.");
+
+      return false;
+   }
+
+   m_uDrained = uDeleted;
+   return uDeleted == vecList.size();
+}
+
+/**
+* @brief retrieves a list of e-mails with RETR or TOP, pipelined if enabled
+*
+* A message that can't be retrieved leaves an empty string in vecOutput,
+* the other ones are still retrieved.
+*
+* @param [in] bHeaders TOP instead of RETR
+* @param [in] uBodyLines number of body lines of TOP
+* @param [in] vecMsgNumbers messages to retrieve
+* @param [out] vecOutput contents of the messages, in the same order
+*
+* @retval true   Every message was retrieved.
+* @retval false  At least one message couldn't be retrieved.
+*/
+const bool CPOPClient::RetrieveBatch(const bool bHeaders, const unsigned int uBodyLines,
+                                     const std::vector<std::string>& vecMsgNumbers,
+                                     std::vector<std::string>& vecOutput)
+{
+   bool bResult = true;
+   vecOutput.assign(vecMsgNumbers.size(), std::string());
+
+   if (!m_bPipelining)
+   {
+      for (size_t i = 0; i < vecMsgNumbers.size(); ++i)
+      {
+         const bool bRetrieved = bHeaders ? GetHeaders(vecMsgNumbers[i], vecOutput[i], uBodyLines)
+                                          : GetString(vecMsgNumbers[i], vecOutput[i]);
+         if (!bRetrieved)
+         {
+            vecOutput[i].clear();
+            bResult = false;
+         }
+      }
+      return bResult;
+   }
+
+   std::vector<CPopSession::Request> vecRequests;
+   vecRequests.reserve(vecMsgNumbers.size());
+   for (size_t i = 0; i < vecMsgNumbers.size(); ++i)
+   {
+      if (bHeaders)
+      {
+         vecRequests.emplace_back("TOP " + vecMsgNumbers[i] + " " + std::to_string(uBodyLines), true);
+         continue;
+      }
+
+      vecRequests.emplace_back("RETR " + vecMsgNumbers[i], true);
+      vecOutput[i].reserve(static_cast<size_t>(std::min(GetListedSize(vecMsgNumbers[i]), MAX_PRESIZE)));
+   }
+
+   return ExecuteBatch(vecRequests,
+                       [&vecOutput](size_t uIndex, const char* pData, size_t uSize)
+                       {
+                          vecOutput[uIndex].append(pData, uSize);
+                          return true;
+                       },
+                       [&](size_t uIndex, bool bOK, const std::string& strStatus)
+                       {
+                          if (!bOK)
+                          {
+                             if (m_eSettingsFlags & ENABLE_LOG)
+                                m_oLog("[POPClient][Error] Unable to retrieve message " + vecMsgNumbers[uIndex]
+                                       + " : " + strStatus);
+
+                             bResult = false;
+                          }
+                          return true;
+                       }) && bResult;
+}
+
+/**
+* @brief indexes a TOP response and passes it to fnHeaders
+*
+* @retval true   The harvest can continue.
+* @retval false  fnHeaders stopped it.
+*/
+const bool CPOPClient::ParseHeaders(const std::string& strMsgNumber, const std::string& strResponse,
+                                    const HeadersFnCallback& fnHeaders)
+{
+   m_oHeaderParser.Parse(strResponse);
+   const CStringView Preview = CStringView(strResponse).substr(m_oHeaderParser.GetHeaderSize());
+
+   return fnHeaders(strMsgNumber, m_oHeaderParser, Preview);
+}
+
+/**
+* @brief runs a batch of commands on the native session
+*
+* The session is opened on first use. The connection libcurl keeps between
+* requests is released before, most servers lock the mailbox for a single
+* session.
+*
+* @retval true   Every response was received.
+* @retval false  The session couldn't be opened or the connection failed.
+*/
+const bool CPOPClient::ExecuteBatch(const std::vector<CPopSession::Request>& vecRequests,
+                                    const CPopSession::DataFnCallback& fnData,
+                                    const CPopSession::DoneFnCallback& fnDone)
+{
+   if (!m_oSession.IsOpen())
+   {
+      if (!m_pCurlSession)
+      {
+         if (m_eSettingsFlags & ENABLE_LOG)
+            m_oLog(LOG_ERROR_CURL_NOT_INIT_MSG);
+
+         return false;
+      }
+
+      CloseCachedConnection();
+      if (!OpenConnection(m_oSession.GetConnection()) || !m_oSession.Start())
+      {
+         if (m_eSettingsFlags & ENABLE_LOG)
+            m_oLog("[POPClient][Error] Unable to open the POP3 session.");
+
+         m_oSession.Close();
+         return false;
+      }
+   }
+
+   return m_oSession.Execute(vecRequests, fnData, fnDone);
+}
+
+const unsigned long long CPOPClient::GetListedSize(const std::string& strMsgNumber) const
+{
+   char* pEnd = nullptr;
+   const unsigned long uMsgNumber = strtoul(strMsgNumber.c_str(), &pEnd, 10);
+   if (pEnd == strMsgNumber.c_str() || *pEnd != '\0' || uMsgNumber >= m_vecListedSizes.size())
+      return 0;
+
+   return m_vecListedSizes[uMsgNumber];
+}
+
 void CPOPClient::ParseURL(std::string& strURL)
 {
    std::string strTmp = strURL;
@@ -115,6 +740,11 @@ const bool CPOPClient::PrePerform()
 {
    std::string strRequestURL(m_strURL);
 
+   /* requests go through libcurl again : end the native session, its
+    * deletions are committed */
+   if (m_oSession.IsOpen())
+      m_oSession.Quit();
+
    switch (m_eOperationType)
    {
       case POP3_TOP:
@@ -128,9 +758,10 @@ const bool CPOPClient::PrePerform()
 
          if (!m_strMsgNumber.empty())
          {
-            /* Set the TOP command for message 'm_strMsgNumber' to only include the headers */
+            /* Set the TOP command for message 'm_strMsgNumber' to only include the headers
+             * and the first 'm_uTopLines' lines of the body */
             curl_easy_setopt(m_pCurlSession, CURLOPT_CUSTOMREQUEST,
-               ("TOP " + m_strMsgNumber + " 0").c_str());
+               ("TOP " + m_strMsgNumber + " " + std::to_string(m_uTopLines)).c_str());
          }
          else
             return false;
@@ -154,6 +785,12 @@ const bool CPOPClient::PrePerform()
             curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEFUNCTION, &CMailClient::WriteInStringCallback);
             curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEDATA, m_pstrText);
          }
+         else if (m_oResponseParser.HasTarget())
+         {
+            /* the listing is parsed on the fly, the raw text is never stored */
+            curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEFUNCTION, &CPopResponseParser::WriteCallback);
+            curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEDATA, &m_oResponseParser);
+         }
          else
             return false;
 
@@ -185,6 +822,10 @@ const bool CPOPClient::PrePerform()
          /* This will retrieve message 'm_strMsgNumber' from the user's mailbox */
          if (m_pstrText != nullptr)
          {
+            /* a single allocation instead of growing by doubling */
+            if (m_uExpectedSize > 0)
+               m_pstrText->reserve(m_pstrText->size() + static_cast<size_t>(m_uExpectedSize));
+
             curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEFUNCTION, &CMailClient::WriteInStringCallback);
             curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEDATA, m_pstrText);
          }
@@ -200,11 +841,10 @@ const bool CPOPClient::PrePerform()
          else
             return false;
 
-         m_fLocalFile.open(m_strLocalFile, std::fstream::out | std::fstream::binary | std::fstream::trunc);
-         if (m_fLocalFile)
+         if (OpenLocalFile(m_uExpectedSize))
          {
-            curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEFUNCTION, &CMailClient::WriteToFileCallback);
-            curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEDATA, &m_fLocalFile);
+            curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEFUNCTION, &CMailClient::WriteToLocalFileCallback);
+            curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEDATA, this);
          }
          else
          {
@@ -216,12 +856,45 @@ const bool CPOPClient::PrePerform()
          }
          break;
 
+      case POP3_RETR_MIME:
+         if (!m_strMsgNumber.empty() && m_pMIMESplitter != nullptr)
+         {
+            strRequestURL += m_strMsgNumber;
+         }
+         else
+            return false;
+
+         /* parts are decoded and written to disk as the e-mail is received */
+         m_pMIMESplitter->Reset();
+         curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEFUNCTION, &CMIMESplitter::WriteCallback);
+         curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEDATA, m_pMIMESplitter);
+         break;
+
+      case POP3_RETR_SINK:
+         if (!m_strMsgNumber.empty() && m_pSink != nullptr)
+         {
+            strRequestURL += m_strMsgNumber;
+         }
+         else
+            return false;
+
+         /* the chunks are handed over as they are received, nothing is buffered */
+         curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEFUNCTION, &CMailSink::WriteCallback);
+         curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEDATA, m_pSink);
+         break;
+
       case POP3_STAT:
          if (m_pstrText != nullptr)
          {
             curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEFUNCTION, &CMailClient::WriteInStringCallback);
             curl_easy_setopt(m_pCurlSession, CURLOPT_WRITEDATA, m_pstrText);
          }
+         else if (m_oResponseParser.HasTarget())
+         {
+            /* libcurl passes the server responses (the drop listing included) to the header callback */
+            curl_easy_setopt(m_pCurlSession, CURLOPT_HEADERFUNCTION, &CPopResponseParser::WriteCallback);
+            curl_easy_setopt(m_pCurlSession, CURLOPT_HEADERDATA, &m_oResponseParser);
+         }
          else
             return false;
 
@@ -258,8 +931,34 @@ const bool CPOPClient::PostPerform(CURLcode ePerformCode)
    ePerformCode;
 
    if (m_eOperationType == POP3_RETR_FILE)
-      if (m_fLocalFile.is_open())
-         m_fLocalFile.close();
+      CloseLocalFile();
+
+   if ((m_eOperationType == POP3_LIST || m_eOperationType == POP3_UIDL || m_eOperationType == POP3_STAT)
+       && m_oResponseParser.HasTarget())
+   {
+      const bool bParsed = m_oResponseParser.Finish();
+      m_oResponseParser.Reset();
+
+      if (ePerformCode == CURLE_OK && !bParsed)
+      {
+         if (m_eSettingsFlags & ENABLE_LOG)
+            m_oLog("[POPClient][Error] Unable to parse the server response.");
+
+         return false;
+      }
+   }
+
+   if (m_eOperationType == POP3_RETR_MIME && m_pMIMESplitter != nullptr)
+   {
+      /* flush the last part, even if the transfer failed */
+      if (!m_pMIMESplitter->Finish())
+      {
+         if (m_eSettingsFlags & ENABLE_LOG)
+            m_oLog("[POPClient][Error] Unable to save the MIME parts of the e-mail.");
+
+         return false;
+      }
+   }
 
    return true;
 }
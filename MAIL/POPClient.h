@@ -9,11 +9,50 @@
 #ifndef INCLUDE_POPCLIENT_H_
 #define INCLUDE_POPCLIENT_H_
 
+#include <vector>
+
+#include "AsyncFileWriter.h"
+#include "HeaderParser.h"
 #include "MAILClient.h"
+#include "MailSink.h"
+#include "MIMESplitter.h"
+#include "POPResponse.h"
+#include "POPSession.h"
+
+// outcome of a message downloaded by GetFiles
+struct PopFileResult
+{
+   PopFileResult() : uOctets(0), bSuccess(false) {}
+   std::string        strMsgNumber;
+   std::string        strFilePath;
+   unsigned long long uOctets;    // written in the file
+   bool               bSuccess;
+   std::string        strError;   // server response or I/O error
+};
+
+// report of GetFiles
+struct PopFilesReport
+{
+   PopFilesReport() : uOctets(0), uFailed(0), dSeconds(0) {}
+   std::vector<PopFileResult> vecFiles;   // in the order of the request
+   unsigned long long         uOctets;    // received from the server
+   size_t                     uFailed;
+   double                     dSeconds;
+   /* bytes per second */
+   inline double GetThroughput() const { return (dSeconds > 0) ? uOctets / dSeconds : 0; }
+};
 
 class CPOPClient : public CMailClient
 {
 public:
+   /* naming policy of GetFiles : file name (without directory) of a message */
+   typedef std::function<std::string(const std::string& strMsgNumber)> FileNameFnCallback;
+   /* receives the headers of a message harvested by HarvestHeaders and the
+    * first lines of its body. The views are only valid during the call.
+    * Returning false stops the harvest. */
+   typedef std::function<bool(const std::string& strMsgNumber, const CHeaderParser& Headers,
+                              const CStringView& Preview)> HeadersFnCallback;
+
    explicit CPOPClient(LogFnCallback oLogger);
 
    // copy constructor and assignment operator are disabled
@@ -27,15 +66,43 @@ public:
 
    /* list the contents of a mailbox by unique ID and save it in strList */
    const bool ListUIDL(std::string& strList);
+
+   /* same as above, the listings are parsed as they are received. The sizes
+    * listed are remembered to presize the retrievals of the session. */
+   const bool List(std::vector<PopListEntry>& vecList);
+   const bool ListUIDL(std::vector<PopUidlEntry>& vecList);
    
-   /* retrieve e-mail and save its content in strOutput */
-   const bool GetString(const std::string& strMsgNumber, std::string& strOutput);
+   /* retrieve e-mail and save its content in strOutput. uExpectedSize (the size
+    * given by LIST) is reserved at once, if 0 the size remembered by List is used */
+   const bool GetString(const std::string& strMsgNumber, std::string& strOutput,
+                        const unsigned long long uExpectedSize = 0);
    
-   /* retrieve e-mail and save its content in a file */
-   const bool GetFile(const std::string& strMsgNumber, const std::string& strFilePath);
+   /* retrieve e-mail and pass its content to oSink as it arrives */
+   const bool GetString(const std::string& strMsgNumber, CMailSink& oSink);
+
+   /* retrieve e-mail and save its content in a file, its space is preallocated
+    * when the size is known (see GetString) */
+   const bool GetFile(const std::string& strMsgNumber, const std::string& strFilePath,
+                      const unsigned long long uExpectedSize = 0);
+
+   /* retrieve up to uMaxMessages e-mails (0 for all) in oSink (one OnComplete per
+    * e-mail) and delete them from the server. The deletions are committed (QUIT)
+    * only if oSink.OnCommit confirms that the e-mails are stored, otherwise or
+    * on any failure the session is dropped and every e-mail stays on the server. */
+   const bool Drain(const size_t uMaxMessages, CMailSink& oSink);
+   /* number of e-mails removed by the last Drain */
+   inline const size_t GetDrainedCount() const { return m_uDrained; }
 
-   /* retrieve only the headers of an e-mail */
-   const bool GetHeaders(const std::string& strMsgNumber, std::string& strOutput);
+   /* size of a message given by the last List, 0 if unknown */
+   const unsigned long long GetListedSize(const std::string& strMsgNumber) const;
+
+   /* retrieve e-mail and save each of its MIME parts in a file while downloading it */
+   const bool GetMIMEParts(const std::string& strMsgNumber, CMIMESplitter& oSplitter);
+
+   /* retrieve only the headers of an e-mail, followed by the first uBodyLines
+    * lines of its body */
+   const bool GetHeaders(const std::string& strMsgNumber, std::string& strOutput,
+                         const unsigned int uBodyLines = 0);
 
    /* delete an existing e-mail from the mailbox */
    const bool Delete(const std::string& strMsgNumber);
@@ -45,6 +112,43 @@ public:
 
    /* obtain message statistics and save it in strStat */
    const bool Stat(std::string& strStat);
+   const bool Stat(PopStat& oStat);
+
+   /* with pipelining enabled, the batch operations below run on a native POP3
+    * session that sends the commands back to back when the server supports it
+    * (RFC 2449), otherwise each message is a separate request */
+   inline void SetPipelining(const bool& bEnable) { m_bPipelining = bEnable; }
+   inline const bool GetPipelining() const { return m_bPipelining; }
+   /* maximum number of commands sent ahead of their responses */
+   inline void SetPipelineWindow(const size_t& uWindow) { m_oSession.SetWindow(uWindow); }
+
+   /* retrieve e-mails, vecOutput[i] receives the content of vecMsgNumbers[i] */
+   const bool GetStrings(const std::vector<std::string>& vecMsgNumbers, std::vector<std::string>& vecOutput);
+
+   /* retrieve only the headers of e-mails (and uBodyLines lines of their body) */
+   const bool GetHeaders(const std::vector<std::string>& vecMsgNumbers, std::vector<std::string>& vecOutput,
+                         const unsigned int uBodyLines = 0);
+
+   /* index the headers of e-mails without downloading their body : each TOP
+    * response is parsed as soon as it is received and passed to fnHeaders with
+    * its first uBodyLines lines, then its buffer is reused for the next one */
+   const bool HarvestHeaders(const std::vector<std::string>& vecMsgNumbers, const unsigned int uBodyLines,
+                             const HeadersFnCallback& fnHeaders);
+   /* same as above for the messages uFirst to uLast */
+   const bool HarvestHeaders(const unsigned long uFirst, const unsigned long uLast, const unsigned int uBodyLines,
+                             const HeadersFnCallback& fnHeaders);
+
+   /* delete existing e-mails from the mailbox */
+   const bool Delete(const std::vector<std::string>& vecMsgNumbers);
+
+   /* retrieve e-mails in files of strDirectory ("<number>.eml" unless fnFileName
+    * is given). A single native session is used, the files are written by a
+    * separate thread while the next messages are received. */
+   const bool GetFiles(const std::vector<std::string>& vecMsgNumbers, const std::string& strDirectory,
+                       PopFilesReport& oReport, const FileNameFnCallback& fnFileName = nullptr);
+   /* same as above for the messages uFirst to uLast */
+   const bool GetFiles(const unsigned long uFirst, const unsigned long uLast, const std::string& strDirectory,
+                       PopFilesReport& oReport, const FileNameFnCallback& fnFileName = nullptr);
 
 protected:
    enum MailOperation
@@ -52,6 +156,8 @@ protected:
       POP3_LIST,
       POP3_RETR_STRING,
       POP3_RETR_FILE,
+      POP3_RETR_MIME,
+      POP3_RETR_SINK,
       POP3_DELE,
       POP3_UIDL,
       POP3_TOP,
@@ -63,10 +169,32 @@ protected:
    const bool PostPerform(CURLcode ePerformCode) override;
    inline void ParseURL(std::string& strURL) override final;
 
+   /* runs a batch on the native session, opened on first use */
+   const bool ExecuteBatch(const std::vector<CPopSession::Request>& vecRequests,
+                           const CPopSession::DataFnCallback& fnData,
+                           const CPopSession::DoneFnCallback& fnDone);
+   const bool RetrieveBatch(const bool bHeaders, const unsigned int uBodyLines,
+                            const std::vector<std::string>& vecMsgNumbers, std::vector<std::string>& vecOutput);
+   const bool ParseHeaders(const std::string& strMsgNumber, const std::string& strResponse,
+                           const HeadersFnCallback& fnHeaders);
+
    MailOperation        m_eOperationType;
 
    std::string          m_strMsgNumber;
    std::string*         m_pstrText;
+   CMIMESplitter*       m_pMIMESplitter;
+   CMailSink*           m_pSink;
+   CPopResponseParser   m_oResponseParser;
+
+   unsigned long long   m_uExpectedSize;
+   unsigned int         m_uTopLines;
+   CHeaderParser        m_oHeaderParser;
+   // indexed by message number
+   std::vector<unsigned long long> m_vecListedSizes;
+
+   CPopSession          m_oSession;
+   bool                 m_bPipelining;
+   size_t               m_uDrained;
 
 };
 
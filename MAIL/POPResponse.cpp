@@ -0,0 +1,226 @@
+/**
+* @file POPResponse.cpp
+* @brief implementation of the POP3 response parser
+*/
+
+#include "POPResponse.h"
+
+#include <cstring>
+
+namespace
+{
+inline bool IsSpace(const char c) { return c == ' ' || c == '\t'; }
+
+// parses an unsigned decimal number at p, p is moved past it
+template <typename T>
+bool ParseNumber(const char*& p, const char* pEnd, T& uValue)
+{
+   const char* pStart = p;
+   uValue = 0;
+   while (p < pEnd && *p >= '0' && *p <= '9')
+      uValue = uValue * 10 + static_cast<T>(*p++ - '0');
+   return p != pStart;
+}
+
+inline void SkipSpaces(const char*& p, const char* pEnd)
+{
+   while (p < pEnd && IsSpace(*p))
+      ++p;
+}
+}
+
+CPopResponseParser::CPopResponseParser() :
+   m_pvecList(nullptr),
+   m_pvecUIDL(nullptr),
+   m_pStat(nullptr),
+   m_bError(false),
+   m_bStatFound(false)
+{
+}
+
+void CPopResponseParser::SetTarget(std::vector<PopListEntry>* pvecList)
+{
+   Reset();
+   m_pvecList = pvecList;
+   if (m_pvecList != nullptr)
+      m_pvecList->clear();
+}
+
+void CPopResponseParser::SetTarget(std::vector<PopUidlEntry>* pvecUIDL)
+{
+   Reset();
+   m_pvecUIDL = pvecUIDL;
+   if (m_pvecUIDL != nullptr)
+      m_pvecUIDL->clear();
+}
+
+void CPopResponseParser::SetTarget(PopStat* pStat)
+{
+   Reset();
+   m_pStat = pStat;
+   if (m_pStat != nullptr)
+      *m_pStat = PopStat();
+}
+
+void CPopResponseParser::Reset()
+{
+   m_pvecList = nullptr;
+   m_pvecUIDL = nullptr;
+   m_pStat = nullptr;
+   m_strPartialLine.clear();
+   m_bError = false;
+   m_bStatFound = false;
+}
+
+/**
+* @brief splits a chunk of the response in lines, only an incomplete last line
+* is kept for the next chunk
+*
+* @param [in] pData chunk of the response
+* @param [in] uSize size of the chunk
+*/
+void CPopResponseParser::Feed(const char* pData, size_t uSize)
+{
+   const char* p = pData;
+   const char* const pEnd = pData + uSize;
+
+   if (!m_strPartialLine.empty())
+   {
+      const char* pNewLine = static_cast<const char*>(memchr(p, '\n', pEnd - p));
+      if (pNewLine == nullptr)
+      {
+         m_strPartialLine.append(p, uSize);
+         return;
+      }
+      m_strPartialLine.append(p, pNewLine - p);
+      ParseLine(m_strPartialLine);
+      m_strPartialLine.clear();
+      p = pNewLine + 1;
+   }
+
+   while (p < pEnd)
+   {
+      const char* pNewLine = static_cast<const char*>(memchr(p, '\n', pEnd - p));
+      if (pNewLine == nullptr)
+      {
+         m_strPartialLine.assign(p, pEnd - p);
+         break;
+      }
+      ParseLine(CStringView(p, pNewLine - p));
+      p = pNewLine + 1;
+   }
+}
+
+const bool CPopResponseParser::Finish()
+{
+   if (!m_strPartialLine.empty())
+   {
+      ParseLine(m_strPartialLine);
+      m_strPartialLine.clear();
+   }
+
+   if (m_pStat != nullptr && !m_bStatFound)
+      return false;
+
+   return !m_bError;
+}
+
+void CPopResponseParser::ParseLine(const CStringView& Line)
+{
+   CStringView Content = Line;
+   if (!Content.empty() && Content[Content.size() - 1] == '\r')
+      Content = Content.substr(0, Content.size() - 1);
+
+   if (m_pStat != nullptr)
+   {
+      // every server response goes through the header callback, the drop listing
+      // is the last line that parses
+      if (ParseStatLine(Content, *m_pStat))
+         m_bStatFound = true;
+      return;
+   }
+
+   // status and terminating lines are skipped if the transport leaves them
+   if (Content.empty() || Content[0] == '+' || (Content.size() == 1 && Content[0] == '.'))
+      return;
+
+   if (m_pvecList != nullptr)
+   {
+      PopListEntry oEntry;
+      if (ParseListLine(Content, oEntry))
+         m_pvecList->push_back(oEntry);
+      else
+         m_bError = true;
+   }
+   else if (m_pvecUIDL != nullptr)
+   {
+      m_pvecUIDL->emplace_back();
+      if (!ParseUidlLine(Content, m_pvecUIDL->back()))
+      {
+         m_pvecUIDL->pop_back();
+         m_bError = true;
+      }
+   }
+}
+
+size_t CPopResponseParser::WriteCallback(void* ptr, size_t size, size_t nmemb, void* data)
+{
+   if (data != nullptr)
+      reinterpret_cast<CPopResponseParser*>(data)->Feed(static_cast<const char*>(ptr), size * nmemb);
+
+   return size * nmemb;
+}
+
+const bool CPopResponseParser::ParseListLine(const CStringView& Line, PopListEntry& oEntry)
+{
+   const char* p = Line.data();
+   const char* const pEnd = Line.end();
+
+   SkipSpaces(p, pEnd);
+   if (!ParseNumber(p, pEnd, oEntry.uMsgNumber) || p == pEnd || !IsSpace(*p))
+      return false;
+   SkipSpaces(p, pEnd);
+   return ParseNumber(p, pEnd, oEntry.uOctets);
+}
+
+const bool CPopResponseParser::ParseUidlLine(const CStringView& Line, PopUidlEntry& oEntry)
+{
+   const char* p = Line.data();
+   const char* const pEnd = Line.end();
+
+   SkipSpaces(p, pEnd);
+   if (!ParseNumber(p, pEnd, oEntry.uMsgNumber) || p == pEnd || !IsSpace(*p))
+      return false;
+   SkipSpaces(p, pEnd);
+
+   // unique-id : 1 to 70 characters in the range 0x21 to 0x7E
+   const char* pUID = p;
+   while (p < pEnd && *p > 0x20 && *p < 0x7F)
+      ++p;
+   if (p == pUID)
+      return false;
+
+   oEntry.strUID.assign(pUID, p - pUID);
+   return true;
+}
+
+const bool CPopResponseParser::ParseStatLine(const CStringView& Line, PopStat& oStat)
+{
+   const char* p = Line.data();
+   const char* const pEnd = Line.end();
+
+   if (Line.size() < 4 || memcmp(p, "+OK", 3) != 0 || !IsSpace(p[3]))
+      return false;
+   p += 3;
+
+   PopStat oParsed;
+   SkipSpaces(p, pEnd);
+   if (!ParseNumber(p, pEnd, oParsed.uMessages) || p == pEnd || !IsSpace(*p))
+      return false;
+   SkipSpaces(p, pEnd);
+   if (!ParseNumber(p, pEnd, oParsed.uOctets))
+      return false;
+
+   oStat = oParsed;
+   return true;
+}
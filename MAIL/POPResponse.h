@@ -0,0 +1,80 @@
+/*
+* @file POPResponse.h
+* @brief typed results of the POP3 LIST, UIDL and STAT commands and their parser
+*
+* The parser is fed by the libcurl callbacks as the response arrives, so only
+* the current incomplete line is buffered, never the whole listing.
+*/
+
+#ifndef INCLUDE_POPRESPONSE_H_
+#define INCLUDE_POPRESPONSE_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "StringView.h"
+
+// scan listing line (RFC 1939 5)
+struct PopListEntry
+{
+   unsigned long      uMsgNumber;
+   unsigned long long uOctets;
+};
+
+// unique-id listing line (RFC 1939 7)
+struct PopUidlEntry
+{
+   unsigned long      uMsgNumber;
+   std::string        strUID;
+};
+
+// drop listing (RFC 1939 5)
+struct PopStat
+{
+   PopStat() : uMessages(0), uOctets(0) {}
+   unsigned long      uMessages;
+   unsigned long long uOctets;
+};
+
+class CPopResponseParser
+{
+public:
+   CPopResponseParser();
+
+   /* select the container filled by the next response, the containers are cleared */
+   void SetTarget(std::vector<PopListEntry>* pvecList);
+   void SetTarget(std::vector<PopUidlEntry>* pvecUIDL);
+   void SetTarget(PopStat* pStat);
+   void Reset();
+
+   inline const bool HasTarget() const { return m_pvecList != nullptr || m_pvecUIDL != nullptr || m_pStat != nullptr; }
+
+   /* parse the next chunk of the response */
+   void Feed(const char* pData, size_t uSize);
+   /* parse a last line without line break. Returns false if a line couldn't be
+    * parsed or, for STAT, if no drop listing was received */
+   const bool Finish();
+
+   /* libcurl write/header callback, data must point to a CPopResponseParser */
+   static size_t WriteCallback(void* ptr, size_t size, size_t nmemb, void* data);
+
+   /* single line parsers, return false if the line isn't well-formed */
+   static const bool ParseListLine(const CStringView& Line, PopListEntry& oEntry);
+   static const bool ParseUidlLine(const CStringView& Line, PopUidlEntry& oEntry);
+   /* "+OK nn mm" */
+   static const bool ParseStatLine(const CStringView& Line, PopStat& oStat);
+
+protected:
+   void ParseLine(const CStringView& Line);
+
+   std::vector<PopListEntry>* m_pvecList;
+   std::vector<PopUidlEntry>* m_pvecUIDL;
+   PopStat*                   m_pStat;
+
+   std::string                m_strPartialLine;
+   bool                       m_bError;
+   bool                       m_bStatFound;
+};
+
+#endif
@@ -0,0 +1,266 @@
+/**
+* @file POPSession.cpp
+* @brief implementation of the native POP3 session
+*/
+
+#include "POPSession.h"
+
+#include <cstring>
+
+#include "StringView.h"
+
+CPopSession::CPopSession(LogFnCallback oLogger) :
+   m_oConnection(oLogger),
+   m_eState(STATUS_LINE),
+   m_bPipelining(false),
+   m_uWindow(DEFAULT_WINDOW),
+   m_oLog(oLogger)
+{
+
+}
+
+/**
+* @brief sends CAPA and looks for the PIPELINING capability, a server that
+* doesn't know CAPA gets one command at a time
+*
+* @retval true   The session is ready.
+* @retval false  The connection failed.
+*/
+const bool CPopSession::Start()
+{
+   m_bPipelining = false;
+
+   std::string strCapabilities;
+   bool bCapa = false;
+   if (!Execute(std::vector<Request>(1, Request("CAPA", true)),
+                [&strCapabilities](size_t, const char* pData, size_t uSize)
+                {
+                   strCapabilities.append(pData, uSize);
+                   return true;
+                },
+                [&bCapa](size_t, bool bOK, const std::string&)
+                {
+                   bCapa = bOK;
+                   return true;
+                }))
+      return false;
+
+   if (!bCapa)
+      return true;
+
+   // one capability per line, its name may be followed by parameters
+   size_t uPos = 0;
+   while (uPos < strCapabilities.size())
+   {
+      size_t uEnd = strCapabilities.find('\n', uPos);
+      if (uEnd == std::string::npos)
+         uEnd = strCapabilities.size();
+
+      CStringView Line = CStringView(strCapabilities.data() + uPos, uEnd - uPos).Trim();
+      const size_t uSpace = Line.find(' ');
+      if (uSpace != CStringView::npos)
+         Line = Line.substr(0, uSpace);
+
+      if (Line.EqualsNoCase("PIPELINING"))
+      {
+         m_bPipelining = true;
+         break;
+      }
+      uPos = uEnd + 1;
+   }
+   return true;
+}
+
+const bool CPopSession::Quit()
+{
+   if (!IsOpen())
+      return false;
+
+   bool bQuit = false;
+   const bool bResult = Execute(std::vector<Request>(1, Request("QUIT", false)), nullptr,
+                                [&bQuit](size_t, bool bOK, const std::string&)
+                                {
+                                   bQuit = bOK;
+                                   return true;
+                                });
+   Close();
+   return bResult && bQuit;
+}
+
+void CPopSession::Close()
+{
+   m_oConnection.Close();
+   m_strBuffer.clear();
+   m_eState = STATUS_LINE;
+   m_bPipelining = false;
+}
+
+/**
+* @brief sends a batch of commands, up to the window size without waiting for
+* the responses if the server supports pipelining
+*
+* @param [in] vecRequests commands to send, in order
+* @param [in] fnData receives the multi-line responses by chunks (can be empty)
+* @param [in] fnDone called at the end of each response (can be empty)
+*
+* @retval true   Every response was received.
+* @retval false  The connection failed or a callback aborted, the session is closed.
+*/
+const bool CPopSession::Execute(const std::vector<Request>& vecRequests, const DataFnCallback& fnData,
+                                const DoneFnCallback& fnDone)
+{
+   if (!IsOpen())
+   {
+      if (m_oLog)
+         m_oLog("[PopSession][Error] The session isn't open.");
+
+      return false;
+   }
+
+   m_strBuffer.clear();
+   m_eState = STATUS_LINE;
+
+   const size_t uWindow = m_bPipelining ? m_uWindow : 1;
+   size_t uSent = 0;
+   size_t uDone = 0;
+   std::string strCommands;
+
+   while (uDone < vecRequests.size())
+   {
+      // refill the window, the commands are sent in a single write
+      strCommands.clear();
+      while (uSent < vecRequests.size() && uSent - uDone < uWindow)
+      {
+         strCommands += vecRequests[uSent++].strCommand;
+         strCommands += "\r\n";
+      }
+
+      if ((!strCommands.empty() && !m_oConnection.Send(strCommands))
+          || !m_oConnection.Receive(m_strBuffer))
+      {
+         if (m_oLog)
+            m_oLog("[PopSession][Error] Connection lost after " + std::to_string(uDone) + " of "
+                   + std::to_string(vecRequests.size()) + " responses.");
+
+         Close();
+         return false;
+      }
+
+      if (!Parse(m_strBuffer, vecRequests, uDone, uSent, fnData, fnDone))
+      {
+         // the pending responses can't be skipped reliably
+         Close();
+         return false;
+      }
+   }
+   return true;
+}
+
+/**
+* @brief parses the responses in strBuffer, the state is kept between calls so
+* a response (even its termination line) can be split anywhere
+*
+* The body of a multi-line response is handed over in spans of whole lines
+* found with memchr, only the lines starting with a dot are looked at.
+*
+* @param [in,out] strBuffer received data, the parsed part is removed
+* @param [in] vecRequests commands of the batch
+* @param [in,out] uDone index of the request whose response is being parsed
+* @param [in] uSent number of requests sent
+* @param [in] fnData receives the multi-line responses by chunks
+* @param [in] fnDone called at the end of each response
+*
+* @retval true   The data was parsed.
+* @retval false  A callback aborted.
+*/
+const bool CPopSession::Parse(std::string& strBuffer, const std::vector<Request>& vecRequests, size_t& uDone,
+                              const size_t uSent, const DataFnCallback& fnData, const DoneFnCallback& fnDone)
+{
+   const char* const pData = strBuffer.data();
+   const size_t uSize = strBuffer.size();
+   size_t uPos = 0;
+   bool bResult = true;
+
+   while (bResult && uPos < uSize && uDone < uSent)
+   {
+      if (m_eState == STATUS_LINE)
+      {
+         const char* pNewLine = static_cast<const char*>(memchr(pData + uPos, '\n', uSize - uPos));
+         if (pNewLine == nullptr)
+            break;
+
+         size_t uLineEnd = pNewLine - pData;
+         if (uLineEnd > uPos && pData[uLineEnd - 1] == '\r')
+            --uLineEnd;
+         m_strStatus.assign(pData + uPos, uLineEnd - uPos);
+         uPos = pNewLine - pData + 1;
+
+         const bool bOK = m_strStatus.compare(0, 3, "+OK") == 0;
+         if (bOK && vecRequests[uDone].bMultiLine)
+         {
+            m_eState = LINE_START;
+            continue;
+         }
+
+         if (fnDone && !fnDone(uDone, bOK, m_strStatus))
+            bResult = false;
+         ++uDone;
+      }
+      else if (m_eState == LINE_START && pData[uPos] == '.')
+      {
+         // "." alone ends the response, otherwise the dot was stuffed
+         if (uPos + 1 >= uSize || (pData[uPos + 1] == '\r' && uPos + 2 >= uSize))
+            break;
+
+         size_t uTermination = 0;
+         if (pData[uPos + 1] == '\n')
+            uTermination = 2;
+         else if (pData[uPos + 1] == '\r' && pData[uPos + 2] == '\n')
+            uTermination = 3;
+
+         if (uTermination == 0)
+         {
+            ++uPos;
+            m_eState = IN_LINE;
+            continue;
+         }
+
+         uPos += uTermination;
+         m_eState = STATUS_LINE;
+         if (fnDone && !fnDone(uDone, true, m_strStatus))
+            bResult = false;
+         ++uDone;
+      }
+      else
+      {
+         const size_t uStart = uPos;
+         for (;;)
+         {
+            const char* pNewLine = static_cast<const char*>(memchr(pData + uPos, '\n', uSize - uPos));
+            if (pNewLine == nullptr)
+            {
+               uPos = uSize;
+               m_eState = IN_LINE;
+               break;
+            }
+
+            uPos = pNewLine - pData + 1;
+            if (uPos == uSize || pData[uPos] == '.')
+            {
+               m_eState = LINE_START;
+               break;
+            }
+         }
+
+         if (fnData && !fnData(uDone, pData + uStart, uPos - uStart))
+            bResult = false;
+      }
+   }
+
+   strBuffer.erase(0, uPos);
+
+   if (!bResult && m_oLog)
+      m_oLog("[PopSession][Error] Batch aborted at request " + std::to_string(uDone) + ".");
+
+   return bResult;
+}
@@ -0,0 +1,94 @@
+/*
+* @file POPSession.h
+* @brief native POP3 session used for batches of commands
+*
+* When the server announces PIPELINING (RFC 2449), a window of commands is
+* sent back to back instead of waiting for each response, the responses are
+* parsed as they stream in. Without it, the commands are sent one at a time on
+* the same connection.
+*/
+
+#ifndef INCLUDE_POPSESSION_H_
+#define INCLUDE_POPSESSION_H_
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "MailConnection.h"
+
+class CPopSession
+{
+public:
+   typedef std::function<void(const std::string&)> LogFnCallback;
+   /* chunk of the multi-line response to the request uIndex : dot-unstuffed,
+    * without the termination line. Returning false aborts the batch. */
+   typedef std::function<bool(size_t uIndex, const char* pData, size_t uSize)> DataFnCallback;
+   /* end of the response to the request uIndex, strStatus is its status line.
+    * Returning false aborts the batch. */
+   typedef std::function<bool(size_t uIndex, bool bOK, const std::string& strStatus)> DoneFnCallback;
+
+   struct Request
+   {
+      Request(const std::string& strCmd, const bool bMulti) : strCommand(strCmd), bMultiLine(bMulti) {}
+      std::string strCommand;
+      /* a successful response is followed by lines up to a "." line */
+      bool        bMultiLine;
+   };
+
+   static const size_t DEFAULT_WINDOW = 32;
+
+   explicit CPopSession(LogFnCallback oLogger = nullptr);
+
+   // copy constructor and assignment operator are disabled
+   CPopSession(const CPopSession& Copy) = delete;
+   CPopSession& operator=(const CPopSession& Copy) = delete;
+
+   /* the connection must be opened (logged in) before Start is called */
+   inline CMailConnection& GetConnection() { return m_oConnection; }
+   inline const bool IsOpen() const { return m_oConnection.IsOpen(); }
+
+   /* reads the capabilities (CAPA) of the server */
+   const bool Start();
+   /* sends QUIT (deletions are committed) and closes the connection */
+   const bool Quit();
+   /* drops the connection without QUIT, the server discards the deletions */
+   void Close();
+
+   inline const bool IsPipelining() const { return m_bPipelining; }
+   /* maximum number of commands waiting for their response */
+   inline void SetWindow(const size_t& uWindow) { m_uWindow = (uWindow > 0) ? uWindow : 1; }
+   inline const size_t GetWindow() const { return m_uWindow; }
+
+   /* sends the requests and passes the responses to the callbacks. Returns
+    * false if the connection failed or a callback aborted the batch (the
+    * session is closed), a negative response isn't a failure. */
+   const bool Execute(const std::vector<Request>& vecRequests, const DataFnCallback& fnData,
+                      const DoneFnCallback& fnDone);
+
+   /* parses received data for the requests [uDone, uSent), returns false if a
+    * callback aborted. Consumed data is removed from strBuffer. */
+   const bool Parse(std::string& strBuffer, const std::vector<Request>& vecRequests, size_t& uDone,
+                    const size_t uSent, const DataFnCallback& fnData, const DoneFnCallback& fnDone);
+
+protected:
+   enum ParserState
+   {
+      STATUS_LINE,
+      LINE_START,
+      IN_LINE
+   };
+
+   CMailConnection   m_oConnection;
+   std::string       m_strBuffer;
+   ParserState       m_eState;
+   std::string       m_strStatus;
+
+   bool              m_bPipelining;
+   size_t            m_uWindow;
+
+   LogFnCallback     m_oLog;
+};
+
+#endif
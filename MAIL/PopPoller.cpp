@@ -0,0 +1,268 @@
+/**
+* @file PopPoller.cpp
+* @brief implementation of the multi-account POP3 poller
+*/
+
+#include "PopPoller.h"
+
+#include <algorithm>
+
+/**
+* @brief constructor of the poller
+*
+* @param [in] fnNewMail called when an account received mail
+* @param [in] oLogger optional log function, called by the worker threads
+* @param [in] uMaxConnections number of worker threads, i.e. maximum number of
+* accounts polled at the same time
+*/
+CPopPoller::CPopPoller(NewMailFnCallback fnNewMail, LogFnCallback oLogger,
+                       const size_t uMaxConnections) :
+   m_fnNewMail(fnNewMail),
+   m_uMaxConnections((uMaxConnections > 0) ? uMaxConnections : 1),
+   m_uMinInterval(DEFAULT_MIN_INTERVAL),
+   m_uMaxInterval(DEFAULT_MAX_INTERVAL),
+   m_iTimeout(30),
+   m_oRandom(std::random_device()()),
+   m_bStopping(false),
+   m_uPolls(0),
+   m_uFailures(0),
+   m_uNewMail(0),
+   m_oLog(oLogger)
+{
+
+}
+
+CPopPoller::~CPopPoller()
+{
+   Stop();
+}
+
+void CPopPoller::SetIntervals(const unsigned uMinInterval, const unsigned uMaxInterval)
+{
+   std::lock_guard<std::mutex> lock(m_mtxAccounts);
+   m_uMinInterval = (uMinInterval > 0) ? uMinInterval : 1;
+   m_uMaxInterval = std::max(uMaxInterval, m_uMinInterval);
+}
+
+size_t CPopPoller::AddAccount(const PopPollerAccount& oAccount)
+{
+   std::lock_guard<std::mutex> lock(m_mtxAccounts);
+
+   const size_t uAccount = m_dqAccounts.size();
+   m_dqAccounts.emplace_back();
+   m_dqAccounts.back().oAccount = oAccount;
+   m_dqAccounts.back().uInterval = m_uMinInterval;
+
+   // the accounts added together aren't polled in a burst
+   std::uniform_int_distribution<unsigned long long> oDelay(0, m_uMinInterval * 1000ULL - 1);
+   m_pqDue.emplace(Clock::now() + std::chrono::milliseconds(oDelay(m_oRandom)), uAccount);
+   m_cvSchedule.notify_one();
+
+   return uAccount;
+}
+
+const bool CPopPoller::RemoveAccount(const size_t uAccount)
+{
+   std::lock_guard<std::mutex> lock(m_mtxAccounts);
+   if (uAccount >= m_dqAccounts.size() || m_dqAccounts[uAccount].bRemoved)
+      return false;
+
+   // its schedule is dropped when it's due
+   m_dqAccounts[uAccount].bRemoved = true;
+   m_dqAccounts[uAccount].oAccount = PopPollerAccount();
+   return true;
+}
+
+const bool CPopPoller::Start()
+{
+   if (!m_fnNewMail)
+   {
+      if (m_oLog)
+         m_oLog("[PopPoller][Error] No new mail callback.");
+
+      return false;
+   }
+
+   if (!m_vecWorkers.empty())
+      return true;
+
+   m_bStopping = false;
+   for (size_t i = 0; i < m_uMaxConnections; ++i)
+      m_vecWorkers.emplace_back(&CPopPoller::Run, this);
+
+   return true;
+}
+
+void CPopPoller::Stop()
+{
+   {
+      std::lock_guard<std::mutex> lock(m_mtxAccounts);
+      m_bStopping = true;
+   }
+   m_cvSchedule.notify_all();
+
+   for (std::thread& oWorker : m_vecWorkers)
+      oWorker.join();
+   m_vecWorkers.clear();
+}
+
+unsigned CPopPoller::GetInterval(const size_t uAccount) const
+{
+   std::lock_guard<std::mutex> lock(m_mtxAccounts);
+   if (uAccount >= m_dqAccounts.size() || m_dqAccounts[uAccount].bRemoved)
+      return 0;
+
+   return m_dqAccounts[uAccount].uInterval;
+}
+
+size_t CPopPoller::GetPollCount() const
+{
+   std::lock_guard<std::mutex> lock(m_mtxAccounts);
+   return m_uPolls;
+}
+
+size_t CPopPoller::GetFailureCount() const
+{
+   std::lock_guard<std::mutex> lock(m_mtxAccounts);
+   return m_uFailures;
+}
+
+size_t CPopPoller::GetNewMailCount() const
+{
+   std::lock_guard<std::mutex> lock(m_mtxAccounts);
+   return m_uNewMail;
+}
+
+unsigned CPopPoller::NextInterval(const unsigned uInterval, const bool bNewMail,
+                                  const unsigned uMinInterval, const unsigned uMaxInterval)
+{
+   if (bNewMail || uInterval < uMinInterval)
+      return uMinInterval;
+
+   return (uInterval > uMaxInterval / 2) ? uMaxInterval : uInterval * 2;
+}
+
+/**
+* @brief body of a worker thread : polls the account that is due first, the
+* account is out of the schedule while it's polled so no other worker can
+* take it
+*/
+void CPopPoller::Run()
+{
+   CPOPClient oClient(m_oLog ? CMailClient::LogFnCallback(m_oLog) : [](const std::string&) {});
+   // signals can't be used for the timeouts of several threads
+   oClient.SetNoSignal(true);
+
+   std::unique_lock<std::mutex> lock(m_mtxAccounts);
+   while (!m_bStopping)
+   {
+      if (m_pqDue.empty())
+      {
+         m_cvSchedule.wait(lock);
+         continue;
+      }
+
+      const Schedule oNext = m_pqDue.top();
+      if (oNext.first > Clock::now())
+      {
+         m_cvSchedule.wait_until(lock, oNext.first);
+         continue;
+      }
+      m_pqDue.pop();
+
+      const size_t uAccount = oNext.second;
+      if (m_dqAccounts[uAccount].bRemoved)
+         continue;
+
+      const PopPollerAccount oAccount = m_dqAccounts[uAccount].oAccount;
+      oClient.SetTimeout(m_iTimeout);
+      lock.unlock();
+
+      PopStat oStat;
+      const bool bPolled = Poll(oClient, oAccount, oStat);
+
+      lock.lock();
+      AccountState& oState = m_dqAccounts[uAccount];
+      ++m_uPolls;
+
+      // a mailbox that changed and isn't empty received mail
+      bool bNewMail = false;
+      if (!bPolled)
+         ++m_uFailures;
+      else
+      {
+         bNewMail = oStat.uMessages > 0
+                 && (!oState.bKnown || oStat.uMessages != oState.uMessages || oStat.uOctets != oState.uOctets);
+         oState.bKnown = true;
+         oState.uMessages = oStat.uMessages;
+         oState.uOctets = oStat.uOctets;
+      }
+
+      if (bNewMail)
+         ++m_uNewMail;
+      lock.unlock();
+
+      PopStat oAfter;
+      bool bStat = false;
+      if (bNewMail)
+      {
+         m_fnNewMail(uAccount, oClient, oStat);
+         // the callback may have removed messages
+         bStat = oClient.Stat(oAfter);
+      }
+      oClient.CleanupSession();
+
+      lock.lock();
+      if (bStat)
+      {
+         oState.uMessages = oAfter.uMessages;
+         oState.uOctets = oAfter.uOctets;
+      }
+
+      if (oState.bRemoved)
+         continue;
+
+      // failures back off like quiet mailboxes
+      oState.uInterval = NextInterval(oState.uInterval, bNewMail, m_uMinInterval, m_uMaxInterval);
+      Reschedule(uAccount, oState.uInterval);
+   }
+}
+
+/**
+* @brief logs in an account and sends STAT, the session is left open for the
+* new mail callback
+*
+* @retval true   oStat was received.
+* @retval false  The connection or the login failed.
+*/
+const bool CPopPoller::Poll(CPOPClient& oClient, const PopPollerAccount& oAccount, PopStat& oStat)
+{
+   if (!oClient.InitSession(oAccount.strServer, oAccount.strUsername, oAccount.strPassword,
+                            m_oLog ? CMailClient::ALL_FLAGS : CMailClient::NO_FLAGS, oAccount.eSslTlsFlags))
+      return false;
+
+   if (!oClient.Stat(oStat))
+   {
+      if (m_oLog)
+         m_oLog("[PopPoller][Error] Unable to poll " + oAccount.strUsername + "@" + oAccount.strServer + ".");
+
+      return false;
+   }
+   return true;
+}
+
+/**
+* @brief schedules the next poll of an account, the interval is spread by
+* +/- 10% so the accounts polled together drift apart. m_mtxAccounts must be
+* locked.
+*/
+void CPopPoller::Reschedule(const size_t uAccount, const unsigned uInterval)
+{
+   // in 64 bits, the interval can be up to UINT_MAX seconds
+   const unsigned long long uMilliseconds = uInterval * 1000ULL;
+   std::uniform_int_distribution<unsigned long long> oJitter(uMilliseconds - uMilliseconds / 10,
+                                                             uMilliseconds + uMilliseconds / 10);
+
+   m_pqDue.emplace(Clock::now() + std::chrono::milliseconds(oJitter(m_oRandom)), uAccount);
+   m_cvSchedule.notify_one();
+}
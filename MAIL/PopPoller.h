@@ -0,0 +1,131 @@
+/*
+* @file PopPoller.h
+* @brief checks many POP3 accounts for new mail over a bounded set of connections
+*
+* Each account is polled with STAT at its own interval : the interval doubles
+* (up to a maximum) while the mailbox stays unchanged and falls back to the
+* minimum as soon as new mail is seen, so quiet accounts cost almost nothing
+* while busy ones are checked often. The accounts that are due are polled by a
+* fixed number of worker threads, which caps the number of simultaneous
+* connections whatever the number of accounts.
+*/
+
+#ifndef INCLUDE_POPPOLLER_H_
+#define INCLUDE_POPPOLLER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "POPClient.h"
+
+// account checked by CPopPoller
+struct PopPollerAccount
+{
+   PopPollerAccount() : eSslTlsFlags(CMailClient::NO_SSLTLS) {}
+   std::string              strServer;
+   std::string              strUsername;
+   std::string              strPassword;
+   CMailClient::SslTlsFlag  eSslTlsFlags;
+};
+
+class CPopPoller
+{
+public:
+   typedef std::function<void(const std::string&)> LogFnCallback;
+   /* called by a worker thread when an account received mail. oClient is logged
+    * in the account (e.g. to run a CPopSync or a Drain), the connection is
+    * closed when the callback returns. */
+   typedef std::function<void(const size_t uAccount, CPOPClient& oClient, const PopStat& oStat)> NewMailFnCallback;
+
+   static const size_t DEFAULT_MAX_CONNECTIONS = 16;
+   static const unsigned DEFAULT_MIN_INTERVAL = 60;
+   static const unsigned DEFAULT_MAX_INTERVAL = 3600;
+
+   explicit CPopPoller(NewMailFnCallback fnNewMail, LogFnCallback oLogger = nullptr,
+                       const size_t uMaxConnections = DEFAULT_MAX_CONNECTIONS);
+   ~CPopPoller();
+
+   // copy constructor and assignment operator are disabled
+   CPopPoller(const CPopPoller& Copy) = delete;
+   CPopPoller& operator=(const CPopPoller& Copy) = delete;
+
+   /* bounds of the polling interval in seconds, to be set before Start */
+   void SetIntervals(const unsigned uMinInterval, const unsigned uMaxInterval);
+   /* timeout of a poll in seconds (default 30) */
+   inline void SetTimeout(const int& iTimeout) { m_iTimeout = iTimeout; }
+
+   /* the accounts can be added or removed while polling, the first poll of a
+    * new account is spread over the minimum interval. Returns its identifier. */
+   size_t AddAccount(const PopPollerAccount& oAccount);
+   const bool RemoveAccount(const size_t uAccount);
+
+   /* starts the worker threads */
+   const bool Start();
+   /* waits for the polls in progress and stops the threads */
+   void Stop();
+
+   /* current polling interval of an account in seconds, 0 if unknown */
+   unsigned GetInterval(const size_t uAccount) const;
+   /* number of STAT sent, of polls that failed and of polls that found new mail */
+   size_t GetPollCount() const;
+   size_t GetFailureCount() const;
+   size_t GetNewMailCount() const;
+
+   /* next interval of an account polled with uInterval : doubled while nothing
+    * changes, reset to the minimum on new mail */
+   static unsigned NextInterval(const unsigned uInterval, const bool bNewMail,
+                                const unsigned uMinInterval, const unsigned uMaxInterval);
+
+protected:
+   typedef std::chrono::steady_clock Clock;
+   typedef std::pair<Clock::time_point, size_t> Schedule;
+
+   struct AccountState
+   {
+      AccountState() : uInterval(0), bKnown(false), bRemoved(false), uMessages(0), uOctets(0) {}
+      PopPollerAccount   oAccount;
+      unsigned           uInterval;
+      bool               bKnown;     // polled successfully at least once
+      bool               bRemoved;
+      // last STAT
+      unsigned long      uMessages;
+      unsigned long long uOctets;
+   };
+
+   void Run();
+   const bool Poll(CPOPClient& oClient, const PopPollerAccount& oAccount, PopStat& oStat);
+   void Reschedule(const size_t uAccount, const unsigned uInterval);
+
+   NewMailFnCallback          m_fnNewMail;
+   size_t                     m_uMaxConnections;
+   unsigned                   m_uMinInterval;
+   unsigned                   m_uMaxInterval;
+   std::atomic<int>           m_iTimeout;    // read by the workers
+
+   // guarded by m_mtxAccounts, a deque keeps the states in place while they're polled
+   std::deque<AccountState>   m_dqAccounts;
+   std::priority_queue<Schedule, std::vector<Schedule>, std::greater<Schedule>> m_pqDue;
+   std::minstd_rand           m_oRandom;
+   bool                       m_bStopping;
+   size_t                     m_uPolls;
+   size_t                     m_uFailures;
+   size_t                     m_uNewMail;
+   mutable std::mutex         m_mtxAccounts;
+   std::condition_variable    m_cvSchedule;
+
+   std::vector<std::thread>   m_vecWorkers;
+
+   LogFnCallback              m_oLog;
+};
+
+#endif
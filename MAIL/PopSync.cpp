@@ -0,0 +1,266 @@
+/**
+* @file PopSync.cpp
+* @brief implementation of the incremental POP3 retrieval
+*/
+
+#include "PopSync.h"
+
+#include <cstdio>
+
+namespace
+{
+const char STATE_FILE_MAGIC[] = "POPSYNC1";
+const size_t STATE_FILE_MAGIC_SIZE = sizeof(STATE_FILE_MAGIC) - 1;
+}
+
+/**
+* @brief constructor of the POP3 synchronizer
+*
+* @param [in] oClient POP client, its session must be initialized before Sync is called
+* @param [in] strStateFile path of the state file of the account, the journal
+* is stored next to it (same path followed by ".journal")
+* @param [in] oLogger optional log function
+*/
+CPopSync::CPopSync(CPOPClient& oClient, const std::string& strStateFile, LogFnCallback oLogger) :
+   m_oClient(oClient),
+   m_strStateFile(strStateFile),
+   m_strJournalFile(strStateFile + ".journal"),
+   m_bDeleteAfterStore(false),
+   m_bLoaded(false),
+   m_uRetrieved(0),
+   m_oLog(oLogger)
+{
+}
+
+CPopSync::~CPopSync()
+{
+   if (m_ofJournal.is_open())
+      m_ofJournal.close();
+}
+
+/**
+* @brief loads the state file (sorted UIDs, each one stored as the length of the
+* prefix shared with the previous UID followed by the rest of it) and replays
+* the journal written since the last Save
+*
+* @retval true   Successfully loaded.
+* @retval false  The state file is corrupted.
+*/
+const bool CPopSync::Load()
+{
+   m_oSeen.Clear();
+
+   std::ifstream ifState(m_strStateFile, std::ifstream::in | std::ifstream::binary);
+   if (ifState)
+   {
+      const std::string strState((std::istreambuf_iterator<char>(ifState)), std::istreambuf_iterator<char>());
+      ifState.close();
+
+      if (strState.compare(0, STATE_FILE_MAGIC_SIZE, STATE_FILE_MAGIC) != 0)
+      {
+         if (m_oLog)
+            m_oLog("[PopSync][Error] Invalid state file " + m_strStateFile + ".");
+
+         return false;
+      }
+
+      size_t uPos = STATE_FILE_MAGIC_SIZE;
+      if (!m_oSeen.Deserialize(strState, uPos))
+      {
+         if (m_oLog)
+            m_oLog("[PopSync][Error] Truncated state file " + m_strStateFile + ".");
+
+         return false;
+      }
+   }
+
+   // UIDs stored after the last Save
+   std::ifstream ifJournal(m_strJournalFile);
+   std::string strLine;
+   while (std::getline(ifJournal, strLine))
+   {
+      if (!strLine.empty())
+         m_oSeen.Insert(strLine);
+   }
+
+   m_bLoaded = true;
+   return true;
+}
+
+/**
+* @brief writes the state file (through a temporary file, so a crash leaves
+* the previous state intact) and clears the journal
+*/
+const bool CPopSync::Save()
+{
+   std::string strState(STATE_FILE_MAGIC, STATE_FILE_MAGIC_SIZE);
+   m_oSeen.Serialize(strState);
+
+   const std::string strTempFile = m_strStateFile + ".tmp";
+   std::ofstream ofState(strTempFile, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+   ofState.write(strState.data(), strState.size());
+   ofState.close();
+
+   if (!ofState)
+   {
+      if (m_oLog)
+         m_oLog("[PopSync][Error] Unable to write state file " + strTempFile + ".");
+
+      return false;
+   }
+
+#ifdef WINDOWS
+   remove(m_strStateFile.c_str());
+#endif
+   if (rename(strTempFile.c_str(), m_strStateFile.c_str()) != 0)
+   {
+      if (m_oLog)
+         m_oLog("[PopSync][Error] Unable to replace state file " + m_strStateFile + ".");
+
+      return false;
+   }
+
+   if (m_ofJournal.is_open())
+      m_ofJournal.close();
+   remove(m_strJournalFile.c_str());
+
+   return true;
+}
+
+/**
+* @brief retrieves the new messages : one UIDL, then a RETR for each UID that
+* wasn't seen yet
+*
+* A message is marked as seen (and deleted from the server if enabled) only
+* when fnStore returns true. With deletion enabled, seen messages still on the
+* server (e.g. the session was interrupted before QUIT) are deleted again.
+*
+* @param [in] fnStore receives the UIDL entry and the content of each new message
+*
+* @retval true   Every new message was retrieved and stored.
+* @retval false  The listing failed or at least one message wasn't stored.
+*/
+const bool CPopSync::Sync(const StoreFnCallback& fnStore)
+{
+   m_uRetrieved = 0;
+
+   if (!m_bLoaded && !Load())
+      return false;
+
+   std::vector<PopUidlEntry> vecUIDL;
+   if (!m_oClient.ListUIDL(vecUIDL))
+   {
+      if (m_oLog)
+         m_oLog("[PopSync][Error] Unable to list the unique IDs of the mailbox.");
+
+      return false;
+   }
+
+   // a single pass over the seen UIDs for the whole listing
+   std::vector<std::string> vecPresent;
+   vecPresent.reserve(vecUIDL.size());
+   for (const PopUidlEntry& oEntry : vecUIDL)
+      vecPresent.push_back(oEntry.strUID);
+
+   std::vector<bool> vecSeen;
+   m_oSeen.Contains(vecPresent, vecSeen);
+
+   bool bResult = true;
+   std::string strMessage;
+
+   for (size_t i = 0; i < vecUIDL.size(); ++i)
+   {
+      const PopUidlEntry& oEntry = vecUIDL[i];
+      const std::string strMsgNumber = std::to_string(oEntry.uMsgNumber);
+
+      if (!vecSeen[i])
+      {
+         strMessage.clear();
+         if (!m_oClient.GetString(strMsgNumber, strMessage))
+         {
+            if (m_oLog)
+               m_oLog("[PopSync][Error] Unable to retrieve message " + oEntry.strUID + ".");
+
+            bResult = false;
+            continue;
+         }
+
+         if (!fnStore(oEntry, strMessage))
+         {
+            bResult = false;
+            continue;
+         }
+
+         // the message mustn't be deleted if we can't remember it was stored
+         if (!MarkSeen(oEntry.strUID))
+         {
+            bResult = false;
+            continue;
+         }
+         ++m_uRetrieved;
+      }
+
+      if (m_bDeleteAfterStore)
+      {
+         if (!m_oClient.Delete(strMsgNumber))
+         {
+            if (m_oLog)
+               m_oLog("[PopSync][Error] Unable to delete message " + oEntry.strUID + ".");
+
+            bResult = false;
+         }
+      }
+   }
+
+   // forget the UIDs that are no longer on the server. The messages deleted by
+   // this run are still in its listing, they're forgotten by the first run
+   // that doesn't list them anymore.
+   const size_t uSeen = m_oSeen.GetCount();
+   m_oSeen.Retain(vecPresent);
+
+   // a poll without changes doesn't rewrite the state
+   if (m_oSeen.GetCount() != uSeen || m_uRetrieved > 0 || m_ofJournal.is_open())
+   {
+      if (!Save())
+         bResult = false;
+   }
+
+   return bResult;
+}
+
+const bool CPopSync::IsSeen(const std::string& strUID) const
+{
+   return m_oSeen.Contains(strUID);
+}
+
+const bool CPopSync::MarkSeen(const std::string& strUID)
+{
+   if (m_oSeen.Contains(strUID))
+      return true;
+
+   if (!AppendJournal(strUID))
+      return false;
+
+   m_oSeen.Insert(strUID);
+   return true;
+}
+
+const bool CPopSync::AppendJournal(const std::string& strUID)
+{
+   if (!m_ofJournal.is_open())
+      m_ofJournal.open(m_strJournalFile, std::ofstream::out | std::ofstream::app);
+
+   m_ofJournal << strUID << '\n';
+   m_ofJournal.flush();
+
+   if (!m_ofJournal)
+   {
+      if (m_oLog)
+         m_oLog("[PopSync][Error] Unable to write journal " + m_strJournalFile + ".");
+
+      m_ofJournal.close();
+      m_ofJournal.clear();
+      return false;
+   }
+   return true;
+}
@@ -0,0 +1,77 @@
+/*
+* @file PopSync.h
+* @brief incremental POP3 retrieval driven by the UIDs already seen
+*
+* The UIDs of the stored messages are kept in a compact state file (sorted,
+* front coded) and an append-only journal, so a poll without new mail costs a
+* single UIDL and a restart, even after a crash, never downloads a message
+* twice.
+*/
+
+#ifndef INCLUDE_POPSYNC_H_
+#define INCLUDE_POPSYNC_H_
+
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "POPClient.h"
+#include "SeenUidSet.h"
+
+class CPopSync
+{
+public:
+   typedef std::function<void(const std::string&)> LogFnCallback;
+   /* receives a new message, returns true once it's safely stored */
+   typedef std::function<bool(const PopUidlEntry&, const std::string&)> StoreFnCallback;
+
+   CPopSync(CPOPClient& oClient, const std::string& strStateFile, LogFnCallback oLogger = nullptr);
+   ~CPopSync();
+
+   // copy constructor and assignment operator are disabled
+   CPopSync(const CPopSync& Copy) = delete;
+   CPopSync& operator=(const CPopSync& Copy) = delete;
+
+   /* read the state file and replay the journal, a missing state file is an empty state.
+    * Called by the first Sync if it wasn't called before. */
+   const bool Load();
+   /* rewrite the state file and clear the journal */
+   const bool Save();
+
+   /* retrieve the messages that weren't seen yet and pass them to fnStore.
+    * Stored messages are marked as seen (and deleted from the server if enabled),
+    * the UIDs no longer on the server are forgotten. */
+   const bool Sync(const StoreFnCallback& fnStore);
+
+   /* delete the messages from the server once they're stored */
+   inline void SetDeleteAfterStore(const bool& bDelete) { m_bDeleteAfterStore = bDelete; }
+
+   const bool IsSeen(const std::string& strUID) const;
+   /* mark a UID as seen, the journal is updated immediately */
+   const bool MarkSeen(const std::string& strUID);
+
+   inline size_t GetSeenCount() const { return m_oSeen.GetCount(); }
+   /* set of the UIDs seen, e.g. to enable its Bloom filter */
+   inline CSeenUidSet& GetSeenSet() { return m_oSeen; }
+   /* number of messages retrieved by the last Sync */
+   inline size_t GetRetrievedCount() const { return m_uRetrieved; }
+
+protected:
+   const bool AppendJournal(const std::string& strUID);
+
+   CPOPClient&               m_oClient;
+   std::string               m_strStateFile;
+   std::string               m_strJournalFile;
+   bool                      m_bDeleteAfterStore;
+   bool                      m_bLoaded;
+   size_t                    m_uRetrieved;
+
+   CSeenUidSet               m_oSeen;
+   std::ofstream             m_ofJournal;
+
+   LogFnCallback             m_oLog;
+};
+
+#endif
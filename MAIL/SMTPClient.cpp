@@ -124,8 +124,16 @@ const bool CSMTPClient::PrePerform()
                [](const char c) { return c == '\n'; });*/
 
             //curl_easy_setopt(m_pCurlSession, CURLOPT_INFILESIZE, uCountLF + m_strMail.length());
-            curl_easy_setopt(m_pCurlSession, CURLOPT_READFUNCTION, ReadLineFromStringStreamCallback);
-            curl_easy_setopt(m_pCurlSession, CURLOPT_READDATA, &m_ssString);
+            if (m_pDKIMSigner)
+            {
+               if (!PrepareSignedUpload(m_strMail.data(), m_strMail.size()))
+                  return false;
+            }
+            else
+            {
+               curl_easy_setopt(m_pCurlSession, CURLOPT_READFUNCTION, ReadLineFromStringStreamCallback);
+               curl_easy_setopt(m_pCurlSession, CURLOPT_READDATA, &m_ssString);
+            }
             curl_easy_setopt(m_pCurlSession, CURLOPT_UPLOAD, 1L);
          }
          else
@@ -147,32 +155,54 @@ const bool CSMTPClient::PrePerform()
             }
             curl_off_t fsize = (curl_off_t)file_info.st_size;*/
 
-            // I want to compute the size of the file without CR bytes
-            // does this work properly ?
-            m_fLocalFile.open(m_strLocalFile, std::fstream::in);
+            if (m_pDKIMSigner)
+            {
+               /* the file is mapped rather than read so that it can be hashed and then
+                * sent without holding a copy of it, whatever its size */
+               if (!m_oMappedFile.Open(m_strLocalFile))
+               {
+                  if (m_eSettingsFlags & ENABLE_LOG)
+                     m_oLog(StringFormat("[SMTPClient][Error] Unable to map local file %s in CSMTPClient::PrePerform()"
+                                         "in case SMTP_SEND_FILE.", m_strLocalFile.c_str()));
 
-            // LF will be replaced by CRLF when sending the mail
-            /*uCountLF = std::count_if((std::istreambuf_iterator<char>(m_fLocalFile)),
-                                      std::istreambuf_iterator<char>(),
-                                      [&uFileSize](const char c) -> bool
-                                      { ++uFileSize; return c == '\n'; });*/
+                  return false;
+               }
+               m_oMappedFile.AdviseSequential();
 
-            if (m_fLocalFile)
-            {
-               m_fLocalFile.seekg(0);
+               if (!PrepareSignedUpload(m_oMappedFile.GetData(), m_oMappedFile.GetSize()))
+                  return false;
 
-               curl_easy_setopt(m_pCurlSession, CURLOPT_READFUNCTION, CMailClient::ReadLineFromFileStreamCallback);
-               curl_easy_setopt(m_pCurlSession, CURLOPT_READDATA, &m_fLocalFile);
                curl_easy_setopt(m_pCurlSession, CURLOPT_UPLOAD, 1L);
-               //curl_easy_setopt(m_pCurlSession, CURLOPT_INFILESIZE_LARGE, uFileSize + uCountLF);
             }
             else
             {
-               if (m_eSettingsFlags & ENABLE_LOG)
-                  m_oLog(StringFormat("[SMTPClient][Error] Unable to open local file %s in CSMTPClient::PrePerform()"
-                                      "in case SMTP_SEND_FILE.", m_strLocalFile.c_str()));
-
-               return false;
+               // I want to compute the size of the file without CR bytes
+               // does this work properly ?
+               m_fLocalFile.open(m_strLocalFile, std::fstream::in);
+
+               // LF will be replaced by CRLF when sending the mail
+               /*uCountLF = std::count_if((std::istreambuf_iterator<char>(m_fLocalFile)),
+                                         std::istreambuf_iterator<char>(),
+                                         [&uFileSize](const char c) -> bool
+                                         { ++uFileSize; return c == '\n'; });*/
+
+               if (m_fLocalFile)
+               {
+                  m_fLocalFile.seekg(0);
+
+                  curl_easy_setopt(m_pCurlSession, CURLOPT_READFUNCTION, CMailClient::ReadLineFromFileStreamCallback);
+                  curl_easy_setopt(m_pCurlSession, CURLOPT_READDATA, &m_fLocalFile);
+                  curl_easy_setopt(m_pCurlSession, CURLOPT_UPLOAD, 1L);
+                  //curl_easy_setopt(m_pCurlSession, CURLOPT_INFILESIZE_LARGE, uFileSize + uCountLF);
+               }
+               else
+               {
+                  if (m_eSettingsFlags & ENABLE_LOG)
+                     m_oLog(StringFormat("[SMTPClient][Error] Unable to open local file %s in CSMTPClient::PrePerform()"
+                                         "in case SMTP_SEND_FILE.", m_strLocalFile.c_str()));
+
+                  return false;
+               }
             }
             curl_easy_setopt(m_pCurlSession, CURLOPT_MAIL_FROM, m_strFrom.c_str());
             m_pRecipientslist = curl_slist_append(m_pRecipientslist, m_strTo.c_str());
@@ -240,8 +270,43 @@ const bool CSMTPClient::PostPerform(CURLcode ePerformCode)
    ePerformCode;
 
    if (m_eOperationType == SMTP_SEND_FILE)
+   {
       if (m_fLocalFile.is_open())
          m_fLocalFile.close();
 
+      m_oMappedFile.Close();
+   }
+   m_oUpload.Reset(nullptr, 0);
+
+   return true;
+}
+
+/**
+* @brief signs the e-mail with DKIM and sets the read callback to send the
+* DKIM-Signature header followed by the e-mail from the same memory block.
+*
+* The body is hashed in a single pass (no copy is made) and the upload is
+* performed in chunks as large as libcurl's buffer.
+*
+* @param [in] pMail e-mail (headers, empty line and body)
+* @param [in] uSize size of the e-mail
+*
+* @retval true   The upload is ready.
+* @retval false  The e-mail couldn't be signed.
+*/
+const bool CSMTPClient::PrepareSignedUpload(const char* pMail, size_t uSize)
+{
+   m_oUpload.Reset(pMail, uSize);
+
+   if (!m_pDKIMSigner->SignMessage(pMail, uSize, m_oUpload.strPrefix))
+   {
+      if (m_eSettingsFlags & ENABLE_LOG)
+         m_oLog("[SMTPClient][Error] Unable to sign the e-mail with DKIM.");
+
+      return false;
+   }
+
+   curl_easy_setopt(m_pCurlSession, CURLOPT_READFUNCTION, &CMailClient::ReadFromMemoryCallback);
+   curl_easy_setopt(m_pCurlSession, CURLOPT_READDATA, &m_oUpload);
    return true;
 }
@@ -10,6 +10,8 @@
 #define INCLUDE_SMTPCLIENT_H_
 
 #include "MAILClient.h"
+#include "DKIMSigner.h"
+#include "MappedFile.h"
 
 class CSMTPClient : public CMailClient
 {
@@ -34,6 +36,10 @@ public:
    /* expand an e-mail mailing list */
    const bool ExpandMailList(const std::string& strListName);
 
+   /* sign the sent e-mails with DKIM, pass nullptr to stop signing */
+   inline void SetDKIMSigner(std::shared_ptr<CDKIMSigner> pSigner) { m_pDKIMSigner = pSigner; }
+   inline std::shared_ptr<CDKIMSigner> GetDKIMSigner() const { return m_pDKIMSigner; }
+
 protected:
    enum MailOperation
    {
@@ -44,6 +50,7 @@ protected:
    };
 
    const bool PrePerform() override;
+   const bool PrepareSignedUpload(const char* pMail, size_t uSize);
    const bool PostPerform(CURLcode ePerformCode) override;
    inline void ParseURL(std::string& strURL) override final;
 
@@ -54,6 +61,11 @@ protected:
    std::string          m_strCc;
    std::string          m_strMail;
 
+   // DKIM : the mail is signed then streamed from memory (string or mapped file)
+   std::shared_ptr<CDKIMSigner> m_pDKIMSigner;
+   CMappedFile                  m_oMappedFile;
+   UploadBufferStruct           m_oUpload;
+
 };
 
 #endif
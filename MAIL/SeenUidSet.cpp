@@ -0,0 +1,436 @@
+/**
+* @file SeenUidSet.cpp
+* @brief implementation of the compact set of seen UIDs
+*/
+
+#include "SeenUidSet.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Varint.h"
+
+namespace
+{
+// below that ratio between the set and the UIDs checked, a lookup per UID is
+// cheaper than a pass over the whole set
+const size_t BULK_LOOKUP_RATIO = 64;
+
+uint64_t HashUID(const CStringView& UID)
+{
+   // FNV-1a followed by a finalizer, the two halves feed the double hashing
+   uint64_t uHash = 14695981039346656037ULL;
+   for (const char c : UID)
+   {
+      uHash ^= static_cast<unsigned char>(c);
+      uHash *= 1099511628211ULL;
+   }
+   uHash ^= uHash >> 33;
+   uHash *= 0xff51afd7ed558ccdULL;
+   uHash ^= uHash >> 33;
+   return uHash;
+}
+}
+
+CSeenUidSet::CBuilder::CBuilder(std::string& strData, std::vector<size_t>& vecRestarts) :
+   m_strData(strData),
+   m_vecRestarts(vecRestarts),
+   m_uCount(0)
+{
+   m_strData.clear();
+   m_vecRestarts.clear();
+}
+
+void CSeenUidSet::CBuilder::Append(const CStringView& UID)
+{
+   size_t uPrefix = 0;
+   if (m_uCount % BLOCK_SIZE == 0)
+      m_vecRestarts.push_back(m_strData.size());
+   else
+      while (uPrefix < m_strPrevious.size() && uPrefix < UID.size() && m_strPrevious[uPrefix] == UID[uPrefix])
+         ++uPrefix;
+
+   WriteVarint(m_strData, uPrefix);
+   WriteVarint(m_strData, UID.size() - uPrefix);
+   m_strData.append(UID.data() + uPrefix, UID.size() - uPrefix);
+
+   m_strPrevious.assign(UID.data(), UID.size());
+   ++m_uCount;
+}
+
+CSeenUidSet::CSeenUidSet() :
+   m_uCount(0),
+   m_dFalsePositiveRate(0),
+   m_uBloomCapacity(0),
+   m_uBloomHashes(0)
+{
+
+}
+
+const bool CSeenUidSet::Insert(const CStringView& UID)
+{
+   if (Contains(UID))
+      return false;
+
+   auto itPending = std::lower_bound(m_vecPending.begin(), m_vecPending.end(), UID,
+                                     [](const std::string& strUID, const CStringView& Value)
+                                     {
+                                        return CStringView(strUID) < Value;
+                                     });
+   m_vecPending.insert(itPending, UID.ToString());
+
+   if (IsBloomFilterEnabled())
+   {
+      if (GetCount() > m_uBloomCapacity)
+         BloomRebuild();
+      else
+         BloomAdd(UID);
+   }
+
+   if (m_vecPending.size() >= MERGE_THRESHOLD)
+      Compact();
+
+   return true;
+}
+
+const bool CSeenUidSet::Contains(const CStringView& UID) const
+{
+   if (IsBloomFilterEnabled() && !BloomMayContain(UID))
+      return false;
+
+   return std::binary_search(m_vecPending.begin(), m_vecPending.end(), UID,
+                             [](const CStringView& Left, const CStringView& Right) { return Left < Right; })
+       || ContainsCompressed(UID);
+}
+
+/**
+* @brief checks a list of UIDs at once
+*
+* The UIDs rejected by the Bloom filter are answered first. If the remaining
+* ones are a large part of the set, they're sorted and the set is decoded once
+* in parallel, otherwise each one is looked up.
+*
+* @param [in] vecUIDs UIDs to check, in any order
+* @param [out] vecSeen same size as vecUIDs
+*/
+void CSeenUidSet::Contains(const std::vector<std::string>& vecUIDs, std::vector<bool>& vecSeen) const
+{
+   vecSeen.assign(vecUIDs.size(), false);
+
+   std::vector<size_t> vecCandidates;
+   vecCandidates.reserve(vecUIDs.size());
+   for (size_t i = 0; i < vecUIDs.size(); ++i)
+   {
+      if (!IsBloomFilterEnabled() || BloomMayContain(vecUIDs[i]))
+         vecCandidates.push_back(i);
+   }
+
+   if (vecCandidates.size() * BULK_LOOKUP_RATIO < m_uCount)
+   {
+      for (const size_t uIndex : vecCandidates)
+         vecSeen[uIndex] = Contains(vecUIDs[uIndex]);
+      return;
+   }
+
+   std::sort(vecCandidates.begin(), vecCandidates.end(),
+             [&vecUIDs](const size_t uLeft, const size_t uRight) { return vecUIDs[uLeft] < vecUIDs[uRight]; });
+
+   size_t uPos = 0;
+   std::string strUID;
+   bool bValid = Next(m_strData, uPos, strUID);
+   for (const size_t uIndex : vecCandidates)
+   {
+      const std::string& strCandidate = vecUIDs[uIndex];
+      while (bValid && strUID < strCandidate)
+         bValid = Next(m_strData, uPos, strUID);
+
+      vecSeen[uIndex] = (bValid && strUID == strCandidate)
+                     || std::binary_search(m_vecPending.begin(), m_vecPending.end(), strCandidate);
+   }
+}
+
+/**
+* @brief keeps the UIDs that are in vecUIDs, the set is rebuilt in a single pass
+*/
+void CSeenUidSet::Retain(const std::vector<std::string>& vecUIDs)
+{
+   Compact();
+
+   std::vector<CStringView> vecKept(vecUIDs.begin(), vecUIDs.end());
+   std::sort(vecKept.begin(), vecKept.end());
+
+   std::string strData;
+   std::vector<size_t> vecRestarts;
+   CBuilder oBuilder(strData, vecRestarts);
+
+   size_t uPos = 0;
+   std::string strUID;
+   auto itKept = vecKept.begin();
+   while (Next(m_strData, uPos, strUID))
+   {
+      while (itKept != vecKept.end() && *itKept < strUID)
+         ++itKept;
+      if (itKept != vecKept.end() && *itKept == strUID)
+         oBuilder.Append(strUID);
+   }
+
+   m_strData.swap(strData);
+   m_vecRestarts.swap(vecRestarts);
+   m_uCount = oBuilder.GetCount();
+
+   // UIDs can't be removed from a Bloom filter
+   if (IsBloomFilterEnabled())
+      BloomRebuild();
+}
+
+void CSeenUidSet::Clear()
+{
+   m_strData.clear();
+   m_vecRestarts.clear();
+   m_uCount = 0;
+   m_vecPending.clear();
+   if (IsBloomFilterEnabled())
+      BloomRebuild();
+}
+
+size_t CSeenUidSet::GetMemoryUsage() const
+{
+   size_t uSize = sizeof(*this) + m_strData.capacity() + m_vecRestarts.capacity() * sizeof(size_t)
+                + m_vecPending.capacity() * sizeof(std::string) + m_vecBloom.capacity() * sizeof(uint64_t);
+   for (const std::string& strUID : m_vecPending)
+      uSize += strUID.capacity();
+   return uSize;
+}
+
+void CSeenUidSet::ForEach(const std::function<void(const CStringView&)>& fnUID) const
+{
+   size_t uPos = 0;
+   std::string strUID;
+   bool bValid = Next(m_strData, uPos, strUID);
+   auto itPending = m_vecPending.begin();
+
+   while (bValid || itPending != m_vecPending.end())
+   {
+      if (itPending == m_vecPending.end() || (bValid && strUID < *itPending))
+      {
+         fnUID(strUID);
+         bValid = Next(m_strData, uPos, strUID);
+      }
+      else
+         fnUID(*itPending++);
+   }
+}
+
+void CSeenUidSet::Compact()
+{
+   if (m_vecPending.empty())
+      return;
+
+   // upper bound : the new UIDs aren't front coded
+   size_t uReserve = m_strData.size();
+   for (const std::string& strUID : m_vecPending)
+      uReserve += strUID.size() + 4;
+
+   std::string strData;
+   std::vector<size_t> vecRestarts;
+   strData.reserve(uReserve);
+   CBuilder oBuilder(strData, vecRestarts);
+   ForEach([&oBuilder](const CStringView& UID) { oBuilder.Append(UID); });
+   if (strData.capacity() > strData.size() + strData.size() / 4)
+      strData.shrink_to_fit();
+
+   m_strData.swap(strData);
+   m_vecRestarts.swap(vecRestarts);
+   m_uCount = oBuilder.GetCount();
+   m_vecPending.clear();
+}
+
+void CSeenUidSet::EnableBloomFilter(const double dFalsePositiveRate /* = 0.01 */)
+{
+   m_dFalsePositiveRate = std::min(std::max(dFalsePositiveRate, 0.0001), 0.5);
+   BloomRebuild();
+}
+
+void CSeenUidSet::DisableBloomFilter()
+{
+   m_dFalsePositiveRate = 0;
+   m_uBloomCapacity = 0;
+   std::vector<uint64_t>().swap(m_vecBloom);
+}
+
+void CSeenUidSet::Serialize(std::string& strOutput) const
+{
+   WriteVarint(strOutput, GetCount());
+
+   std::string strPrevious;
+   ForEach([&strOutput, &strPrevious](const CStringView& UID)
+           {
+              size_t uPrefix = 0;
+              while (uPrefix < strPrevious.size() && uPrefix < UID.size() && strPrevious[uPrefix] == UID[uPrefix])
+                 ++uPrefix;
+
+              WriteVarint(strOutput, uPrefix);
+              WriteVarint(strOutput, UID.size() - uPrefix);
+              strOutput.append(UID.data() + uPrefix, UID.size() - uPrefix);
+              strPrevious.assign(UID.data(), UID.size());
+           });
+}
+
+/**
+* @brief replaces the content of the set with serialized UIDs
+*
+* @param [in] strInput buffer written by Serialize
+* @param [in,out] uPos offset of the set in strInput, moved after it
+*
+* @retval true   Successfully read.
+* @retval false  The data is truncated or the UIDs aren't in increasing order,
+* the set is empty.
+*/
+const bool CSeenUidSet::Deserialize(const std::string& strInput, size_t& uPos)
+{
+   m_vecPending.clear();
+
+   size_t uCount = 0;
+   if (!ReadVarint(strInput, uPos, uCount))
+   {
+      Clear();
+      return false;
+   }
+
+   CBuilder oBuilder(m_strData, m_vecRestarts);
+   m_strData.reserve(std::min(strInput.size() - uPos, uCount * 8));
+
+   std::string strUID;
+   std::string strPrevious;
+   for (size_t i = 0; i < uCount; ++i)
+   {
+      size_t uPrefix;
+      size_t uSuffix;
+      if (!ReadVarint(strInput, uPos, uPrefix) || !ReadVarint(strInput, uPos, uSuffix)
+          || uPrefix > strUID.size() || uSuffix > strInput.size() - uPos)
+      {
+         Clear();
+         return false;
+      }
+
+      strUID.resize(uPrefix);
+      strUID.append(strInput, uPos, uSuffix);
+      uPos += uSuffix;
+
+      if (i > 0 && !(strPrevious < strUID))
+      {
+         Clear();
+         return false;
+      }
+
+      oBuilder.Append(strUID);
+      strPrevious = strUID;
+   }
+   m_uCount = oBuilder.GetCount();
+
+   if (IsBloomFilterEnabled())
+      BloomRebuild();
+
+   return true;
+}
+
+bool CSeenUidSet::Next(const std::string& strData, size_t& uPos, std::string& strUID)
+{
+   size_t uPrefix;
+   size_t uSuffix;
+   if (uPos >= strData.size() || !ReadVarint(strData, uPos, uPrefix) || !ReadVarint(strData, uPos, uSuffix))
+      return false;
+
+   strUID.resize(uPrefix);
+   strUID.append(strData, uPos, uSuffix);
+   uPos += uSuffix;
+   return true;
+}
+
+/**
+* @brief binary search over the UIDs starting the blocks, they're stored whole
+* so they're compared without being decoded
+*/
+size_t CSeenUidSet::FindBlock(const CStringView& UID) const
+{
+   size_t uLow = 0;
+   size_t uHigh = m_vecRestarts.size();
+   while (uHigh - uLow > 1)
+   {
+      const size_t uMiddle = uLow + (uHigh - uLow) / 2;
+      size_t uPos = m_vecRestarts[uMiddle];
+      size_t uPrefix;
+      size_t uSize;
+      ReadVarint(m_strData, uPos, uPrefix);
+      ReadVarint(m_strData, uPos, uSize);
+
+      if (UID < CStringView(m_strData.data() + uPos, uSize))
+         uHigh = uMiddle;
+      else
+         uLow = uMiddle;
+   }
+   return uLow;
+}
+
+const bool CSeenUidSet::ContainsCompressed(const CStringView& UID) const
+{
+   if (m_vecRestarts.empty())
+      return false;
+
+   const size_t uBlock = FindBlock(UID);
+   size_t uPos = m_vecRestarts[uBlock];
+   const size_t uEnd = (uBlock + 1 < m_vecRestarts.size()) ? m_vecRestarts[uBlock + 1] : m_strData.size();
+
+   std::string strUID;
+   while (uPos < uEnd && Next(m_strData, uPos, strUID))
+   {
+      const int iCompare = CStringView(strUID).compare(UID);
+      if (iCompare >= 0)
+         return iCompare == 0;
+   }
+   return false;
+}
+
+void CSeenUidSet::BloomAdd(const CStringView& UID)
+{
+   const uint64_t uHash = HashUID(UID);
+   const uint64_t uBits = m_vecBloom.size() * 64;
+   uint64_t uIndex = uHash;
+   const uint64_t uStep = (uHash >> 32) | 1;
+   for (unsigned i = 0; i < m_uBloomHashes; ++i, uIndex += uStep)
+   {
+      const uint64_t uBit = uIndex % uBits;
+      m_vecBloom[uBit / 64] |= 1ULL << (uBit % 64);
+   }
+}
+
+const bool CSeenUidSet::BloomMayContain(const CStringView& UID) const
+{
+   const uint64_t uHash = HashUID(UID);
+   const uint64_t uBits = m_vecBloom.size() * 64;
+   uint64_t uIndex = uHash;
+   const uint64_t uStep = (uHash >> 32) | 1;
+   for (unsigned i = 0; i < m_uBloomHashes; ++i, uIndex += uStep)
+   {
+      const uint64_t uBit = uIndex % uBits;
+      if (!(m_vecBloom[uBit / 64] & (1ULL << (uBit % 64))))
+         return false;
+   }
+   return true;
+}
+
+/**
+* @brief sizes the filter for twice the current count (m = -n.ln(p) / ln(2)^2
+* bits and k = m/n.ln(2) hashes) and adds every UID
+*/
+void CSeenUidSet::BloomRebuild()
+{
+   const double dLn2 = std::log(2.0);
+   m_uBloomCapacity = std::max<size_t>(GetCount() * 2, 1024);
+   const double dBits = -static_cast<double>(m_uBloomCapacity) * std::log(m_dFalsePositiveRate) / (dLn2 * dLn2);
+   const size_t uWords = static_cast<size_t>(dBits / 64) + 1;
+   m_uBloomHashes = std::max(1u, std::min(16u, static_cast<unsigned>(std::lround(uWords * 64 * dLn2 / m_uBloomCapacity))));
+
+   m_vecBloom.assign(uWords, 0);
+   ForEach([this](const CStringView& UID) { BloomAdd(UID); });
+}
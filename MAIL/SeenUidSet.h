@@ -0,0 +1,103 @@
+/*
+* @file SeenUidSet.h
+* @brief compact set of the message UIDs already seen (POP3 UIDL strings)
+*
+* The UIDs are kept sorted and front coded : each UID only stores the part
+* that differs from the previous one, UIDs sharing long prefixes (most server
+* generated UIDs) take a few bytes each. Every BLOCK_SIZE UIDs the full UID is
+* stored so a lookup is a binary search over the blocks followed by a short
+* scan. New UIDs are buffered and merged by batches. An optional Bloom filter
+* answers most lookups of UIDs that aren't in the set without touching it.
+*/
+
+#ifndef INCLUDE_SEENUIDSET_H_
+#define INCLUDE_SEENUIDSET_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "StringView.h"
+
+class CSeenUidSet
+{
+public:
+   /* UIDs stored between two full UIDs */
+   static const size_t BLOCK_SIZE = 16;
+   /* UIDs buffered before being merged in the compressed array */
+   static const size_t MERGE_THRESHOLD = 4096;
+
+   CSeenUidSet();
+
+   /* adds a UID, returns false if it was already in the set */
+   const bool Insert(const CStringView& UID);
+   const bool Contains(const CStringView& UID) const;
+   /* vecSeen[i] tells if vecUIDs[i] is in the set. The UIDs are sorted once and
+    * checked in a single pass over the set (e.g. a whole UIDL listing). */
+   void Contains(const std::vector<std::string>& vecUIDs, std::vector<bool>& vecSeen) const;
+   /* removes the UIDs that aren't in vecUIDs (e.g. no longer on the server) */
+   void Retain(const std::vector<std::string>& vecUIDs);
+   void Clear();
+
+   inline size_t GetCount() const { return m_uCount + m_vecPending.size(); }
+   /* approximate size of the set in memory (bytes) */
+   size_t GetMemoryUsage() const;
+
+   /* calls fnUID for each UID, in order */
+   void ForEach(const std::function<void(const CStringView&)>& fnUID) const;
+   /* merges the buffered UIDs in the compressed array */
+   void Compact();
+
+   /* the filter is sized for twice the current count (at least 1024 UIDs) and
+    * resized when the set outgrows it */
+   void EnableBloomFilter(const double dFalsePositiveRate = 0.01);
+   void DisableBloomFilter();
+   inline const bool IsBloomFilterEnabled() const { return m_dFalsePositiveRate > 0; }
+
+   /* appends the count of UIDs followed by the UIDs, each one as the length of
+    * the prefix shared with the previous UID, the length of the rest and the
+    * rest (varints) */
+   void Serialize(std::string& strOutput) const;
+   /* reads what Serialize wrote at uPos, false if it's truncated or not sorted */
+   const bool Deserialize(const std::string& strInput, size_t& uPos);
+
+protected:
+   /* appends UIDs in increasing order to a compressed array */
+   class CBuilder
+   {
+   public:
+      CBuilder(std::string& strData, std::vector<size_t>& vecRestarts);
+      void Append(const CStringView& UID);
+      inline size_t GetCount() const { return m_uCount; }
+
+   protected:
+      std::string&         m_strData;
+      std::vector<size_t>& m_vecRestarts;
+      std::string          m_strPrevious;
+      size_t               m_uCount;
+   };
+
+   /* decodes the UIDs of the compressed array from uPos */
+   static bool Next(const std::string& strData, size_t& uPos, std::string& strUID);
+   /* index of the block that may contain UID */
+   size_t FindBlock(const CStringView& UID) const;
+   const bool ContainsCompressed(const CStringView& UID) const;
+
+   void BloomAdd(const CStringView& UID);
+   const bool BloomMayContain(const CStringView& UID) const;
+   void BloomRebuild();
+
+   std::string              m_strData;      // front coded UIDs
+   std::vector<size_t>      m_vecRestarts;  // offset of each block, its UID isn't coded
+   size_t                   m_uCount;
+   std::vector<std::string> m_vecPending;   // sorted, not merged yet
+
+   double                   m_dFalsePositiveRate;  // 0 : no Bloom filter
+   std::vector<uint64_t>    m_vecBloom;
+   size_t                   m_uBloomCapacity;
+   unsigned                 m_uBloomHashes;
+};
+
+#endif
@@ -0,0 +1,99 @@
+/*
+* @file StringView.h
+* @brief non-owning view on a character range (the project is built as C++14,
+* so std::string_view isn't available). The accessors follow std::string_view
+* so the class can be swapped for it later.
+*/
+
+#ifndef INCLUDE_STRINGVIEW_H_
+#define INCLUDE_STRINGVIEW_H_
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+class CStringView
+{
+public:
+   static const size_t npos = static_cast<size_t>(-1);
+
+   CStringView() : m_pData(nullptr), m_uSize(0) {}
+   CStringView(const char* pData, size_t uSize) : m_pData(pData), m_uSize(uSize) {}
+   CStringView(const char* pszText) : m_pData(pszText), m_uSize(pszText ? strlen(pszText) : 0) {}
+   CStringView(const std::string& strText) : m_pData(strText.data()), m_uSize(strText.size()) {}
+
+   inline const char* data() const { return m_pData; }
+   inline size_t size() const { return m_uSize; }
+   inline bool empty() const { return m_uSize == 0; }
+   inline const char* begin() const { return m_pData; }
+   inline const char* end() const { return m_pData + m_uSize; }
+   inline char operator[](size_t uPos) const { return m_pData[uPos]; }
+
+   inline CStringView substr(size_t uPos, size_t uCount = npos) const
+   {
+      if (uPos > m_uSize)
+         uPos = m_uSize;
+      if (uCount > m_uSize - uPos)
+         uCount = m_uSize - uPos;
+      return CStringView(m_pData + uPos, uCount);
+   }
+
+   inline size_t find(char c, size_t uPos = 0) const
+   {
+      if (uPos >= m_uSize)
+         return npos;
+      const void* pFound = memchr(m_pData + uPos, c, m_uSize - uPos);
+      return pFound ? static_cast<const char*>(pFound) - m_pData : npos;
+   }
+
+   inline bool operator==(const CStringView& Other) const
+   {
+      return m_uSize == Other.m_uSize && (m_uSize == 0 || memcmp(m_pData, Other.m_pData, m_uSize) == 0);
+   }
+   inline bool operator!=(const CStringView& Other) const { return !(*this == Other); }
+
+   /* byte-wise ordering, the same as std::string */
+   inline int compare(const CStringView& Other) const
+   {
+      const size_t uSize = (m_uSize < Other.m_uSize) ? m_uSize : Other.m_uSize;
+      const int iResult = (uSize == 0) ? 0 : memcmp(m_pData, Other.m_pData, uSize);
+      if (iResult != 0)
+         return iResult;
+      return (m_uSize < Other.m_uSize) ? -1 : (m_uSize > Other.m_uSize) ? 1 : 0;
+   }
+   inline bool operator<(const CStringView& Other) const { return compare(Other) < 0; }
+
+   /* ASCII case insensitive comparison (field names, keywords...) */
+   inline bool EqualsNoCase(const CStringView& Other) const
+   {
+      if (m_uSize != Other.m_uSize)
+         return false;
+      for (size_t i = 0; i < m_uSize; ++i)
+         if (ToLower(m_pData[i]) != ToLower(Other.m_pData[i]))
+            return false;
+      return true;
+   }
+
+   /* same view without leading and trailing spaces, tabs and line breaks */
+   inline CStringView Trim() const
+   {
+      size_t uStart = 0;
+      size_t uEnd = m_uSize;
+      while (uStart < uEnd && IsSpace(m_pData[uStart]))
+         ++uStart;
+      while (uEnd > uStart && IsSpace(m_pData[uEnd - 1]))
+         --uEnd;
+      return CStringView(m_pData + uStart, uEnd - uStart);
+   }
+
+   inline std::string ToString() const { return std::string(m_pData ? m_pData : "", m_uSize); }
+
+   static inline char ToLower(const char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c; }
+   static inline bool IsSpace(const char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+protected:
+   const char* m_pData;
+   size_t      m_uSize;
+};
+
+#endif
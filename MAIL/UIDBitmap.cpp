@@ -0,0 +1,652 @@
+/**
+* @file UIDBitmap.cpp
+* @brief implementation of the compressed UID set
+*/
+
+#include "UIDBitmap.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "Varint.h"
+
+namespace
+{
+inline unsigned PopCount(uint64_t uWord)
+{
+#if defined(__GNUC__) || defined(__clang__)
+   return static_cast<unsigned>(__builtin_popcountll(uWord));
+#else
+   unsigned uCount = 0;
+   for (; uWord != 0; uWord &= uWord - 1)
+      ++uCount;
+   return uCount;
+#endif
+}
+
+inline unsigned TrailingZeros(const uint64_t uWord)
+{
+#if defined(__GNUC__) || defined(__clang__)
+   return static_cast<unsigned>(__builtin_ctzll(uWord));
+#else
+   unsigned uBit = 0;
+   while (!(uWord & (1ULL << uBit)))
+      ++uBit;
+   return uBit;
+#endif
+}
+
+inline uint16_t High(const uint32_t uUID) { return static_cast<uint16_t>(uUID >> 16); }
+inline uint16_t Low(const uint32_t uUID) { return static_cast<uint16_t>(uUID & 0xFFFF); }
+}
+
+bool CUIDBitmap::Container::Contains(const uint16_t uLow) const
+{
+   if (IsBitmap())
+      return (vecBits[uLow / 64] >> (uLow % 64)) & 1;
+
+   return std::binary_search(vecArray.begin(), vecArray.end(), uLow);
+}
+
+bool CUIDBitmap::Container::Add(const uint16_t uLow)
+{
+   if (IsBitmap())
+   {
+      uint64_t& uWord = vecBits[uLow / 64];
+      const uint64_t uMask = 1ULL << (uLow % 64);
+      if (uWord & uMask)
+         return false;
+
+      uWord |= uMask;
+      ++uCount;
+      return true;
+   }
+
+   auto it = std::lower_bound(vecArray.begin(), vecArray.end(), uLow);
+   if (it != vecArray.end() && *it == uLow)
+      return false;
+
+   vecArray.insert(it, uLow);
+   ++uCount;
+   if (uCount > ARRAY_MAX)
+      ToBitmap();
+   return true;
+}
+
+bool CUIDBitmap::Container::Remove(const uint16_t uLow)
+{
+   if (IsBitmap())
+   {
+      uint64_t& uWord = vecBits[uLow / 64];
+      const uint64_t uMask = 1ULL << (uLow % 64);
+      if (!(uWord & uMask))
+         return false;
+
+      uWord &= ~uMask;
+      --uCount;
+      if (uCount <= ARRAY_MAX)
+         Normalize();
+      return true;
+   }
+
+   auto it = std::lower_bound(vecArray.begin(), vecArray.end(), uLow);
+   if (it == vecArray.end() || *it != uLow)
+      return false;
+
+   vecArray.erase(it);
+   --uCount;
+   return true;
+}
+
+void CUIDBitmap::Container::AddRange(const uint16_t uFirst, const uint16_t uLast)
+{
+   const size_t uRange = static_cast<size_t>(uLast) - uFirst + 1;
+   if (!IsBitmap() && uCount + uRange <= ARRAY_MAX)
+   {
+      std::vector<uint16_t> vecRange(uRange);
+      for (size_t i = 0; i < uRange; ++i)
+         vecRange[i] = static_cast<uint16_t>(uFirst + i);
+
+      std::vector<uint16_t> vecMerged;
+      vecMerged.reserve(vecArray.size() + uRange);
+      std::set_union(vecArray.begin(), vecArray.end(), vecRange.begin(), vecRange.end(),
+                     std::back_inserter(vecMerged));
+      vecArray.swap(vecMerged);
+      uCount = static_cast<uint32_t>(vecArray.size());
+      return;
+   }
+
+   ToBitmap();
+   const size_t uFirstWord = uFirst / 64;
+   const size_t uLastWord = uLast / 64;
+   for (size_t uWord = uFirstWord; uWord <= uLastWord; ++uWord)
+   {
+      uint64_t uMask = ~0ULL;
+      if (uWord == uFirstWord)
+         uMask &= ~0ULL << (uFirst % 64);
+      if (uWord == uLastWord && uLast % 64 != 63)
+         uMask &= (1ULL << (uLast % 64 + 1)) - 1;
+      vecBits[uWord] |= uMask;
+   }
+   Normalize();
+}
+
+void CUIDBitmap::Container::ToBitmap()
+{
+   if (IsBitmap())
+      return;
+
+   vecBits.assign(BITMAP_WORDS, 0);
+   for (const uint16_t uLow : vecArray)
+      vecBits[uLow / 64] |= 1ULL << (uLow % 64);
+   std::vector<uint16_t>().swap(vecArray);
+}
+
+void CUIDBitmap::Container::Normalize()
+{
+   if (!IsBitmap())
+   {
+      uCount = static_cast<uint32_t>(vecArray.size());
+      return;
+   }
+
+   uCount = 0;
+   for (const uint64_t uWord : vecBits)
+      uCount += PopCount(uWord);
+
+   if (uCount > ARRAY_MAX)
+      return;
+
+   vecArray.clear();
+   vecArray.reserve(uCount);
+   for (size_t i = 0; i < BITMAP_WORDS; ++i)
+   {
+      for (uint64_t uWord = vecBits[i]; uWord != 0; uWord &= uWord - 1)
+         vecArray.push_back(static_cast<uint16_t>(i * 64 + TrailingZeros(uWord)));
+   }
+   std::vector<uint64_t>().swap(vecBits);
+}
+
+void CUIDBitmap::Container::Union(const Container& Other)
+{
+   if (!IsBitmap() && !Other.IsBitmap() && uCount + Other.uCount <= ARRAY_MAX)
+   {
+      std::vector<uint16_t> vecMerged;
+      vecMerged.reserve(uCount + Other.uCount);
+      std::set_union(vecArray.begin(), vecArray.end(), Other.vecArray.begin(), Other.vecArray.end(),
+                     std::back_inserter(vecMerged));
+      vecArray.swap(vecMerged);
+      uCount = static_cast<uint32_t>(vecArray.size());
+      return;
+   }
+
+   ToBitmap();
+   if (Other.IsBitmap())
+   {
+      for (size_t i = 0; i < BITMAP_WORDS; ++i)
+         vecBits[i] |= Other.vecBits[i];
+   }
+   else
+   {
+      for (const uint16_t uLow : Other.vecArray)
+         vecBits[uLow / 64] |= 1ULL << (uLow % 64);
+   }
+   Normalize();
+}
+
+void CUIDBitmap::Container::Intersect(const Container& Other)
+{
+   if (IsBitmap() && Other.IsBitmap())
+   {
+      for (size_t i = 0; i < BITMAP_WORDS; ++i)
+         vecBits[i] &= Other.vecBits[i];
+      Normalize();
+      return;
+   }
+
+   if (IsBitmap())
+   {
+      // the result is at most the array of the other container
+      std::vector<uint16_t> vecKept;
+      vecKept.reserve(Other.uCount);
+      for (const uint16_t uLow : Other.vecArray)
+         if (Contains(uLow))
+            vecKept.push_back(uLow);
+
+      std::vector<uint64_t>().swap(vecBits);
+      vecArray.swap(vecKept);
+   }
+   else
+   {
+      vecArray.erase(std::remove_if(vecArray.begin(), vecArray.end(),
+                                    [&Other](const uint16_t uLow) { return !Other.Contains(uLow); }),
+                     vecArray.end());
+   }
+   uCount = static_cast<uint32_t>(vecArray.size());
+}
+
+void CUIDBitmap::Container::Subtract(const Container& Other)
+{
+   if (!IsBitmap())
+   {
+      vecArray.erase(std::remove_if(vecArray.begin(), vecArray.end(),
+                                    [&Other](const uint16_t uLow) { return Other.Contains(uLow); }),
+                     vecArray.end());
+      uCount = static_cast<uint32_t>(vecArray.size());
+      return;
+   }
+
+   if (Other.IsBitmap())
+   {
+      for (size_t i = 0; i < BITMAP_WORDS; ++i)
+         vecBits[i] &= ~Other.vecBits[i];
+   }
+   else
+   {
+      for (const uint16_t uLow : Other.vecArray)
+         vecBits[uLow / 64] &= ~(1ULL << (uLow % 64));
+   }
+   Normalize();
+}
+
+bool CUIDBitmap::Container::operator==(const Container& Other) const
+{
+   // a container is always in its normalized form
+   return uKey == Other.uKey && uCount == Other.uCount && vecArray == Other.vecArray && vecBits == Other.vecBits;
+}
+
+void CUIDBitmap::Add(const uint32_t uUID)
+{
+   FindOrCreate(High(uUID)).Add(Low(uUID));
+}
+
+void CUIDBitmap::AddRange(const uint32_t uFirst, const uint32_t uLast)
+{
+   if (uFirst > uLast)
+      return;
+
+   for (uint32_t uKey = High(uFirst); uKey <= High(uLast); ++uKey)
+   {
+      const uint16_t uStart = (uKey == High(uFirst)) ? Low(uFirst) : 0;
+      const uint16_t uEnd = (uKey == High(uLast)) ? Low(uLast) : 0xFFFF;
+      FindOrCreate(static_cast<uint16_t>(uKey)).AddRange(uStart, uEnd);
+   }
+}
+
+const bool CUIDBitmap::Remove(const uint32_t uUID)
+{
+   auto it = std::lower_bound(m_vecContainers.begin(), m_vecContainers.end(), High(uUID),
+                              [](const Container& oContainer, const uint16_t uKey) { return oContainer.uKey < uKey; });
+   if (it == m_vecContainers.end() || it->uKey != High(uUID) || !it->Remove(Low(uUID)))
+      return false;
+
+   if (it->uCount == 0)
+      m_vecContainers.erase(it);
+   return true;
+}
+
+const bool CUIDBitmap::Contains(const uint32_t uUID) const
+{
+   const Container* pContainer = Find(High(uUID));
+   return pContainer != nullptr && pContainer->Contains(Low(uUID));
+}
+
+void CUIDBitmap::Contains(const std::vector<uint32_t>& vecUIDs, std::vector<bool>& vecSeen) const
+{
+   vecSeen.assign(vecUIDs.size(), false);
+
+   // consecutive UIDs usually share their container
+   const Container* pContainer = nullptr;
+   uint32_t uKey = 0x10000;
+   for (size_t i = 0; i < vecUIDs.size(); ++i)
+   {
+      if (High(vecUIDs[i]) != uKey)
+      {
+         uKey = High(vecUIDs[i]);
+         pContainer = Find(static_cast<uint16_t>(uKey));
+      }
+      vecSeen[i] = pContainer != nullptr && pContainer->Contains(Low(vecUIDs[i]));
+   }
+}
+
+void CUIDBitmap::Clear()
+{
+   m_vecContainers.clear();
+}
+
+/**
+* @brief adds the UIDs of an IMAP sequence set (RFC 3501), ranges may be
+* reversed ("9:7"), "*" has no meaning for a set of known UIDs
+*
+* @param [in] Set sequence set, e.g. "4,7:9,12"
+*
+* @retval true   The set was added.
+* @retval false  The set is invalid, the UIDs before the error were added.
+*/
+const bool CUIDBitmap::AddSequenceSet(const CStringView& Set)
+{
+   size_t uPos = 0;
+   const auto ReadNumber = [&Set, &uPos](uint32_t& uNumber)
+   {
+      const size_t uStart = uPos;
+      unsigned long long uValue = 0;
+      while (uPos < Set.size() && Set[uPos] >= '0' && Set[uPos] <= '9' && uValue <= 0xFFFFFFFFull)
+         uValue = uValue * 10 + (Set[uPos++] - '0');
+
+      uNumber = static_cast<uint32_t>(uValue);
+      return uPos > uStart && uValue > 0 && uValue <= 0xFFFFFFFFull;
+   };
+
+   while (uPos < Set.size())
+   {
+      uint32_t uFirst = 0;
+      if (!ReadNumber(uFirst))
+         return false;
+
+      uint32_t uLast = uFirst;
+      if (uPos < Set.size() && Set[uPos] == ':')
+      {
+         ++uPos;
+         if (!ReadNumber(uLast))
+            return false;
+      }
+
+      if (uFirst > uLast)
+         std::swap(uFirst, uLast);
+      AddRange(uFirst, uLast);
+
+      // a separator must be followed by another range
+      if (uPos < Set.size() && (Set[uPos] != ',' || ++uPos == Set.size()))
+         return false;
+   }
+   return true;
+}
+
+size_t CUIDBitmap::GetCount() const
+{
+   size_t uCount = 0;
+   for (const Container& oContainer : m_vecContainers)
+      uCount += oContainer.uCount;
+   return uCount;
+}
+
+uint32_t CUIDBitmap::GetMin() const
+{
+   uint32_t uMin = 0;
+   ForEach([&uMin](uint32_t uUID)
+           {
+              uMin = uUID;
+              return false;
+           });
+   return uMin;
+}
+
+uint32_t CUIDBitmap::GetMax() const
+{
+   if (m_vecContainers.empty())
+      return 0;
+
+   const Container& oLast = m_vecContainers.back();
+   const uint32_t uHigh = static_cast<uint32_t>(oLast.uKey) << 16;
+   if (!oLast.IsBitmap())
+      return uHigh | oLast.vecArray.back();
+
+   size_t uWord = BITMAP_WORDS;
+   while (uWord > 0 && oLast.vecBits[uWord - 1] == 0)
+      --uWord;
+
+   uint32_t uBit = 63;
+   while (!(oLast.vecBits[uWord - 1] & (1ULL << uBit)))
+      --uBit;
+   return uHigh | static_cast<uint32_t>((uWord - 1) * 64 + uBit);
+}
+
+size_t CUIDBitmap::GetMemoryUsage() const
+{
+   size_t uSize = sizeof(*this) + m_vecContainers.capacity() * sizeof(Container);
+   for (const Container& oContainer : m_vecContainers)
+      uSize += oContainer.vecArray.capacity() * sizeof(uint16_t) + oContainer.vecBits.capacity() * sizeof(uint64_t);
+   return uSize;
+}
+
+void CUIDBitmap::Union(const CUIDBitmap& Other)
+{
+   std::vector<Container> vecResult;
+   vecResult.reserve(m_vecContainers.size() + Other.m_vecContainers.size());
+
+   auto it = m_vecContainers.begin();
+   auto itOther = Other.m_vecContainers.begin();
+   while (it != m_vecContainers.end() || itOther != Other.m_vecContainers.end())
+   {
+      if (itOther == Other.m_vecContainers.end() || (it != m_vecContainers.end() && it->uKey < itOther->uKey))
+         vecResult.push_back(std::move(*it++));
+      else if (it == m_vecContainers.end() || itOther->uKey < it->uKey)
+         vecResult.push_back(*itOther++);
+      else
+      {
+         it->Union(*itOther++);
+         vecResult.push_back(std::move(*it++));
+      }
+   }
+   m_vecContainers.swap(vecResult);
+}
+
+void CUIDBitmap::Intersect(const CUIDBitmap& Other)
+{
+   auto itOut = m_vecContainers.begin();
+   for (auto it = m_vecContainers.begin(); it != m_vecContainers.end(); ++it)
+   {
+      const Container* pOther = Other.Find(it->uKey);
+      if (pOther == nullptr)
+         continue;
+
+      it->Intersect(*pOther);
+      if (it->uCount > 0)
+      {
+         if (itOut != it)
+            *itOut = std::move(*it);
+         ++itOut;
+      }
+   }
+   m_vecContainers.erase(itOut, m_vecContainers.end());
+}
+
+void CUIDBitmap::Subtract(const CUIDBitmap& Other)
+{
+   auto itOut = m_vecContainers.begin();
+   for (auto it = m_vecContainers.begin(); it != m_vecContainers.end(); ++it)
+   {
+      const Container* pOther = Other.Find(it->uKey);
+      if (pOther != nullptr)
+         it->Subtract(*pOther);
+
+      if (it->uCount > 0)
+      {
+         if (itOut != it)
+            *itOut = std::move(*it);
+         ++itOut;
+      }
+   }
+   m_vecContainers.erase(itOut, m_vecContainers.end());
+}
+
+bool CUIDBitmap::operator==(const CUIDBitmap& Other) const
+{
+   return m_vecContainers == Other.m_vecContainers;
+}
+
+void CUIDBitmap::ForEach(const std::function<bool(uint32_t)>& fnUID) const
+{
+   for (const Container& oContainer : m_vecContainers)
+   {
+      const uint32_t uHigh = static_cast<uint32_t>(oContainer.uKey) << 16;
+      if (!oContainer.IsBitmap())
+      {
+         for (const uint16_t uLow : oContainer.vecArray)
+            if (!fnUID(uHigh | uLow))
+               return;
+         continue;
+      }
+
+      for (size_t i = 0; i < BITMAP_WORDS; ++i)
+      {
+         for (uint64_t uWord = oContainer.vecBits[i]; uWord != 0; uWord &= uWord - 1)
+            if (!fnUID(uHigh | static_cast<uint32_t>(i * 64 + TrailingZeros(uWord))))
+               return;
+      }
+   }
+}
+
+void CUIDBitmap::ToVector(std::vector<uint32_t>& vecUIDs) const
+{
+   vecUIDs.clear();
+   vecUIDs.reserve(GetCount());
+   ForEach([&vecUIDs](uint32_t uUID)
+           {
+              vecUIDs.push_back(uUID);
+              return true;
+           });
+}
+
+void CUIDBitmap::ToSequenceSet(std::string& strSet) const
+{
+   strSet.clear();
+
+   uint32_t uFirst = 0;
+   uint32_t uLast = 0;
+   const auto AppendRange = [&strSet, &uFirst, &uLast]()
+   {
+      if (!strSet.empty())
+         strSet += ',';
+      strSet += std::to_string(uFirst);
+      if (uLast != uFirst)
+         strSet += ':' + std::to_string(uLast);
+   };
+
+   ForEach([&](uint32_t uUID)
+           {
+              if (uFirst != 0 && uUID == uLast + 1)
+                 uLast = uUID;
+              else
+              {
+                 if (uFirst != 0)
+                    AppendRange();
+                 uFirst = uLast = uUID;
+              }
+              return true;
+           });
+
+   if (uFirst != 0)
+      AppendRange();
+}
+
+void CUIDBitmap::Serialize(std::string& strOutput) const
+{
+   WriteVarint(strOutput, m_vecContainers.size());
+   for (const Container& oContainer : m_vecContainers)
+   {
+      WriteVarint(strOutput, oContainer.uKey);
+      WriteVarint(strOutput, oContainer.uCount);
+
+      if (oContainer.IsBitmap())
+      {
+         // little endian whatever the platform
+         for (const uint64_t uWord : oContainer.vecBits)
+            for (unsigned uByte = 0; uByte < 8; ++uByte)
+               strOutput += static_cast<char>((uWord >> (uByte * 8)) & 0xFF);
+         continue;
+      }
+
+      uint16_t uPrevious = 0;
+      for (const uint16_t uLow : oContainer.vecArray)
+      {
+         WriteVarint(strOutput, uLow - uPrevious);
+         uPrevious = uLow;
+      }
+   }
+}
+
+/**
+* @brief replaces the content of the set with a serialized set
+*
+* @param [in] strInput buffer written by Serialize
+* @param [in,out] uPos offset of the set in strInput, moved after it
+*
+* @retval true   Successfully read.
+* @retval false  The data is truncated or inconsistent, the set is empty.
+*/
+const bool CUIDBitmap::Deserialize(const std::string& strInput, size_t& uPos)
+{
+   m_vecContainers.clear();
+
+   size_t uContainers = 0;
+   bool bValid = ReadVarint(strInput, uPos, uContainers) && uContainers <= 0x10000;
+   if (bValid)
+      m_vecContainers.reserve(uContainers);
+
+   for (size_t i = 0; bValid && i < uContainers; ++i)
+   {
+      Container oContainer;
+      uint32_t uKey = 0;
+      bValid = ReadVarint(strInput, uPos, uKey) && ReadVarint(strInput, uPos, oContainer.uCount)
+            && uKey <= 0xFFFF && oContainer.uCount > 0 && oContainer.uCount <= 0x10000
+            && (m_vecContainers.empty() || m_vecContainers.back().uKey < uKey);
+      if (!bValid)
+         break;
+      oContainer.uKey = static_cast<uint16_t>(uKey);
+
+      if (oContainer.uCount > ARRAY_MAX)
+      {
+         bValid = strInput.size() - uPos >= BITMAP_WORDS * 8;
+         if (!bValid)
+            break;
+
+         oContainer.vecBits.assign(BITMAP_WORDS, 0);
+         for (uint64_t& uWord : oContainer.vecBits)
+            for (unsigned uByte = 0; uByte < 8; ++uByte)
+               uWord |= static_cast<uint64_t>(static_cast<unsigned char>(strInput[uPos++])) << (uByte * 8);
+
+         const uint32_t uCount = oContainer.uCount;
+         oContainer.Normalize();
+         bValid = oContainer.uCount == uCount;
+      }
+      else
+      {
+         oContainer.vecArray.reserve(oContainer.uCount);
+         uint32_t uLow = 0;
+         for (uint32_t j = 0; bValid && j < oContainer.uCount; ++j)
+         {
+            uint32_t uDelta = 0;
+            bValid = ReadVarint(strInput, uPos, uDelta) && (j == 0 || uDelta > 0) && uDelta <= 0xFFFF - uLow;
+            uLow += uDelta;
+            oContainer.vecArray.push_back(static_cast<uint16_t>(uLow));
+         }
+      }
+
+      if (bValid)
+         m_vecContainers.push_back(std::move(oContainer));
+   }
+
+   if (!bValid)
+      m_vecContainers.clear();
+   return bValid;
+}
+
+const CUIDBitmap::Container* CUIDBitmap::Find(const uint16_t uKey) const
+{
+   auto it = std::lower_bound(m_vecContainers.begin(), m_vecContainers.end(), uKey,
+                              [](const Container& oContainer, const uint16_t uValue) { return oContainer.uKey < uValue; });
+   return (it != m_vecContainers.end() && it->uKey == uKey) ? &*it : nullptr;
+}
+
+CUIDBitmap::Container& CUIDBitmap::FindOrCreate(const uint16_t uKey)
+{
+   auto it = std::lower_bound(m_vecContainers.begin(), m_vecContainers.end(), uKey,
+                              [](const Container& oContainer, const uint16_t uValue) { return oContainer.uKey < uValue; });
+   if (it == m_vecContainers.end() || it->uKey != uKey)
+   {
+      it = m_vecContainers.insert(it, Container());
+      it->uKey = uKey;
+   }
+   return *it;
+}
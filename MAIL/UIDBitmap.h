@@ -0,0 +1,106 @@
+/*
+* @file UIDBitmap.h
+* @brief compressed set of numeric UIDs (IMAP UIDs, message numbers)
+*
+* Roaring-style bitmap : the 32 bits UIDs are grouped by their upper 16 bits,
+* each group is stored as a sorted array of the lower 16 bits while it holds
+* at most 4096 UIDs and as a 8 KB bitmap beyond that. Sparse and dense ranges
+* both take about 2 bytes per UID or less, and the set operations work group
+* by group.
+*/
+
+#ifndef INCLUDE_UIDBITMAP_H_
+#define INCLUDE_UIDBITMAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "StringView.h"
+
+class CUIDBitmap
+{
+public:
+   CUIDBitmap() {}
+
+   void Add(const uint32_t uUID);
+   /* adds uFirst to uLast (included) */
+   void AddRange(const uint32_t uFirst, const uint32_t uLast);
+   /* returns false if the UID wasn't in the set */
+   const bool Remove(const uint32_t uUID);
+   const bool Contains(const uint32_t uUID) const;
+   /* vecSeen[i] tells if vecUIDs[i] is in the set, faster if vecUIDs is sorted */
+   void Contains(const std::vector<uint32_t>& vecUIDs, std::vector<bool>& vecSeen) const;
+   void Clear();
+   /* adds an IMAP sequence set of UIDs, e.g. "4,7:9,12", false if it's invalid */
+   const bool AddSequenceSet(const CStringView& Set);
+
+   inline bool IsEmpty() const { return m_vecContainers.empty(); }
+   size_t GetCount() const;
+   /* smallest and largest UIDs, 0 if the set is empty */
+   uint32_t GetMin() const;
+   uint32_t GetMax() const;
+   /* approximate size of the set in memory (bytes) */
+   size_t GetMemoryUsage() const;
+
+   /* set operations, the result replaces the content of this set */
+   void Union(const CUIDBitmap& Other);
+   void Intersect(const CUIDBitmap& Other);
+   void Subtract(const CUIDBitmap& Other);
+   inline CUIDBitmap& operator|=(const CUIDBitmap& Other) { Union(Other); return *this; }
+   inline CUIDBitmap& operator&=(const CUIDBitmap& Other) { Intersect(Other); return *this; }
+   inline CUIDBitmap& operator-=(const CUIDBitmap& Other) { Subtract(Other); return *this; }
+   bool operator==(const CUIDBitmap& Other) const;
+   inline bool operator!=(const CUIDBitmap& Other) const { return !(*this == Other); }
+
+   /* calls fnUID for each UID, in increasing order, until it returns false */
+   void ForEach(const std::function<bool(uint32_t)>& fnUID) const;
+   void ToVector(std::vector<uint32_t>& vecUIDs) const;
+   /* IMAP sequence set of the UIDs, consecutive ones as ranges : "1:500,720,900:1200" */
+   void ToSequenceSet(std::string& strSet) const;
+
+   /* appends the set to strOutput : arrays are delta coded (varints), bitmaps
+    * are copied */
+   void Serialize(std::string& strOutput) const;
+   /* reads what Serialize wrote at uPos, false if it's invalid (the set is empty) */
+   const bool Deserialize(const std::string& strInput, size_t& uPos);
+
+protected:
+   static const size_t ARRAY_MAX = 4096;
+   static const size_t BITMAP_WORDS = 1024;
+
+   struct Container
+   {
+      Container() : uKey(0), uCount(0) {}
+      uint16_t              uKey;    // upper 16 bits of the UIDs
+      uint32_t              uCount;
+      std::vector<uint16_t> vecArray;
+      std::vector<uint64_t> vecBits; // empty for an array container
+
+      inline bool IsBitmap() const { return !vecBits.empty(); }
+      bool Contains(const uint16_t uLow) const;
+      bool Add(const uint16_t uLow);
+      bool Remove(const uint16_t uLow);
+      void AddRange(const uint16_t uFirst, const uint16_t uLast);
+      void ToBitmap();
+      /* counts the bits and goes back to an array if it's small enough */
+      void Normalize();
+      void Union(const Container& Other);
+      void Intersect(const Container& Other);
+      void Subtract(const Container& Other);
+      bool operator==(const Container& Other) const;
+   };
+
+   const Container* Find(const uint16_t uKey) const;
+   Container& FindOrCreate(const uint16_t uKey);
+
+   std::vector<Container> m_vecContainers;   // sorted by key, never empty
+};
+
+inline CUIDBitmap operator|(CUIDBitmap Left, const CUIDBitmap& Right) { return Left |= Right; }
+inline CUIDBitmap operator&(CUIDBitmap Left, const CUIDBitmap& Right) { return Left &= Right; }
+inline CUIDBitmap operator-(CUIDBitmap Left, const CUIDBitmap& Right) { return Left -= Right; }
+
+#endif
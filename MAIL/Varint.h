@@ -0,0 +1,37 @@
+/*
+* @file Varint.h
+* @brief variable length integers (7 bits per byte, LEB128) of the state files
+*/
+
+#ifndef INCLUDE_VARINT_H_
+#define INCLUDE_VARINT_H_
+
+#include <cstddef>
+#include <string>
+
+inline void WriteVarint(std::string& strOutput, unsigned long long uValue)
+{
+   while (uValue >= 0x80)
+   {
+      strOutput += static_cast<char>((uValue & 0x7F) | 0x80);
+      uValue >>= 7;
+   }
+   strOutput += static_cast<char>(uValue);
+}
+
+/* reads a varint at uPos and moves uPos after it, false if it's truncated */
+template <typename T>
+inline bool ReadVarint(const std::string& strInput, size_t& uPos, T& uValue)
+{
+   uValue = 0;
+   for (unsigned uShift = 0; uPos < strInput.size() && uShift < sizeof(T) * 8; uShift += 7)
+   {
+      const unsigned char c = static_cast<unsigned char>(strInput[uPos++]);
+      uValue |= static_cast<T>(c & 0x7F) << uShift;
+      if (!(c & 0x80))
+         return true;
+   }
+   return false;
+}
+
+#endif
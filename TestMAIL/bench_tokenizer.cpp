@@ -0,0 +1,122 @@
+/**
+* @file bench_tokenizer.cpp
+* @brief throughput of the IMAP response tokenizer over a large synthetic FETCH response
+*
+* Usage : bench_tokenizer [message count] [message size] [chunk size]
+*
+* The response is written to the tokenizer in chunks, as a transfer would,
+* and compared with buffering each response before parsing its data items.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "IMAPSession.h"
+#include "ImapTokenizer.h"
+
+namespace
+{
+std::string BuildResponse(const unsigned uMessages, const size_t uMessageSize)
+{
+   std::string strBody(uMessageSize, 'x');
+   for (size_t i = 76; i < strBody.size(); i += 78)
+   {
+      strBody[i - 1] = '\r';
+      strBody[i] = '\n';
+   }
+
+   std::string strResponse;
+   strResponse.reserve(static_cast<size_t>(uMessages) * (uMessageSize + 160));
+   for (unsigned i = 1; i <= uMessages; ++i)
+   {
+      const std::string strNumber = std::to_string(i);
+      strResponse += "* " + strNumber + " FETCH (UID " + strNumber + " FLAGS (\\Seen $Label1) "
+                     "INTERNALDATE \"17-Jul-2024 02:44:25 -0700\" RFC822.SIZE " + std::to_string(uMessageSize)
+                     + " BODY[] {" + std::to_string(uMessageSize) + "}\r\n" + strBody + ")\r\n";
+   }
+   strResponse += "T1 OK FETCH completed\r\n";
+   return strResponse;
+}
+
+double Seconds(const std::chrono::steady_clock::time_point& tStart)
+{
+   return std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+}
+}
+
+int main(int argc, char** argv)
+{
+   const unsigned uMessages = (argc > 1) ? static_cast<unsigned>(atoi(argv[1])) : 20000;
+   const size_t uMessageSize = (argc > 2) ? static_cast<size_t>(atoi(argv[2])) : 4096;
+   const size_t uChunkSize = (argc > 3) ? static_cast<size_t>(atoi(argv[3])) : 16384;
+
+   if (uMessages == 0 || uChunkSize == 0)
+   {
+      fprintf(stderr, "Usage : %s [message count] [message size] [chunk size]\n", argv[0]);
+      return 1;
+   }
+
+   const std::string strResponse = BuildResponse(uMessages, uMessageSize);
+   const double dMegaBytes = strResponse.size() / (1024.0 * 1024.0);
+   printf("%u messages of %zu bytes, %.1f MB in chunks of %zu bytes\n", uMessages, uMessageSize, dMegaBytes,
+          uChunkSize);
+
+   // tokenizer : the literals are passed on, never copied
+   size_t uTokens = 0;
+   unsigned long long uLiteralBytes = 0;
+   CImapTokenizer Tokenizer([&](const ImapToken& Token)
+                            {
+                               if (Token.eType == ImapToken::LITERAL_DATA)
+                                  uLiteralBytes += Token.Value.size();
+                               else
+                                  ++uTokens;
+                               return true;
+                            });
+
+   auto tStart = std::chrono::steady_clock::now();
+   for (size_t uPos = 0; uPos < strResponse.size(); uPos += uChunkSize)
+   {
+      const size_t uSize = (strResponse.size() - uPos < uChunkSize) ? strResponse.size() - uPos : uChunkSize;
+      if (!Tokenizer.Write(strResponse.data() + uPos, uSize))
+      {
+         fprintf(stderr, "Tokenizer failed at offset %zu\n", uPos);
+         return 1;
+      }
+   }
+   double dSeconds = Seconds(tStart);
+   printf("CImapTokenizer      : %8.1f MB/s, %zu tokens, %llu literal bytes\n", dMegaBytes / dSeconds, uTokens,
+          uLiteralBytes);
+
+   // buffering : each response is framed, then its data items are parsed
+   size_t uItems = 0;
+   std::string strBuffer;
+   tStart = std::chrono::steady_clock::now();
+   for (size_t uPos = 0; uPos < strResponse.size(); uPos += uChunkSize)
+   {
+      const size_t uSize = (strResponse.size() - uPos < uChunkSize) ? strResponse.size() - uPos : uChunkSize;
+      strBuffer.append(strResponse.data() + uPos, uSize);
+
+      size_t uStart = 0;
+      size_t uEnd = 0;
+      while ((uEnd = CImapSession::FindResponseEnd(strBuffer, uStart)) != std::string::npos)
+      {
+         const CStringView Response(strBuffer.data() + uStart, uEnd - uStart);
+         const size_t uItemsPos = Response.find('(');
+         if (uItemsPos != CStringView::npos)
+            CImapSession::ParseFetchItems(Response.substr(uItemsPos),
+                                          [&uItems](const CStringView&, const CStringView&)
+                                          {
+                                             ++uItems;
+                                             return true;
+                                          });
+         uStart = uEnd;
+      }
+      strBuffer.erase(0, uStart);
+   }
+   dSeconds = Seconds(tStart);
+   printf("Buffered responses  : %8.1f MB/s, %zu data items\n", dMegaBytes / dSeconds, uItems);
+
+   return 0;
+}
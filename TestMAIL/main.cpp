@@ -6,9 +6,56 @@
 #include "POPClient.h"
 #include "SMTPClient.h"
 #include "IMAPClient.h"
+#include "DKIMSigner.h"
+#include "MIMESplitter.h"
+#include "HeaderParser.h"
+#include "Charset.h"
+#include "MailMessage.h"
+#include "PopSync.h"
+#include "AsyncFileWriter.h"
+#include "FilePreallocator.h"
+#include "PopPoller.h"
+#include "SeenUidSet.h"
+#include "UIDBitmap.h"
+#include "IMAPSession.h"
+#include "ImapSync.h"
+#include "BodyStructure.h"
+#include "ImapSearch.h"
+#include "ImapTokenizer.h"
+#include "MailCodec.h"
+
+#include <algorithm>
+
+#ifdef DKIM_SUPPORT
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#endif
 
 #define PRINT_LOG [](const std::string& strLogMsg) { std::cout << strLogMsg << std::endl;  }
 
+// sink keeping the chunks of a message, for the retrieval tests
+class CStringSink : public CMailSink
+{
+public:
+   CStringSink() : uChunks(0), bCompleted(false), bSuccess(false) {}
+   bool OnChunk(const char* pData, size_t uSize) override
+   {
+      strData.append(pData, uSize);
+      ++uChunks;
+      return true;
+   }
+   void OnComplete(const bool bResult) override
+   {
+      bCompleted = true;
+      bSuccess = bResult;
+   }
+
+   std::string strData;
+   size_t      uChunks;
+   bool        bCompleted;
+   bool        bSuccess;
+};
+
 // Test parameters
 extern bool POP_TEST_ENABLED;
 extern bool POP_SSL_TEST_ENABLED;
@@ -231,6 +278,1482 @@ TEST(MailClient, TestMultithreading)
    ThirdThread.join();                 // pauses until third finishes
 }
 
+// DKIM Tests
+
+TEST(DKIMSigner, TestBodyHash)
+{
+   CDKIMSigner Signer("example.com", "selector");
+
+#ifdef DKIM_SUPPORT
+   // empty bodies (RFC 6376 3.4.3 and 3.4.4)
+   Signer.BeginBody();
+   EXPECT_STREQ("47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=", Signer.EndBody().c_str());
+
+   Signer.SetCanonicalization(CDKIMSigner::Canonicalization::SIMPLE, CDKIMSigner::Canonicalization::SIMPLE);
+   Signer.BeginBody();
+   EXPECT_STREQ("frcCV1k9oG9oKj3dpUqdJg1PxRT2RSN/XKdLCPjaYaY=", Signer.EndBody().c_str());
+
+   // relaxed : whitespace runs, trailing whitespace, trailing empty lines and
+   // line break styles don't change the hash, whatever the chunking
+   Signer.SetCanonicalization(CDKIMSigner::Canonicalization::RELAXED, CDKIMSigner::Canonicalization::RELAXED);
+   const std::string strBody = "Hello \t World  \r\n\r\nBye\r\n\r\n\r\n";
+   Signer.BeginBody();
+   Signer.UpdateBody(strBody.data(), strBody.size());
+   const std::string strHash = Signer.EndBody();
+
+   const std::string strOther = "Hello World\n\nBye";
+   Signer.BeginBody();
+   for (const char c : strOther)
+      Signer.UpdateBody(&c, 1);
+   EXPECT_EQ(strHash, Signer.EndBody());
+
+   const std::string strDifferent = "Hello World\n\nBye!\n";
+   Signer.BeginBody();
+   Signer.UpdateBody(strDifferent.data(), strDifferent.size());
+   EXPECT_NE(strHash, Signer.EndBody());
+#endif
+}
+
+#ifdef DKIM_SUPPORT
+TEST(DKIMSigner, TestSignMessage)
+{
+   EVP_PKEY* pKey = EVP_RSA_gen(1024);
+   ASSERT_TRUE(pKey != nullptr);
+   BIO* pBio = BIO_new(BIO_s_mem());
+   PEM_write_bio_PrivateKey(pBio, pKey, nullptr, nullptr, 0, nullptr, nullptr);
+   char* pszPEM = nullptr;
+   const long lSize = BIO_get_mem_data(pBio, &pszPEM);
+   const std::string strPEM(pszPEM, lSize);
+   BIO_free(pBio);
+
+   // checks b= over the relaxed canonical form of the signed fields, computed here
+   const auto VerifySignature = [pKey](const std::string& strCanonFields, const std::string& strHeader)
+   {
+      const size_t uSignature = strHeader.rfind("b=") + 2;
+      const std::string strSignature = CMailCodec::Base64Decode(strHeader.substr(uSignature, strHeader.size() - 2 - uSignature));
+
+      std::string strData = strCanonFields + "dkim-signature:" + strHeader.substr(16, uSignature - 16);
+      for (size_t uFold = 0; (uFold = strData.find("\r\n\t", uFold)) != std::string::npos; )
+         strData.replace(uFold, 3, " ");
+
+      EVP_MD_CTX* pCtx = EVP_MD_CTX_new();
+      const bool bValid = EVP_DigestVerifyInit(pCtx, nullptr, EVP_sha256(), nullptr, pKey) == 1
+                       && EVP_DigestVerifyUpdate(pCtx, strData.data(), strData.size()) == 1
+                       && EVP_DigestVerifyFinal(pCtx, reinterpret_cast<const unsigned char*>(strSignature.data()),
+                                                strSignature.size()) == 1;
+      EVP_MD_CTX_free(pCtx);
+      return bValid;
+   };
+
+   CDKIMSigner Signer("example.com", "mail", PRINT_LOG);
+   EXPECT_FALSE(Signer.HasKey());
+   ASSERT_TRUE(Signer.LoadPrivateKey(strPEM));
+
+   const std::string strMail = "From: <foo@example.com>\n"
+                               "To: <bar@example.org>\n"
+                               "Subject: DKIM\n"
+                               " folded\n"
+                               "\n"
+                               "Body\n";
+   std::string strHeader;
+   ASSERT_TRUE(Signer.SignMessage(strMail.data(), strMail.size(), strHeader));
+   EXPECT_EQ(0u, strHeader.find("DKIM-Signature: v=1; a=rsa-sha256; c=relaxed/relaxed; d=example.com; s=mail;"));
+   EXPECT_NE(std::string::npos, strHeader.find("h=from:to:subject;"));
+   EXPECT_EQ("\r\n", strHeader.substr(strHeader.size() - 2));
+   EXPECT_TRUE(VerifySignature("from:<foo@example.com>\r\nto:<bar@example.org>\r\nsubject:DKIM folded\r\n", strHeader));
+   EXPECT_FALSE(VerifySignature("from:<foo@example.com>\r\nto:<bar@example.org>\r\nsubject:DKIM\r\n", strHeader));
+
+   // the fields are signed in the order given, From doesn't have to come first
+   Signer.SetSignedHeaders("to:from");
+   ASSERT_TRUE(Signer.SignMessage(strMail.data(), strMail.size(), strHeader));
+   EXPECT_NE(std::string::npos, strHeader.find("h=to:from;"));
+   EXPECT_TRUE(VerifySignature("to:<bar@example.org>\r\nfrom:<foo@example.com>\r\n", strHeader));
+   EXPECT_FALSE(VerifySignature("from:<foo@example.com>\r\nto:<bar@example.org>\r\n", strHeader));
+
+   // a mail without a From field can't be signed
+   const std::string strNoFrom = "Subject: DKIM\n\nBody\n";
+   EXPECT_FALSE(Signer.SignMessage(strNoFrom.data(), strNoFrom.size(), strHeader));
+
+   // the parsed key is shared with other signers
+   CDKIMSigner OtherSigner("example.com", "mail");
+   EXPECT_TRUE(OtherSigner.LoadPrivateKey(strPEM));
+   EVP_PKEY_free(pKey);
+}
+#endif
+
+// Header Parser Tests
+
+TEST(HeaderParser, TestParse)
+{
+   const std::string strMail = "From foo@example.com Mon Jan  1 00:00:00 2024\n"
+                               "Return-Path: <foo@example.com>\r\n"
+                               "Subject: a folded\r\n"
+                               "\tsubject  \r\n"
+                               "To : <bar@example.org>\r\n"
+                               "X-Empty:\r\n"
+                               "subject: second\r\n"
+                               "\r\n"
+                               "Body: not a header\r\n";
+
+   CHeaderParser Parser;
+   Parser.Parse(strMail);
+
+   ASSERT_EQ(5u, Parser.GetCount());
+   EXPECT_EQ(strMail.find("Body:"), Parser.GetHeaderSize());
+
+   // the index points into the original buffer
+   const CHeaderParser::Field* pSubject = Parser.Find("SUBJECT");
+   ASSERT_TRUE(pSubject != nullptr);
+   EXPECT_EQ(strMail.data() + strMail.find("Subject"), pSubject->Name.data());
+   EXPECT_EQ("a folded\r\n\tsubject", pSubject->Value.ToString());
+   EXPECT_EQ("a folded\tsubject", CHeaderParser::Unfold(pSubject->Value));
+
+   EXPECT_EQ("<bar@example.org>", Parser.GetValue("to").ToString());
+   EXPECT_TRUE(Parser.GetValue("X-Empty").empty());
+   EXPECT_TRUE(Parser.Find("X-Empty") != nullptr);
+   EXPECT_TRUE(Parser.Find("Body") == nullptr);
+   EXPECT_TRUE(Parser.Find("Subjec") == nullptr);
+
+   // headers only, no body
+   Parser.Parse(CStringView("Date: today"));
+   ASSERT_EQ(1u, Parser.GetCount());
+   EXPECT_EQ("today", Parser.GetValue("date").ToString());
+   EXPECT_EQ(11u, Parser.GetHeaderSize());
+}
+
+// MIME Tests
+
+TEST(MailCodec, TestDecoders)
+{
+   EXPECT_EQ("Hello World!", CMailCodec::Base64Decode("SGVsbG8g\r\nV29ybGQh"));
+   EXPECT_EQ("ab", CMailCodec::Base64Decode("YWI=\r\nignored"));
+   EXPECT_EQ(CMailCodec::Base64Encode("\x01\x02\xFE\xFF"), "AQL+/w==");
+
+   EXPECT_EQ("caf\xC3\xA9 au lait", CMailCodec::QuotedPrintableDecode("caf=C3=A9 au =\r\nlait"));
+   EXPECT_EQ("a=zz", CMailCodec::QuotedPrintableDecode("a=zz"));
+
+   // the incremental decoder can be fed one byte at a time
+   const std::string strInput = "=E2=82=AC=\nend=";
+   CMailCodec::QuotedPrintableDecoder Decoder;
+   std::string strOutput;
+   char szBuffer[4];
+   for (const char c : strInput)
+      strOutput.append(szBuffer, Decoder.Decode(&c, 1, szBuffer));
+   strOutput.append(szBuffer, Decoder.Finish(szBuffer));
+   EXPECT_EQ("\xE2\x82\xAC" "end=", strOutput);
+}
+
+TEST(MailCodec, TestDecodeHeader)
+{
+   EXPECT_EQ("plain text", CMailCodec::DecodeHeader("plain text"));
+   EXPECT_EQ("caf\xC3\xA9", CMailCodec::DecodeHeader("=?UTF-8?B?Y2Fmw6k=?="));
+   EXPECT_EQ("Pr\xC3\xA9sentation du projet", CMailCodec::DecodeHeader("=?iso-8859-1?q?Pr=E9sentation_du_projet?="));
+
+   // white space between encoded words is dropped, a character split in two words is kept whole
+   EXPECT_EQ("Re: \xE2\x82\xAC" "100 !", CMailCodec::DecodeHeader("Re: =?utf-8?B?4oI=?=\r\n =?UTF-8?B?rDEwMA==?= !"));
+   EXPECT_EQ("a b", CMailCodec::DecodeHeader("=?utf-8?q?a?= b"));
+
+   // single byte charsets
+   EXPECT_EQ("\xD0\x9F\xD1\x80\xD0\xB8", CMailCodec::DecodeHeader("=?windows-1251?B?z/Do?="));
+   EXPECT_EQ("\xC5\x81\xC3\xB3\x64\xC5\xBA", CMailCodec::DecodeHeader("=?ISO-8859-2?Q?=A3=F3d=BC?="));
+   EXPECT_EQ("\xE2\x82\xAC", CMailCodec::DecodeHeader("=?windows-1252?Q?=80?="));
+
+   // malformed words are left alone, unknown charsets are reported
+   EXPECT_EQ("=?utf-8?x?abc?= =?", CMailCodec::DecodeHeader("=?utf-8?x?abc?= =?"));
+   std::string strOutput;
+   EXPECT_FALSE(CMailCodec::DecodeHeader("x =?gb2312?B?xOO6ww==?=", strOutput));
+   EXPECT_EQ("x =?gb2312?B?xOO6ww==?=", strOutput);
+
+   // raw 8-bit text : UTF-8 is kept, anything else is read as Windows-1252
+   EXPECT_EQ("caf\xC3\xA9 caf\xC3\xA9", CMailCodec::DecodeHeader("caf\xC3\xA9 caf\xE9"));
+
+   // long ASCII runs go through the vectorized path
+   const std::string strLong(100, 'a');
+   EXPECT_EQ(strLong + "\xC3\xA9" + strLong, CMailCodec::DecodeHeader(strLong + "=?UTF-8?Q?=C3=A9?=" + strLong));
+}
+
+TEST(Charset, TestUTF8)
+{
+   const std::string strValid = std::string(40, 'x') + "\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80";
+   EXPECT_TRUE(CCharset::IsValidUTF8(strValid.data(), strValid.size()));
+   EXPECT_EQ(40u, CCharset::ASCIIPrefix(strValid.data(), strValid.size()));
+
+   // overlong form, surrogate, truncated sequence
+   for (const std::string& strInvalid : { std::string("\xC0\xAF"), std::string("\xED\xA0\x80"), std::string(33, 'a') + "\xE2\x82" })
+      EXPECT_FALSE(CCharset::IsValidUTF8(strInvalid.data(), strInvalid.size()));
+
+   std::string strOutput;
+   CCharset::AppendUTF8("a\xFF" "b", 3, strOutput);
+   EXPECT_EQ("a\xEF\xBF\xBD" "b", strOutput);
+
+   EXPECT_TRUE(CCharset::IsSupported("ISO_8859-15"));
+   EXPECT_TRUE(CCharset::IsSupported("utf-8*en"));
+   EXPECT_FALSE(CCharset::IsSupported("shift_jis"));
+}
+
+TEST(MailMessage, TestLazyParsing)
+{
+   const std::string strMail =
+      "From: =?utf-8?Q?Fran=C3=A7ois?= <foo@example.com>\r\n"
+      "Subject: report\r\n"
+      "Content-Type: multipart/mixed; boundary=\"b1\"\r\n"
+      "\r\n"
+      "--b1\r\n"
+      "Content-Type: text/plain; charset=iso-8859-1\r\n"
+      "Content-Transfer-Encoding: quoted-printable\r\n"
+      "\r\n"
+      "d=E9j=E0 vu\r\n"
+      "--b1\r\n"
+      "Content-Type: multipart/related; boundary=b2\r\n"
+      "\r\n"
+      "--b2\r\n"
+      "\r\n"
+      "no headers\r\n"
+      "--b2--\r\n"
+      "--b1\r\n"
+      "Content-Type: application/pdf; name=\"report.pdf\"\r\n"
+      "Content-Transfer-Encoding: base64\r\n"
+      "\r\n"
+      "JVBERi0xLjQK\r\n"
+      "--b1--\r\n";
+
+   {
+      std::ofstream ofMail("test_message.eml", std::ofstream::binary);
+      ofMail << strMail;
+   }
+
+   CMailMessage Message;
+   EXPECT_FALSE(Message.Open("no_such_message.eml"));
+   ASSERT_TRUE(Message.Open("test_message.eml"));
+
+   EXPECT_EQ("report", Message.GetHeader("subject").ToString());
+   EXPECT_EQ("Fran\xC3\xA7ois <foo@example.com>", Message.GetDecodedHeader("From"));
+
+   const std::vector<CMailMessage::Part>& vecParts = Message.GetParts();
+   ASSERT_EQ(3u, vecParts.size());
+   EXPECT_EQ("1", vecParts[0].strPartId);
+   EXPECT_EQ("2.1", vecParts[1].strPartId);
+   EXPECT_EQ("text/plain", vecParts[1].strContentType);
+   EXPECT_EQ("no headers", vecParts[1].Body.ToString());
+   EXPECT_EQ("3", vecParts[2].strPartId);
+   EXPECT_TRUE(vecParts[2].bAttachment);
+   EXPECT_EQ("report.pdf", vecParts[2].strFileName);
+
+   std::string strText;
+   EXPECT_TRUE(Message.GetPartText(vecParts[0], strText));
+   EXPECT_EQ("d\xC3\xA9j\xC3\xA0 vu", strText);
+
+   const CMailMessage::Part* pPDF = Message.FindPart("3");
+   ASSERT_TRUE(pPDF != nullptr);
+   std::string strContent;
+   EXPECT_TRUE(Message.DecodePart(*pPDF, strContent));
+   EXPECT_EQ("%PDF-1.4\n", strContent);
+
+   ASSERT_TRUE(Message.SavePart(*pPDF, "test_report.pdf"));
+   std::ifstream ifPart("test_report.pdf", std::ios::binary);
+   EXPECT_EQ(strContent, std::string((std::istreambuf_iterator<char>(ifPart)), std::istreambuf_iterator<char>()));
+   ifPart.close();
+
+   Message.Close();
+   EXPECT_TRUE(remove("test_report.pdf") == 0);
+   EXPECT_TRUE(remove("test_message.eml") == 0);
+
+   // single part e-mail held in memory
+   const std::string strSimple = "Subject: hi\n\nbody\n";
+   Message.Attach(strSimple);
+   ASSERT_EQ(1u, Message.GetParts().size());
+   EXPECT_EQ("1", Message.GetParts()[0].strPartId);
+   EXPECT_EQ("body\n", Message.GetParts()[0].Body.ToString());
+}
+
+TEST(MIMESplitter, TestSplit)
+{
+   const std::string strMail =
+      "From: <foo@example.com>\r\n"
+      "Subject: parts\r\n"
+      "MIME-Version: 1.0\r\n"
+      "Content-Type: multipart/mixed;\r\n"
+      "\tboundary=\"outer\"\r\n"
+      "\r\n"
+      "This is a multi-part message in MIME format.\r\n"
+      "--outer\r\n"
+      "Content-Type: multipart/alternative; boundary=inner\r\n"
+      "\r\n"
+      "--inner\r\n"
+      "Content-Type: text/plain; charset=utf-8\r\n"
+      "Content-Transfer-Encoding: quoted-printable\r\n"
+      "\r\n"
+      "caf=C3=A9 =\r\n"
+      "cr=C3=A8me\r\n"
+      "--inner\r\n"
+      "Content-Type: text/html\r\n"
+      "\r\n"
+      "<p>--inner-ish</p>\r\n"
+      "--inner--\r\n"
+      "--outer\r\n"
+      "Content-Type: application/octet-stream; name=\"data.bin\"\r\n"
+      "Content-Disposition: attachment; filename=\"../data.bin\"\r\n"
+      "Content-Transfer-Encoding: base64\r\n"
+      "\r\n"
+      "AAECA/7/\r\n"
+      "SGk=\r\n"
+      "--outer--\r\n"
+      "epilogue\r\n";
+
+   const std::string strDirectory = "test_mimesplitter";
+   ASSERT_TRUE(CreateTestDirectory(strDirectory));
+
+   // the splitting mustn't depend on how the e-mail is chunked
+   for (const size_t uChunk : { strMail.size(), size_t(7), size_t(1) })
+   {
+      CMIMESplitter Splitter(strDirectory, PRINT_LOG);
+      for (size_t i = 0; i < strMail.size(); i += uChunk)
+         ASSERT_TRUE(Splitter.Write(strMail.data() + i, std::min(uChunk, strMail.size() - i)));
+      ASSERT_TRUE(Splitter.Finish());
+
+      const std::vector<CMIMESplitter::PartInfo>& vecParts = Splitter.GetParts();
+      ASSERT_EQ(3u, vecParts.size());
+
+      EXPECT_EQ("1.1", vecParts[0].strPartId);
+      EXPECT_EQ("text/plain", vecParts[0].strContentType);
+      EXPECT_EQ("utf-8", vecParts[0].strCharset);
+      EXPECT_FALSE(vecParts[0].bAttachment);
+
+      EXPECT_EQ("1.2", vecParts[1].strPartId);
+      EXPECT_EQ("text/html", vecParts[1].strContentType);
+
+      EXPECT_EQ("2", vecParts[2].strPartId);
+      EXPECT_TRUE(vecParts[2].bAttachment);
+      EXPECT_EQ("../data.bin", vecParts[2].strFileName);
+      EXPECT_EQ(8u, vecParts[2].uSize);
+
+      const std::string strExpected[] = { "caf\xC3\xA9 cr\xC3\xA8me",
+                                          "<p>--inner-ish</p>",
+                                          std::string("\x00\x01\x02\x03\xFE\xFF" "Hi", 8) };
+      for (size_t i = 0; i < vecParts.size(); ++i)
+      {
+         ASSERT_EQ(strDirectory + "/", vecParts[i].strPath.substr(0, strDirectory.size() + 1));
+         // the announced file name can't escape the target directory
+         EXPECT_EQ(std::string::npos, vecParts[i].strPath.find('/', strDirectory.size() + 1));
+
+         std::ifstream ifPart(vecParts[i].strPath, std::ios::binary);
+         const std::string strContent((std::istreambuf_iterator<char>(ifPart)), std::istreambuf_iterator<char>());
+         ifPart.close();
+         EXPECT_EQ(strExpected[i], strContent);
+         EXPECT_EQ(strExpected[i].size(), vecParts[i].uSize);
+         EXPECT_TRUE(remove(vecParts[i].strPath.c_str()) == 0);
+      }
+   }
+   EXPECT_TRUE(RemoveTestDirectory(strDirectory));
+}
+
+TEST(MIMESplitter, TestFileNameCollisions)
+{
+   // the third part is renamed 3_a.txt, which the first one already uses
+   std::string strMail = "Content-Type: multipart/mixed; boundary=b\r\n\r\n";
+   for (const char* pszName : { "3_a.txt", "a.txt", "a.txt" })
+      strMail += std::string("--b\r\nContent-Disposition: attachment; filename=") + pszName + "\r\n\r\n" + pszName + "\r\n";
+   strMail += "--b--\r\n";
+
+   const std::string strDirectory = "test_mimesplitter_names";
+   ASSERT_TRUE(CreateTestDirectory(strDirectory));
+
+   CMIMESplitter Splitter(strDirectory, PRINT_LOG);
+   ASSERT_TRUE(Splitter.Write(strMail.data(), strMail.size()));
+   ASSERT_TRUE(Splitter.Finish());
+
+   const std::vector<CMIMESplitter::PartInfo>& vecParts = Splitter.GetParts();
+   ASSERT_EQ(3u, vecParts.size());
+   EXPECT_NE(vecParts[0].strPath, vecParts[2].strPath);
+   EXPECT_NE(vecParts[1].strPath, vecParts[2].strPath);
+
+   // no part overwrote another
+   for (const CMIMESplitter::PartInfo& oPart : vecParts)
+   {
+      std::ifstream ifPart(oPart.strPath, std::ios::binary);
+      const std::string strContent((std::istreambuf_iterator<char>(ifPart)), std::istreambuf_iterator<char>());
+      ifPart.close();
+      EXPECT_EQ(oPart.strFileName, strContent);
+      EXPECT_TRUE(remove(oPart.strPath.c_str()) == 0);
+   }
+   EXPECT_TRUE(RemoveTestDirectory(strDirectory));
+}
+
+TEST(MailSink, TestWriteCallback)
+{
+   CStringSink Sink;
+   char szChunk[] = "Subject: test\r\n";
+   EXPECT_EQ(sizeof(szChunk) - 1, CMailSink::WriteCallback(szChunk, 1, sizeof(szChunk) - 1, &Sink));
+   EXPECT_EQ(2u, CMailSink::WriteCallback(szChunk, 2, 1, &Sink));
+   EXPECT_EQ("Subject: test\r\nSu", Sink.strData);
+   EXPECT_EQ(2u, Sink.uChunks);
+   EXPECT_EQ(0u, CMailSink::WriteCallback(szChunk, 1, 1, nullptr));
+
+   // a MIME splitter is a sink too
+   const std::string strMail = "Content-Type: text/plain\r\n\r\nhello\r\n";
+   CMIMESplitter Splitter("", PRINT_LOG);
+   CMailSink& oSink = Splitter;
+   EXPECT_TRUE(oSink.OnChunk(strMail.data(), strMail.size()));
+   oSink.OnComplete(true);
+   ASSERT_EQ(1u, Splitter.GetParts().size());
+   EXPECT_EQ("text/plain", Splitter.GetParts()[0].strContentType);
+   EXPECT_TRUE(remove(Splitter.GetParts()[0].strPath.c_str()) == 0);
+}
+
+// POP Response Tests
+
+TEST(PopResponseParser, TestListings)
+{
+   CPopResponseParser Parser;
+
+   // lines split between chunks
+   std::vector<PopListEntry> vecList;
+   Parser.SetTarget(&vecList);
+   const std::string strList = "1 120\r\n2 4294967296\r\n3 7";
+   for (size_t i = 0; i < strList.size(); i += 5)
+      Parser.Feed(strList.data() + i, std::min<size_t>(5, strList.size() - i));
+   EXPECT_TRUE(Parser.Finish());
+   ASSERT_EQ(3u, vecList.size());
+   EXPECT_EQ(2u, vecList[1].uMsgNumber);
+   EXPECT_EQ(4294967296ull, vecList[1].uOctets);
+   EXPECT_EQ(7u, vecList[2].uOctets);
+
+   std::vector<PopUidlEntry> vecUIDL;
+   Parser.SetTarget(&vecUIDL);
+   const std::string strUIDL = "+OK\r\n1 whqtswO00WBw418f9t5JxYwZ\r\n2 QhdPYR:00WBw1Ph7x7\r\n.\r\n";
+   Parser.Feed(strUIDL.data(), strUIDL.size());
+   EXPECT_TRUE(Parser.Finish());
+   ASSERT_EQ(2u, vecUIDL.size());
+   EXPECT_EQ("QhdPYR:00WBw1Ph7x7", vecUIDL[1].strUID);
+
+   Parser.SetTarget(&vecUIDL);
+   Parser.Feed("1\r\n", 3);
+   EXPECT_FALSE(Parser.Finish());
+
+   // the drop listing is the last response line that parses
+   PopStat oStat;
+   Parser.SetTarget(&oStat);
+   const std::string strStat = "+OK POP3 server ready\r\n+OK\r\n+OK 2 320\r\n";
+   Parser.Feed(strStat.data(), strStat.size());
+   EXPECT_TRUE(Parser.Finish());
+   EXPECT_EQ(2u, oStat.uMessages);
+   EXPECT_EQ(320u, oStat.uOctets);
+
+   Parser.SetTarget(&oStat);
+   Parser.Feed("+OK\r\n", 5);
+   EXPECT_FALSE(Parser.Finish());
+}
+
+TEST(PopSync, TestState)
+{
+   CPOPClient POPClient(PRINT_LOG);
+   remove("test_popsync.state");
+   remove("test_popsync.state.journal");
+
+   {
+      CPopSync Sync(POPClient, "test_popsync.state", PRINT_LOG);
+      ASSERT_TRUE(Sync.Load());
+      EXPECT_EQ(0u, Sync.GetSeenCount());
+      EXPECT_TRUE(Sync.MarkSeen("UID-000123"));
+      EXPECT_TRUE(Sync.MarkSeen("UID-000124"));
+      EXPECT_TRUE(Sync.MarkSeen("UID-000124"));
+      EXPECT_EQ(2u, Sync.GetSeenCount());
+      // not saved : the journal keeps the UIDs
+   }
+   {
+      CPopSync Sync(POPClient, "test_popsync.state", PRINT_LOG);
+      ASSERT_TRUE(Sync.Load());
+      EXPECT_TRUE(Sync.IsSeen("UID-000123"));
+      EXPECT_TRUE(Sync.IsSeen("UID-000124"));
+      EXPECT_FALSE(Sync.IsSeen("UID-000125"));
+      EXPECT_TRUE(Sync.MarkSeen("ABC"));
+      ASSERT_TRUE(Sync.Save());
+   }
+   {
+      std::ifstream ifJournal("test_popsync.state.journal");
+      EXPECT_FALSE(ifJournal.is_open());
+   }
+   {
+      CPopSync Sync(POPClient, "test_popsync.state", PRINT_LOG);
+      ASSERT_TRUE(Sync.Load());
+      EXPECT_EQ(3u, Sync.GetSeenCount());
+      EXPECT_TRUE(Sync.IsSeen("ABC"));
+      EXPECT_TRUE(Sync.IsSeen("UID-000124"));
+   }
+
+   // a corrupted state is reported
+   {
+      std::ofstream ofState("test_popsync.state", std::ofstream::binary | std::ofstream::trunc);
+      ofState << "POPSYNC1" << '\x05' << '\x00' << '\x09' << "abc";
+   }
+   CPopSync Sync(POPClient, "test_popsync.state", PRINT_LOG);
+   EXPECT_FALSE(Sync.Load());
+
+   EXPECT_TRUE(remove("test_popsync.state") == 0);
+}
+
+TEST(PopSync, TestDeletedForgotten)
+{
+   // mailbox of the fake server, the deletions are committed by QUIT
+   std::vector<std::string> vecMailbox = { "uid-1", "uid-2" };
+   std::vector<bool> vecDeleted;
+   CFakeServer Server("+OK ready\r\n", [&](const std::string& strLine) -> std::string
+   {
+      const std::string strCommand = strLine.substr(0, strLine.find(' '));
+      const size_t uIndex = strtoul(strLine.c_str() + strCommand.size(), nullptr, 10) - 1;
+
+      if (strCommand == "CAPA")
+      {
+         vecDeleted.assign(vecMailbox.size(), false);
+         return "+OK\r\nUSER\r\nUIDL\r\n.\r\n";
+      }
+      if (strCommand == "USER" || strCommand == "PASS" || strCommand == "NOOP")
+         return "+OK\r\n";
+      if (strCommand == "UIDL")
+      {
+         std::string strReply = "+OK\r\n";
+         for (size_t i = 0; i < vecMailbox.size(); ++i)
+         {
+            if (!vecDeleted[i])
+               strReply += std::to_string(i + 1) + " " + vecMailbox[i] + "\r\n";
+         }
+         return strReply + ".\r\n";
+      }
+      if (strCommand == "RETR" && uIndex < vecMailbox.size())
+         return "+OK\r\nSubject: " + vecMailbox[uIndex] + "\r\n\r\nbody\r\n.\r\n";
+      if (strCommand == "DELE" && uIndex < vecMailbox.size())
+      {
+         vecDeleted[uIndex] = true;
+         return "+OK\r\n";
+      }
+      if (strCommand == "QUIT")
+      {
+         for (size_t i = vecMailbox.size(); i-- > 0; )
+         {
+            if (vecDeleted[i])
+               vecMailbox.erase(vecMailbox.begin() + i);
+         }
+         return "+OK bye\r\n";
+      }
+      return "-ERR unknown command\r\n";
+   });
+   ASSERT_FALSE(Server.GetAddress().empty());
+
+   remove("test_popsync_dele.state");
+   const auto StoreFn = [](const PopUidlEntry&, const std::string& strMail) { return !strMail.empty(); };
+
+   CPOPClient POPClient(PRINT_LOG);
+   ASSERT_TRUE(POPClient.InitSession(Server.GetAddress(), "user", "password",
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::NO_SSLTLS));
+
+   CPopSync Sync(POPClient, "test_popsync_dele.state", PRINT_LOG);
+   Sync.SetDeleteAfterStore(true);
+   EXPECT_TRUE(Sync.Sync(StoreFn));
+   EXPECT_EQ(2u, Sync.GetRetrievedCount());
+   EXPECT_TRUE(Sync.IsSeen("uid-1"));
+   EXPECT_TRUE(Sync.IsSeen("uid-2"));
+
+   // QUIT commits the deletions, then a new message arrives
+   EXPECT_TRUE(POPClient.CleanupSession());
+   {
+      std::lock_guard<std::mutex> Lock(Server.GetMutex());
+      EXPECT_EQ(0u, vecMailbox.size());
+      vecMailbox.push_back("uid-3");
+   }
+   ASSERT_TRUE(POPClient.InitSession(Server.GetAddress(), "user", "password",
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::NO_SSLTLS));
+
+   // the deleted UIDs leave the seen set
+   EXPECT_TRUE(Sync.Sync(StoreFn));
+   EXPECT_EQ(1u, Sync.GetRetrievedCount());
+   EXPECT_FALSE(Sync.IsSeen("uid-1"));
+   EXPECT_FALSE(Sync.IsSeen("uid-2"));
+   EXPECT_TRUE(Sync.IsSeen("uid-3"));
+   EXPECT_EQ(1u, Sync.GetSeenCount());
+
+   EXPECT_TRUE(POPClient.CleanupSession());
+   EXPECT_TRUE(remove("test_popsync_dele.state") == 0);
+}
+
+TEST(SeenUidSet, TestSet)
+{
+   for (const bool bBloom : { false, true })
+   {
+      CSeenUidSet Set;
+      if (bBloom)
+         Set.EnableBloomFilter();
+
+      // enough UIDs for several merges and blocks
+      for (unsigned i = 0; i < 10000; i += 2)
+         EXPECT_TRUE(Set.Insert("1700000000." + std::to_string(100000 + i) + ".mx.example.com"));
+      EXPECT_FALSE(Set.Insert("1700000000.100000.mx.example.com"));
+      EXPECT_EQ(5000u, Set.GetCount());
+
+      EXPECT_TRUE(Set.Contains("1700000000.100002.mx.example.com"));
+      EXPECT_FALSE(Set.Contains("1700000000.100003.mx.example.com"));
+      EXPECT_FALSE(Set.Contains(""));
+
+      std::vector<std::string> vecUIDs;
+      for (unsigned i = 9990; i < 10010; ++i)
+         vecUIDs.push_back("1700000000." + std::to_string(100000 + i) + ".mx.example.com");
+      std::vector<bool> vecSeen;
+      Set.Contains(vecUIDs, vecSeen);
+      ASSERT_EQ(vecUIDs.size(), vecSeen.size());
+      for (size_t i = 0; i < vecUIDs.size(); ++i)
+         EXPECT_EQ(i < 10 && i % 2 == 0, vecSeen[i]) << vecUIDs[i];
+
+      // the state is front coded (33 characters per UID)
+      std::string strState;
+      Set.Serialize(strState);
+      EXPECT_LT(strState.size(), 5000u * 20);
+
+      Set.Retain(vecUIDs);
+      EXPECT_EQ(5u, Set.GetCount());
+      EXPECT_FALSE(Set.Contains("1700000000.100002.mx.example.com"));
+
+      CSeenUidSet Loaded;
+      size_t uPos = 0;
+      ASSERT_TRUE(Loaded.Deserialize(strState, uPos));
+      EXPECT_EQ(strState.size(), uPos);
+      EXPECT_EQ(5000u, Loaded.GetCount());
+      EXPECT_TRUE(Loaded.Contains("1700000000.109998.mx.example.com"));
+
+      // UIDs must be in increasing order
+      uPos = 0;
+      EXPECT_FALSE(Loaded.Deserialize(std::string("\x02\x00\x01" "b" "\x00\x01" "a", 7), uPos));
+      EXPECT_EQ(0u, Loaded.GetCount());
+   }
+}
+
+TEST(UIDBitmap, TestSetOperations)
+{
+   CUIDBitmap Sparse;
+   Sparse.Add(3);
+   Sparse.Add(70000);
+   Sparse.Add(4000000000u);
+   EXPECT_EQ(3u, Sparse.GetCount());
+   EXPECT_EQ(3u, Sparse.GetMin());
+   EXPECT_EQ(4000000000u, Sparse.GetMax());
+   EXPECT_TRUE(Sparse.Contains(70000));
+   EXPECT_FALSE(Sparse.Contains(69999));
+
+   // a range large enough to use bitmaps
+   CUIDBitmap Dense;
+   Dense.AddRange(1, 100000);
+   EXPECT_EQ(100000u, Dense.GetCount());
+   EXPECT_LT(Dense.GetMemoryUsage(), 100000u / 4);
+   EXPECT_TRUE(Dense.Remove(50000));
+   EXPECT_FALSE(Dense.Remove(50000));
+
+   CUIDBitmap Result = Dense;
+   Result.Intersect(Sparse);
+   std::vector<uint32_t> vecUIDs;
+   Result.ToVector(vecUIDs);
+   EXPECT_EQ(std::vector<uint32_t>({ 3, 70000 }), vecUIDs);
+
+   Result = Sparse;
+   Result.Subtract(Dense);
+   Result.ToVector(vecUIDs);
+   EXPECT_EQ(std::vector<uint32_t>({ 4000000000u }), vecUIDs);
+
+   Result.Union(Dense);
+   EXPECT_EQ(100000u, Result.GetCount());
+
+   std::vector<bool> vecSeen;
+   Result.Contains({ 0, 1, 50000, 100000, 100001, 4000000000u }, vecSeen);
+   EXPECT_EQ(std::vector<bool>({ false, true, false, true, false, true }), vecSeen);
+
+   std::string strState;
+   Result.Serialize(strState);
+   CUIDBitmap Loaded;
+   size_t uPos = 0;
+   ASSERT_TRUE(Loaded.Deserialize(strState, uPos));
+   EXPECT_TRUE(Loaded == Result);
+
+   uPos = 0;
+   EXPECT_FALSE(Loaded.Deserialize(strState.substr(0, strState.size() / 2), uPos));
+   EXPECT_TRUE(Loaded.IsEmpty());
+
+   // a delta wrapping around 32 bits : 5 + 0xFFFFFFFF
+   uPos = 0;
+   EXPECT_FALSE(Loaded.Deserialize(std::string("\x01\x00\x02\x05\xFF\xFF\xFF\xFF\x0F", 9), uPos));
+   EXPECT_TRUE(Loaded.IsEmpty());
+
+   // IMAP sequence sets
+   CUIDBitmap Fetch;
+   Fetch.AddRange(1, 500);
+   Fetch.Add(720);
+   Fetch.AddRange(900, 1200);
+   std::string strSet;
+   Fetch.ToSequenceSet(strSet);
+   EXPECT_EQ("1:500,720,900:1200", strSet);
+   CUIDBitmap Parsed;
+   EXPECT_TRUE(Parsed.AddSequenceSet(strSet));
+   EXPECT_TRUE(Parsed == Fetch);
+}
+
+TEST(PopSession, TestParse)
+{
+   // pipelined responses : RETR, an error, TOP, DELE
+   std::vector<CPopSession::Request> vecRequests;
+   vecRequests.emplace_back("RETR 1", true);
+   vecRequests.emplace_back("RETR 9", true);
+   vecRequests.emplace_back("TOP 2 0", true);
+   vecRequests.emplace_back("DELE 1", false);
+   const std::string strResponses = "+OK 40 octets\r\nSubject: a\r\n\r\n..dot\r\n.\r\n"
+                                    "-ERR no such message\r\n"
+                                    "+OK\r\nSubject: b\r\n\r\n.\r\n"
+                                    "+OK deleted\r\n";
+
+   // the stream is parsed whole, then byte by byte
+   for (size_t uChunk : { strResponses.size(), static_cast<size_t>(1) })
+   {
+      CPopSession Session(PRINT_LOG);
+      std::vector<std::string> vecBodies(vecRequests.size());
+      std::vector<bool> vecOK;
+      auto DataFn = [&vecBodies](size_t uIndex, const char* pData, size_t uSize)
+      {
+         vecBodies[uIndex].append(pData, uSize);
+         return true;
+      };
+      auto DoneFn = [&vecOK](size_t uIndex, bool bOK, const std::string&)
+      {
+         EXPECT_EQ(vecOK.size(), uIndex);
+         vecOK.push_back(bOK);
+         return true;
+      };
+
+      std::string strBuffer;
+      size_t uDone = 0;
+      for (size_t i = 0; i < strResponses.size(); i += uChunk)
+      {
+         strBuffer.append(strResponses, i, uChunk);
+         ASSERT_TRUE(Session.Parse(strBuffer, vecRequests, uDone, vecRequests.size(), DataFn, DoneFn));
+      }
+
+      EXPECT_EQ(4u, uDone);
+      EXPECT_TRUE(strBuffer.empty());
+      EXPECT_EQ(std::vector<bool>({ true, false, true, true }), vecOK);
+      EXPECT_EQ("Subject: a\r\n\r\n.dot\r\n", vecBodies[0]);
+      EXPECT_TRUE(vecBodies[1].empty());
+      EXPECT_EQ("Subject: b\r\n\r\n", vecBodies[2]);
+   }
+}
+
+TEST(ImapSession, TestFindResponseEnd)
+{
+   const std::string strResponses = "* 3 EXISTS\r\n"
+                                    "* 1 FETCH (BODY[] {12}\r\nline\r\n{2}\r\n )\r\n"
+                                    "T1 OK done\r\n";
+   const size_t uFirst = CImapSession::FindResponseEnd(strResponses);
+   ASSERT_EQ(12u, uFirst);
+   // the literal holds a CRLF and a fake literal announce
+   const size_t uSecond = CImapSession::FindResponseEnd(strResponses, uFirst);
+   ASSERT_EQ(strResponses.find("T1"), uSecond);
+   EXPECT_EQ(strResponses.size(), CImapSession::FindResponseEnd(strResponses, uSecond));
+
+   // incomplete line or literal
+   EXPECT_EQ(std::string::npos, CImapSession::FindResponseEnd("* 3 EXIS"));
+   EXPECT_EQ(std::string::npos, CImapSession::FindResponseEnd("* 1 FETCH (BODY[] {12}\r\nline\r\n"));
+   EXPECT_EQ(std::string::npos, CImapSession::FindResponseEnd("* 1 FETCH (BODY[] {4+}\r\nline"));
+
+   EXPECT_EQ("\"a \\\"b\\\\\"", CImapSession::Quote("a \"b\\"));
+}
+
+TEST(ImapSession, TestParseFetchItems)
+{
+   // the literal holds text looking like data items
+   const std::string strItems = "(UID 42 FLAGS (\\Seen) BODY[HEADER.FIELDS (FROM TO)] {22}\r\nFrom: x (UID 7) \"{3}\r\n"
+                                " ENVELOPE (\"a \\\" )\" NIL))";
+   std::vector<std::pair<std::string, std::string>> vecItems;
+   ASSERT_TRUE(CImapSession::ParseFetchItems(strItems, [&vecItems](const CStringView& Name, const CStringView& Value)
+                                             {
+                                                vecItems.emplace_back(Name.ToString(), Value.ToString());
+                                                return true;
+                                             }));
+   ASSERT_EQ(4u, vecItems.size());
+   EXPECT_EQ("42", vecItems[0].second);
+   EXPECT_EQ("(\\Seen)", vecItems[1].second);
+   EXPECT_EQ("BODY[HEADER.FIELDS (FROM TO)]", vecItems[2].first);
+   EXPECT_EQ("From: x (UID 7) \"{3}\r\n", vecItems[2].second);
+   EXPECT_EQ("(\"a \\\" )\" NIL)", vecItems[3].second);
+
+   EXPECT_FALSE(CImapSession::ParseFetchItems("(UID 42 BODY[] {30}\r\ntruncated)", [](const CStringView&, const CStringView&)
+                                              {
+                                                 return true;
+                                              }));
+}
+
+TEST(ImapTokenizer, TestTokens)
+{
+   const std::string strResponses = "* 12 FETCH (UID 4 FLAGS (\\Seen $Work) BODY[HEADER.FIELDS (FROM)]<0> {9}\r\n"
+                                    "From: a\r\n INTERNALDATE \"1-Feb-2024 \\\"x\\\"\" BODY[] NIL)\r\n"
+                                    "* OK {maintenance} {12+x} {} {3} ends\r\n"
+                                    "T3 OK [READ-WRITE] done\r\n";
+   const char* EXPECTED[] = { "A:*", "A:12", "A:FETCH", "(", "A:UID", "A:4", "A:FLAGS", "(", "A:\\Seen", "A:$Work",
+                              ")", "A:BODY[HEADER.FIELDS (FROM)]<0>", "L:9", "D:From: a\r\n", "E", "A:INTERNALDATE",
+                              "S:1-Feb-2024 \"x\"", "A:BODY[]", "A:NIL", ")", "\\n",
+                              // braces that don't announce a literal
+                              "A:*", "A:OK", "A:{maintenance}", "A:{12+x}", "A:{}", "A:{3}", "A:ends", "\\n", "A:T3", "A:OK",
+                              "A:[READ-WRITE]", "A:done", "\\n" };
+
+   std::vector<std::string> vecTokens;
+   std::string strData;
+   CImapTokenizer Tokenizer([&](const ImapToken& Token)
+                            {
+                               switch (Token.eType)
+                               {
+                                  case ImapToken::ATOM:         vecTokens.push_back("A:" + Token.Value.ToString()); break;
+                                  case ImapToken::STRING:       vecTokens.push_back("S:" + Token.Value.ToString()); break;
+                                  case ImapToken::LIST_START:   vecTokens.push_back("("); break;
+                                  case ImapToken::LIST_END:     vecTokens.push_back(")"); break;
+                                  case ImapToken::LITERAL:      vecTokens.push_back("L:" + std::to_string(Token.uSize)); break;
+                                  case ImapToken::LITERAL_DATA: strData += Token.Value.ToString(); break;
+                                  case ImapToken::LITERAL_END:  vecTokens.push_back("D:" + strData); vecTokens.push_back("E");
+                                                                strData.clear(); break;
+                                  case ImapToken::LINE_END:     vecTokens.push_back("\\n"); break;
+                               }
+                               return true;
+                            });
+
+   // same tokens whether the responses arrive at once or byte by byte
+   for (const size_t uChunk : { strResponses.size(), static_cast<size_t>(1), static_cast<size_t>(7) })
+   {
+      vecTokens.clear();
+      Tokenizer.Reset();
+      for (size_t uPos = 0; uPos < strResponses.size(); uPos += uChunk)
+         ASSERT_TRUE(Tokenizer.Write(strResponses.data() + uPos, std::min(uChunk, strResponses.size() - uPos)));
+
+      ASSERT_EQ(sizeof(EXPECTED) / sizeof(EXPECTED[0]), vecTokens.size());
+      for (size_t i = 0; i < vecTokens.size(); ++i)
+         EXPECT_EQ(EXPECTED[i], vecTokens[i]);
+   }
+
+   // a literal passed to a sink isn't reported as LITERAL_DATA
+   CStringSink Sink;
+   size_t uDataTokens = 0;
+   CImapTokenizer SinkTokenizer([&](const ImapToken& Token)
+                                {
+                                   if (Token.eType == ImapToken::LITERAL)
+                                      SinkTokenizer.SetLiteralSink(&Sink);
+                                   else if (Token.eType == ImapToken::LITERAL_DATA)
+                                      ++uDataTokens;
+                                   return true;
+                                });
+   const std::string strFetch = "* 1 FETCH (BODY[] {5}\r\nHello)\r\n";
+   EXPECT_TRUE(SinkTokenizer.Write(strFetch.data(), 25));
+   EXPECT_TRUE(SinkTokenizer.Write(strFetch.data() + 25, strFetch.size() - 25));
+   EXPECT_EQ("Hello", Sink.strData);
+   EXPECT_EQ(2u, Sink.uChunks);
+   EXPECT_TRUE(Sink.bCompleted && Sink.bSuccess);
+   EXPECT_EQ(0u, uDataTokens);
+   EXPECT_EQ(0u, SinkTokenizer.GetDepth());
+
+   // literal too large
+   SinkTokenizer.Reset();
+   EXPECT_FALSE(SinkTokenizer.Write("* 1 FETCH (BODY[] {99999999999999999999}\r\n", 42));
+}
+
+TEST(BodyStructure, TestParse)
+{
+   // mixed : alternative (plain, html), a PDF and a forwarded e-mail
+   const std::string strStructure =
+      "(((\"TEXT\" \"PLAIN\" (\"CHARSET\" \"utf-8\") NIL NIL \"QUOTED-PRINTABLE\" 1200 30 NIL NIL NIL NIL)"
+      "(\"TEXT\" \"HTML\" (\"CHARSET\" \"utf-8\") NIL NIL \"BASE64\" 4000 52 NIL NIL NIL NIL)"
+      " \"ALTERNATIVE\" (\"BOUNDARY\" \"b2\") NIL NIL NIL)"
+      "(\"APPLICATION\" \"PDF\" (\"NAME\" \"=?utf-8?Q?r=C3=A9sum=C3=A9.pdf?=\") NIL NIL \"BASE64\" 52428800 NIL"
+      " (\"ATTACHMENT\" (\"FILENAME\" \"=?utf-8?Q?r=C3=A9sum=C3=A9.pdf?=\")) NIL NIL)"
+      "(\"MESSAGE\" \"RFC822\" NIL NIL NIL \"7BIT\" 300 (NIL \"fwd\" NIL NIL NIL NIL NIL NIL NIL NIL)"
+      " (\"TEXT\" \"PLAIN\" NIL NIL NIL \"7BIT\" 20 1 NIL NIL NIL NIL) 12 NIL NIL NIL NIL)"
+      " \"MIXED\" (\"BOUNDARY\" \"b1\") NIL NIL NIL)";
+
+   CBodyStructure Structure;
+   ASSERT_TRUE(Structure.Parse(strStructure));
+   const std::vector<CBodyStructure::Part>& vecParts = Structure.GetParts();
+   ASSERT_EQ(4u, vecParts.size());
+
+   EXPECT_EQ("1.1", vecParts[0].strPartId);
+   EXPECT_EQ("text/plain", vecParts[0].strContentType);
+   EXPECT_EQ("quoted-printable", vecParts[0].strEncoding);
+   EXPECT_EQ(30u, vecParts[0].uLines);
+   EXPECT_EQ("1.2", vecParts[1].strPartId);
+   EXPECT_EQ("2", vecParts[2].strPartId);
+   EXPECT_TRUE(vecParts[2].bAttachment);
+   EXPECT_EQ("r\xC3\xA9sum\xC3\xA9.pdf", vecParts[2].strFileName);
+   EXPECT_EQ(52428800u, vecParts[2].uSize);
+   EXPECT_EQ("3", vecParts[3].strPartId);
+   EXPECT_EQ("message/rfc822", vecParts[3].strContentType);
+   EXPECT_EQ(12u, vecParts[3].uLines);
+
+   ASSERT_NE(nullptr, Structure.FindText());
+   EXPECT_EQ("1.1", Structure.FindText()->strPartId);
+   EXPECT_EQ("1.2", Structure.FindText(true)->strPartId);
+
+   // a single part is section 1
+   ASSERT_TRUE(Structure.Parse("(\"TEXT\" \"PLAIN\" NIL NIL NIL \"7BIT\" 42 2)"));
+   ASSERT_EQ(1u, Structure.GetParts().size());
+   EXPECT_EQ("1", Structure.GetParts()[0].strPartId);
+
+   EXPECT_FALSE(Structure.Parse("(\"TEXT\" \"PLAIN\" NIL"));
+   EXPECT_TRUE(Structure.GetParts().empty());
+}
+
+TEST(SearchResultParser, TestParse)
+{
+   const std::string strResponses = "* 12 EXISTS\r\n"
+                                    "* SEARCH 4 5 6 7 100 4294967295 3 (MODSEQ 917162500)\r\n"
+                                    "* search 4294967296 0 9\r\n";
+
+   // parsed whole, then byte by byte
+   for (size_t uChunk : { strResponses.size(), static_cast<size_t>(1) })
+   {
+      CUIDBitmap Result;
+      CSearchResultParser Parser(Result);
+      for (size_t i = 0; i < strResponses.size(); i += uChunk)
+         EXPECT_TRUE(Parser.Write(strResponses.data() + i, std::min(uChunk, strResponses.size() - i)));
+      Parser.Finish();
+
+      std::string strSet;
+      Result.ToSequenceSet(strSet);
+      EXPECT_EQ("3:7,9,100,4294967295", strSet);
+      EXPECT_EQ(8u, Parser.GetCount());
+   }
+
+   // results combined locally
+   CUIDBitmap Unseen;
+   Unseen.AddRange(1, 10);
+   CUIDBitmap Flagged;
+   Flagged.Add(5);
+   Flagged.Add(20);
+   std::string strSet;
+   (Unseen - Flagged).ToSequenceSet(strSet);
+   EXPECT_EQ("1:4,6:10", strSet);
+   (Unseen & Flagged).ToSequenceSet(strSet);
+   EXPECT_EQ("5", strSet);
+   (Unseen | Flagged).ToSequenceSet(strSet);
+   EXPECT_EQ("1:10,20", strSet);
+}
+
+TEST(SearchCriteria, TestBuild)
+{
+   EXPECT_EQ("ALL", CSearchCriteria().ToString());
+
+   CSearchCriteria Criteria;
+   Criteria.Seen(false).Since(1, 2, 2024).From("alice \"a\" <alice@example.com>").Larger(1024);
+   EXPECT_EQ("UNSEEN SINCE 1-Feb-2024 FROM \"alice \\\"a\\\" <alice@example.com>\" LARGER 1024",
+             Criteria.ToString());
+   EXPECT_TRUE(Criteria.IsValid());
+   EXPECT_FALSE(Criteria.IsUtf8());
+
+   // composed keys are parenthesized
+   CSearchCriteria Either;
+   Either.Or(CSearchCriteria().Flagged(), CSearchCriteria().Subject("urgent").Before(31, 12, 2023))
+         .Not(CSearchCriteria().Deleted())
+         .Header("X-Priority", "1");
+   EXPECT_EQ("OR FLAGGED (SUBJECT \"urgent\" BEFORE 31-Dec-2023) NOT DELETED HEADER \"X-Priority\" \"1\"",
+             Either.ToString());
+
+   CUIDBitmap UIDs;
+   UIDs.AddRange(1, 100);
+   UIDs.Add(200);
+   EXPECT_EQ("UID 1:100,200 UID 5:9", CSearchCriteria().Uid(UIDs).Uid(5, 9).ToString());
+
+   // quoted strings are 7 bits, other text is sent as a literal
+   CSearchCriteria Utf8;
+   Utf8.Subject("\xC3\xA9t\xC3\xA9").Seen();
+   EXPECT_TRUE(Utf8.IsUtf8());
+   EXPECT_EQ("SUBJECT {5}\r\n\xC3\xA9t\xC3\xA9 SEEN", Utf8.ToString());
+
+   // a keyword is an atom, it can't inject keys
+   EXPECT_EQ("KEYWORD $Label1", CSearchCriteria().Keyword("$Label1").ToString());
+   EXPECT_FALSE(CSearchCriteria().Keyword("x ALL").IsValid());
+   EXPECT_FALSE(CSearchCriteria().Keyword("a)").IsValid());
+   EXPECT_FALSE(CSearchCriteria().Keyword("").IsValid());
+
+   EXPECT_FALSE(CSearchCriteria().Since(30, 13, 2024).IsValid());
+   EXPECT_FALSE(CSearchCriteria().Uid(CUIDBitmap()).IsValid());
+   EXPECT_FALSE(CSearchCriteria().Seen().And(CSearchCriteria().Uid(9, 3)).IsValid());
+}
+
+TEST(SearchResultParser, TestParseExtended)
+{
+   ImapSearchResult Result;
+   EXPECT_TRUE(CSearchResultParser::ParseExtended("ESEARCH (TAG \"T4\") UID COUNT 12 MIN 2 MAX 90 ALL 2:10,50,90",
+                                                  Result));
+   EXPECT_EQ(12u, Result.uCount);
+   EXPECT_EQ(2u, Result.uMin);
+   EXPECT_EQ(90u, Result.uMax);
+   EXPECT_EQ(11u, Result.oUIDs.GetCount());
+   EXPECT_TRUE(Result.oUIDs.Contains(50));
+
+   // no match : only the count is sent
+   Result.Clear();
+   EXPECT_TRUE(CSearchResultParser::ParseExtended("ESEARCH (TAG \"T5\") UID COUNT 0", Result));
+   EXPECT_EQ(0u, Result.uCount);
+   EXPECT_TRUE(Result.oUIDs.IsEmpty());
+
+   EXPECT_FALSE(CSearchResultParser::ParseExtended("SEARCH 1 2 3", Result));
+   EXPECT_FALSE(CSearchResultParser::ParseExtended("ESEARCH UID ALL 3:x", Result));
+}
+
+TEST(ImapSync, TestParse)
+{
+   ImapSyncChange Change;
+   ASSERT_TRUE(CImapSync::ParseFetch("(FLAGS (\\Seen \\Flagged) UID 1234 MODSEQ (98765))", Change));
+   EXPECT_EQ(1234u, Change.uUID);
+   EXPECT_EQ("\\Seen \\Flagged", Change.strFlags);
+   EXPECT_EQ(98765u, Change.uModSeq);
+
+   ASSERT_TRUE(CImapSync::ParseFetch("(UID 7 FLAGS ())", Change));
+   EXPECT_EQ(7u, Change.uUID);
+   EXPECT_TRUE(Change.strFlags.empty());
+   EXPECT_EQ(0u, Change.uModSeq);
+   EXPECT_FALSE(CImapSync::ParseFetch("(FLAGS (\\Seen))", Change));
+
+   // VANISHED (EARLIER) sets
+   CUIDBitmap Vanished;
+   EXPECT_TRUE(Vanished.AddSequenceSet("41,43:45,50:48"));
+   EXPECT_EQ(std::vector<uint32_t>({ 41, 43, 44, 45, 48, 49, 50 }), [&Vanished]()
+             {
+                std::vector<uint32_t> vecUIDs;
+                Vanished.ToVector(vecUIDs);
+                return vecUIDs;
+             }());
+   EXPECT_FALSE(Vanished.AddSequenceSet("1:*"));
+   EXPECT_FALSE(Vanished.AddSequenceSet("3,"));
+}
+
+// folder of the fake IMAP server used by the offline IMAP tests
+struct FakeImapFolder
+{
+   FakeImapFolder() : strCapabilities("IMAP4rev1"), uUidValidity(1), strDoneStatus("OK IDLE terminated") {}
+
+   std::string Reply(const std::string& strLine)
+   {
+      if (strLine == "DONE" && !strIdleTag.empty())
+      {
+         const std::string strTag = strIdleTag;
+         strIdleTag.clear();
+         return strTag + " " + strDoneStatus + "\r\n";
+      }
+
+      const std::string strTag = strLine.substr(0, strLine.find(' '));
+      const std::string strCommand = strLine.substr(strTag.size() + 1);
+      vecCommands.push_back(strCommand);
+
+      std::string strReply;
+      if (strCommand == "CAPABILITY")
+         strReply = "* CAPABILITY " + strCapabilities + "\r\n";
+      else if (strCommand.compare(0, 8, "EXAMINE ") == 0 || strCommand.compare(0, 7, "SELECT ") == 0)
+      {
+         const uint32_t uUidNext = vecUIDs.empty() ? 1 : vecUIDs.back() + 1;
+         strReply = "* " + std::to_string(vecUIDs.size()) + " EXISTS\r\n"
+                    "* OK [UIDVALIDITY " + std::to_string(uUidValidity) + "] UIDs valid\r\n"
+                    "* OK [UIDNEXT " + std::to_string(uUidNext) + "] predicted next UID\r\n";
+      }
+      else if (strCommand.compare(0, 10, "UID FETCH ") == 0)
+      {
+         const unsigned long uFirst = strtoul(strCommand.c_str() + 10, nullptr, 10);
+         for (size_t i = 0; i < vecUIDs.size(); ++i)
+         {
+            if (vecUIDs[i] >= uFirst)
+               strReply += "* " + std::to_string(i + 1) + " FETCH (UID " + std::to_string(vecUIDs[i]) + " FLAGS ())\r\n";
+         }
+      }
+      else if (strCommand.compare(0, 11, "UID SEARCH ") == 0)
+      {
+         strReply = "* SEARCH";
+         for (const uint32_t uUID : vecUIDs)
+            strReply += " " + std::to_string(uUID);
+         strReply += "\r\n";
+      }
+      else if (strCommand == "IDLE")
+      {
+         strIdleTag = strTag;
+         return "+ idling\r\n" + strIdlePush;
+      }
+      else if (strCommand == "LOGOUT")
+         strReply = "* BYE\r\n";
+
+      return strReply + strTag + " OK done\r\n";
+   }
+
+   std::string                strCapabilities;
+   unsigned long              uUidValidity;
+   std::vector<uint32_t>      vecUIDs;
+   std::vector<std::string>   vecCommands;   // without their tag
+   std::string                strIdlePush;   // untagged responses sent once IDLE starts
+   std::string                strIdleTag;
+   std::string                strDoneStatus; // completion of IDLE once DONE is received
+};
+
+TEST(ImapSync, TestFolderStates)
+{
+   FakeImapFolder Folder;
+   Folder.vecUIDs = { 1, 2 };
+   Folder.uUidValidity = 100;
+   CFakeServer Server("* OK ready\r\n", [&Folder](const std::string& strLine) { return Folder.Reply(strLine); });
+   ASSERT_FALSE(Server.GetAddress().empty());
+
+   CIMAPClient IMAPClient(PRINT_LOG);
+   ASSERT_TRUE(IMAPClient.InitSession(Server.GetAddress(), "user", "password",
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::NO_SSLTLS));
+
+   remove("test_imapsync.state");
+   std::vector<ImapSyncChange> vecChanges;
+   const auto ChangeFn = [&vecChanges](const ImapSyncChange& Change)
+   {
+      vecChanges.push_back(Change);
+      return true;
+   };
+
+   CImapSync Sync(IMAPClient, "test_imapsync.state", PRINT_LOG);
+   ASSERT_TRUE(Sync.Sync("INBOX", ChangeFn));
+   ASSERT_EQ(2u, vecChanges.size());
+   EXPECT_EQ(ImapSyncChange::NEW, vecChanges[0].eType);
+   EXPECT_EQ(1u, vecChanges[0].uUID);
+   const ImapFolderState* pState = Sync.GetFolderState("INBOX");
+   ASSERT_TRUE(pState != nullptr);
+   EXPECT_EQ(100u, pState->uUidValidity);
+   EXPECT_EQ(3u, pState->uUidNext);
+   EXPECT_EQ(0u, pState->uHighestModSeq);
+
+   // without CONDSTORE, only the messages from the known UIDNEXT on are fetched
+   {
+      std::lock_guard<std::mutex> Lock(Server.GetMutex());
+      Folder.vecUIDs.push_back(3);
+      Folder.vecCommands.clear();
+   }
+   vecChanges.clear();
+   ASSERT_TRUE(Sync.Sync("INBOX", ChangeFn));
+   ASSERT_EQ(1u, vecChanges.size());
+   EXPECT_EQ(ImapSyncChange::NEW, vecChanges[0].eType);
+   EXPECT_EQ(3u, vecChanges[0].uUID);
+   {
+      std::lock_guard<std::mutex> Lock(Server.GetMutex());
+      EXPECT_NE(Folder.vecCommands.end(),
+                std::find(Folder.vecCommands.begin(), Folder.vecCommands.end(), "UID FETCH 3:* (FLAGS)"));
+   }
+
+   // a new UIDVALIDITY resets the state
+   {
+      std::lock_guard<std::mutex> Lock(Server.GetMutex());
+      Folder.uUidValidity = 200;
+      Folder.vecUIDs = { 1 };
+   }
+   vecChanges.clear();
+   ASSERT_TRUE(Sync.Sync("INBOX", ChangeFn));
+   ASSERT_EQ(2u, vecChanges.size());
+   EXPECT_EQ(ImapSyncChange::RESET, vecChanges[0].eType);
+   EXPECT_EQ(ImapSyncChange::NEW, vecChanges[1].eType);
+   EXPECT_EQ(1u, vecChanges[1].uUID);
+   pState = Sync.GetFolderState("INBOX");
+   ASSERT_TRUE(pState != nullptr);
+   EXPECT_EQ(200u, pState->uUidValidity);
+   EXPECT_EQ(1u, pState->oUIDs.GetCount());
+
+   // the state survives a restart
+   CImapSync Reloaded(IMAPClient, "test_imapsync.state", PRINT_LOG);
+   ASSERT_TRUE(Reloaded.Load());
+   ASSERT_TRUE(Reloaded.GetFolderState("INBOX") != nullptr);
+   EXPECT_EQ(200u, Reloaded.GetFolderState("INBOX")->uUidValidity);
+
+   EXPECT_TRUE(IMAPClient.CleanupSession());
+   EXPECT_TRUE(remove("test_imapsync.state") == 0);
+}
+
+TEST(IMAPClient, TestIdleVanished)
+{
+   FakeImapFolder Folder;
+   Folder.strCapabilities = "IMAP4rev1 IDLE";
+   Folder.vecUIDs = { 1, 2, 3 };
+   Folder.strIdlePush = "* VANISHED 2:3\r\n";
+   CFakeServer Server("* OK ready\r\n", [&Folder](const std::string& strLine) { return Folder.Reply(strLine); });
+   ASSERT_FALSE(Server.GetAddress().empty());
+
+   CIMAPClient IMAPClient(PRINT_LOG);
+   ASSERT_TRUE(IMAPClient.InitSession(Server.GetAddress(), "user", "password",
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::NO_SSLTLS));
+
+   // expunges pushed as VANISHED (QRESYNC) aren't lost
+   CUIDBitmap Vanished;
+   EXPECT_TRUE(IMAPClient.Idle("INBOX", [&Vanished](const ImapIdleEvent& Event)
+                               {
+                                  if (Event.eType != ImapIdleEvent::VANISHED)
+                                     return true;
+                                  EXPECT_EQ(2u, Event.uNumber);
+                                  Vanished = Event.oUIDs;
+                                  return false;
+                               }));
+   EXPECT_EQ(2u, Vanished.GetCount());
+   EXPECT_TRUE(Vanished.Contains(3));
+
+   EXPECT_TRUE(IMAPClient.CleanupSession());
+}
+
+TEST(IMAPClient, TestIdleCompletion)
+{
+   FakeImapFolder Folder;
+   Folder.strCapabilities = "IMAP4rev1 IDLE";
+   Folder.vecUIDs = { 1 };
+   CFakeServer Server("* OK ready\r\n", [&Folder](const std::string& strLine) { return Folder.Reply(strLine); });
+   ASSERT_FALSE(Server.GetAddress().empty());
+
+   CIMAPClient IMAPClient(PRINT_LOG);
+   ASSERT_TRUE(IMAPClient.InitSession(Server.GetAddress(), "user", "password",
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::NO_SSLTLS));
+
+   // a refresh of 0 doesn't re-issue IDLE in a loop
+   IMAPClient.SetIdleRefresh(0);
+   std::thread Stopper([&IMAPClient]()
+                       {
+                          std::this_thread::sleep_for(std::chrono::milliseconds(300));
+                          IMAPClient.StopIdle();
+                       });
+   EXPECT_TRUE(IMAPClient.Idle("INBOX", [](const ImapIdleEvent&) { return true; }));
+   Stopper.join();
+   {
+      std::lock_guard<std::mutex> lock(Server.GetMutex());
+      EXPECT_EQ(1, std::count(Folder.vecCommands.begin(), Folder.vecCommands.end(), "IDLE"));
+
+      // DONE answered with BAD
+      Folder.strDoneStatus = "BAD unexpected DONE";
+      Folder.strIdlePush = "* 2 EXISTS\r\n";
+   }
+   EXPECT_FALSE(IMAPClient.Idle("INBOX", [](const ImapIdleEvent& Event) { return Event.eType != ImapIdleEvent::EXISTS
+                                                                              || Event.uNumber != 2; }));
+
+   EXPECT_TRUE(IMAPClient.CleanupSession());
+}
+
+TEST(IMAPClient, TestSearchLiteral)
+{
+   for (const char* pszCapabilities : { "IMAP4rev1", "IMAP4rev1 LITERAL+" })
+   {
+      FakeImapFolder Folder;
+      Folder.strCapabilities = pszCapabilities;
+      Folder.vecUIDs = { 4, 5 };
+      CFakeServer Server("* OK ready\r\n", [&Folder](const std::string& strLine) { return Folder.Reply(strLine); });
+      ASSERT_FALSE(Server.GetAddress().empty());
+
+      CIMAPClient IMAPClient(PRINT_LOG);
+      ASSERT_TRUE(IMAPClient.InitSession(Server.GetAddress(), "user", "password",
+         CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::NO_SSLTLS));
+
+      // the UTF-8 subject is sent as a literal, not in a quoted string
+      ImapSearchResult Result;
+      EXPECT_TRUE(IMAPClient.Search(Result, CSearchCriteria().Subject("\xC3\xA9t\xC3\xA9").Seen()));
+      EXPECT_EQ(2u, Result.oUIDs.GetCount());
+      {
+         const bool bNonSync = Folder.strCapabilities.find("LITERAL+") != std::string::npos;
+         std::lock_guard<std::mutex> Lock(Server.GetMutex());
+         EXPECT_NE(Folder.vecCommands.end(),
+                   std::find(Folder.vecCommands.begin(), Folder.vecCommands.end(),
+                             std::string("UID SEARCH CHARSET UTF-8 SUBJECT ") + (bNonSync ? "{5+}" : "{5}")
+                             + "\r\n\xC3\xA9t\xC3\xA9 SEEN"));
+      }
+
+      EXPECT_TRUE(IMAPClient.CleanupSession());
+   }
+}
+
+// File Writer Tests
+
+TEST(AsyncFileWriter, TestWriteBehind)
+{
+   // a queue smaller than the data : the producer waits for the writer
+   CAsyncFileWriter Writer(PRINT_LOG, 64);
+   Writer.Start();
+
+   std::string strExpected;
+   Writer.Open(0, "test_writer_0.txt");
+   for (int i = 0; i < 100; ++i)
+   {
+      std::string strData = "line " + std::to_string(i) + "\r\n";
+      strExpected += strData;
+      Writer.Write(0, std::move(strData));
+   }
+   Writer.Close(0);
+   // a size hint larger than the data
+   Writer.Open(2, "test_writer_2.txt", 4096);
+   Writer.Write(2, std::string("0123456789"));
+   Writer.Close(2);
+   Writer.Open(3, "no_such_directory/test_writer_3.txt");
+   Writer.Write(3, std::string("lost"));
+   Writer.Close(3);
+   Writer.Finish();
+
+   const std::vector<CAsyncFileWriter::FileResult>& vecResults = Writer.GetResults();
+   ASSERT_EQ(4u, vecResults.size());
+   EXPECT_TRUE(vecResults[0].bSuccess);
+   EXPECT_EQ(strExpected.size(), vecResults[0].uOctets);
+   EXPECT_TRUE(vecResults[1].strPath.empty());
+   EXPECT_TRUE(vecResults[2].bSuccess);
+   EXPECT_EQ(10u, vecResults[2].uOctets);
+   EXPECT_FALSE(vecResults[3].bSuccess);
+   EXPECT_FALSE(vecResults[3].strError.empty());
+
+   std::ifstream ifFile("test_writer_0.txt", std::ifstream::binary);
+   const std::string strContent((std::istreambuf_iterator<char>(ifFile)), std::istreambuf_iterator<char>());
+   ifFile.close();
+   EXPECT_EQ(strExpected, strContent);
+
+   std::ifstream ifHinted("test_writer_2.txt", std::ifstream::binary | std::ifstream::ate);
+   EXPECT_EQ(10, static_cast<long>(ifHinted.tellg()));
+   ifHinted.close();
+
+   EXPECT_TRUE(remove("test_writer_0.txt") == 0);
+   EXPECT_TRUE(remove("test_writer_2.txt") == 0);
+}
+
+TEST(FilePreallocator, TestPreallocate)
+{
+   if (CFilePreallocator::Preallocate("test_prealloc.bin", 65536))
+   {
+      std::ifstream ifFile("test_prealloc.bin", std::ifstream::binary | std::ifstream::ate);
+      EXPECT_EQ(65536, static_cast<long>(ifFile.tellg()));
+      ifFile.close();
+
+      EXPECT_TRUE(CFilePreallocator::Truncate("test_prealloc.bin", 100));
+      ifFile.open("test_prealloc.bin", std::ifstream::binary | std::ifstream::ate);
+      EXPECT_EQ(100, static_cast<long>(ifFile.tellg()));
+      ifFile.close();
+
+      EXPECT_TRUE(remove("test_prealloc.bin") == 0);
+   }
+   else
+      std::cout << "File preallocation isn't supported on this platform." << std::endl;
+
+   EXPECT_FALSE(CFilePreallocator::Preallocate("no_such_directory/test_prealloc.bin", 65536));
+}
+
+TEST(FilePreallocator, TestRetrievedFileSize)
+{
+   // the size given to GetFile is an overestimate, the file is cut to the message
+   const std::string strMail = "Subject: size\r\n\r\nbody\r\n";
+   CFakeServer Server("+OK ready\r\n", [&](const std::string& strLine) -> std::string
+   {
+      const std::string strCommand = strLine.substr(0, strLine.find(' '));
+      if (strCommand == "CAPA")
+         return "+OK\r\nUSER\r\n.\r\n";
+      if (strCommand == "USER" || strCommand == "PASS" || strCommand == "NOOP")
+         return "+OK\r\n";
+      if (strCommand == "RETR")
+         return "+OK\r\n" + strMail + ".\r\n";
+      if (strCommand == "QUIT")
+         return "+OK bye\r\n";
+      return "-ERR unknown command\r\n";
+   });
+   ASSERT_FALSE(Server.GetAddress().empty());
+
+   CPOPClient POPClient(PRINT_LOG);
+   ASSERT_TRUE(POPClient.InitSession(Server.GetAddress(), "user", "password",
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::NO_SSLTLS));
+   EXPECT_TRUE(POPClient.GetFile("1", "test_retrieved.eml", 65536));
+   EXPECT_TRUE(POPClient.CleanupSession());
+
+   std::ifstream ifFile("test_retrieved.eml", std::ifstream::binary | std::ifstream::ate);
+   EXPECT_EQ(static_cast<long>(strMail.size()), static_cast<long>(ifFile.tellg()));
+   ifFile.close();
+   EXPECT_TRUE(remove("test_retrieved.eml") == 0);
+}
+
+TEST(PopPoller, TestIntervals)
+{
+   // quiet mailboxes back off up to the maximum, new mail resets the interval
+   EXPECT_EQ(120u, CPopPoller::NextInterval(60, false, 60, 3600));
+   EXPECT_EQ(3600u, CPopPoller::NextInterval(1920, false, 60, 3600));
+   EXPECT_EQ(3600u, CPopPoller::NextInterval(3600, false, 60, 3600));
+   EXPECT_EQ(60u, CPopPoller::NextInterval(3600, true, 60, 3600));
+   EXPECT_EQ(60u, CPopPoller::NextInterval(0, false, 60, 3600));
+
+   CPopPoller Poller(nullptr);
+   EXPECT_FALSE(Poller.Start());
+
+   Poller.SetIntervals(30, 600);
+   const size_t uAccount = Poller.AddAccount(PopPollerAccount());
+   EXPECT_EQ(30u, Poller.GetInterval(uAccount));
+   EXPECT_TRUE(Poller.RemoveAccount(uAccount));
+   EXPECT_FALSE(Poller.RemoveAccount(uAccount));
+   EXPECT_EQ(0u, Poller.GetInterval(uAccount));
+}
+
+TEST(PopPoller, TestScheduling)
+{
+   // mailbox of 2 messages (320 octets), its STAT are counted
+   size_t uStats = 0;
+   CFakeServer Server("+OK ready\r\n", [&](const std::string& strLine) -> std::string
+   {
+      const std::string strCommand = strLine.substr(0, strLine.find(' '));
+      if (strCommand == "CAPA")
+         return "+OK\r\nUSER\r\n.\r\n";
+      if (strCommand == "USER" || strCommand == "PASS" || strCommand == "NOOP")
+         return "+OK\r\n";
+      if (strCommand == "STAT")
+      {
+         ++uStats;
+         return "+OK 2 320\r\n";
+      }
+      if (strCommand == "QUIT")
+         return "+OK bye\r\n";
+      return "-ERR unknown command\r\n";
+   });
+   ASSERT_FALSE(Server.GetAddress().empty());
+
+   PopPollerAccount Account;
+   Account.strServer = Server.GetAddress();
+   Account.strUsername = "user";
+   Account.strPassword = "password";
+
+   // stub callback : records what it receives, the session is still open
+   std::mutex mtxCalls;
+   std::vector<std::pair<size_t, PopStat>> vecCalls;
+   const auto NewMailFn = [&](const size_t uAccount, CPOPClient& oClient, const PopStat& oStat)
+   {
+      PopStat oAgain;
+      EXPECT_TRUE(oClient.Stat(oAgain));
+      std::lock_guard<std::mutex> lock(mtxCalls);
+      vecCalls.emplace_back(uAccount, oStat);
+   };
+
+   CPopPoller Poller(NewMailFn, nullptr, 2);
+   Poller.SetIntervals(1, 2);
+   Poller.SetTimeout(5);
+   const size_t uAccount = Poller.AddAccount(Account);
+
+   // an interval of 4294968 s is 4294968000 ms : wrapped to 32 bits it's 704 ms
+   CPopPoller Idle(NewMailFn);
+   Idle.SetIntervals(4294968, 4294968);
+   Idle.AddAccount(Account);
+
+   ASSERT_TRUE(Poller.Start());
+   ASSERT_TRUE(Idle.Start());
+
+   // first poll within the minimum interval, then one a second later that finds nothing new
+   const auto Deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+   while (Poller.GetPollCount() < 2 && std::chrono::steady_clock::now() < Deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+   Poller.Stop();
+   Idle.Stop();
+
+   EXPECT_GE(Poller.GetPollCount(), 2u);
+   EXPECT_EQ(0u, Poller.GetFailureCount());
+   EXPECT_EQ(1u, Poller.GetNewMailCount());
+   // the quiet mailbox backed off to the maximum
+   EXPECT_EQ(2u, Poller.GetInterval(uAccount));
+   EXPECT_EQ(0u, Idle.GetPollCount());
+
+   ASSERT_EQ(1u, vecCalls.size());
+   EXPECT_EQ(uAccount, vecCalls[0].first);
+   EXPECT_EQ(2u, vecCalls[0].second.uMessages);
+   EXPECT_EQ(320u, vecCalls[0].second.uOctets);
+   {
+      std::lock_guard<std::mutex> lock(Server.GetMutex());
+      // a STAT per poll, one by the callback and one after it
+      EXPECT_EQ(Poller.GetPollCount() + 2, uStats);
+   }
+}
+
 // SMTP Tests
 
 TEST_F(SMTPClientTest, TestVerifyAddress)
@@ -356,6 +1879,62 @@ TEST_F(POPClientTest, TestListUIDLMailSSL)
       std::cout << "POP (with SSL/TLS) tests are disabled !" << std::endl;
 }
 
+TEST_F(POPClientTest, TestTypedListingsSSL)
+{
+   ASSERT_TRUE(m_pPOPClient->InitSession(SSL_POP_SERVER, SSL_POP_USERNAME, SSL_POP_PASSWORD,
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::ENABLE_SSL));
+
+   if (POP_SSL_TEST_ENABLED)
+   {
+      PopStat oStat;
+      std::vector<PopListEntry> vecList;
+      std::vector<PopUidlEntry> vecUIDL;
+
+      EXPECT_TRUE(m_pPOPClient->Stat(oStat));
+      EXPECT_TRUE(m_pPOPClient->List(vecList));
+      EXPECT_TRUE(m_pPOPClient->ListUIDL(vecUIDL));
+      EXPECT_EQ(oStat.uMessages, vecList.size());
+      EXPECT_EQ(vecList.size(), vecUIDL.size());
+   }
+   else
+      std::cout << "POP (with SSL/TLS) tests are disabled !" << std::endl;
+}
+
+TEST_F(POPClientTest, TestSyncSSL)
+{
+   ASSERT_TRUE(m_pPOPClient->InitSession(SSL_POP_SERVER, SSL_POP_USERNAME, SSL_POP_PASSWORD,
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::ENABLE_SSL));
+
+   if (POP_SSL_TEST_ENABLED)
+   {
+      /* Mailbox must contain at least one e-mail to pass this test */
+      remove("test_sync.state");
+      size_t uStored = 0;
+      auto StoreFn = [&uStored](const PopUidlEntry&, const std::string& strMail)
+      {
+         ++uStored;
+         return !strMail.empty();
+      };
+
+      {
+         CPopSync Sync(*m_pPOPClient, "test_sync.state", PRINT_LOG);
+         EXPECT_TRUE(Sync.Sync(StoreFn));
+         EXPECT_GT(Sync.GetRetrievedCount(), 0u);
+      }
+
+      // nothing is downloaded again after a restart
+      uStored = 0;
+      CPopSync Sync(*m_pPOPClient, "test_sync.state", PRINT_LOG);
+      EXPECT_TRUE(Sync.Sync(StoreFn));
+      EXPECT_EQ(0u, Sync.GetRetrievedCount());
+      EXPECT_EQ(0u, uStored);
+
+      EXPECT_TRUE(remove("test_sync.state") == 0);
+   }
+   else
+      std::cout << "POP (with SSL/TLS) tests are disabled !" << std::endl;
+}
+
 TEST_F(POPClientTest, TestGetMailStringSSL)
 {
    ASSERT_TRUE(m_pPOPClient->InitSession(SSL_POP_SERVER, SSL_POP_USERNAME, SSL_POP_PASSWORD,
@@ -374,6 +1953,187 @@ TEST_F(POPClientTest, TestGetMailStringSSL)
       std::cout << "POP (with SSL/TLS) tests are disabled !" << std::endl;
 }
 
+TEST_F(POPClientTest, TestPresizedRetrievalSSL)
+{
+   ASSERT_TRUE(m_pPOPClient->InitSession(SSL_POP_SERVER, SSL_POP_USERNAME, SSL_POP_PASSWORD,
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::ENABLE_SSL));
+
+   if (POP_SSL_TEST_ENABLED)
+   {
+      /* Mailbox must contain at least one e-mail to pass this test */
+      std::vector<PopListEntry> vecList;
+      ASSERT_TRUE(m_pPOPClient->List(vecList));
+      ASSERT_FALSE(vecList.empty());
+
+      const std::string strMsgNumber = std::to_string(vecList[0].uMsgNumber);
+      EXPECT_EQ(vecList[0].uOctets, m_pPOPClient->GetListedSize(strMsgNumber));
+
+      std::string strEmail;
+      EXPECT_TRUE(m_pPOPClient->GetString(strMsgNumber, strEmail));
+      EXPECT_GE(strEmail.capacity(), vecList[0].uOctets);
+
+      // the preallocated file has the size of the message
+      EXPECT_TRUE(m_pPOPClient->GetFile(strMsgNumber, "test_presized.eml"));
+      std::ifstream ifFile("test_presized.eml", std::ifstream::binary | std::ifstream::ate);
+      EXPECT_EQ(strEmail.size(), static_cast<size_t>(ifFile.tellg()));
+      ifFile.close();
+      EXPECT_TRUE(remove("test_presized.eml") == 0);
+   }
+   else
+      std::cout << "POP (with SSL/TLS) tests are disabled !" << std::endl;
+}
+
+TEST_F(POPClientTest, TestGetMailSinkSSL)
+{
+   ASSERT_TRUE(m_pPOPClient->InitSession(SSL_POP_SERVER, SSL_POP_USERNAME, SSL_POP_PASSWORD,
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::ENABLE_SSL));
+
+   if (POP_SSL_TEST_ENABLED)
+   {
+      /* Mailbox must contain at least one e-mail to pass this test */
+      CStringSink Sink;
+      std::string strEmail;
+
+      EXPECT_TRUE(m_pPOPClient->GetString("1", Sink));
+      EXPECT_TRUE(Sink.bCompleted);
+      EXPECT_TRUE(Sink.bSuccess);
+      EXPECT_TRUE(m_pPOPClient->GetString("1", strEmail));
+      EXPECT_EQ(strEmail, Sink.strData);
+   }
+   else
+      std::cout << "POP (with SSL/TLS) tests are disabled !" << std::endl;
+}
+
+TEST_F(POPClientTest, TestDrainRollbackSSL)
+{
+   ASSERT_TRUE(m_pPOPClient->InitSession(SSL_POP_SERVER, SSL_POP_USERNAME, SSL_POP_PASSWORD,
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::ENABLE_SSL));
+
+   if (POP_SSL_TEST_ENABLED)
+   {
+      /* Mailbox must contain at least one e-mail to pass this test, none is deleted */
+      class CRefusingSink : public CStringSink
+      {
+      public:
+         bool OnCommit() override { return false; }
+      };
+
+      PopStat oBefore;
+      ASSERT_TRUE(m_pPOPClient->Stat(oBefore));
+
+      CRefusingSink Sink;
+      EXPECT_FALSE(m_pPOPClient->Drain(1, Sink));
+      EXPECT_TRUE(Sink.bCompleted);
+      EXPECT_TRUE(Sink.bSuccess);
+      EXPECT_FALSE(Sink.strData.empty());
+      EXPECT_EQ(0u, m_pPOPClient->GetDrainedCount());
+
+      // the session was dropped without QUIT : the deletion isn't committed
+      PopStat oAfter;
+      ASSERT_TRUE(m_pPOPClient->Stat(oAfter));
+      EXPECT_EQ(oBefore.uMessages, oAfter.uMessages);
+   }
+   else
+      std::cout << "POP (with SSL/TLS) tests are disabled !" << std::endl;
+}
+
+TEST_F(POPClientTest, TestPipelinedBatchSSL)
+{
+   ASSERT_TRUE(m_pPOPClient->InitSession(SSL_POP_SERVER, SSL_POP_USERNAME, SSL_POP_PASSWORD,
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::ENABLE_SSL));
+
+   if (POP_SSL_TEST_ENABLED)
+   {
+      /* Mailbox must contain at least one e-mail to pass this test */
+      std::vector<PopListEntry> vecList;
+      ASSERT_TRUE(m_pPOPClient->List(vecList));
+      ASSERT_FALSE(vecList.empty());
+
+      std::vector<std::string> vecMsgNumbers;
+      for (const PopListEntry& oEntry : vecList)
+         vecMsgNumbers.push_back(std::to_string(oEntry.uMsgNumber));
+
+      std::vector<std::string> vecSequential;
+      std::vector<std::string> vecPipelined;
+      std::vector<std::string> vecHeaders;
+      EXPECT_TRUE(m_pPOPClient->GetStrings(vecMsgNumbers, vecSequential));
+      m_pPOPClient->SetPipelining(true);
+      EXPECT_TRUE(m_pPOPClient->GetStrings(vecMsgNumbers, vecPipelined));
+      EXPECT_TRUE(m_pPOPClient->GetHeaders(vecMsgNumbers, vecHeaders));
+      EXPECT_EQ(vecSequential, vecPipelined);
+      ASSERT_EQ(vecMsgNumbers.size(), vecHeaders.size());
+      EXPECT_LE(vecHeaders[0].size(), vecPipelined[0].size());
+
+      // back to libcurl on the same session
+      std::string strEmail;
+      EXPECT_TRUE(m_pPOPClient->GetString(vecMsgNumbers[0], strEmail));
+      EXPECT_EQ(vecPipelined[0], strEmail);
+   }
+   else
+      std::cout << "POP (with SSL/TLS) tests are disabled !" << std::endl;
+}
+
+TEST_F(POPClientTest, TestHarvestHeadersSSL)
+{
+   ASSERT_TRUE(m_pPOPClient->InitSession(SSL_POP_SERVER, SSL_POP_USERNAME, SSL_POP_PASSWORD,
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::ENABLE_SSL));
+
+   if (POP_SSL_TEST_ENABLED)
+   {
+      /* Mailbox must contain at least one e-mail to pass this test */
+      std::string strHeaders;
+      ASSERT_TRUE(m_pPOPClient->GetHeaders("1", strHeaders));
+      CHeaderParser Expected;
+      Expected.Parse(strHeaders);
+
+      for (const bool bPipelining : { false, true })
+      {
+         m_pPOPClient->SetPipelining(bPipelining);
+
+         size_t uCount = 0;
+         EXPECT_TRUE(m_pPOPClient->HarvestHeaders(1, 1, 1,
+            [&](const std::string& strMsgNumber, const CHeaderParser& Headers, const CStringView& Preview)
+            {
+               ++uCount;
+               EXPECT_EQ("1", strMsgNumber);
+               EXPECT_EQ(Expected.GetCount(), Headers.GetCount());
+               EXPECT_TRUE(Headers.GetValue("From") == Expected.GetValue("From"));
+               // a single line of the body
+               EXPECT_GE(1, std::count(Preview.begin(), Preview.end(), '\n'));
+               return true;
+            }));
+         EXPECT_EQ(1u, uCount);
+      }
+   }
+   else
+      std::cout << "POP (with SSL/TLS) tests are disabled !" << std::endl;
+}
+
+TEST_F(POPClientTest, TestGetFilesSSL)
+{
+   ASSERT_TRUE(m_pPOPClient->InitSession(SSL_POP_SERVER, SSL_POP_USERNAME, SSL_POP_PASSWORD,
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::ENABLE_SSL));
+
+   if (POP_SSL_TEST_ENABLED)
+   {
+      /* Mailbox must contain at least one e-mail to pass this test */
+      PopFilesReport oReport;
+      EXPECT_TRUE(m_pPOPClient->GetFiles(1, 1, ".", oReport,
+         [](const std::string& strMsgNumber) { return "test_getfiles_" + strMsgNumber + ".eml"; }));
+      ASSERT_EQ(1u, oReport.vecFiles.size());
+      EXPECT_TRUE(oReport.vecFiles[0].bSuccess);
+      EXPECT_EQ(0u, oReport.uFailed);
+      EXPECT_EQ(oReport.uOctets, oReport.vecFiles[0].uOctets);
+
+      std::string strEmail;
+      EXPECT_TRUE(m_pPOPClient->GetString("1", strEmail));
+      EXPECT_EQ(strEmail.size(), oReport.vecFiles[0].uOctets);
+      EXPECT_TRUE(remove("./test_getfiles_1.eml") == 0);
+   }
+   else
+      std::cout << "POP (with SSL/TLS) tests are disabled !" << std::endl;
+}
+
 TEST_F(POPClientTest, TestGetMailFileSSL)
 {
    ASSERT_TRUE(m_pPOPClient->InitSession(SSL_POP_SERVER, SSL_POP_USERNAME, SSL_POP_PASSWORD,
@@ -466,6 +2226,22 @@ TEST_F(IMAPClientTest, TestGetMailStringSSL)
       std::cout << "IMAP tests are disabled !" << std::endl;
 }
 
+TEST_F(IMAPClientTest, TestGetMailSinkSSL)
+{
+   ASSERT_TRUE(m_pIMAPClient->InitSession(IMAP_SERVER, IMAP_USERNAME, IMAP_PASSWORD,
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::ENABLE_SSL));
+
+   if (IMAP_TEST_ENABLED)
+   {
+      CStringSink Sink;
+      EXPECT_TRUE(m_pIMAPClient->GetString("1", Sink));
+      EXPECT_TRUE(Sink.bCompleted);
+      EXPECT_FALSE(Sink.strData.empty());
+   }
+   else
+      std::cout << "IMAP tests are disabled !" << std::endl;
+}
+
 TEST_F(IMAPClientTest, TestGetMailFileSSL)
 {
    ASSERT_TRUE(m_pIMAPClient->InitSession(IMAP_SERVER, IMAP_USERNAME, IMAP_PASSWORD,
@@ -493,6 +2269,119 @@ TEST_F(IMAPClientTest, TestGetMailFileSSL)
       std::cout << "IMAP tests are disabled !" << std::endl;
 }
 
+TEST_F(IMAPClientTest, TestIdleSSL)
+{
+   ASSERT_TRUE(m_pIMAPClient->InitSession(IMAP_SERVER, IMAP_USERNAME, IMAP_PASSWORD,
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::ENABLE_SSL));
+
+   if (IMAP_TEST_ENABLED)
+   {
+      // EXAMINE reports the message count before IDLE starts
+      unsigned long uExists = 0;
+      EXPECT_TRUE(m_pIMAPClient->Idle("INBOX", [&uExists](const ImapIdleEvent& Event)
+                                      {
+                                         if (Event.eType != ImapIdleEvent::EXISTS)
+                                            return true;
+                                         uExists = Event.uNumber;
+                                         return false;
+                                      }));
+      EXPECT_GT(uExists, 0u);
+
+      // the session stays usable alongside libcurl's
+      EXPECT_TRUE(m_pIMAPClient->Noop());
+   }
+   else
+      std::cout << "IMAP tests are disabled !" << std::endl;
+}
+
+TEST_F(IMAPClientTest, TestMailboxSSL)
+{
+   ASSERT_TRUE(m_pIMAPClient->InitSession(IMAP_SERVER, IMAP_USERNAME, IMAP_PASSWORD,
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::ENABLE_SSL));
+
+   if (IMAP_TEST_ENABLED)
+   {
+      EXPECT_EQ("INBOX", m_pIMAPClient->GetMailbox());
+      m_pIMAPClient->SetMailbox("inbox");
+
+      CUIDBitmap All;
+      EXPECT_TRUE(m_pIMAPClient->Search(All, "ALL"));
+      ASSERT_NE(nullptr, m_pIMAPClient->GetSession());
+      EXPECT_NE(0u, m_pIMAPClient->GetSession()->GetUidValidity());
+
+      // INBOX is case-insensitive : no other SELECT is needed
+      EXPECT_TRUE(m_pIMAPClient->GetSession()->IsSelected("INBOX"));
+      EXPECT_FALSE(m_pIMAPClient->GetSession()->IsSelected("Archive"));
+   }
+   else
+      std::cout << "IMAP tests are disabled !" << std::endl;
+}
+
+TEST_F(IMAPClientTest, TestStoreFlagsSSL)
+{
+   ASSERT_TRUE(m_pIMAPClient->InitSession(IMAP_SERVER, IMAP_USERNAME, IMAP_PASSWORD,
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::ENABLE_SSL));
+
+   if (IMAP_TEST_ENABLED)
+   {
+      CUIDBitmap Unflagged;
+      ASSERT_TRUE(m_pIMAPClient->Search(Unflagged, "UNFLAGGED"));
+      if (!Unflagged.IsEmpty())
+      {
+         CUIDBitmap Message;
+         Message.Add(Unflagged.GetMin());
+
+         // flag a message and restore it
+         EXPECT_TRUE(m_pIMAPClient->SetMailProperty("INBOX", Message, CIMAPClient::MailProperty::Flagged));
+         CUIDBitmap Flagged;
+         EXPECT_TRUE(m_pIMAPClient->Search(Flagged, CIMAPClient::SearchOption::FLAGGED));
+         EXPECT_TRUE(Flagged.Contains(Unflagged.GetMin()));
+
+         EXPECT_TRUE(m_pIMAPClient->StoreFlags("INBOX", Message, "\\Flagged", false));
+         EXPECT_TRUE(m_pIMAPClient->Search(Flagged, CIMAPClient::SearchOption::FLAGGED));
+         EXPECT_FALSE(Flagged.Contains(Unflagged.GetMin()));
+      }
+   }
+   else
+      std::cout << "IMAP tests are disabled !" << std::endl;
+}
+
+TEST_F(IMAPClientTest, TestAppendManySSL)
+{
+   ASSERT_TRUE(m_pIMAPClient->InitSession(IMAP_SERVER, IMAP_USERNAME, IMAP_PASSWORD,
+      CMailClient::SettingsFlag::ALL_FLAGS, CMailClient::SslTlsFlag::ENABLE_SSL));
+
+   if (IMAP_TEST_ENABLED)
+   {
+      const std::string strFirst = "Subject: AppendMany 1\r\n\r\nFirst message.\r\n";
+      const std::string strSecond = "Subject: AppendMany 2\r\n\r\nSecond message.\r\n";
+
+      // the messages are flagged as deleted so they can be expunged
+      std::vector<ImapAppendMessage> vecMessages(2);
+      vecMessages[0].Data = CStringView(strFirst.data(), strFirst.size());
+      vecMessages[0].strFlags = "\\Seen \\Deleted";
+      vecMessages[1].Data = CStringView(strSecond.data(), strSecond.size());
+      vecMessages[1].strFlags = "\\Deleted";
+      vecMessages[1].tInternalDate = 1721209465;
+
+      CUIDBitmap Before;
+      ASSERT_TRUE(m_pIMAPClient->Search(Before, "DELETED"));
+      EXPECT_TRUE(m_pIMAPClient->AppendMany("INBOX", vecMessages));
+
+      CUIDBitmap Appended;
+      ASSERT_TRUE(m_pIMAPClient->Search(Appended, "DELETED"));
+      Appended -= Before;
+      EXPECT_EQ(2u, Appended.GetCount());
+
+      if (m_pIMAPClient->GetSession()->HasCapability("UIDPLUS"))
+      {
+         EXPECT_TRUE(m_pIMAPClient->ExpungeMany("INBOX", Appended));
+      }
+   }
+   else
+      std::cout << "IMAP tests are disabled !" << std::endl;
+}
+
 } // namespace
 
 int main(int argc, char **argv)
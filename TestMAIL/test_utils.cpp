@@ -1,5 +1,15 @@
 #include "test_utils.h"
 
+#ifdef WINDOWS
+#include <direct.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 // Test configuration constants (to be loaded from an INI file)
 bool POP_TEST_ENABLED;
 bool POP_SSL_TEST_ENABLED;
@@ -178,3 +188,174 @@ int TestProgressCallback(void* ptr, double dTotalToDownload, double dNowDownload
    // if you don't return 0, the transfer will be aborted - see the documentation
    return 0;
 }
+
+bool CreateTestDirectory(const std::string& strPath)
+{
+#ifdef WINDOWS
+   return _mkdir(strPath.c_str()) == 0 || errno == EEXIST;
+#else
+   return mkdir(strPath.c_str(), 0700) == 0 || errno == EEXIST;
+#endif
+}
+
+bool RemoveTestDirectory(const std::string& strPath)
+{
+#ifdef WINDOWS
+   return _rmdir(strPath.c_str()) == 0;
+#else
+   return rmdir(strPath.c_str()) == 0;
+#endif
+}
+
+CFakeServer::CFakeServer(const std::string& strGreeting, const ReplyFnCallback& fnReply) :
+   m_strGreeting(strGreeting),
+   m_fnReply(fnReply),
+   m_bListening(false),
+   m_bStop(false)
+{
+   m_Listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+   struct sockaddr_in Address = {};
+   Address.sin_family = AF_INET;
+   Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   Address.sin_port = 0; // any free port
+   socklen_t AddressSize = sizeof(Address);
+
+   if (bind(m_Listen, reinterpret_cast<struct sockaddr*>(&Address), sizeof(Address)) != 0
+       || listen(m_Listen, 4) != 0
+       || getsockname(m_Listen, reinterpret_cast<struct sockaddr*>(&Address), &AddressSize) != 0)
+   {
+      CloseSocket(m_Listen);
+      return;
+   }
+
+   m_strAddress = "127.0.0.1:" + std::to_string(ntohs(Address.sin_port));
+   m_bListening = true;
+   m_Thread = std::thread(&CFakeServer::Run, this);
+}
+
+CFakeServer::~CFakeServer()
+{
+   m_bStop = true;
+   if (m_Thread.joinable())
+      m_Thread.join();
+
+   if (m_bListening)
+      CloseSocket(m_Listen);
+}
+
+void CFakeServer::Run()
+{
+   while (!m_bStop)
+   {
+      if (!WaitReadable(m_Listen))
+         continue;
+
+      const Socket Client = accept(m_Listen, nullptr, nullptr);
+      Serve(Client);
+      CloseSocket(Client);
+   }
+}
+
+void CFakeServer::Serve(const Socket Client)
+{
+   const auto Send = [Client](const std::string& strData)
+   {
+      return strData.empty() || send(Client, strData.data(), static_cast<int>(strData.size()), 0) > 0;
+   };
+
+   if (!Send(m_strGreeting))
+      return;
+
+   std::string strBuffer;
+   std::string strLine;    // command being received, with its literals
+   size_t uLiteral = 0;    // bytes of the literal still expected
+   char szChunk[4096];
+   while (!m_bStop)
+   {
+      if (!WaitReadable(Client))
+         continue;
+
+      const int iReceived = static_cast<int>(recv(Client, szChunk, sizeof(szChunk), 0));
+      if (iReceived <= 0)
+         return;
+      strBuffer.append(szChunk, iReceived);
+
+      for (;;)
+      {
+         if (uLiteral > 0)
+         {
+            const size_t uCopy = std::min(uLiteral, strBuffer.size());
+            strLine.append(strBuffer, 0, uCopy);
+            strBuffer.erase(0, uCopy);
+            uLiteral -= uCopy;
+            if (uLiteral > 0)
+               break;
+         }
+
+         const size_t uEnd = strBuffer.find('\n');
+         if (uEnd == std::string::npos)
+            break;
+
+         std::string strPart = strBuffer.substr(0, uEnd);
+         strBuffer.erase(0, uEnd + 1);
+         if (!strPart.empty() && strPart.back() == '\r')
+            strPart.pop_back();
+         strLine += strPart;
+
+         // "{12}" or "{12+}" ends a line followed by a literal (IMAP)
+         const size_t uOpen = strPart.rfind('{');
+         if (uOpen != std::string::npos && strPart.size() > uOpen + 2 && strPart.back() == '}')
+         {
+            const bool bNonSync = strPart[strPart.size() - 2] == '+';
+            const std::string strSize = strPart.substr(uOpen + 1, strPart.size() - uOpen - (bNonSync ? 3 : 2));
+            if (!strSize.empty() && strSize.find_first_not_of("0123456789") == std::string::npos)
+            {
+               uLiteral = std::stoul(strSize);
+               strLine += "\r\n";
+               if (!bNonSync && !Send("+ Ready for literal data\r\n"))
+                  return;
+               continue;
+            }
+         }
+
+         std::string strReply;
+         {
+            std::lock_guard<std::mutex> Lock(m_mtxReply);
+            strReply = m_fnReply(strLine);
+         }
+         if (!Send(strReply))
+            return;
+
+         std::string strCommand = strLine.substr(strLine.rfind(' ') + 1);
+         strLine.clear();
+         std::transform(strCommand.begin(), strCommand.end(), strCommand.begin(), ::toupper);
+         if (strCommand == "QUIT" || strCommand == "LOGOUT")
+            return;
+      }
+   }
+}
+
+bool CFakeServer::WaitReadable(const Socket Sock)
+{
+#ifdef WINDOWS
+   WSAPOLLFD Poll = {};
+   Poll.fd = Sock;
+   Poll.events = POLLRDNORM;
+   return WSAPoll(&Poll, 1, 50) > 0;
+#else
+   struct pollfd Poll = {};
+   Poll.fd = Sock;
+   Poll.events = POLLIN;
+   return poll(&Poll, 1, 50) > 0;
+#endif
+}
+
+void CFakeServer::CloseSocket(const Socket Sock)
+{
+#ifdef WINDOWS
+   closesocket(Sock);
+#else
+   close(Sock);
+#endif
+}
@@ -2,6 +2,7 @@
 #define INCLUDE_TEST_UTILS_H_
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cmath>
 #include <cstdio>
@@ -19,6 +20,8 @@
 #include <vector>
 
 #ifdef WINDOWS
+   #include <winsock2.h>
+   #include <ws2tcpip.h>
    #ifdef _DEBUG
       #ifdef _USE_VLD_
       #include <vld.h>
@@ -34,4 +37,53 @@ void GlobalTestCleanUp(void);
 void TimeStampTest(std::ostringstream& ssTimestamp);
 int TestProgressCallback(void* ptr, double dTotalToDownload, double dNowDownloaded, double dTotalToUpload, double dNowUploaded);
 
+/* directory of the files written by a test, an existing one is reused. It
+ * must be empty to be removed. */
+bool CreateTestDirectory(const std::string& strPath);
+bool RemoveTestDirectory(const std::string& strPath);
+
+/* server listening on 127.0.0.1 for the tests that can't depend on a real
+ * one : each client receives the greeting, then the reply to each line it
+ * sends (with its IMAP literals, "{n}\r\n" and their data). The connection
+ * is closed after the reply to QUIT or LOGOUT. */
+class CFakeServer
+{
+public:
+   /* receives a line without its CRLF, returns the reply (may be empty) */
+   typedef std::function<std::string(const std::string& strLine)> ReplyFnCallback;
+
+   CFakeServer(const std::string& strGreeting, const ReplyFnCallback& fnReply);
+   ~CFakeServer();
+
+   CFakeServer(const CFakeServer& Copy) = delete;
+   CFakeServer& operator=(const CFakeServer& Copy) = delete;
+
+   /* "127.0.0.1:port", empty if the server can't listen */
+   inline const std::string& GetAddress() const { return m_strAddress; }
+   /* held while fnReply runs, the tests take it to change what it answers */
+   inline std::mutex& GetMutex() { return m_mtxReply; }
+
+private:
+#ifdef WINDOWS
+   typedef SOCKET Socket;
+#else
+   typedef int Socket;
+#endif
+
+   void Run();
+   void Serve(const Socket Client);
+   /* waits up to 50 ms, false if nothing can be read */
+   bool WaitReadable(const Socket Sock);
+   static void CloseSocket(const Socket Sock);
+
+   std::string       m_strGreeting;
+   ReplyFnCallback   m_fnReply;
+   std::string       m_strAddress;
+   Socket            m_Listen;
+   bool              m_bListening;
+   std::atomic<bool> m_bStop;
+   std::mutex        m_mtxReply;
+   std::thread       m_Thread;
+};
+
 #endif